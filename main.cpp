@@ -1,3 +1,15 @@
+#ifdef _WIN32
+// before GLFW, which otherwise defines APIENTRY itself and clashes with the Windows headers
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
@@ -5,8 +17,8 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE // change projection computations to Vulkan [0, 1] standard range instead of OpenGL [-1, 1] standard range.
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -24,6 +36,22 @@
 #include <fstream>
 #include <chrono>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <bit>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <filesystem>
+#include <span>
+#include <memory>
+#include <numeric>
+#include <tuple>
 
 template<typename Func>
 class ScopeExit
@@ -55,2239 +83,9882 @@ static void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMesse
 	}
 }
 
-struct Vertex
+// A sub-range of a VkDeviceMemory block owned by MemoryAllocator.
+// Resources are bound with (memory, offset) instead of owning their own vkAllocateMemory.
+struct Allocation
 {
-	glm::vec3 pos;
-	glm::vec3 color;
-	glm::vec2 texCoord;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr; // points at offset inside the persistently mapped block, nullptr if not host visible
+	uint32_t memoryTypeIndex = 0;
+	uint32_t blockIndex = UINT32_MAX;
+};
 
-	static VkVertexInputBindingDescription getBindingDescription()
+// Block based sub-allocator: one or more big VkDeviceMemory pages per memory type, carved with first-fit.
+// This keeps us far away from maxMemoryAllocationCount (may be as low as 4096) and from the cost of vkAllocateMemory on every resource.
+// Every suballocation also records the resource it backs, so the allocator doubles as the registry behind the memory dashboard:
+// usage per heap and per tag, fragmentation, peaks per frame, and whatever is still allocated at destroy is reported as a leak.
+class MemoryAllocator
+{
+public:
+	enum class ResourceKind : uint8_t
 	{
-		VkVertexInputBindingDescription bindingDescription{};
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		Linear, // buffers and linear images
+		Optimal // optimal tiling images
+	};
 
-		return bindingDescription;
-	}
+	// What an allocation backs, see getResources.
+	struct ResourceInfo
+	{
+		const char* tag = "untagged"; // a string literal, kept as is
+		VkObjectType type = VK_OBJECT_TYPE_UNKNOWN; // buffer or image, unknown for memory aliased by several resources
+		uint64_t handle = 0;
+		uint64_t frame = 0; // frame number the allocation was made in, filled in by tryAllocate
+	};
 
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	struct Resource
 	{
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+		ResourceInfo info;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeIndex = 0;
+		uint32_t heapIndex = 0;
+	};
 
-		// position
-		attributeDescriptions[0].binding = 0;
-		attributeDescriptions[0].location = 0;
-		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[0].offset = offsetof(Vertex, pos);
+	// Fragmentation of the non dedicated blocks of a memory type: the free bytes are spread over freeRangeCount gaps,
+	// so an allocation larger than largestFreeRange needs a new block even though freeBytes would fit it.
+	struct MemoryTypeStats
+	{
+		uint32_t blockCount = 0;
+		uint32_t dedicatedBlockCount = 0;
+		uint32_t allocationCount = 0;
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize usedBytes = 0;
+		VkDeviceSize freeBytes = 0;
+		VkDeviceSize largestFreeRange = 0;
+		uint32_t freeRangeCount = 0;
+	};
 
-		// color
-		attributeDescriptions[1].binding = 0;
-		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, color);
+	// Bytes suballocated from a heap, which unlike the block bytes of getHeapUsage go up and down with every resource.
+	struct HeapPeaks
+	{
+		VkDeviceSize live = 0;
+		VkDeviceSize lastFrame = 0; // highest live bytes during the last finished frame
+		VkDeviceSize peak = 0; // highest since init
+		uint64_t peakFrame = 0; // frame number peak was reached in
+	};
 
-		// texture coordinate
-		attributeDescriptions[2].binding = 0;
-		attributeDescriptions[2].location = 2;
-		attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetSupported)
+	{
+		_physicalDevice = physicalDevice;
+		_device = device;
+		_memoryBudgetSupported = memoryBudgetSupported;
 
-		return attributeDescriptions;
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		_bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+		_nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memoryProperties);
+		updateBudget();
+
+		printf("memory allocator: bufferImageGranularity %llu, maxMemoryAllocationCount %u\n", static_cast<unsigned long long>(_bufferImageGranularity), properties.limits.maxMemoryAllocationCount);
+		for(uint32_t i = 0; i < _memoryProperties.memoryTypeCount; ++i)
+		{
+			printf("memory allocator: type %u -> block size %llu MiB\n", i, static_cast<unsigned long long>(getBlockSize(i) >> 20));
+		}
+		for(uint32_t i = 0; i < _memoryProperties.memoryHeapCount; ++i)
+		{
+			printf("memory allocator: heap %u -> size %llu MiB, budget %llu MiB, usage %llu MiB%s\n", i,
+				static_cast<unsigned long long>(_memoryProperties.memoryHeaps[i].size >> 20),
+				static_cast<unsigned long long>(_heapBudget[i] >> 20),
+				static_cast<unsigned long long>(_heapUsage[i] >> 20),
+				_memoryBudgetSupported ? "" : " (estimated, VK_EXT_memory_budget not available)");
+		}
+		putc('\n', stdout);
 	}
 
-	bool operator==(const Vertex& other) const
+	void destroy()
 	{
-		return pos == other.pos && color == other.color && texCoord == other.texCoord;
+		std::lock_guard lock(_mutex);
+
+		for(auto& block : _blocks)
+		{
+			if(block.memory == VK_NULL_HANDLE)
+			{
+				continue;
+			}
+			if(!block.suballocations.empty())
+			{
+				fprintf(stderr, "memory allocator: block %llu MiB of type %u still has %zu live allocations\n", static_cast<unsigned long long>(block.size >> 20), block.memoryTypeIndex, block.suballocations.size());
+			}
+			for(const auto& [offset, suballocation] : block.suballocations)
+			{
+				const ResourceInfo& info = suballocation.info;
+				fprintf(stderr, "memory allocator: leaked %s \"%s\" 0x%llx, %llu KiB at offset %llu, allocated in frame %llu\n", getObjectTypeName(info.type), info.tag,
+					static_cast<unsigned long long>(info.handle), static_cast<unsigned long long>(suballocation.size >> 10), static_cast<unsigned long long>(offset),
+					static_cast<unsigned long long>(info.frame));
+			}
+			vkFreeMemory(_device, block.memory, nullptr); // implicitly unmaps
+		}
+		_blocks.clear();
 	}
-};
 
-namespace std
-{
-	template<> struct hash<Vertex>
+	// Returns false instead of throwing when the heap of memoryTypeIndex has no budget left, so that the caller can fall back to the next best memory type.
+	bool tryAllocate(const VkMemoryRequirements& memRequirements, uint32_t memoryTypeIndex, ResourceKind kind, const ResourceInfo& info, Allocation& allocation)
 	{
-		size_t operator()(Vertex const& vertex) const
+		std::lock_guard lock(_mutex);
+
+		ResourceInfo resource = info;
+		resource.frame = _frameNumber;
+
+		const VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+		const VkDeviceSize alignment = std::max<VkDeviceSize>(memRequirements.alignment, 1);
+
+		// very large resources get their own block, otherwise they would waste most of a shared one
+		if(memRequirements.size > blockSize / 2)
 		{
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1);
+			uint32_t blockIndex = UINT32_MAX;
+			if(!tryCreateBlock(memoryTypeIndex, memRequirements.size, true, blockIndex))
+			{
+				return false;
+			}
+			allocation = suballocate(blockIndex, 0, memRequirements.size, kind, resource);
+			return true;
 		}
-	};
-}
 
-class HelloTriangleApplication
-{
-public:
-	void run()
-	{
-		initWindow();
-		initVulkan();
-		mainLoop();
-		cleanup();
+		for(uint32_t blockIndex = 0; blockIndex < _blocks.size(); ++blockIndex)
+		{
+			const auto& block = _blocks[blockIndex];
+			if(block.memory == VK_NULL_HANDLE || block.dedicated || block.memoryTypeIndex != memoryTypeIndex)
+			{
+				continue;
+			}
+
+			VkDeviceSize offset = 0;
+			if(findFreeRange(block, memRequirements.size, alignment, kind, offset))
+			{
+				allocation = suballocate(blockIndex, offset, memRequirements.size, kind, resource);
+				return true;
+			}
+		}
+
+		// back off to smaller blocks when the heap budget is getting tight, before giving up on this memory type
+		for(VkDeviceSize size = blockSize; size >= memRequirements.size; size /= 2)
+		{
+			uint32_t blockIndex = UINT32_MAX;
+			if(tryCreateBlock(memoryTypeIndex, size, false, blockIndex))
+			{
+				allocation = suballocate(blockIndex, 0, memRequirements.size, kind, resource);
+				return true;
+			}
+		}
+
+		return false;
 	}
 
-private:
-	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
+	// Writes to host visible memory without HOST_COHERENT must be flushed before the next vkQueueSubmit that reads them.
+	void flush(const Allocation& allocation)
 	{
-		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-		app->_windowResized = true;
+		if(allocation.memory == VK_NULL_HANDLE || (_memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			return;
+		}
+
+		VkDeviceSize begin = allocation.offset / _nonCoherentAtomSize * _nonCoherentAtomSize;
+		VkDeviceSize end = alignUp(allocation.offset + allocation.size, _nonCoherentAtomSize);
+
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = allocation.memory;
+		range.offset = begin;
+		range.size = std::min(end, _blocks.at(allocation.blockIndex).size) - begin;
+		vkFlushMappedMemoryRanges(_device, 1, &range);
 	}
 
-	void initWindow()
+	// Re-queries VK_EXT_memory_budget, or falls back to an estimate from our own blocks (80% of the heap, like VMA does).
+	void updateBudget()
 	{
-		glfwInit();
+		std::lock_guard lock(_mutex);
+		queryBudget();
+	}
 
-		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-		_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan Tutorial", nullptr, nullptr);
-		
-		glfwSetWindowUserPointer(_window, this);
-		glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+	// Once per frame: closes the peaks of the frame that ends and refreshes the budget.
+	void endFrame(uint64_t frameNumber)
+	{
+		std::lock_guard lock(_mutex);
 
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensionNames = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-		_requiredInstanceExtensions.insert(_requiredInstanceExtensions.end(), glfwExtensionNames, glfwExtensionNames + glfwExtensionCount);
+		for(uint32_t i = 0; i < _memoryProperties.memoryHeapCount; ++i)
+		{
+			_heapPeaks[i].lastFrame = std::exchange(_framePeaks[i], _heapPeaks[i].live);
+		}
+		_frameNumber = frameNumber + 1;
+		queryBudget();
 	}
 
-	void initVulkan() {
-		createInstance();
-		createDebugMessenger();
-		createSurface();
-		choosePhysicalDevice();
-		createLogicalDevice();
-		createSwapChain();
-		createSwapChainImageViews();
-		createRenderPass();
-		createDepthBuffer();
-		createFramebuffers();
-		createDescriptorSetLayout();
-		createGraphicsPipelineLayout();
-		createGraphicsPipeline();
-		createCommandPool();
-		createTextureImage();
-		createTextureImageView();
-		createTextureSampler();
-		loadModel();
-		createVertexBuffer();
-		createIndexBuffer();
-		createUniformBuffers();
-		createDescriptorPool();
-		createDescriptorSets();
-		createCommandBuffers();
-		createSyncObjects();
-		// TODO: maybe should create buffers before descriptor set layout and pool so that we can then create the graphics pipeline with every information we need
+	std::vector<MemoryTypeStats> getMemoryTypeStats()
+	{
+		std::lock_guard lock(_mutex);
+
+		std::vector<MemoryTypeStats> stats(_memoryProperties.memoryTypeCount);
+		for(const auto& block : _blocks)
+		{
+			if(block.memory == VK_NULL_HANDLE)
+			{
+				continue;
+			}
+
+			MemoryTypeStats& type = stats[block.memoryTypeIndex];
+			type.blockBytes += block.size;
+			type.allocationCount += static_cast<uint32_t>(block.suballocations.size());
+			if(block.dedicated)
+			{
+				++type.dedicatedBlockCount;
+				type.usedBytes += block.size;
+				continue;
+			}
+			++type.blockCount;
+
+			// the same walk over the gaps as findFreeRange, ignoring alignment
+			VkDeviceSize end = 0;
+			auto addGap = [&](VkDeviceSize gapEnd)
+			{
+				if(gapEnd > end)
+				{
+					type.freeBytes += gapEnd - end;
+					type.largestFreeRange = std::max(type.largestFreeRange, gapEnd - end);
+					++type.freeRangeCount;
+				}
+			};
+			for(const auto& [offset, suballocation] : block.suballocations)
+			{
+				addGap(offset);
+				type.usedBytes += suballocation.size;
+				end = offset + suballocation.size;
+			}
+			addGap(block.size);
+		}
+		return stats;
 	}
 
-	void mainLoop()
+	std::vector<Resource> getResources()
 	{
-		while(!glfwWindowShouldClose(_window))
+		std::lock_guard lock(_mutex);
+
+		std::vector<Resource> resources;
+		for(const auto& block : _blocks)
 		{
-			glfwPollEvents();
-			drawFrame();
+			for(const auto& [offset, suballocation] : block.suballocations)
+			{
+				resources.push_back({suballocation.info, suballocation.size, block.memoryTypeIndex, _memoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex});
+			}
 		}
-		vkDeviceWaitIdle(_device);
+		return resources;
 	}
 
-	void cleanup()
+	HeapPeaks getHeapPeaks(uint32_t heapIndex)
 	{
-		cleanupSwapChain();
-		destroySyncObjects();
-		destroyIndexBuffer();
-		destroyVertexBuffer();
-		vkDestroySampler(_device, _textureSampler, nullptr);
-		vkDestroyImageView(_device, _textureImageView, nullptr);
-		destroyTextureImage();
-		vkDestroyCommandPool(_device, _commandPool, nullptr);
-		vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
-		vkDestroyDevice(_device, nullptr);
-		vkDestroySurfaceKHR(_instance, _surface, nullptr);
-		destroyDebugMessenger();
-		vkDestroyInstance(_instance, nullptr);
-		glfwDestroyWindow(_window);
-		glfwTerminate();
+		std::lock_guard lock(_mutex);
+
+		return _heapPeaks[heapIndex];
 	}
 
-	// VULKAN STUFF ------------------------------------------------------------------------------------------------------------------------------------------------------------------
+	static const char* getObjectTypeName(VkObjectType type)
+	{
+		switch(type)
+		{
+		case VK_OBJECT_TYPE_BUFFER: return "buffer";
+		case VK_OBJECT_TYPE_IMAGE: return "image";
+		default: return "memory";
+		}
+	}
 
-	struct QueueFamilies
+	void free(Allocation& allocation)
 	{
-		std::vector<VkQueueFamilyProperties> properties;
-		std::vector<VkBool32> supportsPresentation;
-		std::optional<uint32_t> graphics;
-		std::optional<uint32_t> present;
-	};
+		if(allocation.memory == VK_NULL_HANDLE)
+		{
+			return;
+		}
 
-	struct SwapChainInfo
+		std::lock_guard lock(_mutex);
+
+		auto& block = _blocks.at(allocation.blockIndex);
+		_heapPeaks[_memoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex].live -= block.suballocations.at(allocation.offset).size;
+		block.suballocations.erase(allocation.offset);
+
+		// keep one empty block per memory type around so that alloc/free patterns don't thrash vkAllocateMemory
+		if(block.suballocations.empty() && (block.dedicated || countBlocks(block.memoryTypeIndex) > 1))
+		{
+			vkFreeMemory(_device, block.memory, nullptr);
+			block = MemoryBlock{};
+		}
+
+		allocation = Allocation{};
+	}
+
+	const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const
 	{
-		VkSurfaceCapabilitiesKHR capabilities;
-		std::vector<VkSurfaceFormatKHR> formats;
-		std::vector<VkPresentModeKHR> presentModes;
-	};
+		return _memoryProperties;
+	}
 
-	struct UniformBufferObject
+	VkDeviceSize getHeapBudget(uint32_t heapIndex) const
 	{
-		glm::mat4 model;
-		glm::mat4 view;
-		glm::mat4 proj;
-	};
+		return _heapBudget[heapIndex];
+	}
 
-	void checkRequiredInstanceExtensions()
+	VkDeviceSize getHeapUsage(uint32_t heapIndex) const
 	{
-		uint32_t extensionCount = 0;
-		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		return _heapUsage[heapIndex];
+	}
 
-		std::vector<VkExtensionProperties> extensions(extensionCount);
-		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+	bool isMemoryBudgetSupported() const
+	{
+		return _memoryBudgetSupported;
+	}
 
-		std::unordered_set<std::string_view> availableExtensions;
-		for(const auto& e : extensions)
+private:
+	struct Suballocation
+	{
+		VkDeviceSize size = 0;
+		ResourceKind kind = ResourceKind::Linear;
+		ResourceInfo info;
+	};
+
+	void queryBudget()
+	{
+		std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> blockBytes{};
+		for(const auto& block : _blocks)
 		{
-			availableExtensions.emplace(e.extensionName);
+			if(block.memory != VK_NULL_HANDLE)
+			{
+				blockBytes[_memoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex] += block.size;
+			}
 		}
 
-		puts("available instance extensions:");
-		for(const auto& extension : extensions)
+		if(_memoryBudgetSupported)
 		{
-			puts(extension.extensionName);
-		}
-		putc('\n', stdout);
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+			budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
 
-		puts("enabling the following instance extensions:");
-		for(auto extension : _requiredInstanceExtensions)
+			VkPhysicalDeviceMemoryProperties2 memoryProperties2{};
+			memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+			memoryProperties2.pNext = &budgetProperties;
+
+			vkGetPhysicalDeviceMemoryProperties2(_physicalDevice, &memoryProperties2);
+
+			for(uint32_t i = 0; i < _memoryProperties.memoryHeapCount; ++i)
+			{
+				_heapBudget[i] = budgetProperties.heapBudget[i];
+				// the driver only refreshes heapUsage from time to time, our own blocks are a lower bound
+				_heapUsage[i] = std::max(budgetProperties.heapUsage[i], blockBytes[i]);
+			}
+		}
+		else
 		{
-			if(!availableExtensions.contains(extension))
+			for(uint32_t i = 0; i < _memoryProperties.memoryHeapCount; ++i)
 			{
-				throw std::runtime_error("required instance extension not found: " + std::string{extension});
+				_heapBudget[i] = _memoryProperties.memoryHeaps[i].size * 8 / 10;
+				_heapUsage[i] = blockBytes[i];
 			}
-			puts(extension);
 		}
-		putc('\n', stdout);
 	}
 
-	void checkRequiredValidationLayers()
+
+	struct MemoryBlock
 	{
-		uint32_t layerCount = 0;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		bool dedicated = false;
+		std::map<VkDeviceSize, Suballocation> suballocations; // keyed by offset, sorted
+	};
 
-		std::vector<VkLayerProperties> layers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
 
-		std::unordered_set<std::string_view> availableLayers;
+	// bufferImageGranularity is a page size in which linear and optimal resources must not be mixed
+	bool onSamePage(VkDeviceSize lastByteOfA, VkDeviceSize firstByteOfB) const
+	{
+		return (lastByteOfA / _bufferImageGranularity) == (firstByteOfB / _bufferImageGranularity);
+	}
 
-		puts("available validation layers:");
-		for(const auto& layer : layers)
-		{
-			availableLayers.emplace(layer.layerName);
-			puts(layer.layerName);
-		}
-		putc('\n', stdout);
+	VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const
+	{
+		// same heuristic as VMA: 256 MiB pages on big heaps, 1/8 of the heap on small ones (e.g. the 256 MiB BAR heap)
+		constexpr VkDeviceSize LARGE_HEAP_BLOCK_SIZE = 256ull << 20;
+		constexpr VkDeviceSize SMALL_HEAP_THRESHOLD = 1ull << 30;
 
-		if constexpr(_enableValidationLayers)
+		VkDeviceSize heapSize = _memoryProperties.memoryHeaps[_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+		return heapSize <= SMALL_HEAP_THRESHOLD ? alignUp(heapSize / 8, 32) : LARGE_HEAP_BLOCK_SIZE;
+	}
+
+	uint32_t countBlocks(uint32_t memoryTypeIndex) const
+	{
+		uint32_t count = 0;
+		for(const auto& block : _blocks)
 		{
-			puts("enabling the following validation layers:");
-			for(auto layer : _requiredValidationLayers)
+			if(block.memory != VK_NULL_HANDLE && !block.dedicated && block.memoryTypeIndex == memoryTypeIndex)
 			{
-				if(!availableLayers.contains(layer))
-				{
-					throw std::runtime_error("required validation layer not found: " + std::string{layer});
-				}
-				puts(layer);
+				++count;
 			}
-			putc('\n', stdout);
 		}
+		return count;
 	}
 
-	VkDebugUtilsMessengerCreateInfoEXT getDebugMessengerCreateInfo()
+	bool findFreeRange(const MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize& outOffset) const
 	{
-		// TODO:
-		/*
-			There are a lot more settings for the behavior of validation layers than just the flags specified in the VkDebugUtilsMessengerCreateInfoEXT struct. Browse to the Vulkan SDK and go to the Config directory. There you will find a vk_layer_settings.txt file that explains how to configure the layers.
-			To configure the layer settings for your own application, copy the file to the Debug and Release directories of your project and follow the instructions to set the desired behavior.
-		*/
-		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo{};
-		messengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		messengerCreateInfo.messageSeverity = /*VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | */VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-		messengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		messengerCreateInfo.pfnUserCallback = debugCallback;
-		messengerCreateInfo.pUserData = nullptr; // optional
-		return messengerCreateInfo;
-	}
-
-	void createInstance()
-	{
-		uint32_t apiVersion = 0;
-		vkEnumerateInstanceVersion(&apiVersion);
+		const Suballocation* prev = nullptr;
+		VkDeviceSize prevEnd = 0;
 
-		if(apiVersion < MINIMUM_VULKAN_VERSION)
+		// walk the gaps between sorted suballocations, plus the tail of the block
+		auto it = block.suballocations.begin();
+		while(true)
 		{
-			throw std::runtime_error("minimum vulkan version not supported");
-		}
-
-		VkApplicationInfo appInfo{};
-		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-		appInfo.pApplicationName = "Vulkan Tutorial";
-		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.pEngineName = "Batata";
-		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = MINIMUM_VULKAN_VERSION;
+			const bool atEnd = it == block.suballocations.end();
+			const VkDeviceSize gapEnd = atEnd ? block.size : it->first;
 
-		checkRequiredInstanceExtensions();
-		checkRequiredValidationLayers();
+			VkDeviceSize offset = alignUp(prevEnd, alignment);
+			if(prev && prev->kind != kind && onSamePage(prevEnd - 1, offset))
+			{
+				offset = alignUp(offset, _bufferImageGranularity);
+			}
 
-		// TODO: https://vulkan.lunarg.com/doc/view/1.1.126.0/windows/best_practices.html
-		VkValidationFeatureEnableEXT validationEnables[] = {VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT};
-		VkValidationFeaturesEXT validationFeatures = {};
-		validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
-		validationFeatures.enabledValidationFeatureCount = 1;
-		validationFeatures.pEnabledValidationFeatures = validationEnables;
+			bool fits = offset + size <= gapEnd;
+			if(fits && !atEnd && it->second.kind != kind && onSamePage(offset + size - 1, it->first))
+			{
+				fits = false;
+			}
 
-		VkInstanceCreateInfo instanceCreateInfo{};
-		instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		instanceCreateInfo.pApplicationInfo = &appInfo;
-		instanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_requiredInstanceExtensions.size());
-		instanceCreateInfo.ppEnabledExtensionNames = _requiredInstanceExtensions.data();
-		instanceCreateInfo.enabledLayerCount = static_cast<uint32_t>(_requiredValidationLayers.size());
-		instanceCreateInfo.ppEnabledLayerNames = _requiredValidationLayers.data();
-		instanceCreateInfo.pNext = &validationFeatures;
+			if(fits)
+			{
+				outOffset = offset;
+				return true;
+			}
 
-		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo = getDebugMessengerCreateInfo();
-		if constexpr(_enableValidationLayers)
-		{
-			instanceCreateInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&messengerCreateInfo;
-		}
+			if(atEnd)
+			{
+				return false;
+			}
 
-		if(vkCreateInstance(&instanceCreateInfo, nullptr, &_instance) != VK_SUCCESS)
-		{
-			throw std::runtime_error{"failed to create instance"};
+			prev = &it->second;
+			prevEnd = it->first + it->second.size;
+			++it;
 		}
 	}
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-		void* pUserData)
+	bool tryCreateBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated, uint32_t& outBlockIndex)
 	{
-		// TODO: checkout other fields in pCallbackData
-		fprintf(stderr, "%s\n", pCallbackData->pMessage);
-		return VK_FALSE;
-	}
+		queryBudget();
 
-	void createDebugMessenger()
-	{
-		if constexpr(!_enableValidationLayers)
+		const uint32_t heapIndex = _memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		if(_heapUsage[heapIndex] + size > _heapBudget[heapIndex])
 		{
-			return;
+			return false;
 		}
 
-		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo = getDebugMessengerCreateInfo();
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
 
-		if(CreateDebugUtilsMessengerEXT(_instance, &messengerCreateInfo, nullptr, &_debugMessenger) != VK_SUCCESS)
+		MemoryBlock block;
+		block.size = size;
+		block.memoryTypeIndex = memoryTypeIndex;
+		block.dedicated = dedicated;
+
+		VkResult result = vkAllocateMemory(_device, &allocInfo, nullptr, &block.memory);
+		if(result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY)
 		{
-			throw std::runtime_error("failed to create debug messenger");
+			return false;
+		}
+		else if(result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate memory block");
 		}
+		_heapUsage[heapIndex] += size;
 
-		puts("created debug messenger\n");
-	}
+		// a VkDeviceMemory can only be mapped once, so host visible blocks stay persistently mapped and hand out pointers
+		if(_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			if(vkMapMemory(_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS)
+			{
+				vkFreeMemory(_device, block.memory, nullptr);
+				throw std::runtime_error("failed to map memory block");
+			}
+		}
 
-	void destroyDebugMessenger()
-	{
-		if constexpr(!_enableValidationLayers)
+		for(uint32_t i = 0; i < _blocks.size(); ++i)
 		{
-			return;
+			if(_blocks[i].memory == VK_NULL_HANDLE)
+			{
+				_blocks[i] = std::move(block);
+				outBlockIndex = i;
+				return true;
+			}
 		}
-		DestroyDebugUtilsMessengerEXT(_instance, _debugMessenger, nullptr);
+
+		_blocks.push_back(std::move(block));
+		outBlockIndex = static_cast<uint32_t>(_blocks.size() - 1);
+		return true;
 	}
 
-	void createSurface()
+	Allocation suballocate(uint32_t blockIndex, VkDeviceSize offset, VkDeviceSize size, ResourceKind kind, const ResourceInfo& info)
 	{
-		if(glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS)
+		auto& block = _blocks[blockIndex];
+		block.suballocations[offset] = Suballocation{size, kind, info};
+
+		const uint32_t heapIndex = _memoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex;
+		HeapPeaks& peaks = _heapPeaks[heapIndex];
+		peaks.live += size;
+		_framePeaks[heapIndex] = std::max(_framePeaks[heapIndex], peaks.live);
+		if(peaks.live > peaks.peak)
 		{
-			throw std::runtime_error("failed to create window surface");
+			peaks.peak = peaks.live;
+			peaks.peakFrame = _frameNumber;
 		}
+
+		Allocation allocation;
+		allocation.memory = block.memory;
+		allocation.offset = offset;
+		allocation.size = size;
+		allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+		allocation.memoryTypeIndex = block.memoryTypeIndex;
+		allocation.blockIndex = blockIndex;
+		return allocation;
 	}
 
-	bool checkPhysicalDeviceExtensions(VkPhysicalDevice physicalDevice, std::vector<VkExtensionProperties>& physicalDeviceExtensions)
+	VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+	VkDevice _device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties _memoryProperties{};
+	VkDeviceSize _bufferImageGranularity = 1;
+	VkDeviceSize _nonCoherentAtomSize = 1;
+	bool _memoryBudgetSupported = false;
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> _heapBudget{};
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> _heapUsage{};
+	std::array<HeapPeaks, VK_MAX_MEMORY_HEAPS> _heapPeaks{};
+	std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> _framePeaks{}; // running peak of the current frame, becomes HeapPeaks::lastFrame in endFrame
+	uint64_t _frameNumber = 0;
+	std::vector<MemoryBlock> _blocks;
+	std::mutex _mutex;
+};
+
+// Records uploads into one batch of command buffers and submits them together, instead of one vkQueueWaitIdle per copy.
+// Copies run on a dedicated transfer queue when there is one; the batch then releases the resources to the graphics queue family,
+// and a second command buffer on the graphics queue acquires them (and runs graphics-only work like mipmap blits).
+// Completion is tracked with a timeline semaphore: flush() returns the value that the batch signals once everything is usable.
+// Staging memory comes from a persistently mapped ring buffer, the space used by a batch is reclaimed when the batch retires.
+// Not thread safe, record and flush from the thread that owns the graphics queue.
+class UploadEngine
+{
+public:
+	// A mapped range of the staging ring, valid until the batch it was allocated in completes.
+	struct StagingRegion
 	{
-		uint32_t extensionCount = 0;
-		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		void* mapped = nullptr;
+	};
 
-		physicalDeviceExtensions.resize(extensionCount);
-		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, physicalDeviceExtensions.data());
+	void init(VkDevice device, uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily, VkQueue graphicsQueue)
+	{
+		_device = device;
+		_transferFamily = transferFamily;
+		_transferQueue = transferQueue;
+		_graphicsFamily = graphicsFamily;
+		_graphicsQueue = graphicsQueue;
 
-		std::unordered_set<std::string_view> availableExtensions;
+		_transferPool = createCommandPool(_transferFamily);
+		_graphicsPool = hasDedicatedTransferQueue() ? createCommandPool(_graphicsFamily) : _transferPool;
 
-		for(const auto& e : physicalDeviceExtensions)
+		// one timeline per queue: the transfer queue signals copies done, the graphics queue signals the batch is fully usable
+		_transferTimeline = createTimelineSemaphore();
+		_graphicsTimeline = hasDedicatedTransferQueue() ? createTimelineSemaphore() : _transferTimeline;
+
+		printf("upload engine: transfer queue family %u, %s\n", _transferFamily, hasDedicatedTransferQueue() ? "dedicated" : "shared with graphics");
+		putc('\n', stdout);
+	}
+
+	void destroy()
+	{
+		if(_current.transfer != VK_NULL_HANDLE)
 		{
-			availableExtensions.emplace(e.extensionName);
+			flush();
 		}
+		wait(_lastSubmitted);
+		collect();
 
-		for(auto extension : _requiredDeviceExtensions)
+		// all batches are retired and their command buffers are back in the free lists
+		vkDestroySemaphore(_device, _transferTimeline, nullptr);
+		vkDestroyCommandPool(_device, _transferPool, nullptr);
+		if(hasDedicatedTransferQueue())
 		{
-			if(!availableExtensions.contains(extension))
-			{
-				return false;
-			}
+			vkDestroySemaphore(_device, _graphicsTimeline, nullptr);
+			vkDestroyCommandPool(_device, _graphicsPool, nullptr);
 		}
-
-		return true;
+		_freeTransferCommandBuffers.clear();
+		_freeGraphicsCommandBuffers.clear();
 	}
 
-	bool checkPhysicalDeviceQueueFamilies(VkPhysicalDevice physicalDevice, QueueFamilies& families)
+	bool hasDedicatedTransferQueue() const
 	{
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		return _transferFamily != _graphicsFamily;
+	}
 
-		families.properties.resize(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, families.properties.data());
+	// The ring buffer is owned by the caller, it must be host visible, persistently mapped and have TRANSFER_SRC usage.
+	void setStagingRing(VkBuffer buffer, void* mapped, VkDeviceSize size)
+	{
+		_ringBuffer = buffer;
+		_ringMapped = static_cast<char*>(mapped);
+		_ringSize = size;
+		_ringHead = 0;
+		_ringTail = 0;
+	}
 
-		families.supportsPresentation.resize(queueFamilyCount);
-		for(uint32_t i = 0; i < queueFamilyCount; ++i)
+	// Carves size bytes out of the staging ring for the current batch, so producers can write their data straight into it.
+	// When the ring is full the current batch is submitted and we wait for the oldest batches to give their space back.
+	// Returns false if size can never fit in the ring, the caller then needs its own staging buffer.
+	bool allocateStaging(VkDeviceSize size, VkDeviceSize alignment, StagingRegion& region)
+	{
+		if(size > _ringSize)
 		{
-			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, _surface, &families.supportsPresentation[i]);
+			return false;
 		}
 
-		// greedily choose first graphics queue that also supports presentation if any
-		// TODO: handle multiple graphics queues, how to choose which one to use?
-		// TODO: for compute and transfer queues, decide if it is better to reuse graphics queue or prefer another queue
-		for(uint32_t i = 0; i < queueFamilyCount; ++i)
+		beginBatch();
+
+		auto alignUp = [](VkDeviceSize value, VkDeviceSize a) { return (value + a - 1) / a * a; };
+
+		// head and tail only ever grow, the position in the ring is head % size
+		VkDeviceSize offset = 0;
+		while(true)
 		{
-			if(families.properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			offset = alignUp(_ringHead, alignment);
+			if(offset % _ringSize + size > _ringSize)
 			{
-				families.graphics = i;
+				// never split a region across the end of the ring, skip the remaining bytes instead
+				offset = alignUp(offset, _ringSize);
+			}
+
+			if(offset + size - _ringTail <= _ringSize)
+			{
+				break;
 			}
-			if(families.supportsPresentation[i])
+
+			if(_ringTail == _ringHead)
 			{
-				families.present = i;
+				// nothing is using the ring anymore, restart at its beginning (which satisfies any alignment dividing the ring size)
+				_ringHead = _ringTail = alignUp(_ringHead, _ringSize);
+				offset = _ringHead;
+				break;
 			}
-			if(families.graphics == families.present)
+
+			if(_inFlight.empty())
 			{
-				return true;
+				// only the current batch holds ring space, submit it so it can be waited on
+				flush();
+				beginBatch();
 			}
+			wait(_inFlight.front().value);
+			collect();
 		}
 
-		return families.graphics.has_value() && families.present.has_value();
+		region.buffer = _ringBuffer;
+		region.offset = offset % _ringSize;
+		region.mapped = _ringMapped + region.offset;
+
+		_ringHead = offset + size;
+		return true;
 	}
 
-	bool checkPhysicalDeviceSwapChain(VkPhysicalDevice physicalDevice, SwapChainInfo& info)
+	// Commands recorded here run on the transfer queue, which may not support graphics or compute work.
+	VkCommandBuffer transferCommands()
 	{
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, _surface, &info.capabilities);
+		beginBatch();
+		return _current.transfer;
+	}
 
-		uint32_t formatCount = 0;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, _surface, &formatCount, nullptr);
+	// Commands recorded here run on the graphics queue after the transfer commands of the same batch, and after ownership was acquired.
+	VkCommandBuffer graphicsCommands()
+	{
+		beginBatch();
+		return _current.graphics;
+	}
 
-		info.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, _surface, &formatCount, info.formats.data());
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0)
+	{
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = srcOffset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(transferCommands(), srcBuffer, dstBuffer, 1, &copyRegion);
+	}
 
-		uint32_t presentModeCount = 0;
-		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, _surface, &presentModeCount, nullptr);
+	// Makes transfer writes to buffer visible to dstStage/dstAccess on the graphics queue, moving queue family ownership if needed.
+	void releaseBuffer(VkBuffer buffer, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
 
-		info.presentModes.resize(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, _surface, &presentModeCount, info.presentModes.data());
+		if(!hasDedicatedTransferQueue())
+		{
+			vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			return;
+		}
 
-		return !info.formats.empty() && !info.presentModes.empty();
+		barrier.srcQueueFamilyIndex = _transferFamily;
+		barrier.dstQueueFamilyIndex = _graphicsFamily;
+
+		// release: the dst access mask is ignored on the releasing queue
+		VkBufferMemoryBarrier release = barrier;
+		release.dstAccessMask = 0;
+		vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+
+		// acquire: the src access mask is ignored on the acquiring queue, the semaphore wait provides the ordering
+		VkBufferMemoryBarrier acquire = barrier;
+		acquire.srcAccessMask = 0;
+		vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &acquire, 0, nullptr);
 	}
 
-	bool checkPhysicalDeviceFeatures(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures& features)
+	// Same as releaseBuffer for images, the layout can change on the way (both queues must agree on it).
+	void releaseImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
 	{
-		vkGetPhysicalDeviceFeatures(physicalDevice, &features);
-		return features.samplerAnisotropy;
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = range;
+
+		if(!hasDedicatedTransferQueue())
+		{
+			vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			return;
+		}
+
+		barrier.srcQueueFamilyIndex = _transferFamily;
+		barrier.dstQueueFamilyIndex = _graphicsFamily;
+
+		VkImageMemoryBarrier release = barrier;
+		release.dstAccessMask = 0;
+		vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+
+		VkImageMemoryBarrier acquire = barrier;
+		acquire.srcAccessMask = 0;
+		vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &acquire);
 	}
 
-	bool checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkPhysicalDeviceProperties& properties)
+	// Runs callback once the current batch has completed on the GPU, e.g. to destroy its staging buffers.
+	void onComplete(std::function<void()> callback)
 	{
-		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
-		return properties.apiVersion >= MINIMUM_VULKAN_VERSION;
+		beginBatch();
+		_current.onComplete.push_back(std::move(callback));
 	}
 
-	void choosePhysicalDevice()
+	// Submits the current batch and returns the graphics timeline value that signals its completion.
+	// Nothing is waited on: poll with isComplete(), make a queue submission wait on getTimeline(), or block with wait().
+	uint64_t flush()
 	{
-		uint32_t physicalDeviceCount = 0;
-		vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, nullptr);
-
-		if(physicalDeviceCount == 0)
+		if(_current.transfer == VK_NULL_HANDLE)
 		{
-			throw std::runtime_error("failed to find any GPU with Vulkan support");
+			return _lastSubmitted;
 		}
 
-		std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
-		vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, physicalDevices.data());
+		const uint64_t value = ++_lastSubmitted;
+		_current.value = value;
+		_current.ringEnd = _ringHead;
 
-		std::vector<VkExtensionProperties> extensions;
-		QueueFamilies families;
-		SwapChainInfo swapChainInfo;
-		VkPhysicalDeviceProperties properties;
-		VkPhysicalDeviceFeatures features;
+		if(vkEndCommandBuffer(_current.transfer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording upload command buffer");
+		}
 
-		// greedily choose first discrete gpu if any
-		// TODO: more sophisticated logic to choose best device with fallbacks
-		for(auto physicalDevice : physicalDevices)
+		submit(_transferQueue, _current.transfer, VK_NULL_HANDLE, 0, _transferTimeline, value);
+
+		if(hasDedicatedTransferQueue())
 		{
-			if(!checkPhysicalDeviceExtensions(physicalDevice, extensions))
+			if(vkEndCommandBuffer(_current.graphics) != VK_SUCCESS)
 			{
-				continue;
+				throw std::runtime_error("failed to end recording upload command buffer");
 			}
 
-			if(!checkPhysicalDeviceQueueFamilies(physicalDevice, families))
-			{
-				continue;
-			}
+			// the acquire barriers wait for the copies through the transfer timeline
+			submit(_graphicsQueue, _current.graphics, _transferTimeline, value, _graphicsTimeline, value);
+		}
 
-			if(!checkPhysicalDeviceSwapChain(physicalDevice, swapChainInfo))
-			{
-				continue;
-			}
+		_inFlight.push_back(std::move(_current));
+		_current = Batch{};
 
-			if(!checkPhysicalDeviceFeatures(physicalDevice, features))
-			{
-				continue;
-			}
+		return value;
+	}
+
+	bool isComplete(uint64_t value) const
+	{
+		uint64_t completed = 0;
+		vkGetSemaphoreCounterValue(_device, _graphicsTimeline, &completed);
+		return completed >= value;
+	}
+
+	void wait(uint64_t value) const
+	{
+		if(value == 0)
+		{
+			return;
+		}
+
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &_graphicsTimeline;
+		waitInfo.pValues = &value;
+		vkWaitSemaphores(_device, &waitInfo, UINT64_MAX);
+	}
+
+	// Retires finished batches: runs their callbacks and recycles their command buffers. Call once per frame.
+	void collect()
+	{
+		uint64_t completed = 0;
+		vkGetSemaphoreCounterValue(_device, _graphicsTimeline, &completed);
 
-			if(!checkPhysicalDeviceProperties(physicalDevice, properties))
+		while(!_inFlight.empty() && _inFlight.front().value <= completed)
+		{
+			Batch& batch = _inFlight.front();
+			for(auto& callback : batch.onComplete)
 			{
-				continue;
+				callback();
 			}
 
-			_physicalDevice = physicalDevice;
-			_queueFamilies = families;
-			_swapChainInfo = swapChainInfo;
+			_ringTail = batch.ringEnd;
 
-			if(properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+			vkResetCommandBuffer(batch.transfer, 0);
+			_freeTransferCommandBuffers.push_back(batch.transfer);
+			if(hasDedicatedTransferQueue())
 			{
-				break;
+				vkResetCommandBuffer(batch.graphics, 0);
+				_freeGraphicsCommandBuffers.push_back(batch.graphics);
 			}
-		}
 
-		if(_physicalDevice == VK_NULL_HANDLE)
-		{
-			throw std::runtime_error("failed to find a suitable GPU");
+			_inFlight.pop_front();
 		}
+	}
 
-		printf("chosen device: %s\n", properties.deviceName);
+	// Graphics timeline and the last value submitted on it, for queue submissions that consume uploaded resources.
+	VkSemaphore getTimeline() const
+	{
+		return _graphicsTimeline;
+	}
 
-		for(uint32_t idx = 0; idx < _queueFamilies.properties.size(); ++idx)
-		{
-			const auto& family = _queueFamilies.properties[idx];
-
-			printf("queue family %d:", idx);
-			if(family.queueFlags & VK_QUEUE_GRAPHICS_BIT) fputs(" graphics", stdout);
-			if(family.queueFlags & VK_QUEUE_COMPUTE_BIT) fputs(" compute", stdout);
-			if(family.queueFlags & VK_QUEUE_TRANSFER_BIT) fputs(" transfer", stdout);
-			if(family.queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) fputs(" sparse_binding", stdout);
-			if(family.queueFlags & VK_QUEUE_PROTECTED_BIT) fputs(" protected", stdout);
-			if(_queueFamilies.supportsPresentation[idx]) fputs(" present", stdout);
-			printf(" (count: %d)", family.queueCount);
-			putc('\n', stdout);
-		}
+	uint64_t getLastSubmitted() const
+	{
+		return _lastSubmitted;
+	}
 
-		printf("chosen graphics queue family: %d\n", _queueFamilies.graphics.value());
-		printf("chosen present  queue family: %d\n", _queueFamilies.present.value());
-		putc('\n', stdout);
+private:
+	struct Batch
+	{
+		uint64_t value = 0;
+		VkDeviceSize ringEnd = 0; // staging ring head when the batch was submitted
+		VkCommandBuffer transfer = VK_NULL_HANDLE;
+		VkCommandBuffer graphics = VK_NULL_HANDLE; // same as transfer without a dedicated transfer queue
+		std::vector<std::function<void()>> onComplete;
+	};
 
-		puts("available device extensions:");
-		for(const auto& e : extensions)
-		{
-			puts(e.extensionName);
-		}
-		putc('\n', stdout);
+	VkCommandPool createCommandPool(uint32_t queueFamily)
+	{
+		VkCommandPoolCreateInfo poolCreateInfo{};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolCreateInfo.queueFamilyIndex = queueFamily;
+		poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-		puts("enabling the following device extensions:");
-		for(auto extension : _requiredDeviceExtensions)
+		VkCommandPool pool = VK_NULL_HANDLE;
+		if(vkCreateCommandPool(_device, &poolCreateInfo, nullptr, &pool) != VK_SUCCESS)
 		{
-			puts(extension);
+			throw std::runtime_error("failed to create upload command pool");
 		}
-		putc('\n', stdout);
+		return pool;
 	}
 
-	void createLogicalDevice()
+	VkSemaphore createTimelineSemaphore()
 	{
-		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::unordered_set<uint32_t> uniqueQueueFamilies = {_queueFamilies.graphics.value(), _queueFamilies.present.value()};
+		VkSemaphoreTypeCreateInfo typeCreateInfo{};
+		typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeCreateInfo.initialValue = 0;
 
-		float queuePriority = 1.0f;
-		for(auto queueFamily : uniqueQueueFamilies)
-		{
-			VkDeviceQueueCreateInfo queueCreateInfo{};
-			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-			queueCreateInfo.queueFamilyIndex = queueFamily;
-			queueCreateInfo.queueCount = 1;
-			queueCreateInfo.pQueuePriorities = &queuePriority;
+		VkSemaphoreCreateInfo semaphoreCreateInfo{};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreCreateInfo.pNext = &typeCreateInfo;
 
-			queueCreateInfos.push_back(queueCreateInfo);
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		if(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &semaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create upload timeline semaphore");
 		}
+		return semaphore;
+	}
 
-		VkPhysicalDeviceFeatures deviceFeatures{};
-		deviceFeatures.samplerAnisotropy = VK_TRUE; // request feature for texture sampling
-
-		VkDeviceCreateInfo deviceCreateInfo{};
-		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-		deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-
-		if constexpr(_enableValidationLayers)
+	VkCommandBuffer acquireCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		if(!freeList.empty())
 		{
-			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(_requiredValidationLayers.size());
-			deviceCreateInfo.ppEnabledLayerNames = _requiredValidationLayers.data();
+			commandBuffer = freeList.back();
+			freeList.pop_back();
 		}
 		else
 		{
-			deviceCreateInfo.enabledLayerCount = 0;
+			VkCommandBufferAllocateInfo allocateInfo{};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocateInfo.commandPool = pool;
+			allocateInfo.commandBufferCount = 1;
+
+			if(vkAllocateCommandBuffers(_device, &allocateInfo, &commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate upload command buffer");
+			}
 		}
 
-		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_requiredDeviceExtensions.size());
-		deviceCreateInfo.ppEnabledExtensionNames = _requiredDeviceExtensions.data();
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-		if(vkCreateDevice(_physicalDevice, &deviceCreateInfo, nullptr, &_device) != VK_SUCCESS)
+		if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to create logical device");
+			throw std::runtime_error("failed to begin recording upload command buffer");
 		}
-
-		vkGetDeviceQueue(_device, _queueFamilies.graphics.value(), 0, &_graphicsQueue);
-		vkGetDeviceQueue(_device, _queueFamilies.present.value(), 0, &_presentQueue);
+		return commandBuffer;
 	}
 
-	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	void beginBatch()
 	{
-		for(const auto& availableFormat : availableFormats)
+		if(_current.transfer != VK_NULL_HANDLE)
 		{
-			if(availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB &&
-				availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-			{
-				return availableFormat;
-			}
+			return;
 		}
-		return availableFormats.front();
+
+		_current.transfer = acquireCommandBuffer(_transferPool, _freeTransferCommandBuffers);
+		_current.graphics = hasDedicatedTransferQueue() ? acquireCommandBuffer(_graphicsPool, _freeGraphicsCommandBuffers) : _current.transfer;
 	}
 
-	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+	void submit(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore, uint64_t waitValue, VkSemaphore signalSemaphore, uint64_t signalValue)
 	{
-		for(const auto& availablePresentMode : availablePresentModes)
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+		timelineInfo.pWaitSemaphoreValues = &waitValue;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = timelineInfo.waitSemaphoreValueCount;
+		submitInfo.pWaitSemaphores = &waitSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &signalSemaphore;
+
+		if(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
 		{
-			if(availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-			{
-				return availablePresentMode;
-			}
+			throw std::runtime_error("failed to submit upload command buffer");
 		}
-		return VK_PRESENT_MODE_FIFO_KHR;
 	}
 
-	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
-	{
-		if(capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
-		{
-			return capabilities.currentExtent;
-		}
-		else
-		{
-			int width = 0;
-			int height = 0;
-			glfwGetFramebufferSize(_window, &width, &height);
+	VkDevice _device = VK_NULL_HANDLE;
+	uint32_t _transferFamily = 0;
+	VkQueue _transferQueue = VK_NULL_HANDLE;
+	uint32_t _graphicsFamily = 0;
+	VkQueue _graphicsQueue = VK_NULL_HANDLE;
 
-			VkExtent2D actualExtent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+	VkCommandPool _transferPool = VK_NULL_HANDLE;
+	VkCommandPool _graphicsPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> _freeTransferCommandBuffers;
+	std::vector<VkCommandBuffer> _freeGraphicsCommandBuffers;
 
-			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+	VkSemaphore _transferTimeline = VK_NULL_HANDLE;
+	VkSemaphore _graphicsTimeline = VK_NULL_HANDLE;
+	uint64_t _lastSubmitted = 0;
 
-			return actualExtent;
+	VkBuffer _ringBuffer = VK_NULL_HANDLE;
+	char* _ringMapped = nullptr;
+	VkDeviceSize _ringSize = 0;
+	VkDeviceSize _ringHead = 0;
+	VkDeviceSize _ringTail = 0;
+
+	Batch _current;
+	std::deque<Batch> _inFlight;
+};
+
+// Fixed set of worker threads that run a batch of jobs in parallel.
+// The calling thread takes part in every batch as worker 0, so workers [1, count) are the extra threads.
+// Worker indices are stable, which lets callers keep per-worker resources such as command pools without locking.
+// Every worker starts on a contiguous range of the jobs and, once it runs dry, steals the back half of the range of another worker,
+// so neighbouring jobs (usually neighbouring data) stay on one thread and nobody idles while uneven jobs are left elsewhere.
+class ThreadPool
+{
+public:
+	void init(uint32_t workerCount)
+	{
+		_workerCount = std::max(workerCount, 1u);
+		_ranges = std::make_unique<JobRange[]>(_workerCount);
+		for(uint32_t i = 1; i < _workerCount; ++i)
+		{
+			_threads.emplace_back([this, i] { workerLoop(i); });
 		}
 	}
 
-	void createSwapChain()
+	void destroy()
 	{
-		VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(_swapChainInfo.formats);
-		VkPresentModeKHR presentMode = chooseSwapPresentMode(_swapChainInfo.presentModes);
-		VkExtent2D extent = chooseSwapExtent(_swapChainInfo.capabilities);
-
-		uint32_t imageCount = _swapChainInfo.capabilities.minImageCount + 1;
-		if(_swapChainInfo.capabilities.maxImageCount > 0 && imageCount > _swapChainInfo.capabilities.maxImageCount)
 		{
-			imageCount = _swapChainInfo.capabilities.maxImageCount;
+			std::lock_guard lock(_mutex);
+			_stop = true;
 		}
+		_wakeCondition.notify_all();
 
-		printf("swapchain supports min of %d and max of %d images\n", _swapChainInfo.capabilities.minImageCount, _swapChainInfo.capabilities.maxImageCount);
+		for(auto& thread : _threads)
+		{
+			thread.join();
+		}
+		_threads.clear();
+	}
 
-		VkSwapchainCreateInfoKHR swapChainCreateInfo{};
-		swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		swapChainCreateInfo.surface = _surface;
-		swapChainCreateInfo.minImageCount = imageCount;
-		swapChainCreateInfo.imageFormat = surfaceFormat.format;
-		swapChainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
-		swapChainCreateInfo.imageExtent = extent;
-		swapChainCreateInfo.imageArrayLayers = 1;
-		swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // It is also possible that you'll render images to a separate image first to perform operations like post-processing. In that case you may use a value like VK_IMAGE_USAGE_TRANSFER_DST_BIT instead and use a memory operation to transfer the rendered image to a swap chain image.
+	uint32_t getWorkerCount() const
+	{
+		return _workerCount;
+	}
 
-		uint32_t queueFamilyIndices[] = {_queueFamilies.graphics.value(), _queueFamilies.present.value()};
-		if(_queueFamilies.graphics != _queueFamilies.present)
+	// Calls job(jobIndex, workerIndex) for every jobIndex in [0, jobCount) and returns when all of them are done.
+	// The first exception thrown by a job is rethrown here.
+	// Not reentrant: one batch at a time, so neither a job nor another thread may call run while a batch is running.
+	void run(uint32_t jobCount, const std::function<void(uint32_t, uint32_t)>& job)
+	{
+		if(jobCount == 0)
 		{
-			swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			swapChainCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(std::size(queueFamilyIndices));
-			swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+			return;
 		}
-		else
+
 		{
-			swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			swapChainCreateInfo.queueFamilyIndexCount = 0; // Optional
-			swapChainCreateInfo.pQueueFamilyIndices = nullptr; // Optional
+			std::lock_guard lock(_mutex);
+			if(_job != nullptr)
+			{
+				throw std::runtime_error("ThreadPool::run is not reentrant");
+			}
+			_job = &job;
+			for(uint32_t worker = 0; worker < _workerCount; ++worker)
+			{
+				_ranges[worker].jobs = packRange(static_cast<uint32_t>(uint64_t(jobCount) * worker / _workerCount), static_cast<uint32_t>(uint64_t(jobCount) * (worker + 1) / _workerCount));
+			}
+			_remainingJobs = jobCount;
+			_error = nullptr;
+			++_generation;
 		}
+		_wakeCondition.notify_all();
 
-		swapChainCreateInfo.preTransform = _swapChainInfo.capabilities.currentTransform;
-		swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR; // ignore alpha
-		swapChainCreateInfo.presentMode = presentMode;
-		swapChainCreateInfo.clipped = VK_TRUE;
-		swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+		execute(0, job);
 
-		if(vkCreateSwapchainKHR(_device, &swapChainCreateInfo, nullptr, &_swapChain) != VK_SUCCESS)
+		std::unique_lock lock(_mutex);
+		// also wait for workers to leave execute(), so no straggler picks a job of the next batch with stale state
+		_doneCondition.wait(lock, [this] { return _remainingJobs == 0 && _activeWorkers == 0; });
+		_job = nullptr;
+
+		if(_error)
 		{
-			throw std::runtime_error("failed to create swap chain");
+			std::rethrow_exception(_error);
 		}
+	}
 
-		printf("asked for %d images,", imageCount);
-		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
-		printf(" got %d images\n\n", imageCount);
+private:
+	void workerLoop(uint32_t workerIndex)
+	{
+		uint64_t generation = 0;
+		while(true)
+		{
+			const std::function<void(uint32_t, uint32_t)>* job = nullptr;
+			{
+				std::unique_lock lock(_mutex);
+				_wakeCondition.wait(lock, [&] { return _stop || _generation != generation; });
+				if(_stop)
+				{
+					return;
+				}
+				// the job is snapshot with the generation it belongs to, run only clears it once this worker has left execute
+				generation = _generation;
+				job = _job;
+				if(job == nullptr)
+				{
+					continue; // woken after the batch was already done without it
+				}
+				++_activeWorkers;
+			}
 
-		_swapChainImages.resize(imageCount);
-		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
+			execute(workerIndex, *job);
 
-		_swapChainImageFormat = surfaceFormat.format;
-		_swapChainExtent = extent;
+			{
+				std::lock_guard lock(_mutex);
+				--_activeWorkers;
+			}
+			_doneCondition.notify_all();
+		}
 	}
 
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+	void execute(uint32_t workerIndex, const std::function<void(uint32_t, uint32_t)>& job)
 	{
-		VkImageViewCreateInfo viewInfo{};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.image = image;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = format;
-		viewInfo.subresourceRange.aspectMask = aspectFlags;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = mipLevels;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
-
-		VkImageView imageView = VK_NULL_HANDLE;
-		if(vkCreateImageView(_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		while(true)
 		{
-			throw std::runtime_error("failed to create image view");
-		}
+			uint32_t jobIndex = 0;
+			if(!popJob(workerIndex, jobIndex))
+			{
+				if(!stealJobs(workerIndex))
+				{
+					return;
+				}
+				continue;
+			}
 
-		return imageView;
+			try
+			{
+				job(jobIndex, workerIndex);
+			}
+			catch(...)
+			{
+				std::lock_guard lock(_mutex);
+				if(!_error)
+				{
+					_error = std::current_exception();
+				}
+			}
+
+			if(_remainingJobs.fetch_sub(1) == 1)
+			{
+				std::lock_guard lock(_mutex);
+				_doneCondition.notify_all();
+			}
+		}
 	}
 
-	void createSwapChainImageViews()
+	// [begin, end) of the jobs left to a worker, packed so that the owner (taking the front) and thieves (taking the back half) race on a single CAS
+	struct alignas(64) JobRange
 	{
-		_swapChainImageViews.resize(_swapChainImages.size());
+		std::atomic<uint64_t> jobs = 0;
+	};
 
-		for(size_t i = 0; i < _swapChainImages.size(); ++i)
+	static uint64_t packRange(uint32_t begin, uint32_t end)
+	{
+		return uint64_t(end) << 32 | begin;
+	}
+
+	bool popJob(uint32_t workerIndex, uint32_t& jobIndex)
+	{
+		std::atomic<uint64_t>& jobs = _ranges[workerIndex].jobs;
+		uint64_t range = jobs.load();
+		while(true)
 		{
-			_swapChainImageViews[i] = createImageView(_swapChainImages[i], _swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+			const uint32_t begin = static_cast<uint32_t>(range);
+			const uint32_t end = static_cast<uint32_t>(range >> 32);
+			if(begin >= end)
+			{
+				return false;
+			}
+			if(jobs.compare_exchange_weak(range, packRange(begin + 1, end)))
+			{
+				jobIndex = begin;
+				return true;
+			}
 		}
 	}
 
-	void destroySwapChainImageViews()
+	// Moves the back half of the first non-empty range of the other workers to the empty range of workerIndex.
+	// Nobody else writes an empty range, so storing into it needs no CAS. False once every range is empty.
+	bool stealJobs(uint32_t workerIndex)
 	{
-		for(auto imageView : _swapChainImageViews)
+		for(uint32_t offset = 1; offset < _workerCount; ++offset)
 		{
-			vkDestroyImageView(_device, imageView, nullptr);
+			std::atomic<uint64_t>& victim = _ranges[(workerIndex + offset) % _workerCount].jobs;
+			uint64_t range = victim.load();
+			while(true)
+			{
+				const uint32_t begin = static_cast<uint32_t>(range);
+				const uint32_t end = static_cast<uint32_t>(range >> 32);
+				if(begin >= end)
+				{
+					break;
+				}
+				const uint32_t middle = begin + (end - begin) / 2; // a single job left is taken whole
+				if(victim.compare_exchange_weak(range, packRange(begin, middle)))
+				{
+					_ranges[workerIndex].jobs.store(packRange(middle, end));
+					return true;
+				}
+			}
 		}
+		return false;
 	}
 
-	void createRenderPass()
-	{
-		VkAttachmentDescription colorAttachment{};
-		colorAttachment.format = _swapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	uint32_t _workerCount = 1;
+	std::vector<std::thread> _threads;
+	std::unique_ptr<JobRange[]> _ranges; // one per worker
 
-		VkAttachmentReference colorAttachmentRef{};
-		colorAttachmentRef.attachment = 0; // index to VkAttachmentDescription array
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _doneCondition;
+	bool _stop = false;
+	uint64_t _generation = 0;
+	uint32_t _activeWorkers = 0;
 
-		VkAttachmentReference colorAttachmentRefs[] = {colorAttachmentRef}; // The index of the attachment in this array is directly referenced from the fragment shader with the layout(location = 0) out vec4 outColor directive!
+	const std::function<void(uint32_t, uint32_t)>* _job = nullptr;
+	std::atomic<uint32_t> _remainingJobs = 0;
+	std::exception_ptr _error;
+};
 
-		VkAttachmentDescription depthAttachment{};
-		depthAttachment.format = findDepthFormat();
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+// Rigid transforms of the scene nodes as a structure of arrays, so the update streams through each array instead of striding over whole nodes.
+// Nodes are stored by depth in the hierarchy (see addNode), which splits them into levels that only read the world matrices of the level above:
+// update computes one level after the other, each of them in parallel on the thread pool without any locking.
+// A node spins around its local angular velocity axis, on top of its rotation, so animation needs no per-node work from the caller.
+class TransformHierarchy
+{
+public:
+	static constexpr uint32_t NO_PARENT = UINT32_MAX;
 
-		VkAttachmentReference depthAttachmentRef{};
-		depthAttachmentRef.attachment = 1;
-		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	// The parent must already be added, and nodes are added in breadth first order: never shallower than the node added before.
+	uint32_t addNode(uint32_t parent, const glm::vec3& translation, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& angularVelocity = glm::vec3(0.0f))
+	{
+		const uint32_t depth = parent == NO_PARENT ? 0 : _depths[parent] + 1;
+		if(!_depths.empty() && depth < _depths.back())
+		{
+			throw std::runtime_error("transform hierarchy: nodes must be added in breadth first order");
+		}
 
-		VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
+		const uint32_t node = static_cast<uint32_t>(_parents.size());
+		if(depth == _levelStarts.size())
+		{
+			_levelStarts.push_back(node);
+		}
 
-		VkSubpassDescription subpass{};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = static_cast<uint32_t>(std::size(colorAttachmentRefs));
-		subpass.pColorAttachments = colorAttachmentRefs;
-		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		_parents.push_back(parent);
+		_depths.push_back(depth);
+		_translations.push_back(translation);
+		_rotations.push_back(rotation);
+		_angularVelocities.push_back(angularVelocity);
+		_worlds.emplace_back(1.0f);
+		return node;
+	}
 
-		VkSubpassDescription subpasses[] = {subpass};
+	void setTranslation(uint32_t node, const glm::vec3& translation)
+	{
+		_translations[node] = translation;
+	}
 
-		// TODO: the question is: why can I use only a single depth buffer for multiple frames in flight? what makes sure it is never concurrently written by more than one frame at the same time?
-		// for example, if I remove the subpass dependencies, everything still works. 
+	void setRotation(uint32_t node, const glm::quat& rotation)
+	{
+		_rotations[node] = rotation;
+	}
 
-		// src and dst are indices to subpasses in VkSubpassDescription array
-		// dst must always be higher than src
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // special value that indicates implicit subpass before or after our subpasses
-		dependency.dstSubpass = 0; // our only subpass
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	// world = parent world * translation * rotation * spin(time)
+	void update(float time, ThreadPool& threadPool)
+	{
+		const uint32_t nodeCount = static_cast<uint32_t>(_parents.size());
+		for(size_t level = 0; level < _levelStarts.size(); ++level)
+		{
+			const uint32_t first = _levelStarts[level];
+			const uint32_t last = level + 1 < _levelStarts.size() ? _levelStarts[level + 1] : nodeCount;
+			const uint32_t jobCount = std::min(threadPool.getWorkerCount() * JOBS_PER_WORKER, (last - first + MIN_NODES_PER_JOB - 1) / MIN_NODES_PER_JOB);
+			if(jobCount <= 1)
+			{
+				updateNodes(first, last, time);
+				continue;
+			}
 
-		VkSubpassDependency dependencies[] = {dependency};
+			threadPool.run(jobCount, [&](uint32_t job, uint32_t)
+			{
+				updateNodes(first + static_cast<uint32_t>(uint64_t(last - first) * job / jobCount), first + static_cast<uint32_t>(uint64_t(last - first) * (job + 1) / jobCount), time);
+			});
+		}
+	}
 
-		VkRenderPassCreateInfo renderPassCreateInfo{};
-		renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
-		renderPassCreateInfo.pAttachments = attachments;
-		renderPassCreateInfo.subpassCount = static_cast<uint32_t>(std::size(subpasses));
-		renderPassCreateInfo.pSubpasses = subpasses;
-		renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(std::size(dependencies));
-		renderPassCreateInfo.pDependencies = dependencies;
+	const glm::mat4& getWorld(uint32_t node) const
+	{
+		return _worlds[node];
+	}
 
-		if(vkCreateRenderPass(_device, &renderPassCreateInfo, nullptr, &_renderPass) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to create render pass");
-		}
+	uint32_t getNodeCount() const
+	{
+		return static_cast<uint32_t>(_parents.size());
 	}
 
-	void createFramebuffers()
+	uint32_t getLevelCount() const
 	{
-		_framebuffers.resize(_swapChainImageViews.size());
+		return static_cast<uint32_t>(_levelStarts.size());
+	}
 
-		for(size_t i = 0; i < _swapChainImageViews.size(); ++i)
-		{
-			// TODO: The color attachment differs for every swap chain image, but the same depth image can be used by all of them because only a single subpass is running at the same time due to our semaphores.
-			// TODO: check if this is really correct!
-			VkImageView attachments[] = {_swapChainImageViews[i], _depthImageView};
+	void clear()
+	{
+		_parents.clear();
+		_depths.clear();
+		_translations.clear();
+		_rotations.clear();
+		_angularVelocities.clear();
+		_worlds.clear();
+		_levelStarts.clear();
+	}
 
-			VkFramebufferCreateInfo framebufferInfo{};
-			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = _renderPass;
-			framebufferInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
-			framebufferInfo.pAttachments = attachments;
-			framebufferInfo.width = _swapChainExtent.width;
-			framebufferInfo.height = _swapChainExtent.height;
-			framebufferInfo.layers = 1;
+private:
+	static constexpr uint32_t MIN_NODES_PER_JOB = 1024; // below that, waking the workers costs more than it saves
+	static constexpr uint32_t JOBS_PER_WORKER = 4; // some slack for stealing
 
-			if(vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &_framebuffers[i]) != VK_SUCCESS)
+	void updateNodes(uint32_t first, uint32_t last, float time)
+	{
+		for(uint32_t node = first; node < last; ++node)
+		{
+			glm::quat rotation = _rotations[node];
+			const float speed = glm::length(_angularVelocities[node]);
+			if(speed > 0.0f)
 			{
-				throw std::runtime_error("failed to create framebuffer");
+				rotation = rotation * glm::angleAxis(speed * time, _angularVelocities[node] / speed);
 			}
+
+			glm::mat4 local = glm::mat4_cast(rotation);
+			local[3] = glm::vec4(_translations[node], 1.0f);
+			_worlds[node] = _parents[node] == NO_PARENT ? local : _worlds[_parents[node]] * local;
 		}
 	}
 
-	void destroyFramebuffers()
+	std::vector<uint32_t> _parents;
+	std::vector<uint32_t> _depths;
+	std::vector<glm::vec3> _translations;
+	std::vector<glm::quat> _rotations;
+	std::vector<glm::vec3> _angularVelocities; // axis times radians per second, in the local space of the node
+	std::vector<glm::mat4> _worlds;
+	std::vector<uint32_t> _levelStarts; // first node of every depth
+};
+
+// Runs the startup stages as soon as the stages they depend on are done, on the calling thread and a few threads of its own.
+// Stages pinned to the main thread (the one calling run) are those that record into the upload engine or call GLFW, the others run wherever a thread is free.
+// A stage can only depend on stages added before it, so the graph is acyclic by construction.
+// Every stage is timed relative to the start of run, see getTimings.
+class TaskGraph
+{
+public:
+	using TaskId = uint32_t;
+
+	struct Timing
 	{
-		for(auto framebuffer : _framebuffers)
-		{
-			vkDestroyFramebuffer(_device, framebuffer, nullptr);
-		}
-	}
+		const char* name = nullptr;
+		double start = 0.0; // milliseconds since run
+		double end = 0.0;
+		bool mainThread = false;
+	};
 
-	void createGraphicsPipelineLayout()
+	TaskId add(const char* name, bool mainThread, std::initializer_list<TaskId> dependencies, std::function<void()> function)
 	{
-		// TODO: It is actually possible to bind multiple descriptor sets simultaneously.
-		// You need to specify a descriptor layout for each descriptor set when creating the pipeline layout. 
-		// Shaders can then reference specific descriptor sets like this:
-		//    layout(set = 0, binding = 0) uniform UniformBufferObject { ... }
-		// You can use this feature to put descriptors that vary per-object and descriptors that are shared into separate descriptor sets.
-		// In that case you avoid rebinding most of the descriptors across draw calls which is potentially more efficient.
-		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutCreateInfo.setLayoutCount = 1;
-		pipelineLayoutCreateInfo.pSetLayouts = &_descriptorSetLayout;
-		pipelineLayoutCreateInfo.pushConstantRangeCount = 0; // Optional
-		pipelineLayoutCreateInfo.pPushConstantRanges = nullptr; // Optional
+		const TaskId id = static_cast<TaskId>(_tasks.size());
 
-		if(vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_graphicsPipelineLayout) != VK_SUCCESS)
+		Task task;
+		task.function = std::move(function);
+		task.timing.name = name;
+		task.timing.mainThread = mainThread;
+		for(TaskId dependency : dependencies)
 		{
-			throw std::runtime_error("failed to create pipeline layout!");
+			if(dependency >= id)
+			{
+				throw std::runtime_error("task graph: dependency added after its dependent");
+			}
+			_tasks[dependency].dependents.push_back(id);
+			++task.remainingDependencies;
 		}
+		_tasks.push_back(std::move(task));
+		return id;
 	}
 
-	std::vector<uint32_t> readSPV(const std::string& filename)
+	// Returns when every task is done. After the first exception no other task is started, the running ones are waited for and the exception is rethrown here.
+	void run(uint32_t threadCount)
 	{
-		std::vector<uint32_t> byteCode;
+		_start = std::chrono::high_resolution_clock::now();
+		_completed = 0;
+		_running = 0;
+		_error = nullptr;
 
-		std::ifstream file(filename, std::ios::binary | std::ios::ate);
+		for(TaskId id = 0; id < _tasks.size(); ++id)
+		{
+			if(_tasks[id].remainingDependencies == 0)
+			{
+				pushReady(id);
+			}
+		}
 
-		if(!file)
+		std::vector<std::thread> threads;
+		for(uint32_t i = 0; i < threadCount; ++i)
 		{
-			throw std::runtime_error("failed to read shader file: " + filename);
+			threads.emplace_back([this] { workerLoop(false); });
 		}
 
-		size_t fileSizeBytes = file.tellg();
+		workerLoop(true);
 
-		if(fileSizeBytes % sizeof(uint32_t) != 0)
+		for(auto& thread : threads)
 		{
-			throw std::runtime_error("bytecode not multiple of uint32_t: " + filename);
+			thread.join();
 		}
 
-		byteCode.resize(fileSizeBytes / sizeof(uint32_t));
+		if(_error)
+		{
+			std::rethrow_exception(_error);
+		}
+	}
 
-		file.seekg(0);
-		file.read(reinterpret_cast<char*>(byteCode.data()), byteCode.size() * sizeof(uint32_t));
+	std::vector<Timing> getTimings() const
+	{
+		std::vector<Timing> timings;
+		for(const Task& task : _tasks)
+		{
+			timings.push_back(task.timing);
+		}
+		return timings;
+	}
 
-		return byteCode;
+	// Time to run the whole graph, in milliseconds.
+	double getTotalTime() const
+	{
+		double end = 0.0;
+		for(const Task& task : _tasks)
+		{
+			end = std::max(end, task.timing.end);
+		}
+		return end;
 	}
 
-	VkShaderModule createShaderModule(const std::vector<uint32_t>& byteCode)
+private:
+	struct Task
 	{
-		VkShaderModuleCreateInfo shaderModuleCreateInfo{};
-		shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		shaderModuleCreateInfo.codeSize = byteCode.size() * sizeof(uint32_t);
-		shaderModuleCreateInfo.pCode = byteCode.data();
+		std::function<void()> function;
+		std::vector<TaskId> dependents;
+		uint32_t remainingDependencies = 0;
+		Timing timing;
+	};
 
-		VkShaderModule shaderModule;
+	// called with _mutex held, or before the threads are started
+	void pushReady(TaskId id)
+	{
+		(_tasks[id].timing.mainThread ? _readyMain : _readyAny).push_back(id);
+	}
 
-		if(vkCreateShaderModule(_device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to create shader module");
-		}
+	bool isFinished() const
+	{
+		return _completed == _tasks.size() || (_error && _running == 0);
+	}
 
-		return shaderModule;
+	double now() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _start).count();
 	}
 
-	void createGraphicsPipeline()
+	// The main thread prefers its pinned tasks, since nobody else can run them.
+	void workerLoop(bool mainThread)
 	{
-		// vertex shader --------------------------------------------------------------------------
+		while(true)
+		{
+			TaskId id = 0;
+			{
+				std::unique_lock lock(_mutex);
+				_condition.wait(lock, [&] { return isFinished() || (!_error && (!_readyAny.empty() || (mainThread && !_readyMain.empty()))); });
+				if(isFinished())
+				{
+					return;
+				}
 
-		auto vertShaderCode = readSPV("shaders/ubo_texture_3d.vert.spv");
-		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+				std::deque<TaskId>& ready = mainThread && !_readyMain.empty() ? _readyMain : _readyAny;
+				id = ready.front();
+				ready.pop_front();
+				++_running;
+			}
 
-		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = vertShaderModule;
-		vertShaderStageInfo.pName = "main";
-		// TODO: pSpecializationInfo allows you to specify values for shader constants. You can use a single shader module where its behavior can be configured at pipeline creation by specifying different values for the constants used in it. This is more efficient than configuring the shader using variables at render time, because the compiler can do optimizations like eliminating if statements that depend on these values.
+			Task& task = _tasks[id];
+			task.timing.start = now();
+			try
+			{
+				task.function();
+			}
+			catch(...)
+			{
+				std::lock_guard lock(_mutex);
+				if(!_error)
+				{
+					_error = std::current_exception();
+				}
+			}
+			task.timing.end = now();
 
-		// fragment shader --------------------------------------------------------------------------
+			{
+				std::lock_guard lock(_mutex);
+				--_running;
+				++_completed;
+				for(TaskId dependent : task.dependents)
+				{
+					if(--_tasks[dependent].remainingDependencies == 0)
+					{
+						pushReady(dependent);
+					}
+				}
+			}
+			_condition.notify_all();
+		}
+	}
 
-		auto fragShaderCode = readSPV("shaders/simple_texture.frag.spv");
-		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+	std::vector<Task> _tasks;
+	std::chrono::high_resolution_clock::time_point _start;
 
-		VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = fragShaderModule;
-		fragShaderStageInfo.pName = "main";
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::deque<TaskId> _readyMain;
+	std::deque<TaskId> _readyAny;
+	size_t _completed = 0;
+	uint32_t _running = 0;
+	std::exception_ptr _error;
+};
 
-		// shader stages --------------------------------------------------------------------------
+// Read-only memory mapping of a whole file.
+// Pages are only read from disk when touched, and the copy into the staging ring reads straight from the page cache.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
 
-		VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+	~MappedFile()
+	{
+		close();
+	}
 
-		// vertex input --------------------------------------------------------------------------
+	bool open(const std::string& path)
+	{
+		close();
 
-		auto bindingDescription = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescriptions();
+#ifdef _WIN32
+		_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if(_file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
 
-		VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
-		vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-		vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+		LARGE_INTEGER fileSize{};
+		if(!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		_size = static_cast<size_t>(fileSize.QuadPart);
 
-		// input assembly --------------------------------------------------------------------------
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(_mapping == nullptr)
+		{
+			close();
+			return false;
+		}
 
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
-		inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
+		_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+		if(_data == nullptr)
+		{
+			close();
+			return false;
+		}
+#else
+		_file = ::open(path.c_str(), O_RDONLY);
+		if(_file < 0)
+		{
+			return false;
+		}
 
-		// viewport --------------------------------------------------------------------------
+		struct stat fileStat{};
+		if(fstat(_file, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close();
+			return false;
+		}
+		_size = static_cast<size_t>(fileStat.st_size);
 
-		// The viewports origin in OpenGL is in the lower left of the screen, with Y pointing up.
-		// In Vulkan the origin is in the top left of the screen, with Y pointing downwards.
-		// If we want to define front faces as Counter-Clockwise and cull back faces, we need to invert Vulkan coordinates
-		// Instead of inverting gl_Position.y in every shader, we can use a negative value in viewport.height
-		// Note: this requires VK_KHR_Maintenance1 extension for Vulkan 1.0, which is core in Vulkan 1.1, and we are already requiring Vulkan 1.2 or greater
-		// ref: https://www.saschawillems.de/blog/2019/03/29/flipping-the-vulkan-viewport/
+		void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+		if(data == MAP_FAILED)
+		{
+			close();
+			return false;
+		}
+		madvise(data, _size, MADV_SEQUENTIAL);
+		_data = static_cast<const uint8_t*>(data);
+#endif
+		return true;
+	}
 
-		VkViewport viewport{};
-		viewport.x = 0.0f;
-		viewport.y = static_cast<float>(_swapChainExtent.height); // invert coordinate system
-		viewport.width = static_cast<float>(_swapChainExtent.width);
-		viewport.height = -static_cast<float>(_swapChainExtent.height); // invert coordinate system
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
+	void close()
+	{
+#ifdef _WIN32
+		if(_data != nullptr)
+		{
+			UnmapViewOfFile(_data);
+		}
+		if(_mapping != nullptr)
+		{
+			CloseHandle(_mapping);
+		}
+		if(_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(_file);
+		}
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+#else
+		if(_data != nullptr)
+		{
+			munmap(const_cast<uint8_t*>(_data), _size);
+		}
+		if(_file >= 0)
+		{
+			::close(_file);
+		}
+		_file = -1;
+#endif
+		_data = nullptr;
+		_size = 0;
+	}
 
-		VkRect2D scissor{};
-		scissor.offset = {0, 0};
-		scissor.extent = _swapChainExtent;
+	const uint8_t* data() const
+	{
+		return _data;
+	}
 
-		VkPipelineViewportStateCreateInfo viewportCreateInfo{};
-		viewportCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportCreateInfo.viewportCount = 1;
-		viewportCreateInfo.pViewports = &viewport;
-		viewportCreateInfo.scissorCount = 1;
-		viewportCreateInfo.pScissors = &scissor;
+	size_t size() const
+	{
+		return _size;
+	}
 
-		// rasterization --------------------------------------------------------------------------
+private:
+#ifdef _WIN32
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = nullptr;
+#else
+	int _file = -1;
+#endif
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+};
 
-		VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
-		rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizationCreateInfo.depthClampEnable = VK_FALSE;
-		rasterizationCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-		rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterizationCreateInfo.lineWidth = 1.0f;
-		rasterizationCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-		rasterizationCreateInfo.depthBiasEnable = VK_FALSE;
-		rasterizationCreateInfo.depthBiasConstantFactor = 0.0f; // Optional
-		rasterizationCreateInfo.depthBiasClamp = 0.0f; // Optional
-		rasterizationCreateInfo.depthBiasSlopeFactor = 0.0f; // Optional
-
-		// multisampling --------------------------------------------------------------------------
-
-		VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo{};
-		multisamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisamplingCreateInfo.sampleShadingEnable = VK_FALSE;
-		multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisamplingCreateInfo.minSampleShading = 1.0f; // Optional
-		multisamplingCreateInfo.pSampleMask = nullptr; // Optional
-		multisamplingCreateInfo.alphaToCoverageEnable = VK_FALSE; // Optional
-		multisamplingCreateInfo.alphaToOneEnable = VK_FALSE; // Optional
-
-		// depth/stencil --------------------------------------------------------------------------
-
-		VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
-		depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depthStencilCreateInfo.depthTestEnable = VK_TRUE;
-		depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
-		depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
-		depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
-		depthStencilCreateInfo.minDepthBounds = 0.0f; // Optional
-		depthStencilCreateInfo.maxDepthBounds = 1.0f; // Optional
-		depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
-		depthStencilCreateInfo.front = {}; // Optional
-		depthStencilCreateInfo.back = {}; // Optional
-
-		// color blending --------------------------------------------------------------------------
-
-		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
-
-		VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo{};
-		colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		colorBlendCreateInfo.logicOpEnable = VK_FALSE;
-		colorBlendCreateInfo.logicOp = VK_LOGIC_OP_COPY; // Optional
-		colorBlendCreateInfo.attachmentCount = 1;
-		colorBlendCreateInfo.pAttachments = &colorBlendAttachment;
-		colorBlendCreateInfo.blendConstants[0] = 0.0f; // Optional
-		colorBlendCreateInfo.blendConstants[1] = 0.0f; // Optional
-		colorBlendCreateInfo.blendConstants[2] = 0.0f; // Optional
-		colorBlendCreateInfo.blendConstants[3] = 0.0f; // Optional
-
-		// dynamic state --------------------------------------------------------------------------
-		// TODO: ignoring for now, will use later
+// Frame profiler: GPU timestamps and pipeline statistics read back through one set of query pools per frame in flight,
+// and CPU scopes timed on the recording thread. Every frame is kept for the last historyFrames frames, so the report gives
+// percentiles rather than averages (a single 30 ms frame among 16 ms ones is the stutter we are after), and the same history
+// is exported as a Chrome trace (chrome://tracing or https://ui.perfetto.dev).
+class Profiler
+{
+public:
+	static constexpr uint32_t MAX_GPU_SCOPES = 16; // per frame
+	static constexpr size_t DEFAULT_HISTORY_FRAMES = 1000;
 
-		VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT};
+	// A CPU scope on the calling thread, ends when destroyed.
+	class CpuScope
+	{
+	public:
+		CpuScope(Profiler& profiler, const char* name) : _profiler(profiler), _name(name), _start(profiler.now()) {}
+		CpuScope(const CpuScope&) = delete;
+		CpuScope& operator=(const CpuScope&) = delete;
+		~CpuScope() { _profiler.addCpuEvent(_name, _start, _profiler.now()); }
+
+	private:
+		Profiler& _profiler;
+		const char* _name;
+		double _start;
+	};
 
-		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
-		dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(std::size(dynamicStates));
-		dynamicStateCreateInfo.pDynamicStates = dynamicStates;
+	// timestampValidBits of the graphics queue family, 0 disables the GPU scopes. Pipeline statistics also need inheritedQueries,
+	// since the draws are in secondary command buffers executed while the query is active.
+	void init(VkDevice device, float timestampPeriod, uint32_t timestampValidBits, bool pipelineStatistics, uint32_t framesInFlight, size_t historyFrames = DEFAULT_HISTORY_FRAMES)
+	{
+		_device = device;
+		_historyFrames = std::max<size_t>(historyFrames, 1);
+		_timestampPeriod = timestampPeriod;
+		_timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (uint64_t(1) << timestampValidBits) - 1;
+		_timestamps = timestampValidBits != 0;
+		_statisticsFlags = pipelineStatistics ? VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT : 0;
+		_origin = std::chrono::high_resolution_clock::now();
+
+		_slots.resize(framesInFlight);
+		for(auto& slot : _slots)
+		{
+			if(_timestamps)
+			{
+				VkQueryPoolCreateInfo poolCreateInfo{};
+				poolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				poolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				poolCreateInfo.queryCount = MAX_GPU_SCOPES * 2;
 
-		// --------------------------------------------------------------------------------------------
-		// graphics pipeline
-		// --------------------------------------------------------------------------------------------
+				if(vkCreateQueryPool(_device, &poolCreateInfo, nullptr, &slot.timestampPool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create timestamp query pool");
+				}
+			}
 
-		VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
-		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineCreateInfo.stageCount = static_cast<uint32_t>(std::size(shaderStages));
-		pipelineCreateInfo.pStages = shaderStages;
-		pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
-		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
-		pipelineCreateInfo.pViewportState = &viewportCreateInfo;
-		pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
-		pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
-		pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
-		pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
-		pipelineCreateInfo.pDynamicState = nullptr; // Optional
-		pipelineCreateInfo.layout = _graphicsPipelineLayout;
-		pipelineCreateInfo.renderPass = _renderPass;
-		pipelineCreateInfo.subpass = 0; // which subpass where this graphics pipeline will be used
-		pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-		pipelineCreateInfo.basePipelineIndex = -1; // Optional
-		// These last two values are only used if deriving from an existing pipeline. In this case, must set the VK_PIPELINE_CREATE_DERIVATIVE_BIT flag in the flags field of VkGraphicsPipelineCreateInfo.
+			if(_statisticsFlags != 0)
+			{
+				VkQueryPoolCreateInfo poolCreateInfo{};
+				poolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				poolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+				poolCreateInfo.queryCount = 1;
+				poolCreateInfo.pipelineStatistics = _statisticsFlags;
 
-		// Note: this function is designed to take multiple VkGraphicsPipelineCreateInfo objects and create multiple VkPipeline objects in a single call
-		// The second parameter, for which we've passed the VK_NULL_HANDLE argument, references an optional VkPipelineCache object.
-		// A pipeline cache can be used to store and reuse data relevant to pipeline creation across multiple calls to vkCreateGraphicsPipelines and even across program executions if the cache is stored to a file.
-		// This makes it possible to significantly speed up pipeline creation at a later time.
-		if(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to create graphics pipeline");
+				if(vkCreateQueryPool(_device, &poolCreateInfo, nullptr, &slot.statisticsPool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create pipeline statistics query pool");
+				}
+			}
 		}
 
-		// we're allowed to destroy the shader modules as soon as pipeline creation is finished
-		vkDestroyShaderModule(_device, fragShaderModule, nullptr);
-		vkDestroyShaderModule(_device, vertShaderModule, nullptr);
+		printf("profiler: GPU timestamps %s, pipeline statistics %s\n", _timestamps ? "on" : "off", _statisticsFlags != 0 ? "on" : "off");
+		putc('\n', stdout);
 	}
 
-	void createCommandPool()
+	void destroy()
 	{
-		VkCommandPoolCreateInfo poolCreateInfo{};
-		poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolCreateInfo.queueFamilyIndex = _queueFamilies.graphics.value();
-		poolCreateInfo.flags = 0; // Optional (later probably use VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
-
-		if(vkCreateCommandPool(_device, &poolCreateInfo, nullptr, &_commandPool) != VK_SUCCESS)
+		for(auto& slot : _slots)
 		{
-			throw std::runtime_error("failed to create command pool");
+			vkDestroyQueryPool(_device, slot.timestampPool, nullptr);
+			vkDestroyQueryPool(_device, slot.statisticsPool, nullptr);
 		}
+		_slots.clear();
 	}
 
-	void createCommandBuffers()
+	double now() const
 	{
-		_commandBuffers.resize(_framebuffers.size());
-
-		VkCommandBufferAllocateInfo allocateInfo{};
-		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocateInfo.commandPool = _commandPool;
-		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocateInfo.commandBufferCount = static_cast<uint32_t>(_commandBuffers.size());
+		return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - _origin).count();
+	}
 
-		if(vkAllocateCommandBuffers(_device, &allocateInfo, _commandBuffers.data()) != VK_SUCCESS)
+	// Resolves the queries last written to slot, whose fence must have been waited on, into the frame that wrote them.
+	void collect(uint32_t slotIndex)
+	{
+		Slot& slot = _slots[slotIndex];
+		if(!slot.written)
 		{
-			throw std::runtime_error("failed to allocate command buffers!");
+			return;
 		}
+		slot.written = false;
 
-		// begin recording command buffers --------------------------------------------------------
-
-		for(size_t i = 0; i < _commandBuffers.size(); ++i)
+		FrameRecord* record = findRecord(slot.frameNumber);
+		if(record == nullptr)
 		{
-			// begin command buffer -------------------------------------------
-
-			VkCommandBufferBeginInfo commandBufferBeginInfo{};
-			commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO; // TODO: later probably use VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT and maybe VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
-			commandBufferBeginInfo.flags = 0; // Optional
-			commandBufferBeginInfo.pInheritanceInfo = nullptr; // Optional
+			return; // already out of the history
+		}
 
-			if(vkBeginCommandBuffer(_commandBuffers[i], &commandBufferBeginInfo) != VK_SUCCESS)
+		if(!slot.scopeNames.empty())
+		{
+			uint64_t timestamps[MAX_GPU_SCOPES * 2] = {};
+			const uint32_t queryCount = static_cast<uint32_t>(slot.scopeNames.size()) * 2;
+			if(vkGetQueryPoolResults(_device, slot.timestampPool, 0, queryCount, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
 			{
-				throw std::runtime_error("failed to begin recording command buffer");
+				// GPU and CPU clocks are not calibrated, the GPU track starts where the frame was submitted
+				const uint64_t origin = timestamps[0];
+				for(size_t i = 0; i < slot.scopeNames.size(); ++i)
+				{
+					const double start = double((timestamps[i * 2] - origin) & _timestampMask) * _timestampPeriod / 1000.0;
+					const double end = double((timestamps[i * 2 + 1] - origin) & _timestampMask) * _timestampPeriod / 1000.0;
+					record->gpuEvents.push_back({slot.scopeNames[i], record->submitTime + start, end - start});
+				}
 			}
+		}
 
-			// begin render pass -------------------------------------------
-
-			VkRenderPassBeginInfo renderPassBeginInfo{};
-			renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassBeginInfo.renderPass = _renderPass;
-			renderPassBeginInfo.framebuffer = _framebuffers[i];
-			renderPassBeginInfo.renderArea.offset = {0, 0};
-			renderPassBeginInfo.renderArea.extent = _swapChainExtent;
-
-			// Note that the order of clearValues should be identical to the order of your attachments.
-			VkClearValue clearValues[] = {{.color = {0.0f, 0.0f, 0.0f, 1.0f}}, {.depthStencil = {1.0f, 0}}};
-			renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(std::size(clearValues));
-			renderPassBeginInfo.pClearValues = clearValues;
-
-			vkCmdBeginRenderPass(_commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			// bind graphics pipeline -------------------------------------------
-
-			vkCmdBindPipeline(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
+		if(slot.statistics)
+		{
+			uint64_t statistics[2] = {}; // in the bit order of _statisticsFlags
+			if(vkGetQueryPoolResults(_device, slot.statisticsPool, 0, 1, sizeof(statistics), statistics, sizeof(statistics), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+			{
+				record->vertexInvocations = statistics[0];
+				record->fragmentInvocations = statistics[1];
+			}
+		}
+	}
 
-			// bind vertex buffer -------------------------------------------
+	void beginFrame(uint64_t frameNumber)
+	{
+		_current = {};
+		_current.frameNumber = frameNumber;
+		_current.start = now();
+	}
 
-			VkBuffer vertexBuffers[] = {_vertexBuffer};
-			VkDeviceSize offsets[] = {0};
-			vkCmdBindVertexBuffers(_commandBuffers[i], 0, 1, vertexBuffers, offsets); // TODO: link the binding parameters with the bindings we used during buffer creation
+	void markSubmit()
+	{
+		_current.submitTime = now();
+	}
 
-			// bind index buffer -------------------------------------------
+	// Frames that return early (e.g. out of date swapchain) never get here and are not recorded.
+	void endFrame()
+	{
+		const double end = now();
+		_current.frameTime = _lastFrameEnd > 0.0 ? end - _lastFrameEnd : end - _current.start;
+		_lastFrameEnd = end;
 
-			vkCmdBindIndexBuffer(_commandBuffers[i], _indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		_history.push_back(std::move(_current));
+		if(_history.size() > _historyFrames)
+		{
+			_history.pop_front();
+		}
+	}
 
-			// bind descriptor sets -------------------------------------------
+	// Drops every recorded frame, e.g. the warmup frames of a benchmark. Queries still in flight are dropped too when they resolve.
+	void clearHistory()
+	{
+		_history.clear();
+	}
 
-			// TODO: 4th parameter must match the layout(set) used in the shader?
-			vkCmdBindDescriptorSets(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 0, 1, &_descriptorSets[i], 0, nullptr);
+	size_t getFrameCount() const
+	{
+		return _history.size();
+	}
 
-			// draw! -------------------------------------------
+	void addCpuEvent(const char* name, double start, double end)
+	{
+		_current.cpuEvents.push_back({name, start, end - start});
+	}
 
-			vkCmdDrawIndexed(_commandBuffers[i], static_cast<uint32_t>(_indices.size()), 1, 0, 0, 0);
+	// Recorded first in the primary command buffer of the frame, outside of any render pass.
+	void beginGpuFrame(VkCommandBuffer commandBuffer, uint32_t slotIndex)
+	{
+		Slot& slot = _slots[slotIndex];
+		slot.written = true;
+		slot.frameNumber = _current.frameNumber;
+		slot.scopeNames.clear();
+		slot.statistics = false;
 
-			// end render pass -------------------------------------------
+		if(_timestamps)
+		{
+			vkCmdResetQueryPool(commandBuffer, slot.timestampPool, 0, MAX_GPU_SCOPES * 2);
+		}
+		if(_statisticsFlags != 0)
+		{
+			vkCmdResetQueryPool(commandBuffer, slot.statisticsPool, 0, 1);
+		}
+		_currentSlot = slotIndex;
+	}
 
-			vkCmdEndRenderPass(_commandBuffers[i]);
+	// Scopes are recorded in the primary command buffer outside of render passes, the returned index is passed to endGpuScope.
+	uint32_t beginGpuScope(VkCommandBuffer commandBuffer, const char* name)
+	{
+		Slot& slot = _slots[_currentSlot];
+		if(!_timestamps || slot.scopeNames.size() == MAX_GPU_SCOPES)
+		{
+			return UINT32_MAX;
+		}
 
-			// end command buffer -------------------------------------------
+		const uint32_t scope = static_cast<uint32_t>(slot.scopeNames.size());
+		slot.scopeNames.push_back(name);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.timestampPool, scope * 2);
+		return scope;
+	}
 
-			if(vkEndCommandBuffer(_commandBuffers[i]) != VK_SUCCESS)
-			{
-				throw std::runtime_error("failed to end recording command buffer");
-			}
+	void endGpuScope(VkCommandBuffer commandBuffer, uint32_t scope)
+	{
+		if(scope == UINT32_MAX)
+		{
+			return;
 		}
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _slots[_currentSlot].timestampPool, scope * 2 + 1);
+	}
 
-		// end recording command buffers --------------------------------------------------------
+	void beginStatistics(VkCommandBuffer commandBuffer)
+	{
+		if(_statisticsFlags == 0)
+		{
+			return;
+		}
+		_slots[_currentSlot].statistics = true;
+		vkCmdBeginQuery(commandBuffer, _slots[_currentSlot].statisticsPool, 0, 0);
 	}
 
-	void createSyncObjects()
+	void endStatistics(VkCommandBuffer commandBuffer)
 	{
-		_imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		_renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		_framesInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+		if(_statisticsFlags == 0)
+		{
+			return;
+		}
+		vkCmdEndQuery(commandBuffer, _slots[_currentSlot].statisticsPool, 0);
+	}
 
-		VkSemaphoreCreateInfo semaphoreCreateInfo{};
-		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	// What secondary command buffers executed inside beginStatistics/endStatistics must declare in their inheritance info.
+	VkQueryPipelineStatisticFlags getStatisticsFlags() const
+	{
+		return _statisticsFlags;
+	}
 
-		VkFenceCreateInfo fenceCreateInfo{};
-		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // so we can render the first frame
+	// Nearest rank percentile of the duration of name over the history, in milliseconds, name "frame" is the CPU frame time.
+	struct Percentiles
+	{
+		double p50 = 0.0;
+		double p99 = 0.0;
+		double max = 0.0;
+		double mean = 0.0; // for comparisons with other runs only, it hides the stutter
+		size_t count = 0;
+	};
 
-		for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	// Scope names in order of first appearance.
+	std::vector<std::string> getEventNames(bool gpu) const
+	{
+		std::vector<std::string> names;
+		for(const FrameRecord& record : _history)
 		{
-			if(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS ||
-				vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS ||
-				vkCreateFence(_device, &fenceCreateInfo, nullptr, &_framesInFlightFences[i]) != VK_SUCCESS)
+			for(const Event& event : gpu ? record.gpuEvents : record.cpuEvents)
 			{
-				throw std::runtime_error("failed to create sync objects");
+				if(std::find(names.begin(), names.end(), event.name) == names.end())
+				{
+					names.push_back(event.name);
+				}
 			}
 		}
+		return names;
 	}
 
-	void destroySyncObjects()
+	Percentiles getPercentiles(const std::string& name, bool gpu) const
 	{
-		for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		std::vector<double> durations;
+		for(const FrameRecord& record : _history)
 		{
-			vkDestroySemaphore(_device, _renderFinishedSemaphores[i], nullptr);
-			vkDestroySemaphore(_device, _imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(_device, _framesInFlightFences[i], nullptr);
+			if(name == "frame" && !gpu)
+			{
+				durations.push_back(record.frameTime);
+				continue;
+			}
+			for(const Event& event : gpu ? record.gpuEvents : record.cpuEvents)
+			{
+				if(name == event.name)
+				{
+					durations.push_back(event.duration);
+				}
+			}
 		}
+		return computePercentiles(durations);
 	}
 
-	void updateFPS()
+	void printReport() const
 	{
-		static char buffer[256] = {};
+		printf("profiler: last %zu frames (ms)\n", _history.size());
+		printf("  %-24s %8s %8s %8s\n", "", "p50", "p99", "max");
 
-		double currentTime = glfwGetTime();
-		double delta = currentTime - _fpsLastTime;
-		_fpsFrameCount++;
-		if(delta >= 0.5)
+		auto printRow = [](const char* track, const std::string& name, const Percentiles& percentiles)
 		{
-			double fps = double(_fpsFrameCount) / delta;
-			double mps = (delta * 1000.0) / double(_fpsFrameCount);
-
-			sprintf_s(buffer, std::size(buffer) - 1, "Vulkan Tutorial - %.2f fps | %.2f ms", fps, mps);
+			printf("  %s %-20s %8.3f %8.3f %8.3f\n", track, name.c_str(), percentiles.p50, percentiles.p99, percentiles.max);
+		};
 
-			glfwSetWindowTitle(_window, buffer);
+		printRow("cpu", "frame", getPercentiles("frame", false));
+		for(const std::string& name : getEventNames(false))
+		{
+			printRow("cpu", name, getPercentiles(name, false));
+		}
+		for(const std::string& name : getEventNames(true))
+		{
+			printRow("gpu", name, getPercentiles(name, true));
+		}
 
-			_fpsFrameCount = 0;
-			_fpsLastTime = currentTime;
+		if(_statisticsFlags != 0)
+		{
+			std::vector<double> vertices, fragments;
+			for(const FrameRecord& record : _history)
+			{
+				vertices.push_back(double(record.vertexInvocations));
+				fragments.push_back(double(record.fragmentInvocations));
+			}
+			// values are counts, computePercentiles does not care about the unit
+			const Percentiles vertexPercentiles = computePercentiles(vertices, 1.0);
+			const Percentiles fragmentPercentiles = computePercentiles(fragments, 1.0);
+			printf("  vertex invocations   p50 %.0f p99 %.0f\n", vertexPercentiles.p50, vertexPercentiles.p99);
+			printf("  fragment invocations p50 %.0f p99 %.0f\n", fragmentPercentiles.p50, fragmentPercentiles.p99);
 		}
+		putc('\n', stdout);
 	}
 
-	void drawFrame()
+	// Trace Event Format, one complete ("X") event per scope: thread 0 is the CPU, thread 1 the graphics queue.
+	bool exportChromeTrace(const std::string& path) const
 	{
-		updateFPS();
-
-		// wait until current frame is finished -----------------------------------------------------
-
-		vkWaitForFences(_device, 1, &_framesInFlightFences[_currentFrame], VK_TRUE, UINT64_MAX);
-		vkResetFences(_device, 1, &_framesInFlightFences[_currentFrame]);
-
-		// acquire next image from swap chain -----------------------------------------------------
+		std::ofstream file(path, std::ios::trunc);
+		if(!file)
+		{
+			return false;
+		}
 
-		uint32_t imageIndex = 0;
-		VkResult result = vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[_currentFrame], VK_NULL_HANDLE, &imageIndex);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU graphics queue\"}}";
 
-		if(result == VK_ERROR_OUT_OF_DATE_KHR)
+		char line[256] = {};
+		auto writeEvent = [&](const char* name, double start, double duration, int tid)
 		{
-			recreateSwapChain();
-			return;
-		}
-		else if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", name, tid, start, duration);
+			file << line;
+		};
+
+		for(const FrameRecord& record : _history)
 		{
-			throw std::runtime_error("failed to acquire swap chain image");
+			writeEvent("frame", record.start, record.frameTime, 0);
+			for(const Event& event : record.cpuEvents)
+			{
+				writeEvent(event.name, event.start, event.duration, 0);
+			}
+			for(const Event& event : record.gpuEvents)
+			{
+				writeEvent(event.name, event.start, event.duration, 1);
+			}
+			if(_statisticsFlags != 0)
+			{
+				snprintf(line, sizeof(line), ",\n{\"name\":\"invocations\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"vertex\":%llu,\"fragment\":%llu}}",
+					record.start, static_cast<unsigned long long>(record.vertexInvocations), static_cast<unsigned long long>(record.fragmentInvocations));
+				file << line;
+			}
 		}
 
-		// update UBOs -----------------------------------------------------
-
-		// The updateUniformBuffer takes care of screen resizing, so we don't need to recreate the descriptor set in recreateSwapChain.
-		updateUniformBuffer(imageIndex);
-
-		// submit command buffers to graphics queue -----------------------------------------------------
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+private:
+	struct Event
+	{
+		const char* name = nullptr; // string literals only, events are not copied
+		double start = 0.0; // microseconds since init
+		double duration = 0.0;
+	};
 
-		// these two arrays run in parallel
-		VkSemaphore imageAvailableSemaphores[] = {_imageAvailableSemaphores[_currentFrame]};
-		VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(std::size(imageAvailableSemaphores));
-		submitInfo.pWaitSemaphores = imageAvailableSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
+	struct FrameRecord
+	{
+		uint64_t frameNumber = 0;
+		double start = 0.0;
+		double submitTime = 0.0;
+		double frameTime = 0.0; // from the end of the previous recorded frame
+		std::vector<Event> cpuEvents;
+		std::vector<Event> gpuEvents; // filled framesInFlight frames later, see collect
+		uint64_t vertexInvocations = 0;
+		uint64_t fragmentInvocations = 0;
+	};
 
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &_commandBuffers[imageIndex];
+	struct Slot
+	{
+		VkQueryPool timestampPool = VK_NULL_HANDLE;
+		VkQueryPool statisticsPool = VK_NULL_HANDLE;
+		bool written = false;
+		bool statistics = false;
+		uint64_t frameNumber = 0;
+		std::vector<const char*> scopeNames; // scope i writes queries 2 * i and 2 * i + 1
+	};
 
-		// TODO: if graphics and present queues are the same we don't need a semaphore for explicit synchronization?
-		VkSemaphore renderFinishedSemaphores[] = {_renderFinishedSemaphores[_currentFrame]};
-		//if(_queueFamilies.graphics != _queueFamilies.present)
+	FrameRecord* findRecord(uint64_t frameNumber)
+	{
+		for(auto it = _history.rbegin(); it != _history.rend(); ++it)
 		{
-			submitInfo.signalSemaphoreCount = static_cast<uint32_t>(std::size(renderFinishedSemaphores));
-			submitInfo.pSignalSemaphores = renderFinishedSemaphores;
+			if(it->frameNumber == frameNumber)
+			{
+				return &*it;
+			}
 		}
+		return nullptr;
+	}
 
-		if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _framesInFlightFences[_currentFrame]) != VK_SUCCESS)
+	// durations in microseconds, returned in milliseconds unless another scale is given
+	static Percentiles computePercentiles(std::vector<double> values, double scale = 0.001)
+	{
+		Percentiles percentiles;
+		percentiles.count = values.size();
+		if(values.empty())
 		{
-			throw std::runtime_error("failed to submit draw command buffer");
+			return percentiles;
 		}
 
-		// present image on screen -----------------------------------------------------
+		std::sort(values.begin(), values.end());
+		auto rank = [&values](double q) { return values[std::min(values.size() - 1, static_cast<size_t>(std::ceil(q * values.size())) - 1)]; };
+		percentiles.p50 = rank(0.50) * scale;
+		percentiles.p99 = rank(0.99) * scale;
+		percentiles.max = values.back() * scale;
+		percentiles.mean = std::accumulate(values.begin(), values.end(), 0.0) / double(values.size()) * scale;
+		return percentiles;
+	}
 
-		VkPresentInfoKHR presentInfo{};
-		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	VkDevice _device = VK_NULL_HANDLE;
+	size_t _historyFrames = DEFAULT_HISTORY_FRAMES;
+	float _timestampPeriod = 1.0f; // nanoseconds per tick
+	uint64_t _timestampMask = UINT64_MAX;
+	bool _timestamps = false;
+	VkQueryPipelineStatisticFlags _statisticsFlags = 0;
+	std::chrono::high_resolution_clock::time_point _origin;
+
+	std::vector<Slot> _slots; // one per frame in flight
+	uint32_t _currentSlot = 0;
+
+	FrameRecord _current;
+	double _lastFrameEnd = 0.0;
+	std::deque<FrameRecord> _history;
+};
 
-		// // TODO: if graphics and present queues are the same we don't need a semaphore for explicit synchronization?
-		//if(_queueFamilies.graphics != _queueFamilies.present)
-		{
+// Orders the GPU work of a frame from what every pass declares it accesses, instead of barriers written by hand next to each pass.
+// Resources are either imported (owned by the caller, the handle may change every frame like the swapchain image does) or transient
+// (created by compile(), their contents only live within a frame). Transients used by passes that do not overlap share memory,
+// and lazy ones (attachments never loaded nor stored) go to lazily allocated memory, which tilers need not back at all.
+// execute() walks the passes in order and batches everything a pass has to wait for into a single barrier in front of it.
+// Accesses are tracked per resource, not per subresource or buffer range: dependencies inside a pass are the pass's business.
+class RenderGraph
+{
+public:
+	using ResourceId = uint32_t;
+	using PassFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t imageIndex)>;
+	using PassHook = std::function<void(VkCommandBuffer commandBuffer, const char* pass, bool begin)>; // around each pass, its barrier included
+	using AllocateFunction = std::function<Allocation(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags preferred)>;
+	using FreeFunction = std::function<void(Allocation& allocation)>;
+
+	struct Access
+	{
+		ResourceId resource = 0;
+		VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+		VkAccessFlags2 access = VK_ACCESS_2_NONE;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED; // images: the layout the pass needs, UNDEFINED if it does not care (e.g. a render pass that transitions it itself)
+		VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED; // images: the layout the pass leaves behind when it transitions it itself
+	};
+
+	struct TransientImageInfo
+	{
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+		VkImageUsageFlags usage = 0;
+		VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		bool lazy = false; // only used as an attachment that is cleared (or not loaded) and not stored, e.g. depth or MSAA color
+	};
+
+	// pipelineBarrier2 is vkCmdPipelineBarrier2KHR, or nullptr without synchronization2: the batched barriers then go through vkCmdPipelineBarrier
+	void init(VkDevice device, PFN_vkCmdPipelineBarrier2KHR pipelineBarrier2, AllocateFunction allocate, FreeFunction free)
+	{
+		_device = device;
+		_pipelineBarrier2 = pipelineBarrier2;
+		_allocate = std::move(allocate);
+		_free = std::move(free);
+	}
+
+	// initialLayout: the layout of the image whenever a frame starts, e.g. UNDEFINED for an acquired swapchain image.
+	// persistent: the image is reused by every frame, so its accesses are also ordered against the ones of the previous frame (on the same queue).
+	// initialStages: not persistent only, the stages the first access of a frame waits for, e.g. the stage the acquire semaphore of a swapchain image is waited in,
+	// so that the layout transition chains with that wait instead of running before the presentation engine released the image.
+	ResourceId importImage(const char* name, VkImageAspectFlags aspect, uint32_t levels, VkImageLayout initialLayout, bool persistent,
+		VkPipelineStageFlags2 initialStages = VK_PIPELINE_STAGE_2_NONE)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = true;
+		resource.persistent = persistent;
+		resource.aspect = aspect;
+		resource.barrierAspect = aspect;
+		resource.levels = levels;
+		resource.initialLayout = initialLayout;
+		resource.initialStages = initialStages;
+		return addResource(std::move(resource));
+	}
+
+	// Buffers are always persistent, they only ever get global memory barriers.
+	ResourceId importBuffer(const char* name)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.persistent = true;
+		return addResource(std::move(resource));
+	}
+
+	ResourceId createImage(const char* name, const TransientImageInfo& info)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = true;
+		resource.transient = true;
+		resource.aspect = info.aspect;
+		resource.barrierAspect = getBarrierAspect(info.format, info.aspect);
+		resource.levels = 1;
+		resource.info = info;
+		return addResource(std::move(resource));
+	}
+
+	// The handle of an imported image for the next execute, only needed when the graph has to transition it.
+	void setImage(ResourceId id, VkImage image)
+	{
+		_resources[id].image = image;
+	}
+
+	VkImage getImage(ResourceId id) const
+	{
+		return _resources[id].image;
+	}
+
+	// transient images only
+	VkImageView getImageView(ResourceId id) const
+	{
+		return _resources[id].view;
+	}
+
+	// The layout a (not persistent) imported image is handed over in at the end of every execute, e.g. PRESENT_SRC for the presentation engine.
+	// Nothing inside the command buffer waits for that transition, whoever takes the image over waits for the submission.
+	void exportImage(ResourceId id, VkImageLayout layout)
+	{
+		if(_resources[id].transient || _resources[id].persistent)
+		{
+			throw std::runtime_error("render graph: only images imported per frame can be exported");
+		}
+		_resources[id].exportLayout = layout;
+	}
+
+	// Passes run in the order they are added.
+	void addPass(const char* name, std::vector<Access> accesses, PassFunction function)
+	{
+		Pass pass;
+		pass.name = name;
+		pass.accesses = std::move(accesses);
+		pass.function = std::move(function);
+		_passes.push_back(std::move(pass));
+	}
+
+	// Creates the transient images and assigns them memory: the largest first, each one joins the first allocation whose images are all used
+	// by passes outside of its own first to last pass, otherwise it gets a new one. Lazy images are never aliased, there is nothing to save.
+	void compile()
+	{
+		for(uint32_t passIndex = 0; passIndex < _passes.size(); ++passIndex)
+		{
+			for(const Access& access : _passes[passIndex].accesses)
+			{
+				Resource& resource = _resources[access.resource];
+				resource.firstPass = std::min(resource.firstPass, passIndex);
+				resource.lastPass = std::max(resource.lastPass, passIndex);
+			}
+		}
+
+		std::vector<ResourceId> transients;
+		for(ResourceId id = 0; id < _resources.size(); ++id)
+		{
+			Resource& resource = _resources[id];
+			if(!resource.transient)
+			{
+				continue;
+			}
+
+			VkImageCreateInfo imageCreateInfo{};
+			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.extent = {resource.info.extent.width, resource.info.extent.height, 1};
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.format = resource.info.format;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.usage = resource.info.usage | (resource.info.lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+			if(vkCreateImage(_device, &imageCreateInfo, nullptr, &resource.image) != VK_SUCCESS)
+			{
+				throw std::runtime_error("render graph: failed to create transient image");
+			}
+			vkGetImageMemoryRequirements(_device, resource.image, &resource.requirements);
+			transients.push_back(id);
+		}
+
+		std::stable_sort(transients.begin(), transients.end(), [this](ResourceId a, ResourceId b) { return _resources[a].requirements.size > _resources[b].requirements.size; });
+
+		for(ResourceId id : transients)
+		{
+			Resource& resource = _resources[id];
+
+			auto fits = [&](const MemorySlot& slot)
+			{
+				if(slot.lazy || resource.info.lazy || !(slot.requirements.memoryTypeBits & resource.requirements.memoryTypeBits))
+				{
+					return false;
+				}
+				for(ResourceId other : slot.images)
+				{
+					if(resource.firstPass <= _resources[other].lastPass && _resources[other].firstPass <= resource.lastPass)
+					{
+						return false;
+					}
+				}
+				return true;
+			};
+
+			auto slot = std::find_if(_slots.begin(), _slots.end(), fits);
+			if(slot == _slots.end())
+			{
+				MemorySlot newSlot;
+				newSlot.requirements = resource.requirements;
+				newSlot.lazy = resource.info.lazy;
+				_slots.push_back(newSlot);
+				slot = _slots.end() - 1;
+			}
+
+			slot->requirements.size = std::max(slot->requirements.size, resource.requirements.size);
+			slot->requirements.alignment = std::max(slot->requirements.alignment, resource.requirements.alignment);
+			slot->requirements.memoryTypeBits &= resource.requirements.memoryTypeBits;
+			slot->images.push_back(id);
+			resource.slot = static_cast<uint32_t>(slot - _slots.begin());
+		}
+
+		for(MemorySlot& slot : _slots)
+		{
+			slot.memory = _allocate(slot.requirements, slot.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+
+			for(ResourceId id : slot.images)
+			{
+				Resource& resource = _resources[id];
+				if(vkBindImageMemory(_device, resource.image, slot.memory.memory, slot.memory.offset) != VK_SUCCESS)
+				{
+					throw std::runtime_error("render graph: failed to bind transient image memory");
+				}
+
+				VkImageViewCreateInfo viewCreateInfo{};
+				viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+				viewCreateInfo.image = resource.image;
+				viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewCreateInfo.format = resource.info.format;
+				viewCreateInfo.subresourceRange = {resource.aspect, 0, 1, 0, 1};
+
+				if(vkCreateImageView(_device, &viewCreateInfo, nullptr, &resource.view) != VK_SUCCESS)
+				{
+					throw std::runtime_error("render graph: failed to create transient image view");
+				}
+			}
+		}
+
+		// whatever touched the resources before is unknown, the first access of every persistent one waits for all of it
+		for(Resource& resource : _resources)
+		{
+			resource.layout = resource.initialLayout;
+			if(resource.persistent)
+			{
+				resource.state.writeStages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+				resource.state.writeAccess = VK_ACCESS_2_MEMORY_WRITE_BIT;
+			}
+		}
+	}
+
+	// Records every pass, each one behind the barrier that covers its accesses. imageIndex is handed to the passes as is.
+	void execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, const PassHook& hook = {})
+	{
+		for(Resource& resource : _resources)
+		{
+			if(resource.transient)
+			{
+				resource.layout = VK_IMAGE_LAYOUT_UNDEFINED; // contents are not kept across frames, the state of its memory is (see MemorySlot)
+			}
+			else if(!resource.persistent)
+			{
+				// an execution dependency only, like the external subpass dependency of a render pass
+				resource.layout = resource.initialLayout;
+				resource.state = {};
+				resource.state.readStages = resource.initialStages;
+			}
+		}
+
+		for(const Pass& pass : _passes)
+		{
+			if(hook)
+			{
+				hook(commandBuffer, pass.name, true);
+			}
+
+			VkMemoryBarrier2 memoryBarrier{};
+			memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+			_imageBarriers.clear();
+
+			for(const Access& access : pass.accesses)
+			{
+				Resource& resource = _resources[access.resource];
+				State& state = resource.transient ? _slots[resource.slot].state : resource.state;
+
+				const VkAccessFlags2 writeAccess = access.access & WRITE_ACCESS;
+				const bool transition = resource.isImage && access.layout != VK_IMAGE_LAYOUT_UNDEFINED && access.layout != resource.layout;
+
+				if(writeAccess != 0 || transition)
+				{
+					// write after write and write after read, a layout transition counts as a write
+					const VkPipelineStageFlags2 srcStages = state.writeStages | state.readStages;
+					if(transition)
+					{
+						VkImageMemoryBarrier2 imageBarrier{};
+						imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+						imageBarrier.srcStageMask = srcStages;
+						imageBarrier.srcAccessMask = state.writeAccess;
+						imageBarrier.dstStageMask = access.stages;
+						imageBarrier.dstAccessMask = access.access;
+						imageBarrier.oldLayout = resource.layout;
+						imageBarrier.newLayout = access.layout;
+						imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						imageBarrier.image = resource.image;
+						imageBarrier.subresourceRange = {resource.barrierAspect, 0, resource.levels, 0, 1};
+						_imageBarriers.push_back(imageBarrier);
+						resource.layout = access.layout;
+					}
+					else if(srcStages != 0)
+					{
+						addMemoryBarrier(memoryBarrier, srcStages, state.writeAccess, access.stages, access.access);
+					}
+
+					state = {};
+					state.writeStages = access.stages;
+					state.writeAccess = writeAccess;
+					state.visibleStages = access.stages;
+					state.visibleAccess = access.access;
+				}
+				else
+				{
+					// read after write, once per stage and access the write was not made visible to yet
+					if(state.writeStages != 0 && ((access.stages & ~state.visibleStages) != 0 || (access.access & ~state.visibleAccess) != 0))
+					{
+						addMemoryBarrier(memoryBarrier, state.writeStages, state.writeAccess, access.stages, access.access);
+						state.visibleStages |= access.stages;
+						state.visibleAccess |= access.access;
+					}
+					state.readStages |= access.stages;
+				}
+
+				if(access.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+				{
+					resource.layout = access.finalLayout;
+				}
+			}
+
+			recordBarriers(commandBuffer, memoryBarrier);
+			pass.function(commandBuffer, imageIndex);
+
+			if(hook)
+			{
+				hook(commandBuffer, pass.name, false);
+			}
+		}
+
+		// exports, unless the last pass already left the image in that layout (e.g. a render pass with that final layout)
+		VkMemoryBarrier2 memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+		_imageBarriers.clear();
+		for(Resource& resource : _resources)
+		{
+			if(resource.exportLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.exportLayout == resource.layout)
+			{
+				continue;
+			}
+
+			VkImageMemoryBarrier2 imageBarrier{};
+			imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			imageBarrier.srcStageMask = resource.state.writeStages | resource.state.readStages;
+			imageBarrier.srcAccessMask = resource.state.writeAccess;
+			imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+			imageBarrier.dstAccessMask = VK_ACCESS_2_NONE;
+			imageBarrier.oldLayout = resource.layout;
+			imageBarrier.newLayout = resource.exportLayout;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = resource.image;
+			imageBarrier.subresourceRange = {resource.barrierAspect, 0, resource.levels, 0, 1};
+			_imageBarriers.push_back(imageBarrier);
+			resource.layout = resource.exportLayout;
+		}
+		recordBarriers(commandBuffer, memoryBarrier);
+	}
+
+	void print() const
+	{
+		VkDeviceSize allocated = 0;
+		VkDeviceSize unaliased = 0;
+		uint32_t lazyCount = 0;
+		for(const MemorySlot& slot : _slots)
+		{
+			allocated += slot.lazy ? 0 : slot.requirements.size;
+			lazyCount += slot.lazy ? 1 : 0;
+			for(ResourceId id : slot.images)
+			{
+				unaliased += slot.lazy ? 0 : _resources[id].requirements.size;
+			}
+		}
+
+		printf("render graph: %zu passes, %zu resources\n", _passes.size(), _resources.size());
+		for(const Pass& pass : _passes)
+		{
+			printf("    %s:", pass.name);
+			for(const Access& access : pass.accesses)
+			{
+				printf(" %s%s", _resources[access.resource].name, (access.access & WRITE_ACCESS) ? " (write)" : "");
+			}
+			putc('\n', stdout);
+		}
+		printf("    transient memory: %.2f MiB in %zu allocations (%.2f MiB without aliasing), %u lazily allocated\n",
+			allocated / (1024.0 * 1024.0), _slots.size() - lazyCount, unaliased / (1024.0 * 1024.0), lazyCount);
+		printf("    barriers: %s\n", _pipelineBarrier2 ? "synchronization2" : "vkCmdPipelineBarrier");
+		putc('\n', stdout);
+	}
+
+	// Destroys the transient images and forgets every pass and resource, the GPU must be done with them.
+	void destroy()
+	{
+		for(Resource& resource : _resources)
+		{
+			if(resource.transient)
+			{
+				vkDestroyImageView(_device, resource.view, nullptr);
+				vkDestroyImage(_device, resource.image, nullptr);
+			}
+		}
+		for(MemorySlot& slot : _slots)
+		{
+			_free(slot.memory);
+		}
+		_resources.clear();
+		_passes.clear();
+		_slots.clear();
+	}
+
+private:
+	static constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	// what the next access of a resource has to synchronize with
+	struct State
+	{
+		VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE; // of the last write (or layout transition)
+		VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+		VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE; // since the last write, the next write waits for them
+		VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE; // the last write is already visible to these
+		VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+	};
+
+	struct Resource
+	{
+		const char* name = nullptr;
+		bool isImage = false;
+		bool transient = false;
+		bool persistent = false;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE; // transient only
+		VkImageAspectFlags aspect = 0; // of the view
+		VkImageAspectFlags barrierAspect = 0; // of the layout transitions, see getBarrierAspect
+		uint32_t levels = 1;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags2 initialStages = VK_PIPELINE_STAGE_2_NONE;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED; // while recording
+		VkImageLayout exportLayout = VK_IMAGE_LAYOUT_UNDEFINED; // see exportImage
+		State state; // imported only, transients share the one of their memory
+		TransientImageInfo info;
+		VkMemoryRequirements requirements{};
+		uint32_t slot = UINT32_MAX;
+		uint32_t firstPass = UINT32_MAX;
+		uint32_t lastPass = 0;
+	};
+
+	// One allocation, shared by transient images whose passes do not overlap. Hazards are tracked on the memory, so the first image
+	// of a frame also waits for the last one of the previous frame, which makes aliasing across frames safe as well.
+	struct MemorySlot
+	{
+		VkMemoryRequirements requirements{};
+		bool lazy = false;
+		Allocation memory;
+		std::vector<ResourceId> images;
+		State state;
+	};
+
+	struct Pass
+	{
+		const char* name = nullptr;
+		std::vector<Access> accesses;
+		PassFunction function;
+	};
+
+	// Without separateDepthStencilLayouts, the layout of a combined depth stencil image is transitioned for both aspects at once,
+	// even when only the depth is viewed.
+	static VkImageAspectFlags getBarrierAspect(VkFormat format, VkImageAspectFlags aspect)
+	{
+		const bool hasStencil = format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+		return (aspect & VK_IMAGE_ASPECT_DEPTH_BIT) && hasStencil ? aspect | VK_IMAGE_ASPECT_STENCIL_BIT : aspect;
+	}
+
+	ResourceId addResource(Resource resource)
+	{
+		_resources.push_back(std::move(resource));
+		return static_cast<ResourceId>(_resources.size() - 1);
+	}
+
+	static void addMemoryBarrier(VkMemoryBarrier2& barrier, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess)
+	{
+		barrier.srcStageMask |= srcStages;
+		barrier.srcAccessMask |= srcAccess;
+		barrier.dstStageMask |= dstStages;
+		barrier.dstAccessMask |= dstAccess;
+	}
+
+	void recordBarriers(VkCommandBuffer commandBuffer, const VkMemoryBarrier2& memoryBarrier)
+	{
+		const bool memory = memoryBarrier.dstStageMask != 0;
+		if(!memory && _imageBarriers.empty())
+		{
+			return;
+		}
+
+		if(_pipelineBarrier2 != nullptr)
+		{
+			VkDependencyInfo dependencyInfo{};
+			dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+			dependencyInfo.memoryBarrierCount = memory ? 1 : 0;
+			dependencyInfo.pMemoryBarriers = &memoryBarrier;
+			dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(_imageBarriers.size());
+			dependencyInfo.pImageMemoryBarriers = _imageBarriers.data();
+			_pipelineBarrier2(commandBuffer, &dependencyInfo);
+			return;
+		}
+
+		// the stages and accesses used here all have the same bit in both flag types, the stage masks are merged as vkCmdPipelineBarrier takes only one pair
+		VkPipelineStageFlags srcStages = static_cast<VkPipelineStageFlags>(memoryBarrier.srcStageMask);
+		VkPipelineStageFlags dstStages = static_cast<VkPipelineStageFlags>(memoryBarrier.dstStageMask);
+
+		VkMemoryBarrier legacyMemoryBarrier{};
+		legacyMemoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		legacyMemoryBarrier.srcAccessMask = static_cast<VkAccessFlags>(memoryBarrier.srcAccessMask);
+		legacyMemoryBarrier.dstAccessMask = static_cast<VkAccessFlags>(memoryBarrier.dstAccessMask);
+
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		for(const VkImageMemoryBarrier2& barrier : _imageBarriers)
+		{
+			VkImageMemoryBarrier imageBarrier{};
+			imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imageBarrier.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+			imageBarrier.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+			imageBarrier.oldLayout = barrier.oldLayout;
+			imageBarrier.newLayout = barrier.newLayout;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = barrier.image;
+			imageBarrier.subresourceRange = barrier.subresourceRange;
+			imageBarriers.push_back(imageBarrier);
+
+			srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+			dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+		}
+
+		vkCmdPipelineBarrier(commandBuffer, srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0, memory ? 1 : 0, &legacyMemoryBarrier,
+			0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+	VkDevice _device = VK_NULL_HANDLE;
+	PFN_vkCmdPipelineBarrier2KHR _pipelineBarrier2 = nullptr;
+	AllocateFunction _allocate;
+	FreeFunction _free;
+
+	std::vector<Resource> _resources;
+	std::vector<Pass> _passes;
+	std::vector<MemorySlot> _slots;
+	std::vector<VkImageMemoryBarrier2> _imageBarriers; // scratch, reused by every pass
+};
+
+// Full precision vertex as imported, see VertexFormat for how it is stored in the vertex buffer.
+struct Vertex
+{
+	glm::vec3 pos;
+	glm::vec3 color;
+	glm::vec2 texCoord;
+
+	bool operator==(const Vertex& other) const
+	{
+		return pos == other.pos && color == other.color && texCoord == other.texCoord;
+	}
+};
+
+enum class PositionFormat : uint32_t
+{
+	Float32, // VK_FORMAT_R32G32B32_SFLOAT
+	Snorm16 // VK_FORMAT_R16G16B16A16_SNORM, mapped to [-1, 1] with a per-mesh scale and bias that go into the model matrix
+};
+
+enum class TexCoordFormat : uint32_t
+{
+	Float32, // VK_FORMAT_R32G32_SFLOAT
+	Float16, // VK_FORMAT_R16G16_SFLOAT
+	Unorm16 // VK_FORMAT_R16G16_UNORM, only for coordinates in [0, 1]
+};
+
+// How vertices are laid out in the vertex buffer, binding and attribute descriptions are generated from it.
+// Stream 0 (binding 0) holds the positions, and with splitPositions the other attributes go to stream 1 (binding 1),
+// so a pass that only needs positions fetches nothing else. A constant color is read from CONSTANT_BINDING, a single
+// value with stride 0, instead of being repeated in every vertex.
+struct VertexFormat
+{
+	static constexpr uint32_t CONSTANT_BINDING = 2;
+
+	PositionFormat position = PositionFormat::Snorm16;
+	TexCoordFormat texCoord = TexCoordFormat::Float16;
+	VkBool32 color = VK_FALSE; // the OBJ importer always sets white
+	VkBool32 splitPositions = VK_TRUE;
+
+	bool operator==(const VertexFormat& other) const = default;
+
+	uint32_t getPositionSize() const
+	{
+		return position == PositionFormat::Float32 ? 3 * sizeof(float) : 4 * sizeof(int16_t);
+	}
+
+	uint32_t getColorSize() const
+	{
+		return color ? 3 * sizeof(float) : 0;
+	}
+
+	uint32_t getTexCoordSize() const
+	{
+		return texCoord == TexCoordFormat::Float32 ? 2 * sizeof(float) : 2 * sizeof(uint16_t);
+	}
+
+	uint32_t getAttributeSize() const
+	{
+		return getColorSize() + getTexCoordSize();
+	}
+
+	uint32_t getStride(uint32_t stream) const
+	{
+		if(!splitPositions)
+		{
+			return getPositionSize() + getAttributeSize();
+		}
+		return stream == 0 ? getPositionSize() : getAttributeSize();
+	}
+
+	std::vector<VkVertexInputBindingDescription> getBindingDescriptions() const
+	{
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = getStride(0);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		bindingDescriptions.push_back(bindingDescription);
+
+		if(splitPositions)
+		{
+			bindingDescription.binding = 1;
+			bindingDescription.stride = getStride(1);
+			bindingDescriptions.push_back(bindingDescription);
+		}
+
+		if(!color)
+		{
+			// stride 0: every vertex (and every instance) reads the same value
+			bindingDescription.binding = CONSTANT_BINDING;
+			bindingDescription.stride = 0;
+			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+			bindingDescriptions.push_back(bindingDescription);
+		}
+
+		return bindingDescriptions;
+	}
+
+	// locations must match the inputs of shaders/uber.vert
+	std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() const
+	{
+		const uint32_t attributeBinding = splitPositions ? 1 : 0;
+		const uint32_t attributeOffset = splitPositions ? 0 : getPositionSize();
+
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3);
+
+		// position
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = position == PositionFormat::Float32 ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R16G16B16A16_SNORM;
+		attributeDescriptions[0].offset = 0;
+
+		// color
+		attributeDescriptions[1].binding = color ? attributeBinding : CONSTANT_BINDING;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].offset = color ? attributeOffset : 0;
+
+		// texture coordinate
+		const VkFormat texCoordFormats[] = {VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16_UNORM};
+		attributeDescriptions[2].binding = attributeBinding;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = texCoordFormats[static_cast<uint32_t>(texCoord)];
+		attributeDescriptions[2].offset = attributeOffset + getColorSize();
+
+		return attributeDescriptions;
+	}
+
+	// Writes vertex to its position and attribute elements, which are the same element without splitPositions.
+	// Quantized positions are stored as (pos - bias) / scale, mapping the mesh bounds to [-1, 1].
+	void encode(const Vertex& vertex, const glm::vec3& scale, const glm::vec3& bias, uint8_t* positionElement, uint8_t* attributeElement) const
+	{
+		if(position == PositionFormat::Float32)
+		{
+			memcpy(positionElement, &vertex.pos, 3 * sizeof(float));
+		}
+		else
+		{
+			const uint64_t packed = glm::packSnorm4x16(glm::vec4((vertex.pos - bias) / scale, 0.0f));
+			memcpy(positionElement, &packed, sizeof(packed));
+		}
+
+		uint8_t* attribute = splitPositions ? attributeElement : positionElement + getPositionSize();
+
+		if(color)
+		{
+			memcpy(attribute, &vertex.color, 3 * sizeof(float));
+			attribute += 3 * sizeof(float);
+		}
+
+		if(texCoord == TexCoordFormat::Float32)
+		{
+			memcpy(attribute, &vertex.texCoord, 2 * sizeof(float));
+		}
+		else
+		{
+			const uint32_t packed = texCoord == TexCoordFormat::Float16 ? glm::packHalf2x16(vertex.texCoord) : glm::packUnorm2x16(vertex.texCoord);
+			memcpy(attribute, &packed, sizeof(packed));
+		}
+	}
+};
+
+// Hash of the raw bytes of a vertex, mixed per 64-bit word and finalized like MurmurHash3's fmix64.
+// Unlike combining per-component float hashes with shifts and XORs, nearby grid coordinates do not collide.
+inline uint64_t hashVertex(const Vertex& vertex)
+{
+	static_assert(sizeof(Vertex) % sizeof(uint64_t) == 0, "Vertex must be a whole number of 64-bit words");
+
+	uint64_t words[sizeof(Vertex) / sizeof(uint64_t)];
+	memcpy(words, &vertex, sizeof(Vertex));
+
+	uint64_t hash = 0x9e3779b97f4a7c15ull;
+	for(uint64_t word : words)
+	{
+		hash = std::rotl(hash ^ (word * 0xff51afd7ed558ccdull), 31) * 0xc4ceb9fe1a85ec53ull;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// Open addressing hash table (linear probing, power of two capacity) from vertex to a 32-bit value.
+// Vertices are compared by their bytes, consistent with hashVertex. Slots are stored inline, so a lookup is one or two cache lines
+// instead of the node chase of std::unordered_map.
+class VertexTable
+{
+public:
+	// Returns the value stored for vertex, after storing value first if vertex is not in the table yet.
+	uint32_t findOrInsert(const Vertex& vertex, uint64_t hash, uint32_t value)
+	{
+		if((_count + 1) * 2 > _slots.size())
+		{
+			grow();
+		}
+
+		const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+		for(size_t i = hash & _mask;; i = (i + 1) & _mask)
+		{
+			Slot& slot = _slots[i];
+			if(slot.value == EMPTY)
+			{
+				slot.vertex = vertex;
+				slot.value = value;
+				slot.tag = tag;
+				++_count;
+				return value;
+			}
+			if(slot.tag == tag && memcmp(&slot.vertex, &vertex, sizeof(Vertex)) == 0)
+			{
+				return slot.value;
+			}
+		}
+	}
+
+	size_t size() const
+	{
+		return _count;
+	}
+
+private:
+	static constexpr uint32_t EMPTY = UINT32_MAX;
+
+	struct Slot
+	{
+		Vertex vertex;
+		uint32_t value = EMPTY;
+		uint32_t tag = 0; // high bits of the hash, the low bits are the position
+	};
+
+	void grow()
+	{
+		std::vector<Slot> slots(std::max<size_t>(_slots.size() * 2, 1024));
+		std::swap(slots, _slots);
+		_mask = _slots.size() - 1;
+		_count = 0;
+
+		for(const Slot& slot : slots)
+		{
+			if(slot.value != EMPTY)
+			{
+				findOrInsert(slot.vertex, hashVertex(slot.vertex), slot.value);
+			}
+		}
+	}
+
+	std::vector<Slot> _slots;
+	size_t _mask = 0;
+	size_t _count = 0;
+};
+
+enum class MeshOptimization : uint32_t
+{
+	None, // OBJ face order
+	VertexCache,
+	VertexCacheAndOverdraw
+};
+
+// Reordering passes for triangle lists: they change the order in which triangles and vertices are stored, never the rendered result.
+// The post-transform vertex cache is modeled as a FIFO of CACHE_SIZE entries, which is what ACMR and ATVR are measured against.
+class MeshOptimizer
+{
+public:
+	static constexpr uint32_t CACHE_SIZE = 16;
+
+	struct CacheStatistics
+	{
+		float acmr = 0.0f; // average cache miss ratio: vertex shader invocations per triangle, 0.5 at best, 3 at worst
+		float atvr = 0.0f; // average transform to vertex ratio: vertex shader invocations per referenced vertex, 1 at best
+	};
+
+	static CacheStatistics analyzeVertexCache(std::span<const uint32_t> indices, size_t vertexCount)
+	{
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> referenced(vertexCount, false);
+		uint32_t time = CACHE_SIZE + 1;
+		size_t transforms = 0;
+		size_t referencedCount = 0;
+
+		for(uint32_t index : indices)
+		{
+			if(time - cacheTime[index] > CACHE_SIZE)
+			{
+				cacheTime[index] = time++;
+				++transforms;
+			}
+			if(!referenced[index])
+			{
+				referenced[index] = true;
+				++referencedCount;
+			}
+		}
+
+		CacheStatistics statistics;
+		statistics.acmr = indices.empty() ? 0.0f : static_cast<float>(transforms) / static_cast<float>(indices.size() / 3);
+		statistics.atvr = referencedCount == 0 ? 0.0f : static_cast<float>(transforms) / static_cast<float>(referencedCount);
+		return statistics;
+	}
+
+	// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007):
+	// emits all triangles around a fanning vertex, then moves to the adjacent vertex that will still be in the cache the longest.
+	// Runs in linear time, and the triangle winding is kept.
+	static void optimizeVertexCache(std::span<uint32_t> indices, size_t vertexCount)
+	{
+		const uint32_t INVALID = UINT32_MAX;
+		const size_t triangleCount = indices.size() / 3;
+
+		// triangles around each vertex, in a single array indexed by adjacencyOffset
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for(uint32_t index : indices)
+		{
+			++liveTriangles[index];
+		}
+
+		std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+		}
+
+		std::vector<uint32_t> adjacency(indices.size());
+		{
+			std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+			for(size_t i = 0; i < indices.size(); ++i)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEnds; // recently used vertices, to restart from when the fan runs out of candidates
+		std::vector<uint32_t> candidates;
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		uint32_t time = CACHE_SIZE + 1;
+		uint32_t cursor = 0; // vertices before the cursor have no live triangles left
+		uint32_t fanning = vertexCount > 0 ? 0 : INVALID;
+
+		while(fanning != INVALID)
+		{
+			candidates.clear();
+
+			for(uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; ++a)
+			{
+				const uint32_t triangle = adjacency[a];
+				if(emitted[triangle])
+				{
+					continue;
+				}
+
+				for(uint32_t corner = 0; corner < 3; ++corner)
+				{
+					const uint32_t v = indices[3 * triangle + corner];
+					result.push_back(v);
+					deadEnds.push_back(v);
+					candidates.push_back(v);
+					--liveTriangles[v];
+
+					if(time - cacheTime[v] > CACHE_SIZE)
+					{
+						cacheTime[v] = time++;
+					}
+				}
+				emitted[triangle] = true;
+			}
+
+			// next fanning vertex: the oldest candidate that stays in the cache while its remaining triangles are emitted
+			uint32_t next = INVALID;
+			int64_t bestPriority = -1;
+			for(uint32_t v : candidates)
+			{
+				if(liveTriangles[v] == 0)
+				{
+					continue;
+				}
+
+				int64_t priority = 0;
+				if(time - cacheTime[v] + 2 * liveTriangles[v] <= CACHE_SIZE)
+				{
+					priority = time - cacheTime[v];
+				}
+				if(priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = v;
+				}
+			}
+
+			while(next == INVALID && !deadEnds.empty())
+			{
+				const uint32_t v = deadEnds.back();
+				deadEnds.pop_back();
+				if(liveTriangles[v] > 0)
+				{
+					next = v;
+				}
+			}
+
+			while(next == INVALID && cursor < vertexCount)
+			{
+				if(liveTriangles[cursor] > 0)
+				{
+					next = cursor;
+				}
+				++cursor;
+			}
+
+			fanning = next;
+		}
+
+		std::copy(result.begin(), result.end(), indices.begin());
+	}
+
+	// Second half of Tipsify: splits the cache optimized order into clusters, cutting wherever the ACMR of the cluster on its own
+	// is within threshold of the ACMR of the whole mesh, then draws outward facing clusters on the outside of the mesh first
+	// so that they occlude the rest. Larger thresholds give smaller clusters and less overdraw, at the cost of cache efficiency.
+	static void optimizeOverdraw(std::span<uint32_t> indices, std::span<const Vertex> vertices, float threshold)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if(triangleCount == 0)
+		{
+			return;
+		}
+
+		// clusters -------------------------------------------
+
+		const float targetAcmr = threshold * analyzeVertexCache(indices, vertices.size()).acmr;
+
+		std::vector<uint32_t> cacheTime(vertices.size(), 0);
+		uint32_t time = CACHE_SIZE + 1;
+
+		std::vector<size_t> clusterStarts = {0};
+		size_t clusterMisses = 0;
+
+		for(size_t triangle = 0; triangle < triangleCount; ++triangle)
+		{
+			uint32_t misses = 0;
+			for(uint32_t corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t v = indices[3 * triangle + corner];
+				if(time - cacheTime[v] > CACHE_SIZE)
+				{
+					cacheTime[v] = time++;
+					++misses;
+				}
+			}
+
+			// three misses: the optimizer restarted from a dead end here, which is a free cut
+			if(misses == 3 && triangle != clusterStarts.back())
+			{
+				clusterStarts.push_back(triangle);
+				clusterMisses = 0;
+			}
+			clusterMisses += misses;
+
+			const size_t clusterTriangles = triangle + 1 - clusterStarts.back();
+			if(clusterTriangles >= MIN_CLUSTER_TRIANGLES && static_cast<float>(clusterMisses) <= targetAcmr * static_cast<float>(clusterTriangles) && triangle + 1 < triangleCount)
+			{
+				clusterStarts.push_back(triangle + 1);
+				clusterMisses = 0;
+				time += CACHE_SIZE + 1; // the next cluster may be drawn after any other, so it starts with a cold cache
+			}
+		}
+		clusterStarts.push_back(triangleCount);
+
+		// sort clusters -------------------------------------------
+
+		glm::vec3 meshCentroid(0.0f);
+		for(size_t i = 0; i < indices.size(); ++i)
+		{
+			meshCentroid += vertices[indices[i]].pos;
+		}
+		meshCentroid /= static_cast<float>(indices.size());
+
+		const size_t clusterCount = clusterStarts.size() - 1;
+		std::vector<float> sortKeys(clusterCount);
+
+		for(size_t cluster = 0; cluster < clusterCount; ++cluster)
+		{
+			glm::vec3 normal(0.0f); // area weighted
+			glm::vec3 centroid(0.0f);
+			for(size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1]; ++triangle)
+			{
+				const glm::vec3& a = vertices[indices[3 * triangle + 0]].pos;
+				const glm::vec3& b = vertices[indices[3 * triangle + 1]].pos;
+				const glm::vec3& c = vertices[indices[3 * triangle + 2]].pos;
+				normal += glm::cross(b - a, c - a);
+				centroid += (a + b + c) / 3.0f;
+			}
+			centroid /= static_cast<float>(clusterStarts[cluster + 1] - clusterStarts[cluster]);
+
+			const float length = glm::length(normal);
+			sortKeys[cluster] = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+		}
+
+		std::vector<uint32_t> clusterOrder(clusterCount);
+		for(uint32_t i = 0; i < clusterCount; ++i)
+		{
+			clusterOrder[i] = i;
+		}
+		std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for(uint32_t cluster : clusterOrder)
+		{
+			result.insert(result.end(), indices.begin() + 3 * clusterStarts[cluster], indices.begin() + 3 * clusterStarts[cluster + 1]);
+		}
+		std::copy(result.begin(), result.end(), indices.begin());
+	}
+
+	// Renumbers vertices in order of first use so that vertex fetch walks memory forward, dropping vertices no index refers to.
+	static void optimizeVertexFetch(std::span<uint32_t> indices, std::vector<Vertex>& vertices)
+	{
+		std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+
+		for(uint32_t& index : indices)
+		{
+			if(remap[index] == UINT32_MAX)
+			{
+				remap[index] = static_cast<uint32_t>(reordered.size());
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		vertices = std::move(reordered);
+	}
+
+	// Vertex clustering (Rossignac and Borrel): snaps every vertex to a representative vertex of its grid cell and drops the
+	// triangles that collapse. Representatives are existing vertices, the one closest to the average of its cell, so a
+	// simplified index list draws from the same vertex buffer as the full mesh. Appends the result to simplified and returns
+	// the geometric error: how far, in mesh units, any vertex moved. Attribute seams are not preserved, which is fine for the
+	// distances coarse levels are drawn at.
+	static float simplifyClustered(std::span<const uint32_t> indices, std::span<const Vertex> vertices, float cellSize, std::vector<uint32_t>& simplified)
+	{
+		if(indices.empty())
+		{
+			return 0.0f;
+		}
+
+		glm::vec3 boundsMin = vertices[indices[0]].pos;
+		for(uint32_t index : indices)
+		{
+			boundsMin = glm::min(boundsMin, vertices[index].pos);
+		}
+
+		auto cellOf = [&](const glm::vec3& position)
+		{
+			const glm::vec3 cell = glm::floor((position - boundsMin) / cellSize);
+			return (static_cast<uint64_t>(cell.x) << 42) | (static_cast<uint64_t>(cell.y) << 21) | static_cast<uint64_t>(cell.z);
+		};
+
+		// cell averages -------------------------------------------
+
+		struct Cell
+		{
+			glm::vec3 sum{0.0f};
+			uint32_t count = 0;
+			uint32_t representative = UINT32_MAX;
+			float representativeDistance = 0.0f;
+		};
+
+		std::unordered_map<uint64_t, uint32_t> cellIndices;
+		std::vector<Cell> cells;
+		std::vector<uint32_t> vertexCell(vertices.size(), UINT32_MAX);
+
+		for(uint32_t index : indices)
+		{
+			if(vertexCell[index] != UINT32_MAX)
+			{
+				continue;
+			}
+
+			auto [it, inserted] = cellIndices.try_emplace(cellOf(vertices[index].pos), static_cast<uint32_t>(cells.size()));
+			if(inserted)
+			{
+				cells.emplace_back();
+			}
+			vertexCell[index] = it->second;
+			cells[it->second].sum += vertices[index].pos;
+			++cells[it->second].count;
+		}
+
+		// representatives -------------------------------------------
+
+		for(uint32_t v = 0; v < vertices.size(); ++v)
+		{
+			if(vertexCell[v] == UINT32_MAX)
+			{
+				continue;
+			}
+
+			Cell& cell = cells[vertexCell[v]];
+			const float distance = glm::distance(vertices[v].pos, cell.sum / static_cast<float>(cell.count));
+			if(cell.representative == UINT32_MAX || distance < cell.representativeDistance)
+			{
+				cell.representative = v;
+				cell.representativeDistance = distance;
+			}
+		}
+
+		float error = 0.0f;
+		for(uint32_t v = 0; v < vertices.size(); ++v)
+		{
+			if(vertexCell[v] != UINT32_MAX)
+			{
+				error = std::max(error, glm::distance(vertices[v].pos, vertices[cells[vertexCell[v]].representative].pos));
+			}
+		}
+
+		// collapse -------------------------------------------
+
+		for(size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const uint32_t a = cells[vertexCell[indices[i + 0]]].representative;
+			const uint32_t b = cells[vertexCell[indices[i + 1]]].representative;
+			const uint32_t c = cells[vertexCell[indices[i + 2]]].representative;
+			if(a != b && b != c && c != a)
+			{
+				simplified.insert(simplified.end(), {a, b, c});
+			}
+		}
+
+		return error;
+	}
+
+private:
+	static constexpr size_t MIN_CLUSTER_TRIANGLES = 32; // smaller clusters would not be worth sorting
+};
+
+// Values of the specialization constants of shaders/uber.vert and shaders/uber.frag.
+// Every member is 32 bits wide and sits at the offset getSpecializationMapEntries reports for its constant_id,
+// so the struct itself is the pData of VkSpecializationInfo.
+struct ShaderVariant
+{
+	int32_t objectDataPath = 0; // constant_id = 0, value of ObjectDataPath
+	VkBool32 vertexColor = VK_TRUE; // constant_id = 1
+	VkBool32 texture = VK_TRUE; // constant_id = 2
+
+	bool operator==(const ShaderVariant& other) const = default;
+
+	static std::array<VkSpecializationMapEntry, 3> getSpecializationMapEntries()
+	{
+		std::array<VkSpecializationMapEntry, 3> entries{};
+
+		// constantID must match layout(constant_id) used in the shaders
+		entries[0].constantID = 0;
+		entries[0].offset = offsetof(ShaderVariant, objectDataPath);
+		entries[0].size = sizeof(objectDataPath);
+
+		entries[1].constantID = 1;
+		entries[1].offset = offsetof(ShaderVariant, vertexColor);
+		entries[1].size = sizeof(vertexColor);
+
+		entries[2].constantID = 2;
+		entries[2].offset = offsetof(ShaderVariant, texture);
+		entries[2].size = sizeof(texture);
+
+		return entries;
+	}
+};
+
+// Every piece of state that makes two graphics pipelines different.
+// Two requests with equal keys get the same VkPipeline, so each state combination is only compiled once.
+struct PipelineKey
+{
+	std::string vertexShader;
+	std::string fragmentShader;
+	ShaderVariant variant; // shared by both stages, each stage only reads the constants it declares
+	VertexFormat vertexFormat;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkBool32 depthTest = VK_TRUE;
+	VkBool32 depthWrite = VK_TRUE;
+	VkBool32 blend = VK_FALSE;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE; // VK_NULL_HANDLE with dynamic rendering, the pipeline is then created against the formats below
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+
+	bool operator==(const PipelineKey& other) const = default;
+};
+
+namespace std
+{
+	template<> struct hash<PipelineKey>
+	{
+		size_t operator()(PipelineKey const& key) const
+		{
+			size_t seed = 0;
+			auto combine = [&seed](size_t value) { seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2); };
+
+			combine(hash<string>()(key.vertexShader));
+			combine(hash<string>()(key.fragmentShader));
+			combine(hash<int32_t>()(key.variant.objectDataPath));
+			combine(hash<uint32_t>()(key.variant.vertexColor));
+			combine(hash<uint32_t>()(key.variant.texture));
+			combine(hash<uint32_t>()(static_cast<uint32_t>(key.vertexFormat.position)));
+			combine(hash<uint32_t>()(static_cast<uint32_t>(key.vertexFormat.texCoord)));
+			combine(hash<uint32_t>()(key.vertexFormat.color));
+			combine(hash<uint32_t>()(key.vertexFormat.splitPositions));
+			combine(hash<uint32_t>()(key.topology));
+			combine(hash<uint32_t>()(key.polygonMode));
+			combine(hash<uint32_t>()(key.cullMode));
+			combine(hash<uint32_t>()(key.depthTest));
+			combine(hash<uint32_t>()(key.depthWrite));
+			combine(hash<uint32_t>()(key.blend));
+			combine(hash<void*>()(key.layout));
+			combine(hash<void*>()(key.renderPass));
+			combine(hash<uint32_t>()(key.colorFormat));
+			combine(hash<uint32_t>()(key.depthFormat));
+			return seed;
+		}
+	};
+}
+
+// Compiles pipelines on background threads, so that the first sight of a new material does not stall a frame.
+// vkCreateGraphicsPipelines may be called from any thread, and the pipeline cache synchronizes itself unless created with
+// VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT, so the compile function needs no locking of its own.
+// A pipeline that fails to compile resolves to VK_NULL_HANDLE and the caller keeps using its fallback.
+class PipelineCompiler
+{
+public:
+	using CompileFunction = std::function<VkPipeline(const PipelineKey&)>;
+
+	void init(uint32_t threadCount, CompileFunction compile)
+	{
+		_compile = std::move(compile);
+		_stop = false;
+		for(uint32_t i = 0; i < std::max(threadCount, 1u); ++i)
+		{
+			_threads.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	// Compiles still in flight are finished, queued ones are dropped and resolve to VK_NULL_HANDLE.
+	void destroy()
+	{
+		{
+			std::lock_guard lock(_mutex);
+			_stop = true;
+			for(auto& job : _queue)
+			{
+				job.promise.set_value(VK_NULL_HANDLE);
+			}
+			_queue.clear();
+		}
+		_wakeCondition.notify_all();
+
+		for(auto& thread : _threads)
+		{
+			thread.join();
+		}
+		_threads.clear();
+	}
+
+	// Queues key for compilation and returns immediately. Poll the result with isReady.
+	std::shared_future<VkPipeline> compile(const PipelineKey& key)
+	{
+		Job job;
+		job.key = key;
+		std::shared_future<VkPipeline> result = job.promise.get_future().share();
+		{
+			std::lock_guard lock(_mutex);
+			_queue.push_back(std::move(job));
+		}
+		_wakeCondition.notify_one();
+		return result;
+	}
+
+	// Blocks until every queued compile has finished, e.g. before destroying the render pass the pipelines were compiled against.
+	void waitIdle()
+	{
+		std::unique_lock lock(_mutex);
+		_idleCondition.wait(lock, [this] { return _queue.empty() && _activeJobs == 0; });
+	}
+
+	static bool isReady(const std::shared_future<VkPipeline>& pipeline)
+	{
+		return pipeline.valid() && pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+private:
+	struct Job
+	{
+		PipelineKey key;
+		std::promise<VkPipeline> promise;
+	};
+
+	void workerLoop()
+	{
+		while(true)
+		{
+			Job job;
+			{
+				std::unique_lock lock(_mutex);
+				_wakeCondition.wait(lock, [this] { return _stop || !_queue.empty(); });
+				if(_stop)
+				{
+					return;
+				}
+				job = std::move(_queue.front());
+				_queue.pop_front();
+				++_activeJobs;
+			}
+
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			try
+			{
+				pipeline = _compile(job.key);
+			}
+			catch(const std::exception& e)
+			{
+				printf("pipeline compiler: %s\n", e.what());
+			}
+			job.promise.set_value(pipeline);
+
+			{
+				std::lock_guard lock(_mutex);
+				--_activeJobs;
+			}
+			_idleCondition.notify_all();
+		}
+	}
+
+	CompileFunction _compile;
+	std::vector<std::thread> _threads;
+
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _idleCondition;
+	std::deque<Job> _queue;
+	uint32_t _activeJobs = 0;
+	bool _stop = false;
+};
+
+// Command line options, see printUsage.
+struct AppSettings
+{
+	bool benchmark = false; // fixed timestep and scripted camera, warmupFrames then measuredFrames frames, then the report is written to reportPath
+	bool headless = false; // render to offscreen images: no window, surface or swapchain, implies benchmark
+	uint32_t width = 800;
+	uint32_t height = 600;
+	uint32_t sceneGridSize = 1; // objects per side, raise to stress the per-object paths
+	uint32_t warmupFrames = 200;
+	uint32_t measuredFrames = 1000;
+	std::string reportPath = "benchmark_report.json";
+
+	// latency against power: FIFO and a low paceFrames for the least power, MAILBOX or IMMEDIATE with one frame in flight and paceFrames 1 for the least latency
+	static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR; // falls back to FIFO when not supported, F1 cycles through the supported modes
+	uint32_t framesInFlight = 2; // frames the CPU may record ahead of the GPU, up to MAX_FRAMES_IN_FLIGHT
+	uint32_t paceFrames = 0; // with VK_KHR_present_wait, frame f does not start before frame f - paceFrames is on screen, 0 to disable
+
+	std::string device; // overrides the device scoring: index, UUID or part of the name, see matchesDeviceOverride
+	bool deviceGroup = false; // alternate frames between the GPUs of the chosen device's group, headless only
+	bool renderPasses = false; // keep the render pass and framebuffer objects even when VK_KHR_dynamic_rendering is supported
+};
+
+const char* getPresentModeName(VkPresentModeKHR presentMode)
+{
+	switch(presentMode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+	default: return "unknown";
+	}
+}
+
+void printUsage()
+{
+	puts("usage: vulkan_tutorial [options]");
+	puts("  --benchmark        fixed timestep and scripted camera, writes a report after the measured frames");
+	puts("  --headless         benchmark without a window, rendering to offscreen images");
+	puts("  --width N          window or offscreen image width (default 800)");
+	puts("  --height N         window or offscreen image height (default 600)");
+	puts("  --grid N           N x N copies of the model (default 1)");
+	puts("  --warmup N         benchmark frames run before measuring (default 200)");
+	puts("  --frames N         benchmark frames measured (default 1000)");
+	puts("  --report PATH      benchmark report path (default benchmark_report.json)");
+	puts("  --present-mode M   fifo, fifo-relaxed, mailbox or immediate (default mailbox, F1 cycles at runtime)");
+	puts("  --frames-in-flight N  1 to 3 (default 2)");
+	puts("  --pace N           start frame f once frame f - N is on screen, needs VK_KHR_present_wait (default: off)");
+	puts("  --device D         use the device with index D, UUID D or D in its name instead of the best scored one");
+	puts("  --device-group     alternate frames between the GPUs of the device group, headless only");
+	puts("  --render-passes    use render pass and framebuffer objects even where VK_KHR_dynamic_rendering is supported");
+}
+
+bool parseCommandLine(int argc, char** argv, AppSettings& settings)
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string_view option = argv[i];
+
+		auto readCount = [&](uint32_t& value)
+		{
+			if(i + 1 >= argc)
+			{
+				return false;
+			}
+			char* end = nullptr;
+			const unsigned long count = strtoul(argv[++i], &end, 10);
+			if(end == argv[i] || *end != '\0' || count == 0 || count > UINT32_MAX)
+			{
+				return false;
+			}
+			value = static_cast<uint32_t>(count);
+			return true;
+		};
+
+		if(option == "--benchmark")
+		{
+			settings.benchmark = true;
+		}
+		else if(option == "--headless")
+		{
+			settings.headless = true;
+			settings.benchmark = true;
+		}
+		else if(option == "--width")
+		{
+			if(!readCount(settings.width)) return false;
+		}
+		else if(option == "--height")
+		{
+			if(!readCount(settings.height)) return false;
+		}
+		else if(option == "--grid")
+		{
+			if(!readCount(settings.sceneGridSize)) return false;
+		}
+		else if(option == "--warmup")
+		{
+			if(!readCount(settings.warmupFrames)) return false;
+		}
+		else if(option == "--frames")
+		{
+			if(!readCount(settings.measuredFrames)) return false;
+		}
+		else if(option == "--report" && i + 1 < argc)
+		{
+			settings.reportPath = argv[++i];
+		}
+		else if(option == "--present-mode" && i + 1 < argc)
+		{
+			const std::string_view name = argv[++i];
+			const VkPresentModeKHR modes[] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+			const auto mode = std::find_if(std::begin(modes), std::end(modes), [&](VkPresentModeKHR mode) { return name == getPresentModeName(mode); });
+			if(mode == std::end(modes)) return false;
+			settings.presentMode = *mode;
+		}
+		else if(option == "--frames-in-flight")
+		{
+			if(!readCount(settings.framesInFlight) || settings.framesInFlight > AppSettings::MAX_FRAMES_IN_FLIGHT) return false;
+		}
+		else if(option == "--device" && i + 1 < argc)
+		{
+			settings.device = argv[++i];
+		}
+		else if(option == "--device-group")
+		{
+			settings.deviceGroup = true;
+		}
+		else if(option == "--render-passes")
+		{
+			settings.renderPasses = true;
+		}
+		else if(option == "--pace")
+		{
+			if(!readCount(settings.paceFrames)) return false;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+class HelloTriangleApplication
+{
+public:
+	void run(const AppSettings& settings)
+	{
+		_settings = settings;
+		_framesInFlight = settings.framesInFlight;
+		_presentMode = settings.presentMode;
+
+		initWindow();
+		initVulkan();
+		mainLoop();
+		cleanup();
+	}
+
+private:
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->_windowResized = true;
+	}
+
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		if(key == GLFW_KEY_F1 && action == GLFW_PRESS)
+		{
+			app->cyclePresentMode();
+		}
+		else if(key == GLFW_KEY_F2 && action == GLFW_PRESS)
+		{
+			app->printMemoryReport(stdout);
+		}
+	}
+
+	bool isHeadless() const
+	{
+		return _settings.headless;
+	}
+
+	void initWindow()
+	{
+		if(isHeadless())
+		{
+			// nothing to present to, so neither the surface nor the swapchain extensions are needed
+			std::erase_if(_requiredDeviceExtensions, [](const char* extension) { return strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; });
+			std::erase_if(_optionalDeviceExtensions, [](const char* extension)
+			{
+				return strcmp(extension, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0 || strcmp(extension, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0;
+			});
+			return;
+		}
+
+		glfwInit();
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		_window = glfwCreateWindow(static_cast<int>(_settings.width), static_cast<int>(_settings.height), "Vulkan Tutorial", nullptr, nullptr);
+		
+		glfwSetWindowUserPointer(_window, this);
+		glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+		glfwSetKeyCallback(_window, keyCallback);
+
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensionNames = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		_requiredInstanceExtensions.insert(_requiredInstanceExtensions.end(), glfwExtensionNames, glfwExtensionNames + glfwExtensionCount);
+	}
+
+	// Everything after choosing the physical device runs as a task graph: the model and the texture are read and decoded while the device,
+	// the swapchain and the pipelines are created, and each stage starts as soon as the ones it reads from are done.
+	void initVulkan() {
+		const auto start = std::chrono::high_resolution_clock::now();
+		createInstance();
+		createDebugMessenger();
+		createSurface();
+		choosePhysicalDevice();
+		const double instanceTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// before any stage runs: the model import already runs jobs on the pool on a mesh cache miss
+		createJobSystem();
+
+		TaskGraph graph;
+		const bool mainThread = true;
+
+		// CPU only, nothing to wait for
+		const auto model = graph.add("model", !mainThread, {}, [this] { loadModel(); });
+		const auto textureDecode = graph.add("texture decode", !mainThread, {}, [this] { loadTexture(); });
+
+		const auto device = graph.add("device", mainThread, {}, [this]
+		{
+			createLogicalDevice();
+			createAllocator();
+			createUploadEngine();
+			createProfiler();
+		});
+
+		// glfwGetFramebufferSize may only be called from the main thread
+		const auto swapChain = graph.add("swapchain", mainThread, {device}, [this]
+		{
+			createSwapChain();
+			createSwapChainImageViews();
+			createRenderPass();
+			createRenderGraph();
+			createFramebuffers();
+		});
+
+		const auto layouts = graph.add("layouts", !mainThread, {device}, [this]
+		{
+			createDescriptorSetLayout();
+			createBindlessTextures();
+			createGraphicsPipelineLayout();
+			createPipelineCache();
+			createPipelineCompiler();
+		});
+
+		const auto cullPipelines = graph.add("cull pipelines", !mainThread, {layouts}, [this] { createCullPipelines(); });
+		const auto graphicsPipeline = graph.add("graphics pipeline", !mainThread, {layouts, swapChain}, [this] { createFallbackPipeline(); });
+		const auto depthPyramid = graph.add("depth pyramid", !mainThread, {swapChain, cullPipelines}, [this] { createDepthPyramid(); });
+
+		const auto commandPools = graph.add("command pools", !mainThread, {device}, [this] { createCommandPools(); });
+
+		// everything recorded into the upload engine stays on the main thread
+		const auto textureUpload = graph.add("texture upload", mainThread, {textureDecode, layouts}, [this]
+		{
+			createTextureImage();
+			createTextureImageView();
+			createTextureSampler();
+			registerTextures();
+		});
+
+		const auto geometry = graph.add("geometry upload", mainThread, {model, device}, [this]
+		{
+			createVertexBuffer();
+			createIndexBuffer();
+			releaseModelData();
+		});
+
+		const auto scene = graph.add("materials and scene", !mainThread, {textureUpload, graphicsPipeline, model}, [this]
+		{
+			createMaterials();
+			createScene();
+		});
+
+		graph.add("frame resources", mainThread, {scene, geometry, depthPyramid, commandPools}, [this]
+		{
+			createUniformBuffers();
+			createIndirectBuffers();
+			createDescriptorPool();
+			createDescriptorSets();
+			createSyncObjects();
+		});
+		// TODO: maybe should create buffers before descriptor set layout and pool so that we can then create the graphics pipeline with every information we need
+
+		const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 2u, MAX_STARTUP_THREADS + 1) - 1;
+		graph.run(threadCount);
+
+		_loadStages.clear();
+		_loadStages.push_back({"instance", 0.0, instanceTime, true});
+		for(TaskGraph::Timing timing : graph.getTimings())
+		{
+			timing.start += instanceTime;
+			timing.end += instanceTime;
+			_loadStages.push_back(timing);
+		}
+		_loadTime = instanceTime + graph.getTotalTime();
+
+		for(const TaskGraph::Timing& stage : _loadStages)
+		{
+			printf("startup: %-20s %8.2f -> %8.2f ms (%.2f ms)%s\n", stage.name, stage.start, stage.end, stage.end - stage.start, stage.mainThread ? ", main thread" : "");
+		}
+		printf("startup: %.2f ms on %u threads\n", _loadTime, threadCount + 1);
+		putc('\n', stdout);
+	}
+
+	void mainLoop()
+	{
+		if(_settings.benchmark)
+		{
+			runBenchmark();
+			return;
+		}
+
+		while(!glfwWindowShouldClose(_window))
+		{
+			drawFrame(); // polls the events itself, as late as possible
+		}
+		vkDeviceWaitIdle(_device);
+	}
+
+	// The warmup frames fill the pipeline cache, the staging ring and the driver caches, only the measured frames end up in the report.
+	void runBenchmark()
+	{
+		printf("benchmark: %u warmup frames, %u measured frames, %ux%u%s, %zu objects\n", _settings.warmupFrames, _settings.measuredFrames,
+			_swapChainExtent.width, _swapChainExtent.height, isHeadless() ? " offscreen" : "", _objects.size());
+		putc('\n', stdout);
+
+		const uint64_t totalFrames = uint64_t(_settings.warmupFrames) + _settings.measuredFrames;
+		for(uint64_t frame = 0; frame < totalFrames; ++frame)
+		{
+			if(frame == _settings.warmupFrames)
+			{
+				_profiler.clearHistory();
+			}
+
+			if(!isHeadless() && glfwWindowShouldClose(_window))
+			{
+				break;
+			}
+			drawFrame();
+		}
+		vkDeviceWaitIdle(_device);
+
+		// the queries of the last frames in flight are only read back when their slot comes around again
+		for(uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			_profiler.collect(i);
+		}
+
+		if(!writeBenchmarkReport(_settings.reportPath))
+		{
+			throw std::runtime_error("failed to write benchmark report: " + _settings.reportPath);
+		}
+		printf("benchmark: report written to %s\n", _settings.reportPath.c_str());
+		putc('\n', stdout);
+	}
+
+	// JSON, so that runs can be compared and regressions gated by a script. Times in milliseconds, memory in bytes.
+	bool writeBenchmarkReport(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if(!file)
+		{
+			return false;
+		}
+
+		char line[512] = {};
+		auto writePercentiles = [&](const char* indent, const std::string& name, const Profiler::Percentiles& percentiles, bool last)
+		{
+			snprintf(line, sizeof(line), "%s\"%s\": {\"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f, \"count\": %zu}%s\n",
+				indent, name.c_str(), percentiles.p50, percentiles.p99, percentiles.max, percentiles.mean, percentiles.count, last ? "" : ",");
+			file << line;
+		};
+		auto writeScopes = [&](const char* key, bool gpu)
+		{
+			const std::vector<std::string> names = _profiler.getEventNames(gpu);
+			file << "  \"" << key << "\": {\n";
+			for(size_t i = 0; i < names.size(); ++i)
+			{
+				writePercentiles("    ", names[i], _profiler.getPercentiles(names[i], gpu), i + 1 == names.size());
+			}
+			file << "  },\n";
+		};
+
+		file << "{\n";
+		snprintf(line, sizeof(line), "  \"device\": \"%s\",\n  \"driverVersion\": %u,\n  \"apiVersion\": \"%u.%u.%u\",\n", _physicalDeviceProperties.deviceName, _physicalDeviceProperties.driverVersion,
+			VK_API_VERSION_MAJOR(_physicalDeviceProperties.apiVersion), VK_API_VERSION_MINOR(_physicalDeviceProperties.apiVersion), VK_API_VERSION_PATCH(_physicalDeviceProperties.apiVersion));
+		file << line;
+		snprintf(line, sizeof(line), "  \"headless\": %s,\n  \"width\": %u,\n  \"height\": %u,\n  \"objects\": %zu,\n  \"objectDataPath\": %d,\n  \"timestep\": %.6f,\n  \"warmupFrames\": %u,\n  \"measuredFrames\": %zu,\n",
+			isHeadless() ? "true" : "false", _swapChainExtent.width, _swapChainExtent.height, _objects.size(), static_cast<int>(_objectDataPath), BENCHMARK_TIMESTEP,
+			_settings.warmupFrames, _profiler.getFrameCount());
+		file << line;
+		snprintf(line, sizeof(line), "  \"presentMode\": \"%s\",\n  \"framesInFlight\": %u,\n  \"paceFrames\": %u,\n  \"presentWait\": %s,\n",
+			isHeadless() ? "none" : getPresentModeName(_swapChainPresentMode), _framesInFlight, _settings.paceFrames, _presentWaitEnabled ? "true" : "false");
+		file << line;
+		snprintf(line, sizeof(line), "  \"deviceGroupSize\": %zu,\n  \"dynamicRendering\": %s,\n", _deviceGroup.size(), _dynamicRenderingEnabled ? "true" : "false");
+		file << line;
+
+		writePercentiles("  ", "cpuFrameTime", _profiler.getPercentiles("frame", false), false);
+		writePercentiles("  ", "latency", _profiler.getPercentiles(getLatencyEventName(), false), false);
+		writePercentiles("  ", "gpuFrameTime", _profiler.getPercentiles("frame", true), false);
+		writeScopes("cpuScopes", false);
+		writeScopes("gpuScopes", true);
+
+		// the stages overlap, so loadTotal is the wall time and not their sum
+		file << "  \"loadStages\": {\n";
+		for(size_t i = 0; i < _loadStages.size(); ++i)
+		{
+			snprintf(line, sizeof(line), "    \"%s\": {\"start\": %.3f, \"end\": %.3f}%s\n", _loadStages[i].name, _loadStages[i].start, _loadStages[i].end, i + 1 == _loadStages.size() ? "" : ",");
+			file << line;
+		}
+		snprintf(line, sizeof(line), "  },\n  \"loadTotal\": %.3f,\n", _loadTime);
+		file << line;
+
+		_allocator.updateBudget();
+		const VkPhysicalDeviceMemoryProperties& memoryProperties = _allocator.getMemoryProperties();
+		file << "  \"memoryHeaps\": [\n";
+		for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		{
+			const MemoryAllocator::HeapPeaks peaks = _allocator.getHeapPeaks(i);
+			snprintf(line, sizeof(line), "    {\"deviceLocal\": %s, \"size\": %llu, \"budget\": %llu, \"usage\": %llu, \"allocated\": %llu, \"peak\": %llu}%s\n",
+				(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false",
+				static_cast<unsigned long long>(memoryProperties.memoryHeaps[i].size), static_cast<unsigned long long>(_allocator.getHeapBudget(i)),
+				static_cast<unsigned long long>(_allocator.getHeapUsage(i)), static_cast<unsigned long long>(peaks.live), static_cast<unsigned long long>(peaks.peak),
+				i + 1 == memoryProperties.memoryHeapCount ? "" : ",");
+			file << line;
+		}
+		file << "  ]\n}\n";
+
+		return static_cast<bool>(file);
+	}
+
+	void cleanup()
+	{
+		unregisterTextures();
+		runDeferredDeletions(UINT64_MAX);
+		printMemoryReport(stdout);
+		cleanupSwapChain();
+		destroyPipelines();
+		_pipelineCompiler.destroy();
+		destroyCullPipelines();
+		destroyPipelineCache();
+		vkDestroyPipelineLayout(_device, _graphicsPipelineLayout, nullptr);
+		destroyRenderPass();
+		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+		destroyUniformBuffers();
+		destroyIndirectBuffers();
+		destroySyncObjects();
+		destroyIndexBuffer();
+		destroyVertexBuffer();
+		vkDestroySampler(_device, _textureSampler, nullptr);
+		vkDestroyImageView(_device, _textureImageView, nullptr);
+		destroyTextureImage();
+		destroyCommandPools();
+		_threadPool.destroy();
+		vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
+		destroyBindlessTextures();
+		destroyUploadEngine();
+		destroyProfiler();
+		_allocator.destroy();
+		vkDestroyDevice(_device, nullptr);
+		if(_surface != VK_NULL_HANDLE)
+		{
+			vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		}
+		destroyDebugMessenger();
+		vkDestroyInstance(_instance, nullptr);
+		if(_window != nullptr)
+		{
+			glfwDestroyWindow(_window);
+			glfwTerminate();
+		}
+	}
+
+	// VULKAN STUFF ------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+	struct QueueFamilies
+	{
+		std::vector<VkQueueFamilyProperties> properties;
+		std::vector<VkBool32> supportsPresentation;
+		std::optional<uint32_t> graphics;
+		std::optional<uint32_t> present;
+		std::optional<uint32_t> transfer; // dedicated transfer family if the device has one, otherwise the graphics family
+		std::optional<uint32_t> compute; // compute family without graphics if the device has one, otherwise the graphics family
+	};
+
+	struct SwapChainInfo
+	{
+		VkSurfaceCapabilitiesKHR capabilities;
+		std::vector<VkSurfaceFormatKHR> formats;
+		std::vector<VkPresentModeKHR> presentModes;
+	};
+
+	// A device that passed all the checks of choosePhysicalDevice, see scorePhysicalDevice.
+	struct DeviceCandidate
+	{
+		uint32_t index = 0; // in vkEnumeratePhysicalDevices order
+		VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+		QueueFamilies families;
+		SwapChainInfo swapChainInfo;
+		VkPhysicalDeviceProperties properties{};
+		std::vector<VkExtensionProperties> extensions;
+		std::string uuid; // deviceUUID in hex, stable across runs and driver updates unlike the index
+		int64_t score = 0;
+	};
+
+	// Command pools are not thread safe: every worker records into its own pool, and every frame in flight has its own set,
+	// so a pool is only reset once the GPU is done with the frame that used it.
+	struct WorkerCommands
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> secondaries; // allocated on demand, reused every frame after the pool reset
+		uint32_t usedSecondaries = 0;
+	};
+
+	struct FrameCommands
+	{
+		std::vector<WorkerCommands> workers; // one per job system worker
+		VkCommandBuffer primary = VK_NULL_HANDLE; // allocated from the pool of worker 0, the main thread
+		VkCommandPool computePool = VK_NULL_HANDLE; // async compute only, on the compute family
+		VkCommandBuffer compute = VK_NULL_HANDLE; // the early cull phase, submitted to _computeQueue ahead of primary
+	};
+
+	struct DrawCommand
+	{
+		uint32_t indexCount = 0;
+		uint32_t firstIndex = 0;
+		int32_t vertexOffset = 0;
+		float lodError = 0.0f; // how far, in mesh units, the surface of this level may be from the full mesh; 0 for LOD 0
+	};
+
+	// A model with its LOD chain, _drawCommands[firstLod + i] is LOD i, from the full mesh down to the coarsest.
+	// Every level indexes the same vertices, only the index ranges differ.
+	struct Mesh
+	{
+		uint32_t firstLod = 0;
+		uint32_t lodCount = 1;
+		glm::vec3 boundsCenter{0.0f}; // bounding sphere in mesh units, before quantization
+		float boundsRadius = 0.0f;
+	};
+
+	// Layout of MESH_CACHE_PATH: this header, then the vertex, index and draw command sections, each starting at a multiple of MESH_SECTION_ALIGNMENT.
+	// Sections are stored exactly as they are uploaded, so loading is a mapping plus a copy into the staging ring.
+	struct MeshFileHeader
+	{
+		uint32_t magic = 0;
+		uint32_t version = 0;
+		uint64_t sourceSize = 0; // size and modification time of the OBJ the cache was built from, to detect a stale cache
+		int64_t sourceTime = 0;
+		VertexFormat vertexFormat;
+		float positionScale[3] = {};
+		float positionBias[3] = {};
+		uint32_t drawCount = 0;
+		uint64_t vertexCount = 0;
+		uint64_t vertexSize = 0; // the vertex section holds the stream of positions, then the attribute stream at attributeStreamOffset
+		uint64_t attributeStreamOffset = 0;
+		uint64_t indexCount = 0;
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+		MeshOptimization meshOptimization = MeshOptimization::None;
+		uint64_t vertexOffset = 0;
+		uint64_t indexOffset = 0;
+		uint64_t drawOffset = 0;
+		uint32_t meshCount = 0;
+		uint64_t meshOffset = 0;
+	};
+
+	// KTX2 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html): this header, then one Ktx2Level per mip level, level 0 first.
+	// Only the level index is read, the data format descriptor and key/value data are not needed to upload the levels as they are.
+	struct Ktx2Header
+	{
+		uint8_t identifier[12] = {};
+		uint32_t vkFormat = 0;
+		uint32_t typeSize = 0;
+		uint32_t pixelWidth = 0;
+		uint32_t pixelHeight = 0;
+		uint32_t pixelDepth = 0;
+		uint32_t layerCount = 0;
+		uint32_t faceCount = 0;
+		uint32_t levelCount = 0; // 0 asks the loader to generate the mips, which is not possible for block compressed formats
+		uint32_t supercompressionScheme = 0;
+		uint32_t dfdByteOffset = 0;
+		uint32_t dfdByteLength = 0;
+		uint32_t kvdByteOffset = 0;
+		uint32_t kvdByteLength = 0;
+		uint64_t sgdByteOffset = 0;
+		uint64_t sgdByteLength = 0;
+	};
+	static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the file layout");
+
+	struct Ktx2Level
+	{
+		uint64_t byteOffset = 0;
+		uint64_t byteLength = 0;
+		uint64_t uncompressedByteLength = 0;
+	};
+
+	// RGBA8 pixels of TEXTURE_PATH, decoded by stb_image off the main thread
+	struct DecodedImage
+	{
+		std::unique_ptr<stbi_uc, void(*)(void*)> pixels{nullptr, stbi_image_free};
+		int width = 0;
+		int height = 0;
+	};
+
+	// set 0, binding 0: shared by every draw of a frame
+	struct FrameUniforms
+	{
+		glm::mat4 view;
+		glm::mat4 proj;
+	};
+
+	// set 0, binding 2 (dynamic offset) or push constants, depending on _objectDataPath
+	struct ObjectUniforms
+	{
+		glm::mat4 model;
+	};
+
+	// fragment stage push constants, right after the model matrix of the vertex stage, pushed whenever the material changes
+	struct MaterialPushConstants
+	{
+		glm::vec4 baseColor{1.0f}; // multiplies the vertex color, and the texture when there is one
+		uint32_t texture = 0; // index into the bindless texture array of set 1
+	};
+	static constexpr uint32_t MATERIAL_PUSH_CONSTANTS_OFFSET = sizeof(ObjectUniforms);
+
+	enum class ObjectDataPath : int32_t
+	{
+		PushConstants = 0, // vkCmdPushConstants per draw, no memory traffic at all, limited to maxPushConstantsSize (at least 128 bytes)
+		DynamicUniformBuffer = 1, // one persistently mapped ring per frame, one descriptor set for all objects, rebound with a new dynamic offset per draw
+		GpuDriven = 2, // GpuObject storage buffer culled by cull.comp into indirect draws, one vkCmdDrawIndexedIndirectCount per material
+		Instanced = 3 // GpuObject storage buffer sorted into DrawBatch ranges on the CPU, one instanced vkCmdDrawIndexed per batch
+	};
+
+	// set 0, binding 3 of the graphics layout and binding 0 of the cull layout, std430, must match cull.comp and uber.vert
+	struct GpuObject
+	{
+		glm::mat4 model; // including the dequantization
+		glm::vec4 bounds; // bounding sphere in quantized units, so model moves the center; the radius is in world units since the rest of model is rigid
+		uint32_t indexCount = 0; // the selected LOD
+		uint32_t firstIndex = 0;
+		int32_t vertexOffset = 0;
+		uint32_t material = 0;
+	};
+	static_assert(sizeof(GpuObject) == 96);
+
+	// cull.comp runs once before each of the two passes of a frame, see createRenderGraph
+	enum class CullPhase : uint32_t
+	{
+		Early = 0, // objects visible last frame, drawn into the depth the pyramid is built from
+		Late = 1 // objects that pass the occlusion test against that pyramid and were not drawn early
+	};
+	static constexpr uint32_t CULL_PHASE_COUNT = 2; // each phase has its own draw lists
+
+	// must match layout(push_constant) in cull.comp
+	struct CullPushConstants
+	{
+		glm::vec4 frustumPlanes[6]; // world space, normalized, pointing inwards
+		glm::vec2 viewportSize{0.0f};
+		uint32_t objectCount = 0;
+		uint32_t maxDrawsPerMaterial = 0;
+		uint32_t materialCount = 0;
+		CullPhase phase = CullPhase::Early;
+	};
+	static_assert(sizeof(CullPushConstants) <= 128); // the minimum maxPushConstantsSize
+
+	// what the passes of _renderGraph access
+	struct GraphResources
+	{
+		RenderGraph::ResourceId color = 0; // swapchain image, or offscreen image when headless
+		RenderGraph::ResourceId depth = 0;
+		RenderGraph::ResourceId depthPyramid = 0; // GPU driven path only, from here on
+		RenderGraph::ResourceId draws = 0;
+		RenderGraph::ResourceId drawCounts = 0;
+		RenderGraph::ResourceId visibility = 0;
+	};
+
+	// Max depth pyramid for the occlusion test, see createDepthPyramid.
+	struct DepthPyramid
+	{
+		VkImage image = VK_NULL_HANDLE;
+		Allocation memory;
+		VkImageView view = VK_NULL_HANDLE; // all levels, sampled by cull.comp
+		std::vector<VkImageView> mipViews; // one per level, written by depth_reduce.comp
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t levels = 0;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE; // only holds the sets below, so they are recreated with the pyramid
+		std::vector<VkDescriptorSet> reduceSets; // one per level
+		VkDescriptorSet cullSet = VK_NULL_HANDLE; // set 1 of the cull pipeline layout
+	};
+
+	// must match layout(push_constant) in depth_reduce.comp
+	struct DepthReducePushConstants
+	{
+		glm::ivec2 sourceSize;
+		glm::ivec2 destinationSize;
+	};
+
+	struct SceneObject
+	{
+		glm::mat4 model{1.0f}; // world matrix of node, including the dequantization
+		uint32_t node = 0; // index into _sceneTransforms
+		uint32_t mesh = 0; // index into _meshes
+		uint32_t drawCommand = 0; // index into _drawCommands, the LOD of mesh selected for the current frame
+		uint32_t material = 0; // index into _materials
+	};
+
+	// An object that survived the CPU frustum culling, see makeDrawKey for the order of the draw list.
+	struct DrawItem
+	{
+		uint64_t key = 0;
+		uint32_t object = 0; // index into _objects, also breaks ties so the order never depends on the job split
+
+		bool operator<(const DrawItem& other) const
+		{
+			return std::tie(key, object) < std::tie(other.key, other.object);
+		}
+	};
+
+	// Objects sharing an LOD of a mesh and a material, drawn as the instances [firstInstance, firstInstance + instanceCount) of the GpuObject storage buffer.
+	struct DrawBatch
+	{
+		uint32_t drawCommand = 0; // index into _drawCommands
+		uint32_t material = 0;
+		uint32_t firstInstance = 0;
+		uint32_t instanceCount = 0;
+	};
+
+	struct Material
+	{
+		PipelineKey key;
+		std::shared_future<VkPipeline> pipeline; // may still be compiling, see resolveMaterialPipelines
+		uint32_t texture = 0; // slot in the bindless texture array, see registerTexture
+		glm::vec4 baseColor{1.0f};
+	};
+
+	void checkRequiredInstanceExtensions()
+	{
+		uint32_t extensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+		std::unordered_set<std::string_view> availableExtensions;
+		for(const auto& e : extensions)
+		{
+			availableExtensions.emplace(e.extensionName);
+		}
+
+		puts("available instance extensions:");
+		for(const auto& extension : extensions)
+		{
+			puts(extension.extensionName);
+		}
+		putc('\n', stdout);
+
+		puts("enabling the following instance extensions:");
+		for(auto extension : _requiredInstanceExtensions)
+		{
+			if(!availableExtensions.contains(extension))
+			{
+				throw std::runtime_error("required instance extension not found: " + std::string{extension});
+			}
+			puts(extension);
+		}
+		putc('\n', stdout);
+	}
+
+	void checkRequiredValidationLayers()
+	{
+		uint32_t layerCount = 0;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+		std::vector<VkLayerProperties> layers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+		std::unordered_set<std::string_view> availableLayers;
+
+		puts("available validation layers:");
+		for(const auto& layer : layers)
+		{
+			availableLayers.emplace(layer.layerName);
+			puts(layer.layerName);
+		}
+		putc('\n', stdout);
+
+		if constexpr(_enableValidationLayers)
+		{
+			puts("enabling the following validation layers:");
+			for(auto layer : _requiredValidationLayers)
+			{
+				if(!availableLayers.contains(layer))
+				{
+					throw std::runtime_error("required validation layer not found: " + std::string{layer});
+				}
+				puts(layer);
+			}
+			putc('\n', stdout);
+		}
+	}
+
+	VkDebugUtilsMessengerCreateInfoEXT getDebugMessengerCreateInfo()
+	{
+		// TODO:
+		/*
+			There are a lot more settings for the behavior of validation layers than just the flags specified in the VkDebugUtilsMessengerCreateInfoEXT struct. Browse to the Vulkan SDK and go to the Config directory. There you will find a vk_layer_settings.txt file that explains how to configure the layers.
+			To configure the layer settings for your own application, copy the file to the Debug and Release directories of your project and follow the instructions to set the desired behavior.
+		*/
+		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo{};
+		messengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		messengerCreateInfo.messageSeverity = /*VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | */VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		messengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		messengerCreateInfo.pfnUserCallback = debugCallback;
+		messengerCreateInfo.pUserData = nullptr; // optional
+		return messengerCreateInfo;
+	}
+
+	void createInstance()
+	{
+		uint32_t apiVersion = 0;
+		vkEnumerateInstanceVersion(&apiVersion);
+
+		if(apiVersion < MINIMUM_VULKAN_VERSION)
+		{
+			throw std::runtime_error("minimum vulkan version not supported");
+		}
+
+		VkApplicationInfo appInfo{};
+		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName = "Vulkan Tutorial";
+		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.pEngineName = "Batata";
+		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.apiVersion = MINIMUM_VULKAN_VERSION;
+
+		checkRequiredInstanceExtensions();
+		checkRequiredValidationLayers();
+
+		// TODO: https://vulkan.lunarg.com/doc/view/1.1.126.0/windows/best_practices.html
+		VkValidationFeatureEnableEXT validationEnables[] = {VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT};
+		VkValidationFeaturesEXT validationFeatures = {};
+		validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+		validationFeatures.enabledValidationFeatureCount = 1;
+		validationFeatures.pEnabledValidationFeatures = validationEnables;
+
+		VkInstanceCreateInfo instanceCreateInfo{};
+		instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		instanceCreateInfo.pApplicationInfo = &appInfo;
+		instanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_requiredInstanceExtensions.size());
+		instanceCreateInfo.ppEnabledExtensionNames = _requiredInstanceExtensions.data();
+		instanceCreateInfo.enabledLayerCount = static_cast<uint32_t>(_requiredValidationLayers.size());
+		instanceCreateInfo.ppEnabledLayerNames = _requiredValidationLayers.data();
+		instanceCreateInfo.pNext = &validationFeatures;
+
+		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo = getDebugMessengerCreateInfo();
+		if constexpr(_enableValidationLayers)
+		{
+			instanceCreateInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&messengerCreateInfo;
+		}
+
+		if(vkCreateInstance(&instanceCreateInfo, nullptr, &_instance) != VK_SUCCESS)
+		{
+			throw std::runtime_error{"failed to create instance"};
+		}
+	}
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+		void* pUserData)
+	{
+		// TODO: checkout other fields in pCallbackData
+		fprintf(stderr, "%s\n", pCallbackData->pMessage);
+		return VK_FALSE;
+	}
+
+	void createDebugMessenger()
+	{
+		if constexpr(!_enableValidationLayers)
+		{
+			return;
+		}
+
+		VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo = getDebugMessengerCreateInfo();
+
+		if(CreateDebugUtilsMessengerEXT(_instance, &messengerCreateInfo, nullptr, &_debugMessenger) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create debug messenger");
+		}
+
+		puts("created debug messenger\n");
+	}
+
+	void destroyDebugMessenger()
+	{
+		if constexpr(!_enableValidationLayers)
+		{
+			return;
+		}
+		DestroyDebugUtilsMessengerEXT(_instance, _debugMessenger, nullptr);
+	}
+
+	void createSurface()
+	{
+		if(isHeadless())
+		{
+			return;
+		}
+
+		if(glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create window surface");
+		}
+	}
+
+	bool checkPhysicalDeviceExtensions(VkPhysicalDevice physicalDevice, std::vector<VkExtensionProperties>& physicalDeviceExtensions)
+	{
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+
+		physicalDeviceExtensions.resize(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, physicalDeviceExtensions.data());
+
+		std::unordered_set<std::string_view> availableExtensions;
+
+		for(const auto& e : physicalDeviceExtensions)
+		{
+			availableExtensions.emplace(e.extensionName);
+		}
+
+		for(auto extension : _requiredDeviceExtensions)
+		{
+			if(!availableExtensions.contains(extension))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool checkPhysicalDeviceQueueFamilies(VkPhysicalDevice physicalDevice, QueueFamilies& families)
+	{
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+		families.properties.resize(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, families.properties.data());
+
+		families.supportsPresentation.assign(queueFamilyCount, VK_FALSE);
+		for(uint32_t i = 0; i < queueFamilyCount && !isHeadless(); ++i)
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, _surface, &families.supportsPresentation[i]);
+		}
+
+		// greedily choose first graphics queue that also supports presentation if any
+		// TODO: handle multiple graphics queues, how to choose which one to use?
+		for(uint32_t i = 0; i < queueFamilyCount; ++i)
+		{
+			if(families.properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				families.graphics = i;
+			}
+			if(families.supportsPresentation[i] || (isHeadless() && families.graphics == i))
+			{
+				families.present = i; // headless: nothing is presented, the graphics queue stands in
+			}
+			if(families.graphics == families.present)
+			{
+				break;
+			}
+		}
+
+		if(!families.graphics.has_value() || !families.present.has_value())
+		{
+			return false;
+		}
+
+		// prefer a transfer-only family (the DMA engines), then anything without graphics, then fall back to the graphics queue
+		// the copies then run in parallel to rendering instead of being serialized in front of it
+		families.transfer.reset();
+		for(uint32_t i = 0; i < queueFamilyCount; ++i)
+		{
+			const VkQueueFlags flags = families.properties[i].queueFlags;
+			if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT))
+			{
+				families.transfer = i;
+				break;
+			}
+		}
+		for(uint32_t i = 0; i < queueFamilyCount && !families.transfer.has_value(); ++i)
+		{
+			const VkQueueFlags flags = families.properties[i].queueFlags;
+			if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+			{
+				families.transfer = i;
+			}
+		}
+		if(!families.transfer.has_value())
+		{
+			families.transfer = families.graphics;
+		}
+
+		// async compute: a family without graphics runs on the compute units left idle by the graphics work, preferably not the one the uploads use
+		families.compute.reset();
+		for(uint32_t i = 0; i < queueFamilyCount; ++i)
+		{
+			const VkQueueFlags flags = families.properties[i].queueFlags;
+			if((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && (!families.compute.has_value() || families.compute == families.transfer))
+			{
+				families.compute = i;
+			}
+		}
+		if(!families.compute.has_value())
+		{
+			families.compute = families.graphics;
+		}
+
+		return true;
+	}
+
+	bool checkPhysicalDeviceSwapChain(VkPhysicalDevice physicalDevice, SwapChainInfo& info)
+	{
+		if(isHeadless())
+		{
+			return true;
+		}
+
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, _surface, &info.capabilities);
+
+		uint32_t formatCount = 0;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, _surface, &formatCount, nullptr);
+
+		info.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, _surface, &formatCount, info.formats.data());
+
+		uint32_t presentModeCount = 0;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, _surface, &presentModeCount, nullptr);
+
+		info.presentModes.resize(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, _surface, &presentModeCount, info.presentModes.data());
+
+		return !info.formats.empty() && !info.presentModes.empty();
+	}
+
+	bool checkPhysicalDeviceFeatures(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures& features, VkPhysicalDeviceVulkan12Features& vulkan12Features)
+	{
+		// descriptor indexing is core in Vulkan 1.2 but optional, the bindless texture array needs the features below
+		vulkan12Features = {};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &vulkan12Features;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+		features = features2.features;
+
+		const bool bindlessSupported = vulkan12Features.runtimeDescriptorArray && vulkan12Features.descriptorBindingPartiallyBound &&
+			vulkan12Features.descriptorBindingSampledImageUpdateAfterBind && vulkan12Features.descriptorBindingUpdateUnusedWhilePending;
+
+		return features.samplerAnisotropy && bindlessSupported && vulkan12Features.timelineSemaphore;
+	}
+
+	bool checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkPhysicalDeviceProperties& properties)
+	{
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		return properties.apiVersion >= MINIMUM_VULKAN_VERSION;
+	}
+
+	void choosePhysicalDevice()
+	{
+		uint32_t physicalDeviceCount = 0;
+		vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, nullptr);
+
+		if(physicalDeviceCount == 0)
+		{
+			throw std::runtime_error("failed to find any GPU with Vulkan support");
+		}
+
+		std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
+		vkEnumeratePhysicalDevices(_instance, &physicalDeviceCount, physicalDevices.data());
+
+		// every device that passes the checks is a candidate, the best scored one wins unless the command line asks for a specific one
+		std::vector<DeviceCandidate> candidates;
+		bool overrideMatched = false;
+		for(uint32_t i = 0; i < physicalDeviceCount; ++i)
+		{
+			DeviceCandidate candidate;
+			candidate.index = i;
+			candidate.physicalDevice = physicalDevices[i];
+			candidate.uuid = getDeviceUuid(candidate.physicalDevice);
+
+			VkPhysicalDeviceFeatures features{};
+			VkPhysicalDeviceVulkan12Features vulkan12Features{};
+			const char* rejection = nullptr;
+			if(!checkPhysicalDeviceProperties(candidate.physicalDevice, candidate.properties)) rejection = "Vulkan version too old";
+			else if(!checkPhysicalDeviceExtensions(candidate.physicalDevice, candidate.extensions)) rejection = "missing required extensions";
+			else if(!checkPhysicalDeviceQueueFamilies(candidate.physicalDevice, candidate.families)) rejection = "no graphics or present queue";
+			else if(!checkPhysicalDeviceSwapChain(candidate.physicalDevice, candidate.swapChainInfo)) rejection = "no surface format or present mode";
+			else if(!checkPhysicalDeviceFeatures(candidate.physicalDevice, features, vulkan12Features)) rejection = "missing required features";
+
+			const bool overridden = matchesDeviceOverride(candidate);
+			overrideMatched |= overridden;
+
+			if(rejection != nullptr)
+			{
+				printf("device %u: %s (%s): rejected, %s\n", i, candidate.properties.deviceName, candidate.uuid.c_str(), rejection);
+				if(overridden)
+				{
+					throw std::runtime_error("the device requested with --device is not suitable: " + std::string(rejection));
+				}
+				continue;
+			}
+
+			candidate.score = scorePhysicalDevice(candidate, features, vulkan12Features);
+			if(overridden)
+			{
+				candidate.score = INT64_MAX; // explicitly requested
+			}
+			candidates.push_back(std::move(candidate));
+		}
+		putc('\n', stdout);
+
+		if(!_settings.device.empty() && !overrideMatched)
+		{
+			throw std::runtime_error("no device matches --device " + _settings.device);
+		}
+		if(candidates.empty())
+		{
+			throw std::runtime_error("failed to find a suitable GPU");
+		}
+
+		// first of the best, so an equal score keeps the enumeration order
+		const DeviceCandidate& best = *std::max_element(candidates.begin(), candidates.end(), [](const DeviceCandidate& a, const DeviceCandidate& b) { return a.score < b.score; });
+		_physicalDevice = best.physicalDevice;
+		_queueFamilies = best.families;
+		_swapChainInfo = best.swapChainInfo;
+		_physicalDeviceProperties = best.properties;
+		_physicalDeviceExtensions = best.extensions;
+
+		chooseDeviceGroup();
+
+		printf("chosen device: %s\n", _physicalDeviceProperties.deviceName);
+
+		for(uint32_t idx = 0; idx < _queueFamilies.properties.size(); ++idx)
+		{
+			const auto& family = _queueFamilies.properties[idx];
+
+			printf("queue family %d:", idx);
+			if(family.queueFlags & VK_QUEUE_GRAPHICS_BIT) fputs(" graphics", stdout);
+			if(family.queueFlags & VK_QUEUE_COMPUTE_BIT) fputs(" compute", stdout);
+			if(family.queueFlags & VK_QUEUE_TRANSFER_BIT) fputs(" transfer", stdout);
+			if(family.queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) fputs(" sparse_binding", stdout);
+			if(family.queueFlags & VK_QUEUE_PROTECTED_BIT) fputs(" protected", stdout);
+			if(_queueFamilies.supportsPresentation[idx]) fputs(" present", stdout);
+			printf(" (count: %d)", family.queueCount);
+			putc('\n', stdout);
+		}
+
+		printf("chosen graphics queue family: %d\n", _queueFamilies.graphics.value());
+		printf("chosen present  queue family: %d\n", _queueFamilies.present.value());
+		printf("chosen transfer queue family: %d\n", _queueFamilies.transfer.value());
+		putc('\n', stdout);
+
+		puts("available device extensions:");
+		for(const auto& e : _physicalDeviceExtensions)
+		{
+			puts(e.extensionName);
+		}
+		putc('\n', stdout);
+
+		_enabledDeviceExtensions = _requiredDeviceExtensions;
+		for(auto extension : _optionalDeviceExtensions)
+		{
+			for(const auto& e : _physicalDeviceExtensions)
+			{
+				if(strcmp(e.extensionName, extension) == 0)
+				{
+					_enabledDeviceExtensions.push_back(extension);
+					break;
+				}
+			}
+		}
+
+		puts("enabling the following device extensions:");
+		for(auto extension : _enabledDeviceExtensions)
+		{
+			puts(extension);
+		}
+		putc('\n', stdout);
+	}
+
+	static std::string getDeviceUuid(VkPhysicalDevice physicalDevice)
+	{
+		VkPhysicalDeviceIDProperties idProperties{};
+		idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+		VkPhysicalDeviceProperties2 properties{};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &idProperties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+		std::string uuid;
+		for(uint8_t byte : idProperties.deviceUUID)
+		{
+			char hex[3] = {};
+			snprintf(hex, sizeof(hex), "%02x", byte);
+			uuid += hex;
+		}
+		return uuid;
+	}
+
+	// --device takes the enumeration index, the UUID (dashes and case are ignored) or a case insensitive part of the device name.
+	bool matchesDeviceOverride(const DeviceCandidate& candidate) const
+	{
+		if(_settings.device.empty())
+		{
+			return false;
+		}
+
+		auto lower = [](std::string text)
+		{
+			std::erase(text, '-');
+			std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			return text;
+		};
+
+		const std::string wanted = lower(_settings.device);
+		if(!wanted.empty() && std::all_of(wanted.begin(), wanted.end(), [](unsigned char c) { return std::isdigit(c); }) && wanted.size() < 4)
+		{
+			return std::stoul(wanted) == candidate.index;
+		}
+		return wanted == candidate.uuid || lower(candidate.properties.deviceName).find(wanted) != std::string::npos;
+	}
+
+	// Only devices that passed every check are scored, so the required features are not part of it. The type dominates, so an integrated GPU
+	// only wins against a discrete one that lacks the GPU driven path and everything else; each term is printed so a choice can be explained.
+	int64_t scorePhysicalDevice(const DeviceCandidate& candidate, const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceVulkan12Features& vulkan12Features)
+	{
+		int64_t typeScore = 0;
+		switch(candidate.properties.deviceType)
+		{
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeScore = 10000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeScore = 3000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeScore = 1000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: typeScore = 0; break;
+		default: typeScore = 500; break;
+		}
+
+		// integrated GPUs report part of the system memory as device local, the cap keeps that from outweighing the type
+		VkPhysicalDeviceMemoryProperties memoryProperties{};
+		vkGetPhysicalDeviceMemoryProperties(candidate.physicalDevice, &memoryProperties);
+		VkDeviceSize deviceLocalSize = 0;
+		for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		{
+			if(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				deviceLocalSize = std::max(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+			}
+		}
+		const int64_t memoryScore = 100 * static_cast<int64_t>(std::min<VkDeviceSize>(deviceLocalSize >> 30, 32));
+
+		bool asyncCompute = false;
+		for(const auto& family : candidate.families.properties)
+		{
+			asyncCompute |= (family.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+		}
+		const int64_t queueScore = (candidate.families.transfer != candidate.families.graphics ? 500 : 0) + (asyncCompute ? 500 : 0);
+
+		auto hasExtension = [&](const char* name)
+		{
+			return std::any_of(candidate.extensions.begin(), candidate.extensions.end(), [&](const VkExtensionProperties& e) { return strcmp(e.extensionName, name) == 0; });
+		};
+		const bool gpuDriven = vulkan12Features.drawIndirectCount && features.multiDrawIndirect && features.drawIndirectFirstInstance;
+		const int64_t featureScore = (gpuDriven ? 1000 : 0) +
+			(features.textureCompressionBC || features.textureCompressionASTC_LDR ? 200 : 0) +
+			(features.pipelineStatisticsQuery && features.inheritedQueries ? 50 : 0) +
+			(hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME) ? 100 : 0) +
+			(hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) ? 50 : 0) +
+			(hasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) ? 50 : 0);
+
+		VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+		vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+		VkPhysicalDeviceProperties2 properties{};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &vulkan12Properties;
+		vkGetPhysicalDeviceProperties2(candidate.physicalDevice, &properties);
+
+		const VkPhysicalDeviceLimits& limits = candidate.properties.limits;
+		const uint32_t bindlessCapacity = std::min(vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers);
+		const int64_t limitScore = (bindlessCapacity >= MAX_BINDLESS_TEXTURES ? 200 : 0) +
+			(limits.maxImageDimension2D >= 16384 ? 100 : 0) +
+			(limits.timestampComputeAndGraphics ? 50 : 0);
+
+		const int64_t score = typeScore + memoryScore + queueScore + featureScore + limitScore;
+		printf("device %u: %s (%s): score %lld = type %lld + memory %lld + queues %lld + features %lld + limits %lld\n", candidate.index, candidate.properties.deviceName, candidate.uuid.c_str(),
+			static_cast<long long>(score), static_cast<long long>(typeScore), static_cast<long long>(memoryScore), static_cast<long long>(queueScore), static_cast<long long>(featureScore), static_cast<long long>(limitScore));
+		return score;
+	}
+
+	// Finds the group of the chosen device. With --device-group and more than one GPU in it, the logical device spans the whole group
+	// and frames alternate between them, see getFrameDeviceMask. Presenting from a group needs VK_KHR_device_group's present modes, so headless only.
+	void chooseDeviceGroup()
+	{
+		_deviceGroup = {_physicalDevice};
+
+		uint32_t groupCount = 0;
+		vkEnumeratePhysicalDeviceGroups(_instance, &groupCount, nullptr);
+		std::vector<VkPhysicalDeviceGroupProperties> groups(groupCount);
+		for(auto& group : groups)
+		{
+			group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES;
+		}
+		vkEnumeratePhysicalDeviceGroups(_instance, &groupCount, groups.data());
+
+		for(uint32_t i = 0; i < groupCount; ++i)
+		{
+			const auto& group = groups[i];
+			const VkPhysicalDevice* begin = group.physicalDevices;
+			const VkPhysicalDevice* end = group.physicalDevices + group.physicalDeviceCount;
+			if(std::find(begin, end, _physicalDevice) == end)
+			{
+				continue;
+			}
+
+			printf("device group %u: %u devices%s\n", i, group.physicalDeviceCount, group.subsetAllocation ? ", subset allocation" : "");
+			if(group.physicalDeviceCount > 1 && _settings.deviceGroup)
+			{
+				if(isHeadless())
+				{
+					_deviceGroup.assign(begin, end);
+				}
+				else
+				{
+					puts("device group: presenting from a group is not supported, rendering on one device");
+				}
+			}
+		}
+		printf("device group: %zu of them used\n", _deviceGroup.size());
+		putc('\n', stdout);
+	}
+
+	// Alternate frame rendering: frame f runs on device f % group size, every frame in flight can then be on another GPU.
+	// Uploads keep the default mask of all devices, so every device has its own copy of the geometry and textures.
+	uint32_t getFrameDeviceIndex() const
+	{
+		return static_cast<uint32_t>(_frameNumber % _deviceGroup.size());
+	}
+
+	uint32_t getFrameDeviceMask() const
+	{
+		return 1u << getFrameDeviceIndex();
+	}
+
+	bool isDeviceExtensionEnabled(const char* extensionName) const
+	{
+		for(auto extension : _enabledDeviceExtensions)
+		{
+			if(strcmp(extension, extensionName) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void createLogicalDevice()
+	{
+		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		std::unordered_set<uint32_t> uniqueQueueFamilies = {_queueFamilies.graphics.value(), _queueFamilies.present.value(), _queueFamilies.transfer.value(), _queueFamilies.compute.value()};
+
+		// when uploads and async compute end up in the same family, they get a queue each if the family has two
+		const uint32_t computeFamily = _queueFamilies.compute.value();
+		const bool computeSharesTransfer = computeFamily == _queueFamilies.transfer.value() && computeFamily != _queueFamilies.graphics.value();
+		const uint32_t computeQueueIndex = computeSharesTransfer && _queueFamilies.properties[computeFamily].queueCount > 1 ? 1 : 0;
+
+		float queuePriorities[] = {1.0f, 1.0f};
+		for(auto queueFamily : uniqueQueueFamilies)
+		{
+			VkDeviceQueueCreateInfo queueCreateInfo{};
+			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueCreateInfo.queueFamilyIndex = queueFamily;
+			queueCreateInfo.queueCount = queueFamily == computeFamily ? computeQueueIndex + 1 : 1;
+			queueCreateInfo.pQueuePriorities = queuePriorities;
+
+			queueCreateInfos.push_back(queueCreateInfo);
+		}
+
+		// the GPU driven path needs a draw count read from a buffer and the object index in firstInstance, all optional in Vulkan 1.2
+		VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+		supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+		VkPhysicalDeviceFeatures2 supportedFeatures{};
+		supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures.pNext = &supportedVulkan12Features;
+		vkGetPhysicalDeviceFeatures2(_physicalDevice, &supportedFeatures);
+
+		const bool gpuDrivenSupported = supportedVulkan12Features.drawIndirectCount && supportedFeatures.features.multiDrawIndirect && supportedFeatures.features.drawIndirectFirstInstance;
+		if(_objectDataPath == ObjectDataPath::GpuDriven && !gpuDrivenSupported)
+		{
+			puts("GPU driven rendering not supported (drawIndirectCount, multiDrawIndirect, drawIndirectFirstInstance): falling back to CPU instancing");
+			putc('\n', stdout);
+			_objectDataPath = ObjectDataPath::Instanced;
+		}
+		const bool gpuDriven = _objectDataPath == ObjectDataPath::GpuDriven;
+
+		// only the GPU driven path has compute work to move, and a frame of a device group would need its device mask on the compute queue as well
+		_asyncComputeEnabled = gpuDriven && computeFamily != _queueFamilies.graphics.value() && _deviceGroup.size() == 1;
+		printf("async compute: %s\n", _asyncComputeEnabled ? "early culling on its own queue" : "off, culling runs on the graphics queue");
+		if(_asyncComputeEnabled)
+		{
+			printf("    queue family %u, queue %u%s\n", computeFamily, computeQueueIndex, computeSharesTransfer ? ", same family as the uploads" : "");
+		}
+		putc('\n', stdout);
+
+		// present wait needs present ids, the extensions are only enabled together with a swapchain
+		VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+		presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+		presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		presentIdFeatures.pNext = &presentWaitFeatures;
+
+		_presentWaitEnabled = false;
+		if(isDeviceExtensionEnabled(VK_KHR_PRESENT_ID_EXTENSION_NAME) && isDeviceExtensionEnabled(VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+		{
+			VkPhysicalDeviceFeatures2 features{};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &presentIdFeatures;
+			vkGetPhysicalDeviceFeatures2(_physicalDevice, &features);
+			_presentWaitEnabled = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+		}
+		printf("present wait: %s\n", _presentWaitEnabled ? "supported" : "not supported, frame pacing is off and latency is measured up to the end of rendering");
+		putc('\n', stdout);
+
+		VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+		synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+
+		_synchronization2Enabled = false;
+		if(isDeviceExtensionEnabled(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+		{
+			VkPhysicalDeviceFeatures2 features{};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &synchronization2Features;
+			vkGetPhysicalDeviceFeatures2(_physicalDevice, &features);
+			_synchronization2Enabled = synchronization2Features.synchronization2;
+		}
+
+		// Drivers that support Vulkan 1.3 still expose the extension, so it is the only check: without it (or with --render-passes)
+		// the passes keep their render pass and framebuffer objects, see createRenderPass.
+		VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures{};
+		dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+
+		_dynamicRenderingEnabled = false;
+		if(isDeviceExtensionEnabled(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) && !_settings.renderPasses)
+		{
+			VkPhysicalDeviceFeatures2 features{};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &dynamicRenderingFeatures;
+			vkGetPhysicalDeviceFeatures2(_physicalDevice, &features);
+			_dynamicRenderingEnabled = dynamicRenderingFeatures.dynamicRendering;
+		}
+
+		VkPhysicalDeviceFeatures deviceFeatures{};
+		deviceFeatures.samplerAnisotropy = VK_TRUE; // request feature for texture sampling
+		deviceFeatures.textureCompressionBC = supportedFeatures.features.textureCompressionBC; // KTX2 textures, see loadTexture
+		deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.features.textureCompressionASTC_LDR;
+		deviceFeatures.multiDrawIndirect = gpuDriven; // maxDrawCount above 1
+		deviceFeatures.drawIndirectFirstInstance = gpuDriven;
+		// the draws are in secondary command buffers, which can only run inside the statistics query with inherited queries
+		_pipelineStatisticsEnabled = supportedFeatures.features.pipelineStatisticsQuery && supportedFeatures.features.inheritedQueries;
+		deviceFeatures.pipelineStatisticsQuery = _pipelineStatisticsEnabled;
+		deviceFeatures.inheritedQueries = _pipelineStatisticsEnabled;
+
+		// timeline semaphores are core (and mandatory) since Vulkan 1.2, but still have to be enabled
+		VkPhysicalDeviceVulkan12Features vulkan12Features{};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		vulkan12Features.timelineSemaphore = VK_TRUE;
+		vulkan12Features.drawIndirectCount = gpuDriven;
+		vulkan12Features.runtimeDescriptorArray = VK_TRUE; // bindless textures, checked in checkPhysicalDeviceFeatures
+		vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		if(_presentWaitEnabled)
+		{
+			vulkan12Features.pNext = &presentIdFeatures; // presentWaitFeatures is chained behind it
+		}
+		if(_synchronization2Enabled)
+		{
+			synchronization2Features.pNext = vulkan12Features.pNext;
+			vulkan12Features.pNext = &synchronization2Features;
+		}
+		if(_dynamicRenderingEnabled)
+		{
+			dynamicRenderingFeatures.pNext = vulkan12Features.pNext;
+			vulkan12Features.pNext = &dynamicRenderingFeatures;
+		}
+
+		VkDeviceGroupDeviceCreateInfo deviceGroupInfo{};
+		deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO;
+		deviceGroupInfo.pNext = &vulkan12Features;
+		deviceGroupInfo.physicalDeviceCount = static_cast<uint32_t>(_deviceGroup.size());
+		deviceGroupInfo.pPhysicalDevices = _deviceGroup.data();
+
+		VkDeviceCreateInfo deviceCreateInfo{};
+		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceCreateInfo.pNext = _deviceGroup.size() > 1 ? static_cast<const void*>(&deviceGroupInfo) : &vulkan12Features;
+		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+		deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+
+		if constexpr(_enableValidationLayers)
+		{
+			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(_requiredValidationLayers.size());
+			deviceCreateInfo.ppEnabledLayerNames = _requiredValidationLayers.data();
+		}
+		else
+		{
+			deviceCreateInfo.enabledLayerCount = 0;
+		}
+
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_enabledDeviceExtensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = _enabledDeviceExtensions.data();
+
+		if(vkCreateDevice(_physicalDevice, &deviceCreateInfo, nullptr, &_device) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create logical device");
+		}
+
+		vkGetDeviceQueue(_device, _queueFamilies.graphics.value(), 0, &_graphicsQueue);
+		vkGetDeviceQueue(_device, _queueFamilies.present.value(), 0, &_presentQueue);
+		vkGetDeviceQueue(_device, _queueFamilies.transfer.value(), 0, &_transferQueue);
+		vkGetDeviceQueue(_device, computeFamily, computeQueueIndex, &_computeQueue);
+
+		if(_presentWaitEnabled)
+		{
+			_vkWaitForPresentKHR = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(_device, "vkWaitForPresentKHR");
+			_presentWaitEnabled = _vkWaitForPresentKHR != nullptr;
+		}
+		if(_synchronization2Enabled)
+		{
+			_vkCmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(_device, "vkCmdPipelineBarrier2KHR");
+			_synchronization2Enabled = _vkCmdPipelineBarrier2 != nullptr;
+		}
+		if(_dynamicRenderingEnabled)
+		{
+			_vkCmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(_device, "vkCmdBeginRenderingKHR");
+			_vkCmdEndRendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(_device, "vkCmdEndRenderingKHR");
+			_dynamicRenderingEnabled = _vkCmdBeginRendering != nullptr && _vkCmdEndRendering != nullptr;
+		}
+		printf("rendering: %s\n", _dynamicRenderingEnabled ? "dynamic rendering, no render pass or framebuffer objects" : "render pass and framebuffer objects");
+		putc('\n', stdout);
+	}
+
+	void createAllocator()
+	{
+		_allocator.init(_physicalDevice, _device, isDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME));
+
+		const auto& memProperties = _allocator.getMemoryProperties();
+
+		bool unifiedMemory = true;
+		for(uint32_t i = 0; i < memProperties.memoryHeapCount; ++i)
+		{
+			unifiedMemory &= (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		}
+
+		// host visible device local memory is either the 256 MiB BAR window, the whole VRAM with resizable BAR, or simply all memory on integrated GPUs
+		VkDeviceSize largestHostVisibleDeviceLocalHeap = 0;
+		for(uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+		{
+			const auto& type = memProperties.memoryTypes[i];
+			if((type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+			{
+				largestHostVisibleDeviceLocalHeap = std::max(largestHostVisibleDeviceLocalHeap, memProperties.memoryHeaps[type.heapIndex].size);
+			}
+		}
+
+		if(unifiedMemory)
+		{
+			puts("unified memory architecture: device local buffers will be written directly from the host");
+		}
+		else if(largestHostVisibleDeviceLocalHeap > SMALL_BAR_HEAP_SIZE)
+		{
+			puts("resizable BAR detected: device local buffers will be written directly from the host");
+		}
+		else if(largestHostVisibleDeviceLocalHeap > 0)
+		{
+			puts("small BAR heap detected: reserved for host visible resources");
+		}
+		putc('\n', stdout);
+	}
+
+	void createUploadEngine()
+	{
+		_uploadEngine.init(_device, _queueFamilies.transfer.value(), _transferQueue, _queueFamilies.graphics.value(), _graphicsQueue);
+
+		// one persistently mapped staging buffer for all uploads, instead of a create/map/destroy per resource
+		createBuffer("staging ring", STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _stagingRingBuffer, _stagingRingMemory);
+		_uploadEngine.setStagingRing(_stagingRingBuffer, _stagingRingMemory.mapped, STAGING_RING_SIZE);
+	}
+
+	void destroyUploadEngine()
+	{
+		_uploadEngine.destroy();
+		destroyBuffer(_stagingRingBuffer, _stagingRingMemory);
+	}
+
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	{
+		for(const auto& availableFormat : availableFormats)
+		{
+			if(availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB &&
+				availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+			{
+				return availableFormat;
+			}
+		}
+		return availableFormats.front();
+	}
+
+	// _presentMode if the surface supports it, otherwise FIFO, the only mode every surface has to support.
+	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+	{
+		if(std::find(availablePresentModes.begin(), availablePresentModes.end(), _presentMode) != availablePresentModes.end())
+		{
+			return _presentMode;
+		}
+
+		printf("present mode %s not supported, falling back to fifo\n", getPresentModeName(_presentMode));
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	// Switches to the next supported present mode, the swapchain is recreated after the next present.
+	void cyclePresentMode()
+	{
+		const std::vector<VkPresentModeKHR>& modes = _swapChainInfo.presentModes;
+		auto current = std::find(modes.begin(), modes.end(), _presentMode);
+		_presentMode = current == modes.end() || current + 1 == modes.end() ? modes.front() : *(current + 1);
+		_windowResized = true;
+	}
+
+	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+	{
+		if(capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+		{
+			return capabilities.currentExtent;
+		}
+		else
+		{
+			int width = 0;
+			int height = 0;
+			glfwGetFramebufferSize(_window, &width, &height);
+
+			VkExtent2D actualExtent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+
+			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+			return actualExtent;
+		}
+	}
+
+	// Passing the previous swapchain lets the driver hand its resources over, and lets the old images finish presenting while we already render to the new ones.
+	void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE)
+	{
+		if(isHeadless())
+		{
+			createOffscreenImages();
+			return;
+		}
+
+		VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(_swapChainInfo.formats);
+		VkPresentModeKHR presentMode = chooseSwapPresentMode(_swapChainInfo.presentModes);
+		VkExtent2D extent = chooseSwapExtent(_swapChainInfo.capabilities);
+
+		uint32_t imageCount = _swapChainInfo.capabilities.minImageCount + 1;
+		if(_swapChainInfo.capabilities.maxImageCount > 0 && imageCount > _swapChainInfo.capabilities.maxImageCount)
+		{
+			imageCount = _swapChainInfo.capabilities.maxImageCount;
+		}
+
+		printf("swapchain supports min of %d and max of %d images\n", _swapChainInfo.capabilities.minImageCount, _swapChainInfo.capabilities.maxImageCount);
+		printf("swapchain present mode: %s, %u frames in flight\n", getPresentModeName(presentMode), _framesInFlight);
+		_swapChainPresentMode = presentMode;
+
+		VkSwapchainCreateInfoKHR swapChainCreateInfo{};
+		swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		swapChainCreateInfo.surface = _surface;
+		swapChainCreateInfo.minImageCount = imageCount;
+		swapChainCreateInfo.imageFormat = surfaceFormat.format;
+		swapChainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
+		swapChainCreateInfo.imageExtent = extent;
+		swapChainCreateInfo.imageArrayLayers = 1;
+		swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // It is also possible that you'll render images to a separate image first to perform operations like post-processing. In that case you may use a value like VK_IMAGE_USAGE_TRANSFER_DST_BIT instead and use a memory operation to transfer the rendered image to a swap chain image.
+
+		uint32_t queueFamilyIndices[] = {_queueFamilies.graphics.value(), _queueFamilies.present.value()};
+		if(_queueFamilies.graphics != _queueFamilies.present)
+		{
+			swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			swapChainCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(std::size(queueFamilyIndices));
+			swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else
+		{
+			swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			swapChainCreateInfo.queueFamilyIndexCount = 0; // Optional
+			swapChainCreateInfo.pQueueFamilyIndices = nullptr; // Optional
+		}
+
+		swapChainCreateInfo.preTransform = _swapChainInfo.capabilities.currentTransform;
+		swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR; // ignore alpha
+		swapChainCreateInfo.presentMode = presentMode;
+		swapChainCreateInfo.clipped = VK_TRUE;
+		swapChainCreateInfo.oldSwapchain = oldSwapChain;
+
+		if(vkCreateSwapchainKHR(_device, &swapChainCreateInfo, nullptr, &_swapChain) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create swap chain");
+		}
+
+		printf("asked for %d images,", imageCount);
+		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
+		printf(" got %d images\n\n", imageCount);
+
+		_swapChainImages.resize(imageCount);
+		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
+
+		_swapChainImageFormat = surfaceFormat.format;
+		_swapChainExtent = extent;
+	}
+
+	// Headless stand-in for the swapchain: one image per frame in flight, so frame f always renders to image f once its fence is waited on.
+	// Same format as the preferred surface format, so that the numbers compare with a windowed run.
+	void createOffscreenImages()
+	{
+		_swapChainImageFormat = findSupportedFormat({VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+		_swapChainExtent = {_settings.width, _settings.height};
+
+		_swapChainImages.resize(_framesInFlight);
+		_offscreenImageMemory.resize(_framesInFlight);
+		for(uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			// TRANSFER_SRC: left in that layout by the last render pass, ready to be read back
+			createImage("offscreen color", _swapChainExtent.width, _swapChainExtent.height, 1, _swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _swapChainImages[i], _offscreenImageMemory[i]);
+		}
+
+		printf("offscreen images: %u of %ux%u\n", _framesInFlight, _swapChainExtent.width, _swapChainExtent.height);
+		putc('\n', stdout);
+	}
+
+	void destroyOffscreenImages()
+	{
+		for(size_t i = 0; i < _swapChainImages.size(); ++i)
+		{
+			destroyImage(_swapChainImages[i], _offscreenImageMemory[i]);
+		}
+		_swapChainImages.clear();
+		_offscreenImageMemory.clear();
+	}
+
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+	{
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = format;
+		viewInfo.subresourceRange.aspectMask = aspectFlags;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = mipLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		VkImageView imageView = VK_NULL_HANDLE;
+		if(vkCreateImageView(_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create image view");
+		}
+
+		return imageView;
+	}
+
+	void createSwapChainImageViews()
+	{
+		_swapChainImageViews.resize(_swapChainImages.size());
+
+		for(size_t i = 0; i < _swapChainImages.size(); ++i)
+		{
+			_swapChainImageViews[i] = createImageView(_swapChainImages[i], _swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+		}
+	}
+
+	void destroySwapChainImageViews()
+	{
+		for(auto imageView : _swapChainImageViews)
+		{
+			vkDestroyImageView(_device, imageView, nullptr);
+		}
+	}
+
+	// The GPU driven path draws a frame in two passes around the depth pyramid build (see recordCommandBuffer):
+	// _renderPass clears and keeps the depth for the pyramid, _loadRenderPass draws the late objects on top and presents.
+	// Both are compatible, so the pipelines and framebuffers created against _renderPass work in either.
+	// With dynamic rendering there are no render pass objects, beginRendering describes the attachments and the pipelines only know their formats.
+	void createRenderPass()
+	{
+		if(_dynamicRenderingEnabled)
+		{
+			return;
+		}
+
+		const bool twoPasses = _objectDataPath == ObjectDataPath::GpuDriven;
+		_renderPass = createRenderPass(true, !twoPasses);
+		if(twoPasses)
+		{
+			_loadRenderPass = createRenderPass(false, true);
+		}
+	}
+
+	void destroyRenderPass()
+	{
+		vkDestroyRenderPass(_device, _renderPass, nullptr);
+		vkDestroyRenderPass(_device, _loadRenderPass, nullptr);
+		_loadRenderPass = VK_NULL_HANDLE;
+	}
+
+	// first: clears the attachments instead of loading them, last: transitions the color attachment for presentation (or readback when headless)
+	VkRenderPass createRenderPass(bool first, bool last)
+	{
+		// depth is kept for the depth pyramid when another pass follows
+		const bool keepDepth = !last;
+
+		VkAttachmentDescription colorAttachment{};
+		colorAttachment.format = _swapChainImageFormat;
+		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		colorAttachment.loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		colorAttachment.initialLayout = first ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		const VkImageLayout lastLayout = isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // PRESENT_SRC needs the swapchain extension
+		colorAttachment.finalLayout = last ? lastLayout : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorAttachmentRef{};
+		colorAttachmentRef.attachment = 0; // index to VkAttachmentDescription array
+		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorAttachmentRefs[] = {colorAttachmentRef}; // The index of the attachment in this array is directly referenced from the fragment shader with the layout(location = 0) out vec4 outColor directive!
+
+		VkAttachmentDescription depthAttachment{};
+		depthAttachment.format = findDepthFormat();
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.storeOp = keepDepth ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// the render graph transitions the depth back from what the first pass left for the pyramid build, behind the reads of the pyramid
+		depthAttachment.initialLayout = first ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.finalLayout = keepDepth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference depthAttachmentRef{};
+		depthAttachmentRef.attachment = 1;
+		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(std::size(colorAttachmentRefs));
+		subpass.pColorAttachments = colorAttachmentRefs;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+		VkSubpassDescription subpasses[] = {subpass};
+
+		// TODO: the question is: why can I use only a single depth buffer for multiple frames in flight? what makes sure it is never concurrently written by more than one frame at the same time?
+		// for example, if I remove the subpass dependencies, everything still works. 
+
+		// src and dst are indices to subpasses in VkSubpassDescription array
+		// dst must always be higher than src
+		VkSubpassDependency dependency{};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // special value that indicates implicit subpass before or after our subpasses
+		dependency.dstSubpass = 0; // our only subpass
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependency.srcAccessMask = 0;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		// everything between the passes of a frame (the pyramid reading the depth, the late pass continuing on the attachments) is ordered by the render graph,
+		// which also transitions the attachments the second pass loads into the layouts it starts in, so only the first pass keeps the dependency on the image acquire
+		std::vector<VkSubpassDependency> dependencies;
+		if(first)
+		{
+			dependencies.push_back(dependency);
+		}
+
+		VkRenderPassCreateInfo renderPassCreateInfo{};
+		renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+		renderPassCreateInfo.pAttachments = attachments;
+		renderPassCreateInfo.subpassCount = static_cast<uint32_t>(std::size(subpasses));
+		renderPassCreateInfo.pSubpasses = subpasses;
+		renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassCreateInfo.pDependencies = dependencies.data();
+
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		if(vkCreateRenderPass(_device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create render pass");
+		}
+
+		return renderPass;
+	}
+
+	// Not needed with dynamic rendering, which takes the image views when the rendering begins: recreating the swapchain then only touches images and views.
+	void createFramebuffers()
+	{
+		if(_dynamicRenderingEnabled)
+		{
+			return;
+		}
+
+		_framebuffers.resize(_swapChainImageViews.size());
+
+		for(size_t i = 0; i < _swapChainImageViews.size(); ++i)
+		{
+			// TODO: The color attachment differs for every swap chain image, but the same depth image can be used by all of them because only a single subpass is running at the same time due to our semaphores.
+			// TODO: check if this is really correct!
+			VkImageView attachments[] = {_swapChainImageViews[i], _depthImageView};
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = _renderPass;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+			framebufferInfo.pAttachments = attachments;
+			framebufferInfo.width = _swapChainExtent.width;
+			framebufferInfo.height = _swapChainExtent.height;
+			framebufferInfo.layers = 1;
+
+			if(vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &_framebuffers[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create framebuffer");
+			}
+		}
+	}
+
+	void destroyFramebuffers()
+	{
+		for(auto framebuffer : _framebuffers)
+		{
+			vkDestroyFramebuffer(_device, framebuffer, nullptr);
+		}
+	}
+
+	void createGraphicsPipelineLayout()
+	{
+		// TODO: It is actually possible to bind multiple descriptor sets simultaneously.
+		// You need to specify a descriptor layout for each descriptor set when creating the pipeline layout. 
+		// Shaders can then reference specific descriptor sets like this:
+		//    layout(set = 0, binding = 0) uniform UniformBufferObject { ... }
+		// You can use this feature to put descriptors that vary per-object and descriptors that are shared into separate descriptor sets.
+		// In that case you avoid rebinding most of the descriptors across draw calls which is potentially more efficient.
+		// set 0: per frame resources, set 1: the bindless textures, bound once for the whole frame
+		VkDescriptorSetLayout setLayouts[] = {_descriptorSetLayout, _bindlessDescriptorSetLayout};
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(std::size(setLayouts));
+		pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+
+		// per-draw model matrix and per-material texture, must match layout(push_constant) in the vertex and fragment shaders
+		VkPushConstantRange pushConstantRanges[2] = {};
+		pushConstantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRanges[0].offset = 0;
+		pushConstantRanges[0].size = sizeof(ObjectUniforms);
+		pushConstantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRanges[1].offset = MATERIAL_PUSH_CONSTANTS_OFFSET;
+		pushConstantRanges[1].size = sizeof(MaterialPushConstants);
+
+		pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(std::size(pushConstantRanges));
+		pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges;
+
+		if(vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_graphicsPipelineLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+	}
+
+	std::vector<uint32_t> readSPV(const std::string& filename)
+	{
+		std::vector<uint32_t> byteCode;
+
+		std::ifstream file(filename, std::ios::binary | std::ios::ate);
+
+		if(!file)
+		{
+			throw std::runtime_error("failed to read shader file: " + filename + " (built from its GLSL source by the project, or by shaders/compile.bat)");
+		}
+
+		// SPIR-V compiled before an interface change of its GLSL does not match the layouts on the CPU side anymore.
+		// Only checked when the source sits next to it, as in a checkout, and only a warning since a checkout does not order the file times.
+		if(filename.ends_with(".spv"))
+		{
+			const std::string source = filename.substr(0, filename.size() - 4);
+			std::error_code error;
+			const auto sourceTime = std::filesystem::last_write_time(source, error);
+			if(!error && sourceTime > std::filesystem::last_write_time(filename, error) && !error)
+			{
+				fprintf(stderr, "warning: %s is older than its source, rebuild it\n", filename.c_str());
+			}
+		}
+
+		size_t fileSizeBytes = file.tellg();
+
+		if(fileSizeBytes % sizeof(uint32_t) != 0)
+		{
+			throw std::runtime_error("bytecode not multiple of uint32_t: " + filename);
+		}
+
+		byteCode.resize(fileSizeBytes / sizeof(uint32_t));
+
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(byteCode.data()), byteCode.size() * sizeof(uint32_t));
+
+		return byteCode;
+	}
+
+	VkShaderModule createShaderModule(const std::vector<uint32_t>& byteCode)
+	{
+		VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+		shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		shaderModuleCreateInfo.codeSize = byteCode.size() * sizeof(uint32_t);
+		shaderModuleCreateInfo.pCode = byteCode.data();
+
+		VkShaderModule shaderModule;
+
+		if(vkCreateShaderModule(_device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create shader module");
+		}
+
+		return shaderModule;
+	}
+
+	void createPipelineCompiler()
+	{
+		// leave most cores to the frame recording threads, one or two compile threads are enough to hide a spike
+		const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency() / 4, 1u, MAX_PIPELINE_COMPILE_THREADS);
+		_pipelineCompiler.init(threadCount, [this](const PipelineKey& key) { return compilePipeline(key); });
+	}
+
+	// The key of material 0, the other materials are variations of it.
+	PipelineKey getFallbackPipelineKey() const
+	{
+		PipelineKey key;
+		key.vertexShader = "shaders/uber.vert.spv";
+		key.fragmentShader = "shaders/uber.frag.spv";
+		key.variant.objectDataPath = static_cast<int32_t>(_objectDataPath);
+		key.variant.vertexColor = _vertexFormat.color; // a constant white color is not worth a multiply
+		key.vertexFormat = _vertexFormat;
+		key.layout = _graphicsPipelineLayout;
+		key.renderPass = _renderPass;
+		key.colorFormat = _swapChainImageFormat;
+		key.depthFormat = _depthFormat; // set by createRenderGraph
+		return key;
+	}
+
+	// Compiles the pipeline of material 0 into the registry at startup, while the texture and the model are still loading.
+	void createFallbackPipeline()
+	{
+		_graphicsPipeline = getPipeline(getFallbackPipelineKey());
+	}
+
+	// Material 0 is compiled right away (unless createFallbackPipeline already did it), since every other material falls back to it until its own pipeline is ready.
+	// Called again with the new render pass after a surface format change.
+	void createMaterials()
+	{
+		const PipelineKey key = getFallbackPipelineKey();
+
+		PipelineKey doubleSidedKey = key;
+		doubleSidedKey.cullMode = VK_CULL_MODE_NONE;
+
+		PipelineKey untexturedKey = key;
+		untexturedKey.variant.texture = VK_FALSE;
+		const glm::vec4 untexturedBaseColor(0.5f, 0.5f, 0.5f, 1.0f); // a neutral grey instead of a flat white
+
+		_materials.clear();
+		_materials.push_back({key, {}, _textureSlot});
+		_materials.push_back({doubleSidedKey, {}, _textureSlot});
+		_materials.push_back({untexturedKey, {}, _textureSlot, untexturedBaseColor}); // the texture is never sampled
+
+		_graphicsPipeline = getPipeline(_materials[0].key);
+
+		for(auto& material : _materials)
+		{
+			material.pipeline = requestPipeline(material.key);
+		}
+		_materialPipelines.assign(_materials.size(), _graphicsPipeline);
+	}
+
+	// Called once per frame before recording: materials whose pipeline is still compiling (or failed to) draw with the fallback.
+	void resolveMaterialPipelines()
+	{
+		for(size_t i = 0; i < _materials.size(); ++i)
+		{
+			VkPipeline pipeline = _graphicsPipeline;
+			if(PipelineCompiler::isReady(_materials[i].pipeline) && _materials[i].pipeline.get() != VK_NULL_HANDLE)
+			{
+				pipeline = _materials[i].pipeline.get();
+			}
+			_materialPipelines[i] = pipeline;
+		}
+	}
+
+	VkPipeline compilePipeline(const PipelineKey& key)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline = createPipeline(key);
+		auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("pipeline: compiled %s + %s in %.2f ms\n", key.vertexShader.c_str(), key.fragmentShader.c_str(), elapsed);
+		return pipeline;
+	}
+
+	// Returns the pipeline for key from the registry without blocking, queueing its compilation the first time it is requested.
+	std::shared_future<VkPipeline> requestPipeline(const PipelineKey& key)
+	{
+		auto it = _pipelines.find(key);
+		if(it != _pipelines.end())
+		{
+			return it->second;
+		}
+
+		std::shared_future<VkPipeline> pipeline = _pipelineCompiler.compile(key);
+		_pipelines.emplace(key, pipeline);
+		return pipeline;
+	}
+
+	// Same as requestPipeline, but compiles on the calling thread (or waits for the background compile) and returns the pipeline itself.
+	VkPipeline getPipeline(const PipelineKey& key)
+	{
+		auto it = _pipelines.find(key);
+		if(it != _pipelines.end())
+		{
+			return it->second.get();
+		}
+
+		std::promise<VkPipeline> promise;
+		promise.set_value(compilePipeline(key));
+		std::shared_future<VkPipeline> pipeline = promise.get_future().share();
+		_pipelines.emplace(key, pipeline);
+		return pipeline.get();
+	}
+
+	// Pipelines that reference a destroyed render pass or layout must go too, so the registry is only ever cleared as a whole.
+	void destroyPipelines()
+	{
+		_pipelineCompiler.waitIdle();
+
+		for(auto& [key, pipeline] : _pipelines)
+		{
+			if(pipeline.get() != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(_device, pipeline.get(), nullptr);
+			}
+		}
+		_pipelines.clear();
+		_graphicsPipeline = VK_NULL_HANDLE;
+	}
+
+	VkPipeline createPipeline(const PipelineKey& key)
+	{
+		// vertex shader --------------------------------------------------------------------------
+
+		auto vertShaderCode = readSPV(key.vertexShader);
+		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+
+		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vertShaderStageInfo.module = vertShaderModule;
+		vertShaderStageInfo.pName = "main";
+
+		// pSpecializationInfo allows you to specify values for shader constants, so the compiler can eliminate the branches that depend on them
+		// entries for constants a stage does not declare are ignored, so both stages share the same info
+		auto specializationEntries = ShaderVariant::getSpecializationMapEntries();
+
+		VkSpecializationInfo specializationInfo{};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+		specializationInfo.pMapEntries = specializationEntries.data();
+		specializationInfo.dataSize = sizeof(ShaderVariant);
+		specializationInfo.pData = &key.variant;
+
+		vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+		// fragment shader --------------------------------------------------------------------------
+
+		auto fragShaderCode = readSPV(key.fragmentShader);
+		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+		VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		fragShaderStageInfo.module = fragShaderModule;
+		fragShaderStageInfo.pName = "main";
+		fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+		// shader stages --------------------------------------------------------------------------
+
+		VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+		// vertex input --------------------------------------------------------------------------
+
+		auto bindingDescriptions = key.vertexFormat.getBindingDescriptions();
+		auto attributeDescriptions = key.vertexFormat.getAttributeDescriptions();
+
+		VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
+		vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+		vertexInputCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+		vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+		// input assembly --------------------------------------------------------------------------
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{};
+		inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssemblyCreateInfo.topology = key.topology;
+		inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
+
+		// viewport --------------------------------------------------------------------------
+
+		// The viewports origin in OpenGL is in the lower left of the screen, with Y pointing up.
+		// In Vulkan the origin is in the top left of the screen, with Y pointing downwards.
+		// If we want to define front faces as Counter-Clockwise and cull back faces, we need to invert Vulkan coordinates
+		// Instead of inverting gl_Position.y in every shader, we can use a negative value in viewport.height
+		// Note: this requires VK_KHR_Maintenance1 extension for Vulkan 1.0, which is core in Vulkan 1.1, and we are already requiring Vulkan 1.2 or greater
+		// ref: https://www.saschawillems.de/blog/2019/03/29/flipping-the-vulkan-viewport/
+		// The viewport and scissor are dynamic state (see setViewportAndScissor), so the pipeline does not depend on the swapchain extent.
+
+		VkPipelineViewportStateCreateInfo viewportCreateInfo{};
+		viewportCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportCreateInfo.viewportCount = 1;
+		viewportCreateInfo.pViewports = nullptr; // dynamic
+		viewportCreateInfo.scissorCount = 1;
+		viewportCreateInfo.pScissors = nullptr; // dynamic
+
+		// rasterization --------------------------------------------------------------------------
+
+		VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
+		rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizationCreateInfo.depthClampEnable = VK_FALSE;
+		rasterizationCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+		rasterizationCreateInfo.polygonMode = key.polygonMode;
+		rasterizationCreateInfo.lineWidth = 1.0f;
+		rasterizationCreateInfo.cullMode = key.cullMode;
+		rasterizationCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterizationCreateInfo.depthBiasEnable = VK_FALSE;
+		rasterizationCreateInfo.depthBiasConstantFactor = 0.0f; // Optional
+		rasterizationCreateInfo.depthBiasClamp = 0.0f; // Optional
+		rasterizationCreateInfo.depthBiasSlopeFactor = 0.0f; // Optional
+
+		// multisampling --------------------------------------------------------------------------
+
+		VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo{};
+		multisamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+		multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisamplingCreateInfo.minSampleShading = 1.0f; // Optional
+		multisamplingCreateInfo.pSampleMask = nullptr; // Optional
+		multisamplingCreateInfo.alphaToCoverageEnable = VK_FALSE; // Optional
+		multisamplingCreateInfo.alphaToOneEnable = VK_FALSE; // Optional
+
+		// depth/stencil --------------------------------------------------------------------------
+
+		VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
+		depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencilCreateInfo.depthTestEnable = key.depthTest;
+		depthStencilCreateInfo.depthWriteEnable = key.depthWrite;
+		depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+		depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+		depthStencilCreateInfo.minDepthBounds = 0.0f; // Optional
+		depthStencilCreateInfo.maxDepthBounds = 1.0f; // Optional
+		depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+		depthStencilCreateInfo.front = {}; // Optional
+		depthStencilCreateInfo.back = {}; // Optional
+
+		// color blending --------------------------------------------------------------------------
+
+		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachment.blendEnable = key.blend;
+		colorBlendAttachment.srcColorBlendFactor = key.blend ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstColorBlendFactor = key.blend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+
+		VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo{};
+		colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlendCreateInfo.logicOpEnable = VK_FALSE;
+		colorBlendCreateInfo.logicOp = VK_LOGIC_OP_COPY; // Optional
+		colorBlendCreateInfo.attachmentCount = 1;
+		colorBlendCreateInfo.pAttachments = &colorBlendAttachment;
+		colorBlendCreateInfo.blendConstants[0] = 0.0f; // Optional
+		colorBlendCreateInfo.blendConstants[1] = 0.0f; // Optional
+		colorBlendCreateInfo.blendConstants[2] = 0.0f; // Optional
+		colorBlendCreateInfo.blendConstants[3] = 0.0f; // Optional
+
+		// dynamic state --------------------------------------------------------------------------
+
+		// set in every command buffer, which lets the pipeline survive window resizes
+		VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+		dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(std::size(dynamicStates));
+		dynamicStateCreateInfo.pDynamicStates = dynamicStates;
+
+		// --------------------------------------------------------------------------------------------
+		// graphics pipeline
+		// --------------------------------------------------------------------------------------------
+
+		VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stageCount = static_cast<uint32_t>(std::size(shaderStages));
+		pipelineCreateInfo.pStages = shaderStages;
+		pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
+		pipelineCreateInfo.pViewportState = &viewportCreateInfo;
+		pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
+		pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
+		pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+		pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
+		pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+		pipelineCreateInfo.layout = key.layout;
+		pipelineCreateInfo.renderPass = key.renderPass;
+		pipelineCreateInfo.subpass = 0; // which subpass where this graphics pipeline will be used
+
+		// without a render pass, the attachment formats come from here
+		VkPipelineRenderingCreateInfo renderingCreateInfo{};
+		renderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+		renderingCreateInfo.colorAttachmentCount = 1;
+		renderingCreateInfo.pColorAttachmentFormats = &key.colorFormat;
+		renderingCreateInfo.depthAttachmentFormat = key.depthFormat;
+		if(key.renderPass == VK_NULL_HANDLE)
+		{
+			pipelineCreateInfo.pNext = &renderingCreateInfo;
+		}
+		pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+		pipelineCreateInfo.basePipelineIndex = -1; // Optional
+		// These last two values are only used if deriving from an existing pipeline. In this case, must set the VK_PIPELINE_CREATE_DERIVATIVE_BIT flag in the flags field of VkGraphicsPipelineCreateInfo.
+
+		// Note: this function is designed to take multiple VkGraphicsPipelineCreateInfo objects and create multiple VkPipeline objects in a single call
+		// The second parameter references the pipeline cache, which is stored to a file across program executions (see createPipelineCache).
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if(vkCreateGraphicsPipelines(_device, _pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create graphics pipeline");
+		}
+
+		// we're allowed to destroy the shader modules as soon as pipeline creation is finished
+		vkDestroyShaderModule(_device, fragShaderModule, nullptr);
+		vkDestroyShaderModule(_device, vertShaderModule, nullptr);
+
+		return pipeline;
+	}
+
+	// Compute pipelines of the GPU driven path, see cull.comp and depth_reduce.comp. They have their own descriptor set layouts, and no render pass to depend on,
+	// so unlike the graphics pipelines they do not go through the registry and survive a surface format change.
+	void createCullPipelines()
+	{
+		if(_objectDataPath != ObjectDataPath::GpuDriven)
+		{
+			return;
+		}
+
+		// cull descriptor set layouts --------------------------------------------------------------------------
+
+		// set 0: objects (read), draws (written), counts (atomics), visibility (read and written), frame uniforms
+		VkDescriptorSetLayoutBinding cullBindings[5] = {};
+		for(uint32_t i = 0; i < std::size(cullBindings); ++i)
+		{
+			cullBindings[i].binding = i;
+			cullBindings[i].descriptorType = i < 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			cullBindings[i].descriptorCount = 1;
+			cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		_cullDescriptorSetLayout = createComputeDescriptorSetLayout(cullBindings, static_cast<uint32_t>(std::size(cullBindings)));
+
+		// set 1: the depth pyramid, allocated with it since it changes with the swapchain extent
+		VkDescriptorSetLayoutBinding pyramidBinding{};
+		pyramidBinding.binding = 0;
+		pyramidBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pyramidBinding.descriptorCount = 1;
+		pyramidBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		_depthPyramidDescriptorSetLayout = createComputeDescriptorSetLayout(&pyramidBinding, 1);
+
+		// depth reduce descriptor set layout --------------------------------------------------------------------------
+
+		// source level (or the depth buffer), destination level
+		VkDescriptorSetLayoutBinding reduceBindings[2] = {};
+		reduceBindings[0].binding = 0;
+		reduceBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		reduceBindings[0].descriptorCount = 1;
+		reduceBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		reduceBindings[1].binding = 1;
+		reduceBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		reduceBindings[1].descriptorCount = 1;
+		reduceBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		_depthReduceDescriptorSetLayout = createComputeDescriptorSetLayout(reduceBindings, static_cast<uint32_t>(std::size(reduceBindings)));
+
+		// pipeline layouts --------------------------------------------------------------------------
+
+		VkDescriptorSetLayout cullSetLayouts[] = {_cullDescriptorSetLayout, _depthPyramidDescriptorSetLayout};
+		_cullPipelineLayout = createComputePipelineLayout(cullSetLayouts, static_cast<uint32_t>(std::size(cullSetLayouts)), sizeof(CullPushConstants));
+		_depthReducePipelineLayout = createComputePipelineLayout(&_depthReduceDescriptorSetLayout, 1, sizeof(DepthReducePushConstants));
+
+		// pipelines --------------------------------------------------------------------------
+
+		_cullPipeline = createComputePipeline("shaders/cull.comp.spv", _cullPipelineLayout);
+		_depthReducePipeline = createComputePipeline("shaders/depth_reduce.comp.spv", _depthReducePipelineLayout);
+
+		// the shaders only use texelFetch, but a sampled image still needs a sampler
+		VkSamplerCreateInfo samplerCreateInfo{};
+		samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+		samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+		samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCreateInfo.minLod = 0.0f;
+		samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+		if(vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_depthPyramidSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create depth pyramid sampler");
+		}
+	}
+
+	void destroyCullPipelines()
+	{
+		vkDestroySampler(_device, _depthPyramidSampler, nullptr);
+		vkDestroyPipeline(_device, _depthReducePipeline, nullptr);
+		vkDestroyPipeline(_device, _cullPipeline, nullptr);
+		vkDestroyPipelineLayout(_device, _depthReducePipelineLayout, nullptr);
+		vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _depthReduceDescriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _depthPyramidDescriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _cullDescriptorSetLayout, nullptr);
+	}
+
+	VkDescriptorSetLayout createComputeDescriptorSetLayout(const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount)
+	{
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.bindingCount = bindingCount;
+		layoutCreateInfo.pBindings = bindings;
+
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+		if(vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &layout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create compute descriptor set layout");
+		}
+		return layout;
+	}
+
+	VkPipelineLayout createComputePipelineLayout(const VkDescriptorSetLayout* setLayouts, uint32_t setLayoutCount, uint32_t pushConstantSize)
+	{
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = pushConstantSize;
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCreateInfo.setLayoutCount = setLayoutCount;
+		pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		if(vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &layout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create compute pipeline layout");
+		}
+		return layout;
+	}
+
+	VkPipeline createComputePipeline(const std::string& shader, VkPipelineLayout layout)
+	{
+		auto compShaderCode = readSPV(shader);
+		VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+		VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+		compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		compShaderStageInfo.module = compShaderModule;
+		compShaderStageInfo.pName = "main";
+
+		VkComputePipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stage = compShaderStageInfo;
+		pipelineCreateInfo.layout = layout;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if(vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create compute pipeline: " + shader);
+		}
+
+		vkDestroyShaderModule(_device, compShaderModule, nullptr);
+		return pipeline;
+	}
+
+	// Our own header in front of the cache data: the driver's own header has no driver version,
+	// and a cache from an older driver is at best useless and at worst crashes a buggy driver.
+	struct PipelineCacheFileHeader
+	{
+		uint32_t magic = 0;
+		uint32_t headerVersion = 0;
+		uint32_t vendorID = 0;
+		uint32_t deviceID = 0;
+		uint32_t driverVersion = 0;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+		uint64_t dataSize = 0;
+	};
+
+	PipelineCacheFileHeader makePipelineCacheFileHeader() const
+	{
+		PipelineCacheFileHeader header;
+		header.magic = PIPELINE_CACHE_MAGIC;
+		header.headerVersion = 1;
+		header.vendorID = _physicalDeviceProperties.vendorID;
+		header.deviceID = _physicalDeviceProperties.deviceID;
+		header.driverVersion = _physicalDeviceProperties.driverVersion;
+		memcpy(header.pipelineCacheUUID, _physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+		return header;
+	}
+
+	// Returns the cache data stored in PIPELINE_CACHE_PATH, or nothing if the file is missing, truncated or was written by another device or driver.
+	std::vector<char> loadPipelineCacheData()
+	{
+		std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+		if(!file.is_open())
+		{
+			puts("pipeline cache: no cache file, starting cold");
+			return {};
+		}
+
+		const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+		file.seekg(0);
+
+		PipelineCacheFileHeader header;
+		if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		{
+			puts("pipeline cache: truncated header, ignored");
+			return {};
+		}
+
+		const PipelineCacheFileHeader expected = makePipelineCacheFileHeader();
+		if(header.magic != expected.magic || header.headerVersion != expected.headerVersion ||
+			header.vendorID != expected.vendorID || header.deviceID != expected.deviceID || header.driverVersion != expected.driverVersion ||
+			memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		{
+			puts("pipeline cache: written by another device or driver, ignored");
+			return {};
+		}
+
+		// checked before allocating, a corrupt size would otherwise ask for any amount of memory
+		if(header.dataSize != fileSize - sizeof(header))
+		{
+			puts("pipeline cache: data size does not match the file, ignored");
+			return {};
+		}
+
+		std::vector<char> data(header.dataSize);
+		if(!file.read(data.data(), data.size()))
+		{
+			puts("pipeline cache: truncated data, ignored");
+			return {};
+		}
+
+		// the driver header (VkPipelineCacheHeaderVersionOne) must agree too: length, version, vendorID, deviceID, pipelineCacheUUID
+		uint32_t driverHeader[4] = {};
+		if(data.size() < sizeof(driverHeader) + VK_UUID_SIZE)
+		{
+			return {};
+		}
+		memcpy(driverHeader, data.data(), sizeof(driverHeader));
+		if(driverHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader[2] != expected.vendorID || driverHeader[3] != expected.deviceID ||
+			memcmp(data.data() + sizeof(driverHeader), expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		{
+			puts("pipeline cache: driver header mismatch, ignored");
+			return {};
+		}
+
+		printf("pipeline cache: loaded %llu bytes\n", static_cast<unsigned long long>(data.size()));
+		return data;
+	}
+
+	void createPipelineCache()
+	{
+		std::vector<char> data = loadPipelineCacheData();
+		putc('\n', stdout);
+
+		VkPipelineCacheCreateInfo cacheCreateInfo{};
+		cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheCreateInfo.initialDataSize = data.size();
+		cacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+		if(vkCreatePipelineCache(_device, &cacheCreateInfo, nullptr, &_pipelineCache) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create pipeline cache");
+		}
+	}
+
+	// Writes the cache next to the executable for the next run: to a temporary file first, so a crash while writing never leaves a corrupt cache behind.
+	void savePipelineCache()
+	{
+		size_t dataSize = 0;
+		vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, nullptr);
+
+		std::vector<char> data(dataSize);
+		if(vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+		{
+			puts("pipeline cache: failed to read back cache data, not saved");
+			return;
+		}
+
+		PipelineCacheFileHeader header = makePipelineCacheFileHeader();
+		header.dataSize = dataSize;
+
+		const std::string tempPath = PIPELINE_CACHE_PATH + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if(!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !file.write(data.data(), dataSize))
+			{
+				puts("pipeline cache: failed to write cache file");
+				return;
+			}
+		}
+
+		std::remove(PIPELINE_CACHE_PATH.c_str());
+		if(std::rename(tempPath.c_str(), PIPELINE_CACHE_PATH.c_str()) != 0)
+		{
+			puts("pipeline cache: failed to replace cache file");
+			return;
+		}
+
+		printf("pipeline cache: saved %llu bytes\n", static_cast<unsigned long long>(dataSize));
+	}
+
+	void destroyPipelineCache()
+	{
+		savePipelineCache();
+		vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+	}
+
+	void createProfiler()
+	{
+		const uint32_t timestampValidBits = _queueFamilies.properties[_queueFamilies.graphics.value()].timestampValidBits;
+		const size_t historyFrames = _settings.benchmark ? std::max<size_t>(Profiler::DEFAULT_HISTORY_FRAMES, _settings.measuredFrames) : Profiler::DEFAULT_HISTORY_FRAMES;
+		_profiler.init(_device, _physicalDeviceProperties.limits.timestampPeriod, timestampValidBits, _pipelineStatisticsEnabled, _framesInFlight, historyFrames);
+	}
+
+	// Called once the device is idle, the report and the trace cover the frames still in the profiler history.
+	void destroyProfiler()
+	{
+		_profiler.printReport();
+		if(_profiler.exportChromeTrace(PROFILER_TRACE_PATH))
+		{
+			printf("profiler: trace written to %s\n", PROFILER_TRACE_PATH.c_str());
+			putc('\n', stdout);
+		}
+		_profiler.destroy();
+	}
+
+	void createJobSystem()
+	{
+		const uint32_t workerCount = std::clamp(std::thread::hardware_concurrency(), 1u, MAX_RECORDING_THREADS);
+		_threadPool.init(workerCount);
+
+		printf("job system: %u workers\n", workerCount);
+		putc('\n', stdout);
+	}
+
+	void createCommandPools()
+	{
+		// one transient pool per worker per frame in flight, reset as a whole once the frame's fence is signaled
+		_frameCommands.resize(_framesInFlight);
+
+		for(auto& frame : _frameCommands)
+		{
+			frame.workers.resize(_threadPool.getWorkerCount());
+
+			for(auto& worker : frame.workers)
+			{
+				VkCommandPoolCreateInfo poolCreateInfo{};
+				poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+				poolCreateInfo.queueFamilyIndex = _queueFamilies.graphics.value();
+				poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+				if(vkCreateCommandPool(_device, &poolCreateInfo, nullptr, &worker.pool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create command pool");
+				}
+			}
+
+			VkCommandBufferAllocateInfo allocateInfo{};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.commandPool = frame.workers[0].pool; // the primary is recorded by the main thread, which is worker 0
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocateInfo.commandBufferCount = 1;
+
+			if(vkAllocateCommandBuffers(_device, &allocateInfo, &frame.primary) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+
+			if(!_asyncComputeEnabled)
+			{
+				continue;
+			}
+
+			VkCommandPoolCreateInfo computePoolCreateInfo{};
+			computePoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			computePoolCreateInfo.queueFamilyIndex = _queueFamilies.compute.value();
+			computePoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+			if(vkCreateCommandPool(_device, &computePoolCreateInfo, nullptr, &frame.computePool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create compute command pool");
+			}
+
+			allocateInfo.commandPool = frame.computePool;
+			if(vkAllocateCommandBuffers(_device, &allocateInfo, &frame.compute) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate compute command buffer");
+			}
+		}
+	}
+
+	void destroyCommandPools()
+	{
+		// command buffers are freed together with their pool
+		for(auto& frame : _frameCommands)
+		{
+			for(auto& worker : frame.workers)
+			{
+				vkDestroyCommandPool(_device, worker.pool, nullptr);
+			}
+			if(frame.computePool != VK_NULL_HANDLE)
+			{
+				vkDestroyCommandPool(_device, frame.computePool, nullptr);
+			}
+		}
+		_frameCommands.clear();
+	}
+
+	// Records the current frame: the primary command buffer runs the passes of _renderGraph (see createRenderGraph),
+	// the draws themselves are in secondary command buffers.
+	void recordCommandBuffer(uint32_t imageIndex)
+	{
+		FrameCommands& frame = _frameCommands[_currentFrame];
+
+		// the fence of this frame was waited on, so nothing allocated from these pools is in use anymore
+		for(auto& worker : frame.workers)
+		{
+			vkResetCommandPool(_device, worker.pool, 0);
+			worker.usedSecondaries = 0;
+		}
+
+		// begin command buffer -------------------------------------------
+
+		VkCommandBufferBeginInfo commandBufferBeginInfo{};
+		commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		commandBufferBeginInfo.pInheritanceInfo = nullptr; // Optional
+
+		// the secondaries keep the default mask of all devices, which contains the one of the primary
+		VkDeviceGroupCommandBufferBeginInfo deviceGroupBeginInfo{};
+		deviceGroupBeginInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO;
+		deviceGroupBeginInfo.deviceMask = getFrameDeviceMask();
+		if(_deviceGroup.size() > 1)
+		{
+			commandBufferBeginInfo.pNext = &deviceGroupBeginInfo;
+		}
+
+		if(vkBeginCommandBuffer(frame.primary, &commandBufferBeginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to begin recording command buffer");
+		}
+
+		resolveMaterialPipelines();
+
+		_profiler.beginGpuFrame(frame.primary, _currentFrame);
+		const uint32_t frameScope = _profiler.beginGpuScope(frame.primary, "frame");
+		_profiler.beginStatistics(frame.primary);
+
+		_renderGraph.setImage(_graphResources.color, _swapChainImages[imageIndex]);
+		if(_objectDataPath == ObjectDataPath::GpuDriven)
+		{
+			_renderGraph.setImage(_graphResources.depthPyramid, _depthPyramid.image);
+		}
+
+		// a GPU timestamp scope per pass, passes do not nest
+		uint32_t passScope = 0;
+		_renderGraph.execute(frame.primary, imageIndex, [&](VkCommandBuffer commandBuffer, const char* pass, bool begin)
+		{
+			if(begin)
+			{
+				passScope = _profiler.beginGpuScope(commandBuffer, pass);
+			}
+			else
+			{
+				_profiler.endGpuScope(commandBuffer, passScope);
+			}
+		});
+
+		_profiler.endStatistics(frame.primary);
+		_profiler.endGpuScope(frame.primary, frameScope);
+
+		// end command buffer -------------------------------------------
+
+		if(vkEndCommandBuffer(frame.primary) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording command buffer");
+		}
+	}
+
+	void beginRenderPass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t imageIndex)
+	{
+		VkRenderPassBeginInfo renderPassBeginInfo{};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderPass = renderPass;
+		renderPassBeginInfo.framebuffer = _framebuffers[imageIndex];
+		renderPassBeginInfo.renderArea.offset = {0, 0};
+		renderPassBeginInfo.renderArea.extent = _swapChainExtent;
+
+		// Note that the order of clearValues should be identical to the order of your attachments.
+		// ignored by the attachments that are loaded instead
+		VkClearValue clearValues[] = {{.color = {0.0f, 0.0f, 0.0f, 1.0f}}, {.depthStencil = {1.0f, 0}}};
+		renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(std::size(clearValues));
+		renderPassBeginInfo.pClearValues = clearValues;
+
+		// the subpass contents come exclusively from secondary command buffers
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	}
+
+	// Begins drawing to the color and depth attachments, with the loads and stores of createRenderPass(first, last).
+	// With dynamic rendering the render graph has already moved the attachments to their attachment layouts.
+	void beginRendering(VkCommandBuffer commandBuffer, bool first, bool last, uint32_t imageIndex)
+	{
+		if(!_dynamicRenderingEnabled)
+		{
+			beginRenderPass(commandBuffer, first ? _renderPass : _loadRenderPass, imageIndex);
+			return;
+		}
+
+		VkRenderingAttachmentInfo colorAttachment{};
+		colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		colorAttachment.imageView = _swapChainImageViews[imageIndex];
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.clearValue.color = {0.0f, 0.0f, 0.0f, 1.0f};
+
+		// depth is kept for the depth pyramid when another pass follows
+		VkRenderingAttachmentInfo depthAttachment{};
+		depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		depthAttachment.imageView = _depthImageView;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.storeOp = last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.clearValue.depthStencil = {1.0f, 0};
+
+		VkRenderingInfo renderingInfo{};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+		renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT; // same as the render pass, only secondaries draw
+		renderingInfo.renderArea.offset = {0, 0};
+		renderingInfo.renderArea.extent = _swapChainExtent;
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments = &colorAttachment;
+		renderingInfo.pDepthAttachment = &depthAttachment;
+
+		_vkCmdBeginRendering(commandBuffer, &renderingInfo);
+	}
+
+	void endRendering(VkCommandBuffer commandBuffer)
+	{
+		if(_dynamicRenderingEnabled)
+		{
+			_vkCmdEndRendering(commandBuffer);
+		}
+		else
+		{
+			vkCmdEndRenderPass(commandBuffer);
+		}
+	}
+
+	// CPU driven paths: the objects (or batches) are split into contiguous ranges, recorded into secondary command buffers in parallel.
+	void recordDrawJobs(FrameCommands& frame, uint32_t imageIndex)
+	{
+		const bool instanced = _objectDataPath == ObjectDataPath::Instanced;
+		const uint32_t drawCount = static_cast<uint32_t>(instanced ? _drawBatches.size() : _drawList.size());
+		const uint32_t jobCount = std::min(_threadPool.getWorkerCount(), (drawCount + MIN_DRAWS_PER_JOB - 1) / MIN_DRAWS_PER_JOB);
+
+		std::vector<VkCommandBuffer> secondaries(jobCount, VK_NULL_HANDLE);
+
+		_threadPool.run(jobCount, [&](uint32_t jobIndex, uint32_t workerIndex)
+		{
+			const uint32_t first = static_cast<uint32_t>(uint64_t(drawCount) * jobIndex / jobCount);
+			const uint32_t last = static_cast<uint32_t>(uint64_t(drawCount) * (jobIndex + 1) / jobCount);
+			secondaries[jobIndex] = instanced ? recordBatches(frame.workers[workerIndex], imageIndex, first, last) : recordDraws(frame.workers[workerIndex], imageIndex, first, last);
+		});
+
+		// executed in job order, so the draw order does not depend on thread scheduling
+		if(!secondaries.empty())
+		{
+			vkCmdExecuteCommands(frame.primary, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		}
+	}
+
+	void setViewportAndScissor(VkCommandBuffer commandBuffer)
+	{
+		VkViewport viewport{};
+		viewport.x = 0.0f;
+		viewport.y = static_cast<float>(_swapChainExtent.height); // invert coordinate system
+		viewport.width = static_cast<float>(_swapChainExtent.width);
+		viewport.height = -static_cast<float>(_swapChainExtent.height); // invert coordinate system
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor{};
+		scissor.offset = {0, 0};
+		scissor.extent = _swapChainExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	// Allocates (or reuses) a secondary command buffer from the pool of worker, begins it inside the render pass and binds the geometry.
+	VkCommandBuffer beginDrawCommands(WorkerCommands& worker, uint32_t imageIndex)
+	{
+		if(worker.usedSecondaries == worker.secondaries.size())
+		{
+			VkCommandBufferAllocateInfo allocateInfo{};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.commandPool = worker.pool;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocateInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			if(vkAllocateCommandBuffers(_device, &allocateInfo, &commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer");
+			}
+			worker.secondaries.push_back(commandBuffer);
+		}
+
+		VkCommandBuffer commandBuffer = worker.secondaries[worker.usedSecondaries++];
+
+		// begin command buffer -------------------------------------------
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = _renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = _dynamicRenderingEnabled ? VK_NULL_HANDLE : _framebuffers[imageIndex]; // Optional, but may let the driver optimize
+		inheritanceInfo.pipelineStatistics = _profiler.getStatisticsFlags(); // executed while the statistics query of the frame is active
+
+		// with dynamic rendering there is no render pass to inherit, only the formats of beginRendering
+		VkCommandBufferInheritanceRenderingInfo inheritanceRenderingInfo{};
+		inheritanceRenderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		inheritanceRenderingInfo.colorAttachmentCount = 1;
+		inheritanceRenderingInfo.pColorAttachmentFormats = &_swapChainImageFormat;
+		inheritanceRenderingInfo.depthAttachmentFormat = _depthFormat;
+		inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		if(_dynamicRenderingEnabled)
+		{
+			inheritanceInfo.pNext = &inheritanceRenderingInfo;
+		}
+
+		VkCommandBufferBeginInfo commandBufferBeginInfo{};
+		commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		if(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to begin recording command buffer");
+		}
+
+		// secondary command buffers do not inherit any state from the primary, so everything is bound again
+		// the caller binds the pipelines, all materials share the pipeline layout so the other bindings survive a pipeline change
+
+		setViewportAndScissor(commandBuffer);
+
+		// bind vertex buffer -------------------------------------------
+
+		// one buffer for both streams, binding 1 is simply not read without VertexFormat::splitPositions
+		VkBuffer vertexBuffers[] = {_vertexBuffer, _vertexBuffer, _constantVertexBuffer};
+		VkDeviceSize offsets[] = {0, _attributeStreamOffset, 0};
+		static_assert(std::size(vertexBuffers) == VertexFormat::CONSTANT_BINDING + 1);
+		vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(std::size(vertexBuffers)), vertexBuffers, offsets);
+
+		// bind index buffer -------------------------------------------
+
+		vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _indexType);
+
+		// bind bindless textures -------------------------------------------
+
+		// set 0 is bound by the caller, with the dynamic offset of its draws
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 1, 1, &_bindlessDescriptorSet, 0, nullptr);
+
+		return commandBuffer;
+	}
+
+	void pushMaterialConstants(VkCommandBuffer commandBuffer, uint32_t material)
+	{
+		MaterialPushConstants constants;
+		constants.baseColor = _materials[material].baseColor;
+		constants.texture = _materials[material].texture;
+		vkCmdPushConstants(commandBuffer, _graphicsPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, MATERIAL_PUSH_CONSTANTS_OFFSET, sizeof(constants), &constants);
+	}
+
+	// Runs on a job system worker, only touches the command pool of that worker.
+	VkCommandBuffer recordDraws(WorkerCommands& worker, uint32_t imageIndex, uint32_t firstDraw, uint32_t lastDraw)
+	{
+		VkCommandBuffer commandBuffer = beginDrawCommands(worker, imageIndex);
+
+		// bind descriptor sets -------------------------------------------
+
+		// TODO: 4th parameter must match the layout(set) used in the shader?
+		// the push constant path still needs an offset for the dynamic binding, the shader just never reads it
+		uint32_t dynamicOffset = static_cast<uint32_t>((_currentFrame * _objectCapacity + firstDraw) * _objectUniformStride);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 0, 1, &_descriptorSets[_currentFrame], 1, &dynamicOffset);
+
+		// draw! -------------------------------------------
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		uint32_t boundMaterial = UINT32_MAX;
+
+		for(uint32_t i = firstDraw; i < lastDraw; ++i)
+		{
+			const SceneObject& object = _objects[_drawList[i].object];
+
+			// bind graphics pipeline -------------------------------------------
+
+			VkPipeline pipeline = _materialPipelines[object.material];
+			if(pipeline != boundPipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+
+			if(object.material != boundMaterial)
+			{
+				pushMaterialConstants(commandBuffer, object.material);
+				boundMaterial = object.material;
+			}
+
+			if(_objectDataPath == ObjectDataPath::PushConstants)
+			{
+				vkCmdPushConstants(commandBuffer, _graphicsPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ObjectUniforms), &object.model);
+			}
+			else if(i != firstDraw)
+			{
+				// rebinding the same set with another dynamic offset is cheap, the descriptor itself does not change
+				dynamicOffset = static_cast<uint32_t>((_currentFrame * _objectCapacity + i) * _objectUniformStride);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 0, 1, &_descriptorSets[_currentFrame], 1, &dynamicOffset);
+			}
+
+			const DrawCommand& draw = _drawCommands[object.drawCommand];
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+		}
+
+		// end command buffer -------------------------------------------
+
+		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording command buffer");
+		}
+
+		return commandBuffer;
+	}
+
+	// Instanced path: one draw per batch, the vertex shader finds the per-object data of every instance with gl_InstanceIndex.
+	VkCommandBuffer recordBatches(WorkerCommands& worker, uint32_t imageIndex, uint32_t firstBatch, uint32_t lastBatch)
+	{
+		VkCommandBuffer commandBuffer = beginDrawCommands(worker, imageIndex);
+
+		// bind descriptor sets -------------------------------------------
+
+		// binding 2 is not read on this path, but a dynamic descriptor still needs a valid offset
+		uint32_t dynamicOffset = static_cast<uint32_t>(_currentFrame * _objectCapacity * _objectUniformStride);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 0, 1, &_descriptorSets[_currentFrame], 1, &dynamicOffset);
+
+		// draw! -------------------------------------------
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+
+		for(uint32_t i = firstBatch; i < lastBatch; ++i)
+		{
+			const DrawBatch& batch = _drawBatches[i];
+
+			VkPipeline pipeline = _materialPipelines[batch.material];
+			if(pipeline != boundPipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+
+			// batches are sorted by material, so this is once per material
+			if(i == firstBatch || batch.material != _drawBatches[i - 1].material)
+			{
+				pushMaterialConstants(commandBuffer, batch.material);
+			}
+
+			const DrawCommand& draw = _drawCommands[batch.drawCommand];
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, batch.instanceCount, draw.firstIndex, draw.vertexOffset, batch.firstInstance);
+		}
+
+		// end command buffer -------------------------------------------
+
+		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording command buffer");
+		}
+
+		return commandBuffer;
+	}
+
+	// GPU driven path: the same commands no matter how many objects there are, cull.comp decides what is drawn.
+	// Recorded against _renderPass, which is compatible with _loadRenderPass, so the late draws execute in either (with dynamic rendering, both passes have the same formats).
+	VkCommandBuffer recordIndirectDraws(WorkerCommands& worker, uint32_t imageIndex, CullPhase phase)
+	{
+		VkCommandBuffer commandBuffer = beginDrawCommands(worker, imageIndex);
+
+		// bind descriptor sets -------------------------------------------
+
+		// binding 2 is not read on this path, but a dynamic descriptor still needs a valid offset
+		uint32_t dynamicOffset = static_cast<uint32_t>(_currentFrame * _objectCapacity * _objectUniformStride);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipelineLayout, 0, 1, &_descriptorSets[_currentFrame], 1, &dynamicOffset);
+
+		// draw! -------------------------------------------
+
+		const VkDeviceSize drawFrameOffset = _currentFrame * getDrawListCount() * _objectCapacity * sizeof(VkDrawIndexedIndirectCommand);
+		const uint32_t firstList = static_cast<uint32_t>(phase) * static_cast<uint32_t>(_materials.size());
+
+		for(uint32_t material = 0; material < _materials.size(); ++material)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _materialPipelines[material]);
+			pushMaterialConstants(commandBuffer, material);
+
+			const uint32_t list = firstList + material;
+			const VkDeviceSize drawOffset = drawFrameOffset + list * _objectCapacity * sizeof(VkDrawIndexedIndirectCommand);
+			const VkDeviceSize countOffset = _currentFrame * _drawCountStride + list * sizeof(uint32_t);
+			vkCmdDrawIndexedIndirectCount(commandBuffer, _indirectDrawBuffer, drawOffset, _drawCountBuffer, countOffset, _objectCapacity, sizeof(VkDrawIndexedIndirectCommand));
+		}
+
+		// end command buffer -------------------------------------------
+
+		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording command buffer");
+		}
+
+		return commandBuffer;
+	}
+
+	// Dispatches cull.comp for phase, which fills the indirect draws read by recordIndirectDraws. Must be recorded outside of a render pass.
+	// The early phase also clears the draw counts of this frame.
+	void recordCulling(VkCommandBuffer commandBuffer, CullPhase phase)
+	{
+		if(phase == CullPhase::Early)
+		{
+			vkCmdFillBuffer(commandBuffer, _drawCountBuffer, _currentFrame * _drawCountStride, getDrawListCount() * sizeof(uint32_t), 0);
+
+			if(!_visibilityCleared)
+			{
+				vkCmdFillBuffer(commandBuffer, _visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+				_visibilityCleared = true;
+			}
+
+			// the clears only, the accesses of other passes are ordered by the render graph (or by the timeline semaphores with async compute)
+			VkMemoryBarrier clearBarrier{};
+			clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+				1, &clearBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		_cullConstants.phase = phase;
+
+		VkDescriptorSet descriptorSets[] = {_cullDescriptorSets[_currentFrame], _depthPyramid.cullSet};
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, static_cast<uint32_t>(std::size(descriptorSets)), descriptorSets, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &_cullConstants);
+		vkCmdDispatch(commandBuffer, (_cullConstants.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	}
+
+	// Reduces the depth of the early pass into _depthPyramid, one dispatch per level. The render graph already made the depth visible to compute.
+	void recordDepthPyramid(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipeline);
+
+		glm::ivec2 sourceSize{static_cast<int>(_swapChainExtent.width), static_cast<int>(_swapChainExtent.height)};
+
+		for(uint32_t level = 0; level < _depthPyramid.levels; ++level)
+		{
+			DepthReducePushConstants constants{};
+			constants.sourceSize = sourceSize;
+			constants.destinationSize = {static_cast<int>(std::max(_depthPyramid.width >> level, 1u)), static_cast<int>(std::max(_depthPyramid.height >> level, 1u))};
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipelineLayout, 0, 1, &_depthPyramid.reduceSets[level], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, _depthReducePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReducePushConstants), &constants);
+			vkCmdDispatch(commandBuffer, (constants.destinationSize.x + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, (constants.destinationSize.y + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, 1);
+
+			// the next level reads this one, and the late cull phase reads all of them
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+			sourceSize = constants.destinationSize;
+		}
+	}
+
+	// Async compute: records the early cull phase of the current frame into its compute command buffer and submits it ahead of the graphics work.
+	// It reads only what the host wrote for this frame and the visibility slice of this frame slot, which was written by the late phase of the frame
+	// that used the slot before (complete, its fence was waited on). So it waits for nothing on the GPU and overlaps the graphics work still queued,
+	// e.g. the late pass of the previous frame. Returns the value of _computeTimeline that the graphics submit of this frame has to wait for.
+	// Untimed: the profiler queries are reset on the graphics queue, after this already ran.
+	uint64_t submitAsyncCompute()
+	{
+		FrameCommands& frame = _frameCommands[_currentFrame];
+
+		// the graphics submit of the previous use of this slot waited on this command buffer, and its fence was waited on
+		vkResetCommandPool(_device, frame.computePool, 0);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if(vkBeginCommandBuffer(frame.compute, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to begin recording compute command buffer");
+		}
+
+		recordCulling(frame.compute, CullPhase::Early);
+
+		if(vkEndCommandBuffer(frame.compute) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to end recording compute command buffer");
+		}
+
+		const uint64_t signalValue = ++_computeTimelineValue;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.compute;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &_computeTimeline;
+
+		if(vkQueueSubmit(_computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit compute command buffer");
+		}
+
+		return signalValue;
+	}
+
+	void createSyncObjects()
+	{
+		_imageAvailableSemaphores.resize(_framesInFlight);
+		_renderFinishedSemaphores.resize(_framesInFlight);
+		_framesInFlightFences.resize(_framesInFlight);
+
+		VkSemaphoreCreateInfo semaphoreCreateInfo{};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkFenceCreateInfo fenceCreateInfo{};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // so we can render the first frame
+
+		for(uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			if(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS ||
+				vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS ||
+				vkCreateFence(_device, &fenceCreateInfo, nullptr, &_framesInFlightFences[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create sync objects");
+			}
+		}
+
+		if(_asyncComputeEnabled)
+		{
+			VkSemaphoreTypeCreateInfo typeCreateInfo{};
+			typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+			typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+			typeCreateInfo.initialValue = 0;
+			semaphoreCreateInfo.pNext = &typeCreateInfo;
+
+			if(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_computeTimeline) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create compute timeline semaphore");
+			}
+			_computeTimelineValue = 0;
+		}
+	}
+
+	void destroySyncObjects()
+	{
+		for(uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			vkDestroySemaphore(_device, _renderFinishedSemaphores[i], nullptr);
+			vkDestroySemaphore(_device, _imageAvailableSemaphores[i], nullptr);
+			vkDestroyFence(_device, _framesInFlightFences[i], nullptr);
+		}
+		if(_computeTimeline != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(_device, _computeTimeline, nullptr);
+		}
+	}
+
+	// Percentiles over the profiler history rather than an average, the p99 is what shows stutter.
+	void updateWindowTitle()
+	{
+		if(isHeadless())
+		{
+			return;
+		}
+
+		static char buffer[256] = {};
+
+		double currentTime = glfwGetTime();
+		if(currentTime - _titleUpdateTime >= 0.5)
+		{
+			const Profiler::Percentiles cpu = _profiler.getPercentiles("frame", false);
+			const Profiler::Percentiles gpu = _profiler.getPercentiles("frame", true);
+
+			const Profiler::Percentiles latency = _profiler.getPercentiles(getLatencyEventName(), false);
+
+			sprintf_s(buffer, std::size(buffer) - 1, "Vulkan Tutorial - frame p50 %.2f ms p99 %.2f ms | GPU p50 %.2f ms p99 %.2f ms | %s p50 %.2f ms p99 %.2f ms (%s)",
+				cpu.p50, cpu.p99, gpu.p50, gpu.p99, getLatencyEventName(), latency.p50, latency.p99, getPresentModeName(_swapChainPresentMode));
+
+			glfwSetWindowTitle(_window, buffer);
+
+			_titleUpdateTime = currentTime;
+		}
+	}
+
+	void drawFrame()
+	{
+		updateWindowTitle();
+		_profiler.beginFrame(_frameNumber);
+
+		// wait until current frame is finished -----------------------------------------------------
+
+		waitForFramePacing();
+		{
+			Profiler::CpuScope scope(_profiler, "vkWaitForFences");
+			vkWaitForFences(_device, 1, &_framesInFlightFences[_currentFrame], VK_TRUE, UINT64_MAX);
+		}
+		_profiler.collect(_currentFrame);
+		collectLatencySamples(); // before the fence is reset
+
+		if(_frameNumber >= _framesInFlight)
+		{
+			runDeferredDeletions(_frameNumber - _framesInFlight);
+		}
+
+		// sample input as late as possible, everything from here on is input to photon latency -----------------------------------------------------
+
+		if(!isHeadless())
+		{
+			glfwPollEvents();
+		}
+		const double inputTime = _profiler.now();
+
+		// retire finished uploads and submit the ones recorded since last frame -----------------------------------------------------
+
+		uint64_t uploadValue = 0;
+		{
+			Profiler::CpuScope scope(_profiler, "uploads");
+			_uploadEngine.collect();
+			uploadValue = _uploadEngine.flush();
+		}
+
+		// acquire next image from swap chain -----------------------------------------------------
+
+		// headless: the offscreen image of this frame is free since its fence was waited on
+		uint32_t imageIndex = _currentFrame;
+		VkResult result = VK_SUCCESS;
+		if(!isHeadless())
+		{
+			Profiler::CpuScope scope(_profiler, "vkAcquireNextImageKHR");
+			result = vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[_currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
+
+		if(result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			// the fence is still signaled since nothing was submitted, so the next attempt does not block on it
+			recreateSwapChain();
+			return;
+		}
+		else if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("failed to acquire swap chain image");
+		}
+
+		// only reset the fence once we know we are going to submit work with it
+		vkResetFences(_device, 1, &_framesInFlightFences[_currentFrame]);
+
+		// update UBOs -----------------------------------------------------
+
+		// The updateUniformBuffer takes care of screen resizing, so we don't need to recreate the descriptor set in recreateSwapChain.
+		{
+			Profiler::CpuScope scope(_profiler, "updateUniformBuffer");
+			updateUniformBuffer(_currentFrame);
+		}
+
+		// memory budget -----------------------------------------------------
+
+		checkMemoryBudget();
+
+		// kick off async compute first, it runs while the graphics work below is recorded -----------------------------------------------------
+
+		uint64_t computeValue = 0;
+		if(_asyncComputeEnabled)
+		{
+			Profiler::CpuScope scope(_profiler, "submitAsyncCompute");
+			computeValue = submitAsyncCompute();
+		}
+
+		// record command buffers -----------------------------------------------------
+
+		{
+			Profiler::CpuScope scope(_profiler, "recordCommandBuffer");
+			recordCommandBuffer(imageIndex);
+		}
+
+		// submit command buffers to graphics queue -----------------------------------------------------
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+		// these three arrays run in parallel
+		// the upload timeline makes the frame wait for resources it may read, the value is ignored for the binary semaphore
+		// the compute timeline holds back the indirect draws and the late cull phase until the early cull phase is done
+		VkSemaphore waitSemaphores[] = {_imageAvailableSemaphores[_currentFrame], _uploadEngine.getTimeline(), _computeTimeline};
+		VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+		uint64_t waitValues[] = {0, uploadValue, computeValue};
+		const uint32_t firstWait = isHeadless() ? 1 : 0; // no image to wait for when headless
+		const uint32_t waitCount = static_cast<uint32_t>(std::size(waitSemaphores)) - (_asyncComputeEnabled ? 0 : 1) - firstWait;
+		submitInfo.waitSemaphoreCount = waitCount;
+		submitInfo.pWaitSemaphores = waitSemaphores + firstWait;
+		submitInfo.pWaitDstStageMask = waitStages + firstWait;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = waitCount;
+		timelineInfo.pWaitSemaphoreValues = waitValues + firstWait;
+		submitInfo.pNext = &timelineInfo;
+
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &_frameCommands[_currentFrame].primary;
+
+		// TODO: if graphics and present queues are the same we don't need a semaphore for explicit synchronization?
+		VkSemaphore renderFinishedSemaphores[] = {_renderFinishedSemaphores[_currentFrame]};
+		//if(_queueFamilies.graphics != _queueFamilies.present)
+		if(!isHeadless())
+		{
+			submitInfo.signalSemaphoreCount = static_cast<uint32_t>(std::size(renderFinishedSemaphores));
+			submitInfo.pSignalSemaphores = renderFinishedSemaphores;
+		}
+
+		// the waits and signals happen on the device that runs the frame
+		const uint32_t deviceIndex = getFrameDeviceIndex();
+		const uint32_t deviceMask = getFrameDeviceMask();
+		const std::vector<uint32_t> waitDeviceIndices(submitInfo.waitSemaphoreCount, deviceIndex);
+		const std::vector<uint32_t> signalDeviceIndices(submitInfo.signalSemaphoreCount, deviceIndex);
+		VkDeviceGroupSubmitInfo deviceGroupSubmitInfo{};
+		deviceGroupSubmitInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+		deviceGroupSubmitInfo.waitSemaphoreCount = submitInfo.waitSemaphoreCount;
+		deviceGroupSubmitInfo.pWaitSemaphoreDeviceIndices = waitDeviceIndices.data();
+		deviceGroupSubmitInfo.commandBufferCount = submitInfo.commandBufferCount;
+		deviceGroupSubmitInfo.pCommandBufferDeviceMasks = &deviceMask;
+		deviceGroupSubmitInfo.signalSemaphoreCount = submitInfo.signalSemaphoreCount;
+		deviceGroupSubmitInfo.pSignalSemaphoreDeviceIndices = signalDeviceIndices.data();
+		if(_deviceGroup.size() > 1)
+		{
+			timelineInfo.pNext = &deviceGroupSubmitInfo;
+		}
+
+		{
+			Profiler::CpuScope scope(_profiler, "vkQueueSubmit");
+			_profiler.markSubmit();
+			if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _framesInFlightFences[_currentFrame]) != VK_SUCCESS)
+			{
+				// device loss is often an overcommitted heap, the report is all there is to tell afterwards
+				printMemoryReport(stderr);
+				throw std::runtime_error("failed to submit draw command buffer");
+			}
+		}
+
+		if(!_presentWaitEnabled)
+		{
+			_latencySamples.push_back({_frameNumber, _currentFrame, inputTime});
+		}
+
+		if(isHeadless())
+		{
+			finishFrame();
+			return;
+		}
+
+		// present image on screen -----------------------------------------------------
+
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+		// // TODO: if graphics and present queues are the same we don't need a semaphore for explicit synchronization?
+		//if(_queueFamilies.graphics != _queueFamilies.present)
+		{
 			presentInfo.waitSemaphoreCount = static_cast<uint32_t>(std::size(renderFinishedSemaphores));
 			presentInfo.pWaitSemaphores = renderFinishedSemaphores;
 		}
 
-		// these two arrays run in parallel
-		VkSwapchainKHR swapChains[] = {_swapChain};
-		uint32_t imageIndices[] = {imageIndex};
-		presentInfo.swapchainCount = static_cast<uint32_t>(std::size(swapChains));
-		presentInfo.pSwapchains = swapChains;
-		presentInfo.pImageIndices = imageIndices;
+		// these two arrays run in parallel
+		VkSwapchainKHR swapChains[] = {_swapChain};
+		uint32_t imageIndices[] = {imageIndex};
+		presentInfo.swapchainCount = static_cast<uint32_t>(std::size(swapChains));
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = imageIndices;
+
+		presentInfo.pResults = nullptr; // Optional
+
+		// frame f is present id f + 1, 0 means no id
+		const uint64_t presentId = _frameNumber + 1;
+		VkPresentIdKHR presentIdInfo{};
+		presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+		presentIdInfo.swapchainCount = 1;
+		presentIdInfo.pPresentIds = &presentId;
+		if(_presentWaitEnabled)
+		{
+			presentInfo.pNext = &presentIdInfo;
+		}
+
+		{
+			Profiler::CpuScope scope(_profiler, "vkQueuePresentKHR");
+			result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+		}
+
+		if(_presentWaitEnabled && (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR))
+		{
+			_lastPresentId = presentId;
+			_latencySamples.push_back({_frameNumber, _currentFrame, inputTime});
+		}
+
+		if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || _windowResized)
+		{
+			_windowResized = false;
+			recreateSwapChain();
+		}
+		else if(result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to present swap chain image");
+		}
+
+		finishFrame();
+	}
+
+	// Just in time frame start: instead of queueing up to _framesInFlight frames behind the display, wait until frame f - paceFrames is on screen,
+	// so that the input of frame f is sampled as late as the display allows. Most useful with FIFO, where the queue is otherwise always full.
+	void waitForFramePacing()
+	{
+		if(!_presentWaitEnabled || _settings.paceFrames == 0 || _frameNumber < _settings.paceFrames)
+		{
+			return;
+		}
+
+		const uint64_t presentId = _frameNumber - _settings.paceFrames + 1;
+		if(presentId > _lastPresentId)
+		{
+			return; // not presented to the current swapchain, it was out of date or recreated since
+		}
+
+		Profiler::CpuScope scope(_profiler, "vkWaitForPresentKHR");
+		const VkResult result = _vkWaitForPresentKHR(_device, _swapChain, presentId, PRESENT_WAIT_TIMEOUT);
+		if(result != VK_SUCCESS && result != VK_TIMEOUT && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			throw std::runtime_error("failed to wait for present");
+		}
+	}
+
+	const char* getLatencyEventName() const
+	{
+		return _presentWaitEnabled ? "input to photon" : "input to GPU done";
+	}
+
+	// Input to photon estimates: from sampling the input of a frame to its image being presented with VK_KHR_present_wait, otherwise only to the end
+	// of its rendering. Polled once per frame, so every sample is late by up to a frame; they end up as CPU events in the profiler report.
+	void collectLatencySamples()
+	{
+		while(!_latencySamples.empty())
+		{
+			const LatencySample& sample = _latencySamples.front();
+			const bool done = _presentWaitEnabled ?
+				_vkWaitForPresentKHR(_device, _swapChain, sample.frameNumber + 1, 0) == VK_SUCCESS :
+				vkGetFenceStatus(_device, _framesInFlightFences[sample.frameIndex]) == VK_SUCCESS;
+			if(!done)
+			{
+				return;
+			}
+
+			_profiler.addCpuEvent(getLatencyEventName(), sample.inputTime, _profiler.now());
+			_latencySamples.pop_front();
+		}
+	}
+
+	void finishFrame()
+	{
+		// goto next frame -----------------------------------------------------
+
+		_profiler.endFrame();
+		_allocator.endFrame(_frameNumber);
+
+		_currentFrame = (_currentFrame + 1) % _framesInFlight;
+		++_frameNumber;
+	}
+
+	// Only the objects that depend on the swapchain images or extent, the render pass and pipeline only depend on the formats.
+	void cleanupSwapChain()
+	{
+		destroyDepthPyramid(_depthPyramid);
+		destroyRenderGraph();
+		destroyFramebuffers();
+		destroySwapChainImageViews();
+		if(isHeadless())
+		{
+			destroyOffscreenImages();
+			return;
+		}
+		vkDestroySwapchainKHR(_device, _swapChain, nullptr);
+	}
+
+	void recreateSwapChain()
+	{
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(_window, &width, &height);
+		while(width == 0 || height == 0)
+		{
+			glfwGetFramebufferSize(_window, &width, &height);
+			glfwWaitEvents();
+		}
+
+		// present ids are per swapchain, the pending ones can not be waited for on the new one
+		_lastPresentId = 0;
+		if(_presentWaitEnabled)
+		{
+			_latencySamples.clear();
+		}
+
+		if(!checkPhysicalDeviceSwapChain(_physicalDevice, _swapChainInfo))
+		{
+			throw std::runtime_error("swapchain is not compatible anymore");
+		}
+
+		// the render pass (and so the pipeline) only has to change if the surface format does, e.g. when moving to an HDR monitor
+		if(chooseSwapSurfaceFormat(_swapChainInfo.formats).format != _swapChainImageFormat)
+		{
+			vkDeviceWaitIdle(_device);
+			runDeferredDeletions(UINT64_MAX);
+
+			cleanupSwapChain();
+			_swapChain = VK_NULL_HANDLE;
+			destroyPipelines();
+			destroyRenderPass();
+
+			createSwapChain();
+			createSwapChainImageViews();
+			createRenderPass();
+			createMaterials();
+			createRenderGraph();
+			createDepthPyramid();
+			createFramebuffers();
+			return;
+		}
+
+		// Frames in flight may still be rendering to the old images, so instead of waiting for the device to go idle
+		// the old objects are retired and destroyed once every frame submitted so far has finished.
+		VkSwapchainKHR oldSwapChain = _swapChain;
+		std::vector<VkImageView> oldImageViews = std::move(_swapChainImageViews);
+		std::vector<VkFramebuffer> oldFramebuffers = std::move(_framebuffers);
+		RenderGraph oldRenderGraph = std::move(_renderGraph);
+		_renderGraph = {};
+		DepthPyramid oldDepthPyramid = std::move(_depthPyramid);
+		_depthPyramid = {};
+
+		createSwapChain(oldSwapChain);
+		createSwapChainImageViews();
+		createRenderGraph();
+		createDepthPyramid();
+		createFramebuffers();
+
+		deferDeletion([=, this]() mutable
+		{
+			for(auto framebuffer : oldFramebuffers)
+			{
+				vkDestroyFramebuffer(_device, framebuffer, nullptr);
+			}
+			destroyDepthPyramid(oldDepthPyramid);
+			oldRenderGraph.destroy();
+			for(auto imageView : oldImageViews)
+			{
+				vkDestroyImageView(_device, imageView, nullptr);
+			}
+			vkDestroySwapchainKHR(_device, oldSwapChain, nullptr);
+		});
+	}
+
+	// Runs deletion after every frame submitted up to now has completed on the GPU.
+	void deferDeletion(std::function<void()> deletion)
+	{
+		_deferredDeletions.push_back({_frameNumber, std::move(deletion)});
+	}
+
+	// Frame f waits for the fence of frame f - _framesInFlight, so every frame up to that one is known to be complete.
+	void runDeferredDeletions(uint64_t completedFrame)
+	{
+		while(!_deferredDeletions.empty() && _deferredDeletions.front().first <= completedFrame)
+		{
+			_deferredDeletions.front().second();
+			_deferredDeletions.pop_front();
+		}
+	}
+
+	// Returns the memory types that have all the required flags, best first.
+	// Types are ranked by how many preferred flags they have, then by how few unrequested flags they carry
+	// (e.g. a device local texture should not land in host visible memory), then by heap size.
+	std::vector<uint32_t> rankMemoryTypes(uint32_t typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0)
+	{
+		const auto& memProperties = _allocator.getMemoryProperties();
+
+		bool unifiedMemory = true;
+		for(uint32_t i = 0; i < memProperties.memoryHeapCount; ++i)
+		{
+			unifiedMemory &= (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		}
+
+		const VkMemoryPropertyFlags wanted = required | preferred;
+		const VkMemoryPropertyFlags avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+			VK_MEMORY_PROPERTY_DEVICE_COHERENT_BIT_AMD | VK_MEMORY_PROPERTY_DEVICE_UNCACHED_BIT_AMD | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+		std::vector<std::pair<int, uint32_t>> candidates;
+		for(uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+		{
+			const auto& type = memProperties.memoryTypes[i];
+			if(!(typeFilter & (1 << i)) || (type.propertyFlags & required) != required)
+			{
+				continue;
+			}
+
+			const auto& heap = memProperties.memoryHeaps[type.heapIndex];
+
+			// with a device group, allocations in these heaps get one instance per GPU and can not be mapped
+			if((required & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && _deviceGroup.size() > 1 && (heap.flags & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT))
+			{
+				continue;
+			}
+
+			int score = 1000 * std::popcount(type.propertyFlags & preferred);
+			score -= 100 * std::popcount(type.propertyFlags & avoided & ~wanted);
+			score += std::bit_width(static_cast<uint64_t>(heap.size >> 20));
+
+			// keep the small BAR heap for resources that actually need to be written by the host
+			if(!unifiedMemory && !(required & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+				(type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && heap.size <= SMALL_BAR_HEAP_SIZE)
+			{
+				score -= 2000;
+			}
+
+			candidates.emplace_back(score, i);
+		}
+
+		std::stable_sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b){ return a.first > b.first; });
+
+		std::vector<uint32_t> ranked;
+		for(const auto& candidate : candidates)
+		{
+			ranked.push_back(candidate.second);
+		}
+		return ranked;
+	}
+
+	// Walks the ranked memory types until one of them still has budget left in its heap.
+	Allocation allocateMemory(const VkMemoryRequirements& memRequirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, MemoryAllocator::ResourceKind kind,
+		const MemoryAllocator::ResourceInfo& info)
+	{
+		auto memoryTypes = rankMemoryTypes(memRequirements.memoryTypeBits, required, preferred);
+		if(memoryTypes.empty())
+		{
+			throw std::runtime_error("failed to find suitable memory type");
+		}
+
+		Allocation allocation;
+		for(auto memoryTypeIndex : memoryTypes)
+		{
+			if(_allocator.tryAllocate(memRequirements, memoryTypeIndex, kind, info, allocation))
+			{
+				return allocation;
+			}
+			printf("memory type %u is over budget for \"%s\" (%llu KiB), trying next candidate\n", memoryTypeIndex, info.tag, static_cast<unsigned long long>(memRequirements.size >> 10));
+		}
+
+		// what was using the memory is the first question after an out of memory
+		printMemoryReport(stderr);
+		throw std::runtime_error(std::string("failed to allocate memory for \"") + info.tag + "\": all suitable heaps are over budget");
+	}
+
+	// The memory dashboard, on F2, at cleanup and when running out of memory: budget, usage and peaks of every heap,
+	// how fragmented the blocks of every memory type are, and what the memory is used for, by tag.
+	void printMemoryReport(FILE* file)
+	{
+		_allocator.updateBudget();
+		const VkPhysicalDeviceMemoryProperties& memoryProperties = _allocator.getMemoryProperties();
+		auto mib = [](VkDeviceSize bytes) { return static_cast<double>(bytes) / (1 << 20); };
+
+		fprintf(file, "memory report at frame %llu%s\n", static_cast<unsigned long long>(_frameNumber),
+			_allocator.isMemoryBudgetSupported() ? "" : " (budget estimated, VK_EXT_memory_budget not available)");
+
+		for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		{
+			// usage also counts the memory of other processes, allocated only ours
+			const MemoryAllocator::HeapPeaks peaks = _allocator.getHeapPeaks(i);
+			const VkDeviceSize budget = _allocator.getHeapBudget(i);
+			const VkDeviceSize usage = _allocator.getHeapUsage(i);
+			fprintf(file, "  heap %u%s: usage %.1f of %.1f MiB budget%s, allocated %.1f MiB, last frame peak %.1f MiB, peak %.1f MiB in frame %llu\n", i,
+				(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "", mib(usage), mib(budget), usage > budget ? " OVER BUDGET" : "",
+				mib(peaks.live), mib(peaks.lastFrame), mib(peaks.peak), static_cast<unsigned long long>(peaks.peakFrame));
+		}
+
+		const std::vector<MemoryAllocator::MemoryTypeStats> typeStats = _allocator.getMemoryTypeStats();
+		for(uint32_t i = 0; i < typeStats.size(); ++i)
+		{
+			const MemoryAllocator::MemoryTypeStats& stats = typeStats[i];
+			if(stats.blockBytes == 0)
+			{
+				continue;
+			}
+
+			// 0% when the free memory is a single range, close to 100% when it is scattered over many small ones
+			const double fragmentation = stats.freeBytes > 0 ? 100.0 * (1.0 - static_cast<double>(stats.largestFreeRange) / stats.freeBytes) : 0.0;
+			fprintf(file, "  type %u (heap %u): %u blocks + %u dedicated, %.1f MiB, %.1f MiB used by %u allocations, %.1f MiB free in %u ranges, largest %.1f MiB, fragmentation %.0f%%\n",
+				i, memoryProperties.memoryTypes[i].heapIndex, stats.blockCount, stats.dedicatedBlockCount, mib(stats.blockBytes), mib(stats.usedBytes), stats.allocationCount,
+				mib(stats.freeBytes), stats.freeRangeCount, mib(stats.largestFreeRange), fragmentation);
+		}
+
+		struct TagUsage
+		{
+			const char* tag = nullptr;
+			VkObjectType type = VK_OBJECT_TYPE_UNKNOWN;
+			uint32_t heapIndex = 0;
+			uint32_t count = 0;
+			VkDeviceSize bytes = 0;
+		};
+
+		std::map<std::pair<std::string_view, uint32_t>, TagUsage> tags;
+		for(const MemoryAllocator::Resource& resource : _allocator.getResources())
+		{
+			TagUsage& usage = tags[{resource.info.tag, resource.heapIndex}];
+			usage.tag = resource.info.tag;
+			usage.type = resource.info.type;
+			usage.heapIndex = resource.heapIndex;
+			++usage.count;
+			usage.bytes += resource.size;
+		}
+
+		std::vector<TagUsage> sortedTags;
+		for(const auto& [key, usage] : tags)
+		{
+			sortedTags.push_back(usage);
+		}
+		std::sort(sortedTags.begin(), sortedTags.end(), [](const TagUsage& a, const TagUsage& b) { return a.bytes > b.bytes; });
+
+		for(const TagUsage& usage : sortedTags)
+		{
+			fprintf(file, "  %-24s heap %u: %u %s, %.1f MiB\n", usage.tag, usage.heapIndex, usage.count, MemoryAllocator::getObjectTypeName(usage.type), mib(usage.bytes));
+		}
+
+		putc('\n', file);
+	}
+
+	// sharedWithCompute: the buffer is used by both the graphics and the async compute queue, see setComputeSharing
+	// tag: what the memory dashboard reports the buffer as, a string literal
+	void createBuffer(const char* tag, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory, VkMemoryPropertyFlags preferredProperties = 0,
+		bool sharedWithCompute = false)
+	{
+		VkBufferCreateInfo bufferCreateInfo{};
+		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferCreateInfo.size = size;
+		bufferCreateInfo.usage = usage;
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		const uint32_t sharingFamilies[] = {_queueFamilies.graphics.value(), _queueFamilies.compute.value()};
+		if(sharedWithCompute)
+		{
+			setComputeSharing(bufferCreateInfo, sharingFamilies);
+		}
+
+		if(vkCreateBuffer(_device, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create buffer");
+		}
+
+		// In a real world application, you're not supposed to actually call vkAllocateMemory for every individual buffer.
+		// The maximum number of simultaneous memory allocations is limited by the maxMemoryAllocationCount physical device limit, which may be as low as 4096 even on high end hardware like an NVIDIA GTX 1080.
+		// So the buffer is carved out of a big block by MemoryAllocator instead, which honors memRequirements.alignment and bufferImageGranularity.
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+
+		bufferMemory = allocateMemory(memRequirements, properties, preferredProperties, MemoryAllocator::ResourceKind::Linear, {tag, VK_OBJECT_TYPE_BUFFER, reinterpret_cast<uint64_t>(buffer)});
+
+		// the offset is required to be divisible by memRequirements.alignment, which the allocator guarantees
+		if(vkBindBufferMemory(_device, buffer, bufferMemory.memory, bufferMemory.offset) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to bind buffer memory");
+		}
+	}
+
+	// Concurrent sharing between the graphics and the async compute families, so that resources written on one queue and read on the other need
+	// no queue family ownership transfers, the timeline semaphores order the accesses. Exclusive (and unchanged) without async compute.
+	template<typename CreateInfo>
+	void setComputeSharing(CreateInfo& createInfo, const uint32_t (&families)[2])
+	{
+		if(!_asyncComputeEnabled)
+		{
+			return;
+		}
+
+		createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = static_cast<uint32_t>(std::size(families));
+		createInfo.pQueueFamilyIndices = families;
+	}
+
+	void destroyBuffer(VkBuffer& buffer, Allocation& bufferMemory)
+	{
+		vkDestroyBuffer(_device, buffer, nullptr);
+		_allocator.free(bufferMemory);
+		buffer = VK_NULL_HANDLE;
+	}
+
+	// Returns mapped staging memory for the current upload batch: a slice of the staging ring, or a temporary buffer released with the batch if size does not fit in the ring.
+	UploadEngine::StagingRegion allocateStaging(VkDeviceSize size)
+	{
+		UploadEngine::StagingRegion region;
+		if(_uploadEngine.allocateStaging(size, STAGING_ALIGNMENT, region))
+		{
+			return region;
+		}
+
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		Allocation stagingBufferMemory;
+		createBuffer("staging", size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		_uploadEngine.onComplete([this, stagingBuffer, stagingBufferMemory]() mutable { destroyBuffer(stagingBuffer, stagingBufferMemory); });
+
+		region.buffer = stagingBuffer;
+		region.offset = 0;
+		region.mapped = stagingBufferMemory.mapped;
+		return region;
+	}
+
+	void createDeviceLocalBuffer(const char* tag, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& bufferMemory)
+	{
+		createDeviceLocalBuffer(tag, size, usage, buffer, bufferMemory, [&](void* dst) { memcpy(dst, data, (size_t)size); });
+	}
+
+	// Creates a device local buffer and lets fill write its contents straight into mapped memory.
+	// With resizable BAR or on integrated GPUs the buffer memory is host visible as well, so fill writes into it directly and the staging copy is skipped.
+	// Otherwise fill writes into the staging ring.
+	void createDeviceLocalBuffer(const char* tag, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& bufferMemory, const std::function<void(void*)>& fill)
+	{
+		createBuffer(tag, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		if(bufferMemory.mapped)
+		{
+			fill(bufferMemory.mapped);
+			_allocator.flush(bufferMemory);
+			return;
+		}
+
+		UploadEngine::StagingRegion staging = allocateStaging(size);
+		fill(staging.mapped);
+
+		// queued in the current upload batch, which is submitted with the next frame
+		_uploadEngine.copyBuffer(staging.buffer, buffer, size, staging.offset);
+
+		VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT;
+		if(usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+		{
+			dstStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+			dstAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		}
+		else if(usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+		{
+			dstStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+			dstAccess = VK_ACCESS_INDEX_READ_BIT;
+		}
+		_uploadEngine.releaseBuffer(buffer, dstStage, dstAccess);
+	}
+
+	void createVertexBuffer()
+	{
+		// TODO: the driver may not immediately copy the data into the buffer memory, for example because of caching.
+		// It is also possible that writes to the buffer are not visible in the mapped memory yet.
+		// There are two ways to deal with that problem:
+		// - Use a memory heap that is host coherent, indicated with VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		// - Call vkFlushMappedMemoryRanges after writing to the mapped memory, and call vkInvalidateMappedMemoryRanges before reading from the mapped memory
+		// We went for the first approach, which ensures that the mapped memory always matches the contents of the allocated memory.
+		// Do keep in mind that this may lead to slightly worse performance than explicit flushing, but we'll see why that doesn't matter in the next chapter.
+
+		// Flushing memory ranges or using a coherent memory heap means that the driver will be aware of our writes to the buffer, but it doesn't mean that they are actually visible on the GPU yet.
+		// The transfer of data to the GPU is an operation that happens in the background and the specification simply tells us that it is guaranteed to be complete as of the next call to vkQueueSubmit.
+
+		VkDeviceSize bufferSize = _vertexData.size_bytes();
+
+		createDeviceLocalBuffer("vertices", _vertexData.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, _vertexBuffer, _vertexBufferMemory);
+
+		// attributes that are the same for every vertex, read with stride 0
+		const glm::vec3 constantColor(1.0f, 1.0f, 1.0f);
+		createDeviceLocalBuffer("constant color", &constantColor, sizeof(constantColor), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, _constantVertexBuffer, _constantVertexBufferMemory);
+	}
+
+	void destroyVertexBuffer()
+	{
+		destroyBuffer(_constantVertexBuffer, _constantVertexBufferMemory);
+		destroyBuffer(_vertexBuffer, _vertexBufferMemory);
+	}
+
+	void createIndexBuffer()
+	{
+		// TODO: Remember you should allocate multiple resources like buffers from a single memory allocation, but in fact you should go a step further.
+		// Driver developers recommend that you also store multiple buffers, like the vertex and index buffer, into a single VkBuffer and use offsets in commands like vkCmdBindVertexBuffers.
+		// The advantage is that your data is more cache friendly in that case, because it's closer together.
+		// It is even possible to reuse the same chunk of memory for multiple resources if they are not used during the same render operations, provided that their data is refreshed, of course.
+		// This is known as aliasing and some Vulkan functions have explicit flags to specify that you want to do this.
+
+		VkDeviceSize bufferSize = _indexData.size_bytes();
+
+		createDeviceLocalBuffer("indices", _indexData.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, _indexBuffer, _indexBufferMemory);
+	}
+
+	void destroyIndexBuffer()
+	{
+		destroyBuffer(_indexBuffer, _indexBufferMemory);
+	}
+
+	void createDescriptorSetLayout()
+	{
+		// Each descriptor set may have multiple resources of the same or different type.
+		// What type of resources can be bound through a descriptor set is defined in a descriptor set layout.
+		// There, through a VkDescriptorSetLayoutBinding structure, You specify a given type of a resource (for example sampler, storage image or uniform buffer) and the number of resources of this type accessed as an array inside shader.
+		// You can also specify multiple resources of the same or different types as separate layout entries (multiple VkDescriptorSetLayoutBinding entries specified during layout creation).
+		// Each such descriptor must use a separate, different binding.
+		// And the same binding must be used inside shader to access given resource:
+		//   layout(set = S, binding = B) uniform <variable_type> <variable_name>;
+		// So, to sum that up:
+		//   You can have an(homogenous) array of a single descriptor type
+		//   You can have several "bindings" which each can hold any descriptor type resource(or their array)
+		//   And as one more layer of indirection you can have several descriptor sets each with its own bindings
+		// Rule of thumb is probably "less is more".
+		// If you do not need the resources to have separate types or names, use array.
+		// If you do not need separate set, use only one set.
+
+		// example shader code:
+		//
+		//	// binding to a single sampled image descriptor in set 0
+		//	layout(set = 0, binding = 0) uniform texture2D mySampledImage;
+		//
+		//	// binding to an array of sampled image descriptors in set 0
+		//	layout(set = 0, binding = 1) uniform texture2D myArrayOfSampledImages[12];
+		//
+		//	// binding to a single uniform buffer descriptor in set 1
+		//	layout(set = 1, binding = 0) uniform myUniformBuffer
+		//	{
+		//		 vec4 myElement[32];
+		//	};
+		// 
+		// correspinding example API code:
+		//
+		//	const VkDescriptorSetLayoutBinding myDescriptorSetLayoutBinding[] =
+		//	{
+		//		// binding to a single image descriptor
+		//		{
+		//			0,                                      // binding
+		//			VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,       // descriptorType
+		//			1,                                      // descriptorCount
+		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
+		//			NULL                                    // pImmutableSamplers
+		//		},
+		//		// binding to an array of image descriptors
+		//		{
+		//			1,                                      // binding
+		//			VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,       // descriptorType
+		//			12,                                     // descriptorCount
+		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
+		//			NULL                                    // pImmutableSamplers
+		//		},
+		//		// binding to a single uniform buffer descriptor
+		//		{
+		//			0,                                      // binding
+		//			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,      // descriptorType
+		//			1,                                      // descriptorCount
+		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
+		//			NULL                                    // pImmutableSamplers
+		//		}
+		//	};
+		//	const VkDescriptorSetLayoutCreateInfo myDescriptorSetLayoutCreateInfo[] =
+		//	{
+		//		// Create info for first descriptor set with two descriptor bindings
+		//		{
+		//			VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    // sType
+		//			NULL,                                                   // pNext
+		//			0,                                                      // flags
+		//			2,                                                      // bindingCount
+		//			&myDescriptorSetLayoutBinding[0]                        // pBindings
+		//		},
+		//		// Create info for second descriptor set with one descriptor binding
+		//		{
+		//			VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    // sType
+		//			NULL,                                                   // pNext
+		//			0,                                                      // flags
+		//			1,                                                      // bindingCount
+		//			&myDescriptorSetLayoutBinding[2]                        // pBindings
+		//		}
+		//	};
+		//	VkDescriptorSetLayout myDescriptorSetLayout[2];
+		//	//
+		//	// Create first descriptor set layout
+		//	//
+		//	myResult = vkCreateDescriptorSetLayout(
+		//		myDevice,
+		//		&myDescriptorSetLayoutCreateInfo[0],
+		//		NULL,
+		//		&myDescriptorSetLayout[0]);
+		//	//
+		//	// Create second descriptor set layout
+		//	//
+		//	myResult = vkCreateDescriptorSetLayout(
+		//		myDevice,
+		//		&myDescriptorSetLayoutCreateInfo[1],
+		//		NULL,
+		//		&myDescriptorSetLayout[1]);
+
+		// TODO: It is possible for the shader variable to represent an array of uniform buffer objects, and descriptorCount specifies the number of values in the array.
+		// This could be used to specify a transformation for each of the bones in a skeleton for skeletal animation, for example.
+		// Our MVP transformation is in a single uniform buffer object, so we're using a descriptorCount of 1.
+		VkDescriptorSetLayoutBinding uboLayoutBinding{};
+		uboLayoutBinding.binding = 0; // // must match layout(binding) used in the shader
+		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		uboLayoutBinding.descriptorCount = 1;
+		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+		// binding 1 used to be the texture, now in the bindless set, see createBindlessTextures
+
+		// per-object data: the same descriptor is used by every object, each draw only changes the dynamic offset
+		VkDescriptorSetLayoutBinding objectLayoutBinding{};
+		objectLayoutBinding.binding = 2;
+		objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		objectLayoutBinding.descriptorCount = 1;
+		objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		objectLayoutBinding.pImmutableSamplers = nullptr;
+
+		// per-object data of the GPU driven path, indexed with gl_InstanceIndex
+		VkDescriptorSetLayoutBinding objectStorageLayoutBinding{};
+		objectStorageLayoutBinding.binding = 3;
+		objectStorageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		objectStorageLayoutBinding.descriptorCount = 1;
+		objectStorageLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		objectStorageLayoutBinding.pImmutableSamplers = nullptr;
+
+		VkDescriptorSetLayoutBinding bindings[] = {uboLayoutBinding, objectLayoutBinding, objectStorageLayoutBinding};
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.bindingCount = static_cast<uint32_t>(std::size(bindings));
+		layoutCreateInfo.pBindings = bindings;
+
+		if(vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create descriptor set layout");
+		}
+	}
+
+	// One global set with a partially bound array of every texture, indexed in the fragment shader with the texture of the material (see MaterialPushConstants).
+	// Update after bind lets registerTexture fill slots while frames bound to the set are still in flight, so the set is never reallocated nor rebound,
+	// and changing the material between draws is a push constant instead of a descriptor set bind.
+	void createBindlessTextures()
+	{
+		VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+		vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+		VkPhysicalDeviceProperties2 properties{};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &vulkan12Properties;
+		vkGetPhysicalDeviceProperties2(_physicalDevice, &properties);
+
+		const uint32_t capacity = std::min({MAX_BINDLESS_TEXTURES,
+			vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages, vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers,
+			vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+		VkDescriptorSetLayoutBinding textureLayoutBinding{};
+		textureLayoutBinding.binding = 0;
+		textureLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		textureLayoutBinding.descriptorCount = capacity;
+		textureLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		textureLayoutBinding.pImmutableSamplers = nullptr;
+
+		// partially bound: free slots are never written, the shader must simply not index them
+		// update unused while pending: writing a slot no pending command buffer reads is fine, the others are only recycled once their frames are done
+		VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{};
+		bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsCreateInfo.bindingCount = 1;
+		bindingFlagsCreateInfo.pBindingFlags = &bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+		layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		layoutCreateInfo.bindingCount = 1;
+		layoutCreateInfo.pBindings = &textureLayoutBinding;
+
+		if(vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &_bindlessDescriptorSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create bindless descriptor set layout");
+		}
+
+		VkDescriptorPoolSize poolSize{};
+		poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSize.descriptorCount = capacity;
+
+		VkDescriptorPoolCreateInfo poolCreateInfo{};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		poolCreateInfo.poolSizeCount = 1;
+		poolCreateInfo.pPoolSizes = &poolSize;
+		poolCreateInfo.maxSets = 1;
+
+		if(vkCreateDescriptorPool(_device, &poolCreateInfo, nullptr, &_bindlessDescriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create bindless descriptor pool");
+		}
+
+		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocateInfo.descriptorPool = _bindlessDescriptorPool;
+		descriptorSetAllocateInfo.descriptorSetCount = 1;
+		descriptorSetAllocateInfo.pSetLayouts = &_bindlessDescriptorSetLayout;
+
+		if(vkAllocateDescriptorSets(_device, &descriptorSetAllocateInfo, &_bindlessDescriptorSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate bindless descriptor set");
+		}
+
+		// handed out from the back, so slot 0 goes first
+		_freeTextureSlots.resize(capacity);
+		std::iota(_freeTextureSlots.rbegin(), _freeTextureSlots.rend(), 0u);
+
+		printf("bindless textures: %u slots\n", capacity);
+		putc('\n', stdout);
+	}
+
+	void destroyBindlessTextures()
+	{
+		// frees the set as well
+		vkDestroyDescriptorPool(_device, _bindlessDescriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _bindlessDescriptorSetLayout, nullptr);
+		_freeTextureSlots.clear();
+	}
+
+	// Returns the slot of the bindless texture array that now holds view and sampler, view must be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL when sampled.
+	uint32_t registerTexture(VkImageView view, VkSampler sampler)
+	{
+		if(_freeTextureSlots.empty())
+		{
+			throw std::runtime_error("out of bindless texture slots");
+		}
+
+		const uint32_t slot = _freeTextureSlots.back();
+		_freeTextureSlots.pop_back();
+
+		writeTextureSlot(slot, view, sampler);
+		return slot;
+	}
+
+	void writeTextureSlot(uint32_t slot, VkImageView view, VkSampler sampler)
+	{
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = view;
+		imageInfo.sampler = sampler;
+
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = _bindlessDescriptorSet;
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = slot;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(_device, 1, &descriptorWrite, 0, nullptr);
+	}
+
+	// The frames in flight may still sample the slot, so it is only reused once they are complete.
+	// The caller keeps view and sampler alive until then as well, e.g. by destroying them with deferDeletion.
+	void unregisterTexture(uint32_t slot)
+	{
+		deferDeletion([this, slot]() { _freeTextureSlots.push_back(slot); });
+	}
+
+	void registerTextures()
+	{
+		_textureSlot = registerTexture(_textureImageView, _textureSampler);
+	}
+
+	// Before the textures are destroyed, the slots are free again once the deferred deletions have run.
+	void unregisterTextures()
+	{
+		unregisterTexture(_textureSlot);
+	}
+
+	// Logs when a heap goes over its budget or back under it.
+	void checkMemoryBudget()
+	{
+		const VkPhysicalDeviceMemoryProperties& memoryProperties = _allocator.getMemoryProperties();
+		for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		{
+			const VkDeviceSize budget = _allocator.getHeapBudget(i);
+			const VkDeviceSize usage = _allocator.getHeapUsage(i);
+			const bool overBudget = usage > budget;
+			const bool wasOverBudget = (_overBudgetHeaps >> i) & 1;
+			if(overBudget != wasOverBudget)
+			{
+				// only the transitions, an overcommitted heap would otherwise log every frame
+				printf("memory: heap %u %s budget, usage %llu MiB, budget %llu MiB\n", i, overBudget ? "over" : "back under",
+					static_cast<unsigned long long>(usage >> 20), static_cast<unsigned long long>(budget >> 20));
+				_overBudgetHeaps ^= 1u << i;
+			}
+		}
+	}
+
+	void createUniformBuffers()
+	{
+		VkDeviceSize bufferSize = sizeof(FrameUniforms);
+
+		_uniformBuffers.resize(_framesInFlight);
+		_uniformBuffersMemory.resize(_framesInFlight);
+
+		for(size_t i = 0; i < _framesInFlight; i++)
+		{
+			// read by cull.comp as well
+			createBuffer("frame uniforms", bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _uniformBuffers[i], _uniformBuffersMemory[i],
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+		}
+
+		// one persistently mapped buffer for the per-object data of all frames in flight: frame f uses slices [f * _objectCapacity, (f + 1) * _objectCapacity)
+		// every slice starts at a multiple of minUniformBufferOffsetAlignment, as required for dynamic offsets
+		const VkDeviceSize alignment = std::max<VkDeviceSize>(_physicalDeviceProperties.limits.minUniformBufferOffsetAlignment, 1);
+		_objectUniformStride = (sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+
+		createBuffer("object uniforms", _objectUniformStride * _objectCapacity * _framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			_objectUniformBuffer, _objectUniformBufferMemory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		// same slicing for the GPU driven path, tightly packed since a slice of _objectCapacity objects is already a multiple of any minStorageBufferOffsetAlignment (at most 256)
+		static_assert(OBJECT_CAPACITY_GRANULARITY * sizeof(GpuObject) % 256 == 0);
+		createBuffer("gpu objects", sizeof(GpuObject) * _objectCapacity * _framesInFlight, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			_objectStorageBuffer, _objectStorageBufferMemory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+	}
+
+	void destroyUniformBuffers()
+	{
+		for(size_t i = 0; i < _framesInFlight; i++)
+		{
+			destroyBuffer(_uniformBuffers[i], _uniformBuffersMemory[i]);
+		}
+		destroyBuffer(_objectUniformBuffer, _objectUniformBufferMemory);
+		destroyBuffer(_objectStorageBuffer, _objectStorageBufferMemory);
+	}
+
+	// Written by cull.comp and read by vkCmdDrawIndexedIndirectCount, so they never leave device local memory.
+	// Per frame in flight and cull phase: _objectCapacity draws for every material, and one draw count per material.
+	void createIndirectBuffers()
+	{
+		if(_objectDataPath != ObjectDataPath::GpuDriven)
+		{
+			return;
+		}
+
+		static_assert(OBJECT_CAPACITY_GRANULARITY * sizeof(VkDrawIndexedIndirectCommand) % 256 == 0);
+		const VkDeviceSize drawBufferSize = _framesInFlight * getDrawListCount() * _objectCapacity * sizeof(VkDrawIndexedIndirectCommand);
+		createBuffer("indirect draws", drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indirectDrawBuffer, _indirectDrawBufferMemory, 0, true);
+
+		const VkDeviceSize alignment = std::max<VkDeviceSize>(_physicalDeviceProperties.limits.minStorageBufferOffsetAlignment, 1);
+		_drawCountStride = (getDrawListCount() * sizeof(uint32_t) + alignment - 1) / alignment * alignment;
+		createBuffer("draw counts", _drawCountStride * _framesInFlight, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			_drawCountBuffer, _drawCountBufferMemory, 0, true);
+
+		// Without async compute a single slice is shared by all frames: the late phase of a frame writes what the early phase of the next one reads, in submission order.
+		// With it, the early phase of the next frame may already run while the late phase is still going, so every frame slot reads its own slice instead,
+		// written _framesInFlight frames ago. Staler, but still correct: whatever became visible since is caught by the late phase.
+		static_assert(OBJECT_CAPACITY_GRANULARITY * sizeof(uint32_t) % 256 == 0);
+		createBuffer("visibility", getVisibilitySliceCount() * _objectCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			_visibilityBuffer, _visibilityBufferMemory, 0, true);
+		_visibilityCleared = false;
+	}
+
+	uint32_t getVisibilitySliceCount() const
+	{
+		return _asyncComputeEnabled ? _framesInFlight : 1;
+	}
+
+	void destroyIndirectBuffers()
+	{
+		if(_indirectDrawBuffer != VK_NULL_HANDLE)
+		{
+			destroyBuffer(_indirectDrawBuffer, _indirectDrawBufferMemory);
+			destroyBuffer(_drawCountBuffer, _drawCountBufferMemory);
+			destroyBuffer(_visibilityBuffer, _visibilityBufferMemory);
+		}
+	}
+
+	// a draw list per cull phase and material, list phase * materials + material
+	uint32_t getDrawListCount() const
+	{
+		return CULL_PHASE_COUNT * static_cast<uint32_t>(_materials.size());
+	}
+
+	void updateUniformBuffer(uint32_t currentFrame)
+	{
+		// Per-object data goes through push constants or the dynamic uniform buffer (see ObjectDataPath), only per-frame data stays in this UBO.
+
+		// TODO: For host-to-device memory operations, you need to perform a form of synchronization known as a "domain operation".
+		// Fortunately, vkQueueSubmit automatically performs a domain operation on any host writes made visible before the vkQueueSubmit call.
+		// So if you write stuff to GPU-visible memory, then call vkQueueSubmit (either in the same thread or via CPU-side inter-thread communication), any commands in that submit call (or later ones) will see the values you wrote.
+		// Assuming you have made them visible. Writes to host - coherent memory are always visible to the GPU, but writes to non - coherent memory must be made visible via a call to vkFlushMappedMemoryRanges.
+		// If you want to write to memory asynchronously to the GPU process that reads it, you'll need to use an event.
+		// You write to the memory, make it visible if needs be, then set the event.
+		// The GPU commands that read from it would wait on the event, using VK_ACCESS_HOST_WRITE_BIT as the source access, and VK_PIPELINE_STAGE_HOST_BIT as the source stage.
+		// The destination access and stage are determined by how you plan to read from it.
+
+		static auto startTime = std::chrono::high_resolution_clock::now();
+
+		auto currentTime = std::chrono::high_resolution_clock::now();
+		float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+		if(_settings.benchmark)
+		{
+			// every run sees exactly the same frames, however fast they are rendered
+			time = static_cast<float>(static_cast<double>(_frameNumber) * BENCHMARK_TIMESTEP);
+		}
+
+		// pull the camera back so the whole object grid stays in view
+		const float distance = 2.0f * static_cast<float>(_settings.sceneGridSize);
+
+		FrameUniforms ubo{};
+		ubo.view = glm::lookAt(getCameraPosition(time, distance), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.proj = glm::perspective(glm::radians(45.0f), _swapChainExtent.width / (float)_swapChainExtent.height, 0.1f, 10.0f * distance);
+
+		memcpy(_uniformBuffersMemory[currentFrame].mapped, &ubo, sizeof(ubo));
+
+		{
+			Profiler::CpuScope scope(_profiler, "scene transforms");
+			_sceneTransforms.update(time, _threadPool);
+		}
+
+		// proj[1][1] is 1 / tan(fovy / 2): an object-space unit at depth 1 covers this many pixels
+		const float pixelsPerUnitAtUnitDepth = std::abs(ubo.proj[1][1]) * 0.5f * static_cast<float>(_swapChainExtent.height);
+
+		glm::vec4 frustumPlanes[6];
+		getFrustumPlanes(ubo.proj * ubo.view, frustumPlanes);
+
+		char* objectData = static_cast<char*>(_objectUniformBufferMemory.mapped) + currentFrame * _objectCapacity * _objectUniformStride;
+		GpuObject* gpuObjects = static_cast<GpuObject*>(_objectStorageBufferMemory.mapped) + currentFrame * _objectCapacity;
+
+		{
+			Profiler::CpuScope scope(_profiler, "scene culling");
+			updateObjects(ubo.view, frustumPlanes, pixelsPerUnitAtUnitDepth, gpuObjects);
+		}
+
+		if(_objectDataPath != ObjectDataPath::GpuDriven)
+		{
+			Profiler::CpuScope scope(_profiler, "draw list");
+			sortDrawList();
+
+			// after the LOD selection, which decides what can be batched
+			if(_objectDataPath == ObjectDataPath::Instanced)
+			{
+				buildDrawBatches(gpuObjects);
+			}
+			else if(_objectDataPath == ObjectDataPath::DynamicUniformBuffer)
+			{
+				writeDrawUniforms(objectData);
+			}
+		}
+
+		if(_objectDataPath == ObjectDataPath::GpuDriven)
+		{
+			std::copy(std::begin(frustumPlanes), std::end(frustumPlanes), _cullConstants.frustumPlanes);
+			_cullConstants.viewportSize = glm::vec2(static_cast<float>(_swapChainExtent.width), static_cast<float>(_swapChainExtent.height));
+			_cullConstants.objectCount = static_cast<uint32_t>(_objects.size());
+			_cullConstants.maxDrawsPerMaterial = _objectCapacity;
+			_cullConstants.materialCount = static_cast<uint32_t>(_materials.size());
+		}
+	}
+
+	GpuObject makeGpuObject(const SceneObject& object) const
+	{
+		const Mesh& mesh = _meshes[object.mesh];
+		const DrawCommand& draw = _drawCommands[object.drawCommand];
+
+		GpuObject gpuObject;
+		gpuObject.model = object.model;
+		gpuObject.bounds = glm::vec4((mesh.boundsCenter - _positionBias) / _positionScale, mesh.boundsRadius);
+		gpuObject.indexCount = draw.indexCount;
+		gpuObject.firstIndex = draw.firstIndex;
+		gpuObject.vertexOffset = draw.vertexOffset;
+		gpuObject.material = object.material;
+		return gpuObject;
+	}
+
+	// Gribb-Hartmann: the planes are sums and differences of the rows of the view projection matrix, glm is column major so row r is m[c][r]
+	// with depth in [0, 1] the near plane is row 2 alone
+	static void getFrustumPlanes(const glm::mat4& viewProj, glm::vec4 (&planes)[6])
+	{
+		auto row = [&](int r) { return glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]); };
+
+		planes[0] = row(3) + row(0); // left
+		planes[1] = row(3) - row(0); // right
+		planes[2] = row(3) + row(1); // bottom
+		planes[3] = row(3) - row(1); // top
+		planes[4] = row(2); // near
+		planes[5] = row(3) - row(2); // far
+
+		// normalized, so the distance to a plane can be compared against the sphere radius
+		for(auto& plane : planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+	}
+
+	// the CPU counterpart of the frustum test in cull.comp
+	static bool isSphereInFrustum(const glm::vec4 (&planes)[6], const glm::vec3& center, float radius)
+	{
+		for(const auto& plane : planes)
+		{
+			if(glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Pipeline, material and LOD first, then front to back: each pipeline and material is bound once, each LOD of a material is a contiguous
+	// run for the batcher, and within a run the nearest objects are drawn first for early depth rejection. Positive floats sort like their bits.
+	static uint64_t makeDrawKey(uint32_t pipelineRank, uint32_t material, uint32_t drawCommand, float depth)
+	{
+		const uint64_t depthBits = std::bit_cast<uint32_t>(std::max(depth, 0.0f)) >> 8; // sign bit, exponent and the top 15 bits of the mantissa
+		return uint64_t(pipelineRank) << 52 | uint64_t(material) << 40 | uint64_t(drawCommand) << 24 | depthBits;
+	}
+
+	uint32_t getSceneJobCount(uint32_t count) const
+	{
+		return std::max(1u, std::min(_threadPool.getWorkerCount() * SCENE_JOBS_PER_WORKER, (count + MIN_OBJECTS_PER_JOB - 1) / MIN_OBJECTS_PER_JOB));
+	}
+
+	// Model matrix and LOD of every object, on the thread pool. The CPU driven paths also cull against the frustum here: every job appends
+	// the objects that survive to its own chunk of the draw list, see sortDrawList. The GPU driven path writes every object for cull.comp instead.
+	void updateObjects(const glm::mat4& view, const glm::vec4 (&frustumPlanes)[6], float pixelsPerUnitAtUnitDepth, GpuObject* gpuObjects)
+	{
+		// maps quantized positions back to the mesh bounds, free here instead of a multiply-add per vertex
+		const glm::mat4 dequantization = glm::scale(glm::translate(glm::mat4(1.0f), _positionBias), _positionScale);
+
+		// with the pipelines the materials were drawn with last frame, materials that share one sort next to each other
+		std::vector<uint32_t> pipelineRanks(_materials.size());
+		for(uint32_t material = 0; material < pipelineRanks.size(); ++material)
+		{
+			const auto first = std::find(_materialPipelines.begin(), _materialPipelines.end(), _materialPipelines[material]);
+			pipelineRanks[material] = static_cast<uint32_t>(first - _materialPipelines.begin());
+		}
+
+		const bool cpuCulling = _objectDataPath != ObjectDataPath::GpuDriven;
+		const uint32_t objectCount = static_cast<uint32_t>(_objects.size());
+		const uint32_t jobCount = getSceneJobCount(objectCount);
+		_drawListChunks.resize(jobCount);
+
+		_threadPool.run(jobCount, [&](uint32_t job, uint32_t)
+		{
+			const uint32_t first = static_cast<uint32_t>(uint64_t(objectCount) * job / jobCount);
+			const uint32_t last = static_cast<uint32_t>(uint64_t(objectCount) * (job + 1) / jobCount);
+			std::vector<DrawItem>& chunk = _drawListChunks[job];
+			chunk.clear();
+
+			for(uint32_t i = first; i < last; ++i)
+			{
+				SceneObject& object = _objects[i];
+				const Mesh& mesh = _meshes[object.mesh];
+				const glm::mat4& world = _sceneTransforms.getWorld(object.node); // rigid, so LOD errors and bounds need no scaling
+				const glm::mat4 modelView = view * world;
+				object.model = world * dequantization;
+				object.drawCommand = selectLod(mesh, modelView, pixelsPerUnitAtUnitDepth);
+
+				if(!cpuCulling)
+				{
+					gpuObjects[i] = makeGpuObject(object);
+					continue;
+				}
+
+				if(!isSphereInFrustum(frustumPlanes, glm::vec3(world * glm::vec4(mesh.boundsCenter, 1.0f)), mesh.boundsRadius))
+				{
+					continue;
+				}
+				const float depth = -(modelView * glm::vec4(mesh.boundsCenter, 1.0f)).z;
+				chunk.push_back({makeDrawKey(pipelineRanks[object.material], object.material, object.drawCommand, depth), i});
+			}
+		});
+	}
+
+	// Gathers the chunks of updateObjects into _drawList in key order: every job sorts its own chunk into place,
+	// then neighbouring sorted runs are merged pairwise, halving the number of runs (and jobs) every round.
+	void sortDrawList()
+	{
+		const uint32_t chunkCount = static_cast<uint32_t>(_drawListChunks.size());
+		std::vector<size_t> runStarts(chunkCount + 1, 0);
+		for(uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			runStarts[chunk + 1] = runStarts[chunk] + _drawListChunks[chunk].size();
+		}
+		_drawList.resize(runStarts.back());
+
+		_threadPool.run(chunkCount, [&](uint32_t chunk, uint32_t)
+		{
+			std::vector<DrawItem>& items = _drawListChunks[chunk];
+			std::sort(items.begin(), items.end());
+			std::copy(items.begin(), items.end(), _drawList.begin() + runStarts[chunk]);
+		});
+
+		for(uint32_t width = 1; width < chunkCount; width *= 2)
+		{
+			const uint32_t mergeCount = (chunkCount + 2 * width - 1) / (2 * width);
+			_threadPool.run(mergeCount, [&](uint32_t merge, uint32_t)
+			{
+				const uint32_t first = merge * 2 * width;
+				const uint32_t middle = std::min(first + width, chunkCount);
+				const uint32_t last = std::min(first + 2 * width, chunkCount);
+				std::inplace_merge(_drawList.begin() + runStarts[first], _drawList.begin() + runStarts[middle], _drawList.begin() + runStarts[last]);
+			});
+		}
+	}
+
+	// dynamic uniform buffer path: slot i of the frame holds the model matrix of draw i, see recordDraws
+	void writeDrawUniforms(char* objectData)
+	{
+		const uint32_t drawCount = static_cast<uint32_t>(_drawList.size());
+		const uint32_t jobCount = getSceneJobCount(drawCount);
+		_threadPool.run(jobCount, [&](uint32_t job, uint32_t)
+		{
+			const uint32_t first = static_cast<uint32_t>(uint64_t(drawCount) * job / jobCount);
+			const uint32_t last = static_cast<uint32_t>(uint64_t(drawCount) * (job + 1) / jobCount);
+			for(uint32_t i = first; i < last; ++i)
+			{
+				memcpy(objectData + i * _objectUniformStride, &_objects[_drawList[i].object].model, sizeof(ObjectUniforms));
+			}
+		});
+	}
+
+	// Writes the draw list to instances in its order, where every run of the same material and LOD is a contiguous instance range
+	// drawn with a single vkCmdDrawIndexed. The pipeline and material lead the sort key, so each is bound once.
+	void buildDrawBatches(GpuObject* instances)
+	{
+		const uint32_t drawCount = static_cast<uint32_t>(_drawList.size());
+		const uint32_t jobCount = getSceneJobCount(drawCount);
+		_threadPool.run(jobCount, [&](uint32_t job, uint32_t)
+		{
+			const uint32_t first = static_cast<uint32_t>(uint64_t(drawCount) * job / jobCount);
+			const uint32_t last = static_cast<uint32_t>(uint64_t(drawCount) * (job + 1) / jobCount);
+			for(uint32_t instance = first; instance < last; ++instance)
+			{
+				instances[instance] = makeGpuObject(_objects[_drawList[instance].object]);
+			}
+		});
+
+		_drawBatches.clear();
+		for(uint32_t instance = 0; instance < drawCount; ++instance)
+		{
+			const SceneObject& object = _objects[_drawList[instance].object];
+
+			if(_drawBatches.empty() || _drawBatches.back().material != object.material || _drawBatches.back().drawCommand != object.drawCommand)
+			{
+				_drawBatches.push_back({object.drawCommand, object.material, instance, 0});
+			}
+			++_drawBatches.back().instanceCount;
+		}
+	}
+
+	void createDescriptorPool()
+	{
+		// per frame in flight: one graphics set, and one cull set with four storage buffers and the frame uniforms
+		VkDescriptorPoolSize poolSizes[3] = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[0].descriptorCount = _framesInFlight * 2;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSizes[1].descriptorCount = _framesInFlight;
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[2].descriptorCount = _framesInFlight * (1 + 4);
+
+		VkDescriptorPoolCreateInfo poolCreateInfo{};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolCreateInfo.poolSizeCount = static_cast<uint32_t>(std::size(poolSizes));
+		poolCreateInfo.pPoolSizes = poolSizes;
+		poolCreateInfo.maxSets = _framesInFlight * 2;
+
+		if(vkCreateDescriptorPool(_device, &poolCreateInfo, nullptr, &_descriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create descriptor pool");
+		}
+	}
+
+	void createDescriptorSets()
+	{
+		std::vector<VkDescriptorSetLayout> layouts(_framesInFlight, _descriptorSetLayout);
+		
+		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocateInfo.descriptorPool = _descriptorPool;
+		descriptorSetAllocateInfo.descriptorSetCount = _framesInFlight;
+		descriptorSetAllocateInfo.pSetLayouts = layouts.data();
 
-		presentInfo.pResults = nullptr; // Optional
+		_descriptorSets.resize(layouts.size(), VK_NULL_HANDLE);
+		if(vkAllocateDescriptorSets(_device, &descriptorSetAllocateInfo, _descriptorSets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate descriptor sets");
+		}
 
-		result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+		for(size_t i = 0; i < _framesInFlight; ++i)
+		{
+			VkDescriptorBufferInfo bufferInfo{};
+			bufferInfo.buffer = _uniformBuffers[i];
+			bufferInfo.offset = 0;
+			bufferInfo.range = sizeof(FrameUniforms);
 
-		if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || _windowResized)
+			// the base offset of the frame slice is part of the dynamic offset, see recordDraws
+			VkDescriptorBufferInfo objectBufferInfo{};
+			objectBufferInfo.buffer = _objectUniformBuffer;
+			objectBufferInfo.offset = 0;
+			objectBufferInfo.range = sizeof(ObjectUniforms);
+
+			VkDescriptorBufferInfo objectStorageBufferInfo{};
+			objectStorageBufferInfo.buffer = _objectStorageBuffer;
+			objectStorageBufferInfo.offset = i * _objectCapacity * sizeof(GpuObject);
+			objectStorageBufferInfo.range = _objectCapacity * sizeof(GpuObject);
+
+			// The pBufferInfo field is used for descriptors that refer to buffer data, pImageInfo is used for descriptors that refer to image data, and pTexelBufferView is used for descriptors that refer to buffer views.
+			VkWriteDescriptorSet descriptorWrites[3] = {};
+			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[0].dstSet = _descriptorSets[i];
+			descriptorWrites[0].dstBinding = 0; // must match layout(binding) used in the shader
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[0].dstArrayElement = 0; // if the descriptor is an array, start index in array
+			descriptorWrites[0].descriptorCount = 1; // if the descriptor is an array, number of elements to update in array
+			descriptorWrites[0].pBufferInfo = &bufferInfo; // descriptorCount structures
+
+			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[1].dstSet = _descriptorSets[i];
+			descriptorWrites[1].dstBinding = 2;
+			descriptorWrites[1].dstArrayElement = 0;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			descriptorWrites[1].descriptorCount = 1;
+			descriptorWrites[1].pBufferInfo = &objectBufferInfo;
+
+			descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[2].dstSet = _descriptorSets[i];
+			descriptorWrites[2].dstBinding = 3;
+			descriptorWrites[2].dstArrayElement = 0;
+			descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[2].descriptorCount = 1;
+			descriptorWrites[2].pBufferInfo = &objectStorageBufferInfo;
+
+			vkUpdateDescriptorSets(_device, static_cast<uint32_t>(std::size(descriptorWrites)), descriptorWrites, 0, nullptr);
+		}
+
+		createCullDescriptorSets();
+	}
+
+	void createCullDescriptorSets()
+	{
+		if(_objectDataPath != ObjectDataPath::GpuDriven)
 		{
-			_windowResized = false;
-			recreateSwapChain();
+			return;
 		}
-		else if(result != VK_SUCCESS)
+
+		std::vector<VkDescriptorSetLayout> layouts(_framesInFlight, _cullDescriptorSetLayout);
+
+		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocateInfo.descriptorPool = _descriptorPool;
+		descriptorSetAllocateInfo.descriptorSetCount = _framesInFlight;
+		descriptorSetAllocateInfo.pSetLayouts = layouts.data();
+
+		_cullDescriptorSets.resize(layouts.size(), VK_NULL_HANDLE);
+		if(vkAllocateDescriptorSets(_device, &descriptorSetAllocateInfo, _cullDescriptorSets.data()) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to present swap chain image");
+			throw std::runtime_error("failed to allocate cull descriptor sets");
 		}
 
-		// goto next frame -----------------------------------------------------
+		const VkDeviceSize drawFrameSize = getDrawListCount() * _objectCapacity * sizeof(VkDrawIndexedIndirectCommand);
+
+		for(size_t i = 0; i < _framesInFlight; ++i)
+		{
+			// the slices of frame i, in binding order: objects, draws, counts, visibility (shared by all frames without async compute) and the frame uniforms
+			VkDescriptorBufferInfo bufferInfos[5] = {};
+			bufferInfos[0].buffer = _objectStorageBuffer;
+			bufferInfos[0].offset = i * _objectCapacity * sizeof(GpuObject);
+			bufferInfos[0].range = _objectCapacity * sizeof(GpuObject);
+			bufferInfos[1].buffer = _indirectDrawBuffer;
+			bufferInfos[1].offset = i * drawFrameSize;
+			bufferInfos[1].range = drawFrameSize;
+			bufferInfos[2].buffer = _drawCountBuffer;
+			bufferInfos[2].offset = i * _drawCountStride;
+			bufferInfos[2].range = getDrawListCount() * sizeof(uint32_t);
+			bufferInfos[3].buffer = _visibilityBuffer;
+			bufferInfos[3].offset = (i % getVisibilitySliceCount()) * _objectCapacity * sizeof(uint32_t);
+			bufferInfos[3].range = _objectCapacity * sizeof(uint32_t);
+			bufferInfos[4].buffer = _uniformBuffers[i];
+			bufferInfos[4].offset = 0;
+			bufferInfos[4].range = sizeof(FrameUniforms);
+
+			VkWriteDescriptorSet descriptorWrites[5] = {};
+			for(uint32_t binding = 0; binding < std::size(descriptorWrites); ++binding)
+			{
+				descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[binding].dstSet = _cullDescriptorSets[i];
+				descriptorWrites[binding].dstBinding = binding;
+				descriptorWrites[binding].dstArrayElement = 0;
+				descriptorWrites[binding].descriptorType = binding < 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				descriptorWrites[binding].descriptorCount = 1;
+				descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+			}
 
-		_currentFrame = (_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+			vkUpdateDescriptorSets(_device, static_cast<uint32_t>(std::size(descriptorWrites)), descriptorWrites, 0, nullptr);
+		}
 	}
 
-	void cleanupSwapChain()
+	// tag: what the memory dashboard reports the image as, a string literal
+	void createImage(const char* tag, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory, VkMemoryPropertyFlags preferredProperties = 0,
+		bool sharedWithCompute = false)
 	{
-		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
-		destroyUniformBuffers();
-		vkFreeCommandBuffers(_device, _commandPool, static_cast<uint32_t>(_commandBuffers.size()), _commandBuffers.data());
-		vkDestroyPipeline(_device, _graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(_device, _graphicsPipelineLayout, nullptr);
-		destroyDepthBuffer();
-		vkDestroyRenderPass(_device, _renderPass, nullptr);
-		destroyFramebuffers();
-		destroySwapChainImageViews();
-		vkDestroySwapchainKHR(_device, _swapChain, nullptr);
+		// TODO: It is possible that the VK_FORMAT_R8G8B8A8_SRGB format is not supported by the graphics hardware.
+		// You should have a list of acceptable alternatives and go with the best one that is supported.
+		// However, support for this particular format is so widespread that we'll skip this step.
+		// Using different formats would also require annoying conversions. 
+		VkImageCreateInfo imageCreateInfo{};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.extent.width = width;
+		imageCreateInfo.extent.height = height;
+		imageCreateInfo.extent.depth = 1;
+		imageCreateInfo.mipLevels = mipLevels;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.format = format;
+		imageCreateInfo.tiling = tiling;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageCreateInfo.usage = usage;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.flags = 0; // Optional
+
+		const uint32_t sharingFamilies[] = {_queueFamilies.graphics.value(), _queueFamilies.compute.value()};
+		if(sharedWithCompute)
+		{
+			setComputeSharing(imageCreateInfo, sharingFamilies);
+		}
+
+		if(vkCreateImage(_device, &imageCreateInfo, nullptr, &image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create image");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(_device, image, &memRequirements);
+
+		// optimal tiling images must not share a bufferImageGranularity page with buffers and linear images
+		auto kind = tiling == VK_IMAGE_TILING_OPTIMAL ? MemoryAllocator::ResourceKind::Optimal : MemoryAllocator::ResourceKind::Linear;
+		imageMemory = allocateMemory(memRequirements, properties, preferredProperties, kind, {tag, VK_OBJECT_TYPE_IMAGE, reinterpret_cast<uint64_t>(image)});
+
+		if(vkBindImageMemory(_device, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to bind image memory");
+		}
+	}
+
+	void destroyImage(VkImage& image, Allocation& imageMemory)
+	{
+		vkDestroyImage(_device, image, nullptr);
+		_allocator.free(imageMemory);
+		image = VK_NULL_HANDLE;
+	}
+
+	void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		VkPipelineStageFlags sourceStage;
+		VkPipelineStageFlags destinationStage;
+		
+		if(oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		}
+		else if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		}
+		else
+		{
+			throw std::invalid_argument("unsupported layout transition");
+		}
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			sourceStage,
+			destinationStage,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier
+		);
+	}
+
+	void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height)
+	{
+		VkBufferImageCopy region{};
+		region.bufferOffset = bufferOffset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = {width, height, 1};
+
+		vkCmdCopyBufferToImage(
+			commandBuffer,
+			buffer,
+			image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1,
+			&region
+		);
+	}
+
+	// vkCmdBlitImage must be submitted to a queue with graphics capability, so commandBuffer cannot come from the transfer queue
+	void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = image;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.levelCount = 1;
+
+		int32_t mipWidth = texWidth;
+		int32_t mipHeight = texHeight;
+
+		for(uint32_t i = 1; i < mipLevels; i++)
+		{
+			barrier.subresourceRange.baseMipLevel = i - 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+			vkCmdPipelineBarrier(commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+				0, nullptr,
+				0, nullptr,
+				1, &barrier);
+
+			VkImageBlit blit{};
+			blit.srcOffsets[0] = {0, 0, 0};
+			blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = i - 1;
+			blit.srcSubresource.baseArrayLayer = 0;
+			blit.srcSubresource.layerCount = 1;
+			blit.dstOffsets[0] = {0, 0, 0};
+			blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = i;
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = 1;
+
+			vkCmdBlitImage(commandBuffer,
+				image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, &blit,
+				VK_FILTER_LINEAR);
+
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+			vkCmdPipelineBarrier(commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+				0, nullptr,
+				0, nullptr,
+				1, &barrier);
+
+			if(mipWidth > 1) mipWidth /= 2;
+			if(mipHeight > 1) mipHeight /= 2;
+		}
+
+		barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
 	}
 
-	void recreateSwapChain()
+	// Picks the texture source as soon as the physical device is known, so that decoding a PNG overlaps everything up to createTextureImage.
+	// The first KTX2 variant whose format the device can sample wins: it needs no decoding and no mip blits, and takes 4 to 8 times less memory.
+	// Runs on a startup thread, see initVulkan.
+	void loadTexture()
 	{
-		// TODO: review this entire process, check other demos and source codes, etc.
-		// I'm sure this can be simplified and made more efficient
-
-		int width = 0, height = 0;
-		glfwGetFramebufferSize(_window, &width, &height);
-		while(width == 0 || height == 0)
+		for(const std::string& path : TEXTURE_KTX2_PATHS)
 		{
-			glfwGetFramebufferSize(_window, &width, &height);
-			glfwWaitEvents();
-		}
+			if(!openKtx2Texture(path))
+			{
+				continue;
+			}
 
-		// TODO: It is possible to create a new swap chain while drawing commands on an image from the old swap chain are still in-flight.
-		// You need to pass the previous swap chain to the oldSwapChain field in the VkSwapchainCreateInfoKHR struct and destroy the old swap chain as soon as you've finished using it.
-		vkDeviceWaitIdle(_device);
+			// RGBA8 sampling with linear filtering is mandatory, so the query returns it when the compressed format is not supported
+			const VkFormat format = static_cast<VkFormat>(_textureHeader.vkFormat);
+			if(findSupportedFormat({format, VK_FORMAT_R8G8B8A8_SRGB}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) == format)
+			{
+				printf("texture: %s, format %u, %ux%u, %u mip levels\n", path.c_str(), _textureHeader.vkFormat, _textureHeader.pixelWidth, _textureHeader.pixelHeight, _textureHeader.levelCount);
+				putc('\n', stdout);
+				return;
+			}
 
-		cleanupSwapChain();
+			printf("texture: %s, format %u not supported by the device\n", path.c_str(), _textureHeader.vkFormat);
+			closeKtx2Texture();
+		}
 
-		if(!checkPhysicalDeviceSwapChain(_physicalDevice, _swapChainInfo))
+		int channels = 0;
+		_decodedTexture.pixels.reset(stbi_load(TEXTURE_PATH.c_str(), &_decodedTexture.width, &_decodedTexture.height, &channels, STBI_rgb_alpha));
+		if(!_decodedTexture.pixels)
 		{
-			throw std::runtime_error("swapchain is not compatible anymore");
+			throw std::runtime_error("failed to load texture image from file");
 		}
 
-		createSwapChain();
-		createSwapChainImageViews();
-		createRenderPass();
-		createDepthBuffer();
-		createGraphicsPipelineLayout();
-		createGraphicsPipeline();
-		createFramebuffers();
-		createUniformBuffers();
-		createDescriptorPool();
-		createDescriptorSets();
-		createCommandBuffers();
+		printf("texture: %s, decoded\n", TEXTURE_PATH.c_str());
+		putc('\n', stdout);
 	}
 
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	// Block width, height and size in bytes of the formats a KTX2 texture may come in, false for any other format.
+	static bool getBlockFootprint(VkFormat format, uint32_t& blockWidth, uint32_t& blockHeight, uint32_t& blockBytes)
 	{
-		VkPhysicalDeviceMemoryProperties memProperties;
-		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
-
-		// TODO: Right now we'll only concern ourselves with the type of memory and not the heap it comes from, but you can imagine that this can affect performance.
-		for(uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+		switch(format)
 		{
-			if((typeFilter & (1 << i)) &&
-				(memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			{
-				return i;
-			}
+			case VK_FORMAT_R8G8B8A8_UNORM:
+			case VK_FORMAT_R8G8B8A8_SRGB:
+				blockWidth = 1; blockHeight = 1; blockBytes = 4;
+				return true;
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+				blockWidth = 4; blockHeight = 4; blockBytes = 8;
+				return true;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+			case VK_FORMAT_BC3_SRGB_BLOCK:
+			case VK_FORMAT_BC5_UNORM_BLOCK:
+			case VK_FORMAT_BC5_SNORM_BLOCK:
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+			case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+			case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+				blockWidth = 4; blockHeight = 4; blockBytes = 16;
+				return true;
+			case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+			case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+				blockWidth = 6; blockHeight = 6; blockBytes = 16;
+				return true;
+			case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+			case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+				blockWidth = 8; blockHeight = 8; blockBytes = 16;
+				return true;
+			default:
+				return false;
 		}
-
-		throw std::runtime_error("failed to find suitable memory type");
 	}
 
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+	bool openKtx2Texture(const std::string& path)
 	{
-		VkBufferCreateInfo bufferCreateInfo{};
-		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferCreateInfo.size = size;
-		bufferCreateInfo.usage = usage;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-		if(vkCreateBuffer(_device, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS)
+		if(!_textureFile.open(path))
 		{
-			throw std::runtime_error("failed to create buffer");
+			return false;
 		}
 
-		// TODO: It should be noted that in a real world application, you're not supposed to actually call vkAllocateMemory for every individual buffer.
-		// The maximum number of simultaneous memory allocations is limited by the maxMemoryAllocationCount physical device limit, which may be as low as 4096 even on high end hardware like an NVIDIA GTX 1080.
-		// The right way to allocate memory for a large number of objects at the same time is to create a custom allocator that splits up a single allocation among many different objects by using the offset parameters that we've seen in many functions.
-		// You can either implement such an allocator yourself, or use the VulkanMemoryAllocator library provided by the GPUOpen initiative: https://github.com/GPUOpen-LibrariesAndSDKs/VulkanMemoryAllocator
-
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+		auto reject = [this, &path](const char* reason)
+		{
+			printf("texture: %s, %s\n", path.c_str(), reason);
+			closeKtx2Texture();
+			return false;
+		};
 
-		VkMemoryAllocateInfo memoryAllocateInfo{};
-		memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		memoryAllocateInfo.allocationSize = memRequirements.size;
-		memoryAllocateInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+		static constexpr uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
 
-		if(vkAllocateMemory(_device, &memoryAllocateInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+		if(_textureFile.size() < sizeof(Ktx2Header) || memcmp(_textureFile.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
 		{
-			throw std::runtime_error("failed to allocate buffer memory");
+			return reject("not a KTX2 file");
 		}
 
-		// TODO: Since this memory is allocated specifically for this buffer, the offset is simply 0.
-		// If the offset is non-zero, then it is required to be divisible by memRequirements.alignment
-		vkBindBufferMemory(_device, buffer, bufferMemory, 0);
-	}
-
-	VkCommandBuffer beginSingleShotCommands()
-	{
-		// TODO: We must first allocate a temporary command buffer.
-		// You may wish to create a separate command pool for these kinds of short-lived buffers, because the implementation may be able to apply memory allocation optimizations.
-		// Or reuse the same command buffer already created for drawing.
-		VkCommandBufferAllocateInfo bufferAllocateInfo{};
-		bufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		bufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		bufferAllocateInfo.commandPool = _commandPool;
-		bufferAllocateInfo.commandBufferCount = 1;
+		memcpy(&_textureHeader, _textureFile.data(), sizeof(_textureHeader));
 
-		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-		vkAllocateCommandBuffers(_device, &bufferAllocateInfo, &commandBuffer);
+		if(_textureHeader.supercompressionScheme != 0)
+		{
+			return reject("supercompressed data is not supported");
+		}
 
-		VkCommandBufferBeginInfo commandBufferBeginInfo{};
-		commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if(_textureHeader.vkFormat == VK_FORMAT_UNDEFINED || _textureHeader.pixelWidth == 0 || _textureHeader.pixelHeight == 0 ||
+			_textureHeader.pixelDepth != 0 || _textureHeader.layerCount > 1 || _textureHeader.faceCount != 1)
+		{
+			return reject("not a single 2D image");
+		}
 
-		if(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS)
+		if(_textureHeader.levelCount == 0 || _textureHeader.levelCount > std::bit_width(std::max(_textureHeader.pixelWidth, _textureHeader.pixelHeight)))
 		{
-			throw std::runtime_error("failed to begin recording command buffer");
+			return reject("no baked mip chain");
 		}
 
-		return commandBuffer;
-	}
+		const uint64_t fileSize = _textureFile.size();
+		if(fileSize - sizeof(Ktx2Header) < _textureHeader.levelCount * sizeof(Ktx2Level))
+		{
+			return reject("truncated level index");
+		}
 
-	void endSingleShotCommands(VkCommandBuffer commandBuffer)
-	{
-		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		uint32_t blockWidth = 0;
+		uint32_t blockHeight = 0;
+		uint32_t blockBytes = 0;
+		if(!getBlockFootprint(static_cast<VkFormat>(_textureHeader.vkFormat), blockWidth, blockHeight, blockBytes))
 		{
-			throw std::runtime_error("failed to end recording command buffer");
+			return reject("format with unknown block size");
 		}
 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
+		_textureLevels.resize(_textureHeader.levelCount);
+		memcpy(_textureLevels.data(), _textureFile.data() + sizeof(Ktx2Header), _textureLevels.size() * sizeof(Ktx2Level));
 
-		if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		for(uint32_t i = 0; i < _textureHeader.levelCount; ++i)
 		{
-			throw std::runtime_error("failed to submit copy command buffer");
+			const Ktx2Level& level = _textureLevels[i];
+			if(level.byteOffset > fileSize || level.byteLength > fileSize - level.byteOffset)
+			{
+				return reject("truncated level data");
+			}
+
+			// the copy reads exactly this much for the extent of the level, see createCompressedTextureImage
+			const uint64_t blocksX = (std::max(_textureHeader.pixelWidth >> i, 1u) + blockWidth - 1) / blockWidth;
+			const uint64_t blocksY = (std::max(_textureHeader.pixelHeight >> i, 1u) + blockHeight - 1) / blockHeight;
+			if(level.byteLength != blocksX * blocksY * blockBytes)
+			{
+				return reject("level size does not match its format and extent");
+			}
 		}
-		// TODO: We could use a fence and wait with vkWaitForFences, or simply wait for the transfer queue to become idle with vkQueueWaitIdle.
-		// A fence would allow you to schedule multiple transfers simultaneously and wait for all of them complete, instead of executing one at a time.
-		// That may give the driver more opportunities to optimize.
-		vkQueueWaitIdle(_graphicsQueue);
 
-		vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
+		return true;
 	}
 
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+	void closeKtx2Texture()
 	{
-		VkCommandBuffer commandBuffer = beginSingleShotCommands();
-
-		VkBufferCopy copyRegion{};
-		copyRegion.srcOffset = 0; // Optional
-		copyRegion.dstOffset = 0; // Optional
-		copyRegion.size = size;
-		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+		_textureFile.close();
+		_textureLevels.clear();
+	}
 
-		endSingleShotCommands(commandBuffer);
+	void createTextureImage()
+	{
+		if(!_textureLevels.empty())
+		{
+			createCompressedTextureImage();
+		}
+		else
+		{
+			createDecodedTextureImage();
+		}
 	}
 
-	void createVertexBuffer()
+	// The levels are copied as they are stored in the file, in one copy command, and handed over to the graphics queue ready to be sampled.
+	void createCompressedTextureImage()
 	{
-		// TODO: the driver may not immediately copy the data into the buffer memory, for example because of caching.
-		// It is also possible that writes to the buffer are not visible in the mapped memory yet.
-		// There are two ways to deal with that problem:
-		// - Use a memory heap that is host coherent, indicated with VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		// - Call vkFlushMappedMemoryRanges after writing to the mapped memory, and call vkInvalidateMappedMemoryRanges before reading from the mapped memory
-		// We went for the first approach, which ensures that the mapped memory always matches the contents of the allocated memory.
-		// Do keep in mind that this may lead to slightly worse performance than explicit flushing, but we'll see why that doesn't matter in the next chapter.
+		_textureFormat = static_cast<VkFormat>(_textureHeader.vkFormat);
+		_textureMipLevels = _textureHeader.levelCount;
 
-		// Flushing memory ranges or using a coherent memory heap means that the driver will be aware of our writes to the buffer, but it doesn't mean that they are actually visible on the GPU yet.
-		// The transfer of data to the GPU is an operation that happens in the background and the specification simply tells us that it is guaranteed to be complete as of the next call to vkQueueSubmit.
+		VkDeviceSize stagingSize = 0;
+		for(const Ktx2Level& level : _textureLevels)
+		{
+			stagingSize += (level.byteLength + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+		}
 
-		VkDeviceSize bufferSize = sizeof(decltype(_vertices)::value_type) * _vertices.size();
+		UploadEngine::StagingRegion staging = allocateStaging(stagingSize);
 
-		VkBuffer stagingBuffer = VK_NULL_HANDLE;
-		VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		std::vector<VkBufferImageCopy> regions(_textureMipLevels);
+		VkDeviceSize stagingOffset = 0;
+		for(uint32_t i = 0; i < _textureMipLevels; ++i)
+		{
+			const Ktx2Level& level = _textureLevels[i];
+			memcpy(static_cast<char*>(staging.mapped) + stagingOffset, _textureFile.data() + level.byteOffset, static_cast<size_t>(level.byteLength));
+
+			VkBufferImageCopy& region = regions[i];
+			region.bufferOffset = staging.offset + stagingOffset; // a multiple of STAGING_ALIGNMENT, which covers the 16 byte blocks of BC7 and ASTC
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = i;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = {std::max(_textureHeader.pixelWidth >> i, 1u), std::max(_textureHeader.pixelHeight >> i, 1u), 1};
+
+			stagingOffset += (level.byteLength + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+		}
 
-		void* data = nullptr;
-		vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, _vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(_device, stagingBufferMemory);
+		createImage("texture", _textureHeader.pixelWidth, _textureHeader.pixelHeight, _textureMipLevels, _textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _textureImage, _textureImageMemory);
 
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferMemory);
+		transitionImageLayout(_uploadEngine.transferCommands(), _textureImage, _textureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, _textureMipLevels);
 
-		copyBuffer(stagingBuffer, _vertexBuffer, bufferSize);
+		vkCmdCopyBufferToImage(_uploadEngine.transferCommands(), staging.buffer, _textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
 
-		vkFreeMemory(_device, stagingBufferMemory, nullptr);
-		vkDestroyBuffer(_device, stagingBuffer, nullptr);
-	}
+		VkImageSubresourceRange range{};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = _textureMipLevels;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+		_uploadEngine.releaseImage(_textureImage, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 
-	void destroyVertexBuffer()
-	{
-		vkFreeMemory(_device, _vertexBufferMemory, nullptr);
-		vkDestroyBuffer(_device, _vertexBuffer, nullptr);
+		// the levels are in the staging memory now
+		closeKtx2Texture();
 	}
 
-	void createIndexBuffer()
+	void createDecodedTextureImage()
 	{
-		// TODO: Remember you should allocate multiple resources like buffers from a single memory allocation, but in fact you should go a step further.
-		// Driver developers recommend that you also store multiple buffers, like the vertex and index buffer, into a single VkBuffer and use offsets in commands like vkCmdBindVertexBuffers.
-		// The advantage is that your data is more cache friendly in that case, because it's closer together.
-		// It is even possible to reuse the same chunk of memory for multiple resources if they are not used during the same render operations, provided that their data is refreshed, of course.
-		// This is known as aliasing and some Vulkan functions have explicit flags to specify that you want to do this.
+		DecodedImage image = std::move(_decodedTexture);
+		const int texWidth = image.width;
+		const int texHeight = image.height;
+
+		_textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+		_textureMipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+
+		VkDeviceSize imageSize = texWidth * texHeight * 4;
+
+		// stb_image only decodes into an allocation of its own, so the pixels are copied once; KTX2 levels go straight from the mapped file
+		UploadEngine::StagingRegion staging = allocateStaging(imageSize);
+		memcpy(staging.mapped, image.pixels.get(), static_cast<size_t>(imageSize));
 
-		VkDeviceSize bufferSize = sizeof(decltype(_indices)::value_type) * _indices.size();
+		// The transitions and the copy are recorded into the current upload batch and run asynchronously on the transfer queue.
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		createImage("texture", texWidth, texHeight, _textureMipLevels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _textureImage, _textureImageMemory);
 
-		void* data = nullptr;
-		vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, _indices.data(), (size_t)bufferSize);
-		vkUnmapMemory(_device, stagingBufferMemory);
+		transitionImageLayout(_uploadEngine.transferCommands(), _textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, _textureMipLevels);
 
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indexBuffer, _indexBufferMemory);
+		copyBufferToImage(_uploadEngine.transferCommands(), staging.buffer, staging.offset, _textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
 
-		copyBuffer(stagingBuffer, _indexBuffer, bufferSize);
+		// hand the whole mip chain over to the graphics queue, the blits below read level 0
+		VkImageSubresourceRange range{};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = _textureMipLevels;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+		_uploadEngine.releaseImage(_textureImage, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		// transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+		generateMipmaps(_uploadEngine.graphicsCommands(), _textureImage, texWidth, texHeight, _textureMipLevels);
 
-		vkDestroyBuffer(_device, stagingBuffer, nullptr);
-		vkFreeMemory(_device, stagingBufferMemory, nullptr);
+		// TODO: it looks like the code would be simpler if we just resized the image manually upon loading, and then load each mip level the same way we did for the original image
 	}
 
-	void destroyIndexBuffer()
+	void destroyTextureImage()
 	{
-		vkFreeMemory(_device, _indexBufferMemory, nullptr);
-		vkDestroyBuffer(_device, _indexBuffer, nullptr);
+		destroyImage(_textureImage, _textureImageMemory);
 	}
 
-	void createDescriptorSetLayout()
+	void createTextureImageView()
 	{
-		// Each descriptor set may have multiple resources of the same or different type.
-		// What type of resources can be bound through a descriptor set is defined in a descriptor set layout.
-		// There, through a VkDescriptorSetLayoutBinding structure, You specify a given type of a resource (for example sampler, storage image or uniform buffer) and the number of resources of this type accessed as an array inside shader.
-		// You can also specify multiple resources of the same or different types as separate layout entries (multiple VkDescriptorSetLayoutBinding entries specified during layout creation).
-		// Each such descriptor must use a separate, different binding.
-		// And the same binding must be used inside shader to access given resource:
-		//   layout(set = S, binding = B) uniform <variable_type> <variable_name>;
-		// So, to sum that up:
-		//   You can have an(homogenous) array of a single descriptor type
-		//   You can have several "bindings" which each can hold any descriptor type resource(or their array)
-		//   And as one more layer of indirection you can have several descriptor sets each with its own bindings
-		// Rule of thumb is probably "less is more".
-		// If you do not need the resources to have separate types or names, use array.
-		// If you do not need separate set, use only one set.
-
-		// example shader code:
-		//
-		//	// binding to a single sampled image descriptor in set 0
-		//	layout(set = 0, binding = 0) uniform texture2D mySampledImage;
-		//
-		//	// binding to an array of sampled image descriptors in set 0
-		//	layout(set = 0, binding = 1) uniform texture2D myArrayOfSampledImages[12];
-		//
-		//	// binding to a single uniform buffer descriptor in set 1
-		//	layout(set = 1, binding = 0) uniform myUniformBuffer
-		//	{
-		//		 vec4 myElement[32];
-		//	};
-		// 
-		// correspinding example API code:
-		//
-		//	const VkDescriptorSetLayoutBinding myDescriptorSetLayoutBinding[] =
-		//	{
-		//		// binding to a single image descriptor
-		//		{
-		//			0,                                      // binding
-		//			VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,       // descriptorType
-		//			1,                                      // descriptorCount
-		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
-		//			NULL                                    // pImmutableSamplers
-		//		},
-		//		// binding to an array of image descriptors
-		//		{
-		//			1,                                      // binding
-		//			VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,       // descriptorType
-		//			12,                                     // descriptorCount
-		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
-		//			NULL                                    // pImmutableSamplers
-		//		},
-		//		// binding to a single uniform buffer descriptor
-		//		{
-		//			0,                                      // binding
-		//			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,      // descriptorType
-		//			1,                                      // descriptorCount
-		//			VK_SHADER_STAGE_FRAGMENT_BIT,           // stageFlags
-		//			NULL                                    // pImmutableSamplers
-		//		}
-		//	};
-		//	const VkDescriptorSetLayoutCreateInfo myDescriptorSetLayoutCreateInfo[] =
-		//	{
-		//		// Create info for first descriptor set with two descriptor bindings
-		//		{
-		//			VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    // sType
-		//			NULL,                                                   // pNext
-		//			0,                                                      // flags
-		//			2,                                                      // bindingCount
-		//			&myDescriptorSetLayoutBinding[0]                        // pBindings
-		//		},
-		//		// Create info for second descriptor set with one descriptor binding
-		//		{
-		//			VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    // sType
-		//			NULL,                                                   // pNext
-		//			0,                                                      // flags
-		//			1,                                                      // bindingCount
-		//			&myDescriptorSetLayoutBinding[2]                        // pBindings
-		//		}
-		//	};
-		//	VkDescriptorSetLayout myDescriptorSetLayout[2];
-		//	//
-		//	// Create first descriptor set layout
-		//	//
-		//	myResult = vkCreateDescriptorSetLayout(
-		//		myDevice,
-		//		&myDescriptorSetLayoutCreateInfo[0],
-		//		NULL,
-		//		&myDescriptorSetLayout[0]);
-		//	//
-		//	// Create second descriptor set layout
-		//	//
-		//	myResult = vkCreateDescriptorSetLayout(
-		//		myDevice,
-		//		&myDescriptorSetLayoutCreateInfo[1],
-		//		NULL,
-		//		&myDescriptorSetLayout[1]);
-
-		// TODO: It is possible for the shader variable to represent an array of uniform buffer objects, and descriptorCount specifies the number of values in the array.
-		// This could be used to specify a transformation for each of the bones in a skeleton for skeletal animation, for example.
-		// Our MVP transformation is in a single uniform buffer object, so we're using a descriptorCount of 1.
-		VkDescriptorSetLayoutBinding uboLayoutBinding{};
-		uboLayoutBinding.binding = 0; // // must match layout(binding) used in the shader
-		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		uboLayoutBinding.descriptorCount = 1;
-		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-		uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
-
-		VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-		samplerLayoutBinding.binding = 1;
-		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		samplerLayoutBinding.descriptorCount = 1;
-		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		samplerLayoutBinding.pImmutableSamplers = nullptr;
+		_textureImageView = createImageView(_textureImage, _textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, _textureMipLevels);
+	}
 
-		VkDescriptorSetLayoutBinding bindings[] = {uboLayoutBinding, samplerLayoutBinding};
+	void createTextureSampler()
+	{
+		// TODO: avoid asking this again (already did this when choosing best device)
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
 
-		VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
-		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutCreateInfo.bindingCount = static_cast<uint32_t>(std::size(bindings));
-		layoutCreateInfo.pBindings = bindings;
+		VkSamplerCreateInfo samplerCreateInfo{};
+		samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+		samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+		samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerCreateInfo.anisotropyEnable = VK_TRUE;
+		samplerCreateInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+		samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+		samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+		samplerCreateInfo.compareEnable = VK_FALSE;
+		samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+		samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerCreateInfo.mipLodBias = 0.0f;
+		samplerCreateInfo.minLod = 0.0f;
+		samplerCreateInfo.maxLod = static_cast<float>(_textureMipLevels);
 
-		if(vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS)
+		if(vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_textureSampler) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to create descriptor set layout");
+			throw std::runtime_error("failed to create texture sampler");
 		}
 	}
 
-	void createUniformBuffers()
+	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
 	{
-		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-		_uniformBuffers.resize(_swapChainImages.size());
-		_uniformBuffersMemory.resize(_swapChainImages.size());
-
-		for(size_t i = 0; i < _swapChainImages.size(); i++)
+		for(VkFormat format : candidates)
 		{
-			createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _uniformBuffers[i], _uniformBuffersMemory[i]);
+			VkFormatProperties props;
+			vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &props);
+
+			if(tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
+			{
+				return format;
+			}
+			else if(tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+			{
+				return format;
+			}
 		}
+
+		throw std::runtime_error("failed to find supported format");
 	}
 
-	void destroyUniformBuffers()
+	VkFormat findDepthFormat()
 	{
-		for(size_t i = 0; i < _swapChainImages.size(); i++)
-		{
-			vkDestroyBuffer(_device, _uniformBuffers[i], nullptr);
-			vkFreeMemory(_device, _uniformBuffersMemory[i], nullptr);
-		}
+		return findSupportedFormat(
+			{VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT // sampled by the depth pyramid build
+		);
 	}
 
-	void updateUniformBuffer(uint32_t currentImage)
+	bool hasStencilComponent(VkFormat format)
 	{
-		// TODO: Using a UBO this way is not the most efficient way to pass frequently changing values to the shader.
-		// A more efficient way to pass a small buffer of data to shaders are push constants.
-		// Check these out in the future.
+		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+	}
 
-		// TODO: For host-to-device memory operations, you need to perform a form of synchronization known as a "domain operation".
-		// Fortunately, vkQueueSubmit automatically performs a domain operation on any host writes made visible before the vkQueueSubmit call.
-		// So if you write stuff to GPU-visible memory, then call vkQueueSubmit (either in the same thread or via CPU-side inter-thread communication), any commands in that submit call (or later ones) will see the values you wrote.
-		// Assuming you have made them visible. Writes to host - coherent memory are always visible to the GPU, but writes to non - coherent memory must be made visible via a call to vkFlushMappedMemoryRanges.
-		// If you want to write to memory asynchronously to the GPU process that reads it, you'll need to use an event.
-		// You write to the memory, make it visible if needs be, then set the event.
-		// The GPU commands that read from it would wait on the event, using VK_ACCESS_HOST_WRITE_BIT as the source access, and VK_PIPELINE_STAGE_HOST_BIT as the source stage.
-		// The destination access and stage are determined by how you plan to read from it.
+	// The passes of a frame and what each of them accesses, the render graph derives the barriers between them.
+	// The CPU driven paths are a single render pass: the primary only executes the secondary command buffers, which are recorded in parallel
+	// by the job system, each job covering a contiguous range of _drawList (or _drawBatches when instanced).
+	// The GPU driven path does two-phase occlusion culling: the objects visible last frame are drawn first, the depth pyramid is built from their depth,
+	// and whatever else passes the occlusion test against it is drawn on top. Each render pass takes one secondary with a draw per material,
+	// recording it is not worth a job. With async compute the early cull phase is not part of the graph, see submitAsyncCompute.
+	// The depth buffer is a transient image of the graph, so the graph is rebuilt with the swapchain.
+	void createRenderGraph()
+	{
+		// A single depth buffer serves all frames in flight: the graph tracks the accesses of its memory across frames,
+		// so the first pass of a frame waits for the depth writes of the previous one.
+		_renderGraph.init(_device, _synchronization2Enabled ? _vkCmdPipelineBarrier2 : nullptr,
+			[this](const VkMemoryRequirements& requirements, VkMemoryPropertyFlags preferred)
+			{
+				// the memory of a slot is aliased by the images of several resources, so it is tracked as a whole
+				return allocateMemory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, preferred, MemoryAllocator::ResourceKind::Optimal, {"render graph transients"});
+			},
+			[this](Allocation& allocation) { _allocator.free(allocation); });
+
+		const bool gpuDriven = _objectDataPath == ObjectDataPath::GpuDriven;
+		const VkImageLayout lastLayout = isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		GraphResources& resources = _graphResources;
+
+		// acquired every frame, its semaphore is waited on in COLOR_ATTACHMENT_OUTPUT (see drawFrame). The render pass path has the same wait
+		// in the external dependency of its first subpass, see createRenderPass.
+		const VkPipelineStageFlags2 colorInitialStages = _dynamicRenderingEnabled ? VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT : VK_PIPELINE_STAGE_2_NONE;
+		resources.color = _renderGraph.importImage("color", VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_LAYOUT_UNDEFINED, false, colorInitialStages);
+
+		// only an attachment that is cleared and thrown away, unless the depth pyramid is built from it
+		RenderGraph::TransientImageInfo depthInfo{};
+		depthInfo.format = findDepthFormat();
+		depthInfo.extent = _swapChainExtent;
+		depthInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (gpuDriven ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+		depthInfo.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+		depthInfo.lazy = !gpuDriven;
+		resources.depth = _renderGraph.createImage("depth", depthInfo);
+
+		_depthFormat = depthInfo.format;
+
+		// Render passes transition the attachments themselves, from the layout they expect to the one they leave behind, which the graph only tracks.
+		// With dynamic rendering the graph transitions the attachments in front of each pass instead, and the color image
+		// to the layout of presentation (or readback when headless) after the last one.
+		const VkPipelineStageFlags2 depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+		const VkAccessFlags2 depthAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		const VkAccessFlags2 colorAccess = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+		auto attachment = [&](RenderGraph::ResourceId id, bool depth, VkImageLayout renderPassInitialLayout, VkImageLayout renderPassFinalLayout) -> RenderGraph::Access
+		{
+			const VkPipelineStageFlags2 stages = depth ? depthStages : VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+			const VkAccessFlags2 access = depth ? depthAccess : colorAccess;
+			if(_dynamicRenderingEnabled)
+			{
+				return {id, stages, access, depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+			}
+			return {id, stages, access, renderPassInitialLayout, renderPassFinalLayout};
+		};
+		_renderGraph.exportImage(resources.color, lastLayout);
 
-		static auto startTime = std::chrono::high_resolution_clock::now();
+		if(!gpuDriven)
+		{
+			_renderGraph.addPass("render pass", {
+				attachment(resources.color, false, VK_IMAGE_LAYOUT_UNDEFINED, lastLayout),
+				attachment(resources.depth, true, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)},
+				[this](VkCommandBuffer commandBuffer, uint32_t imageIndex)
+				{
+					beginRendering(commandBuffer, true, true, imageIndex);
+					recordDrawJobs(_frameCommands[_currentFrame], imageIndex);
+					endRendering(commandBuffer);
+				});
+		}
+		else
+		{
+			// moved to VK_IMAGE_LAYOUT_GENERAL by the first depth pyramid pass after its creation, the early cull phase binds it but never samples it
+			resources.depthPyramid = _renderGraph.importImage("depth pyramid", VK_IMAGE_ASPECT_COLOR_BIT, VK_REMAINING_MIP_LEVELS, VK_IMAGE_LAYOUT_UNDEFINED, true);
+			resources.draws = _renderGraph.importBuffer("draws");
+			resources.drawCounts = _renderGraph.importBuffer("draw counts");
+			resources.visibility = _renderGraph.importBuffer("visibility");
 
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+			const VkPipelineStageFlags2 cullStages = VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT; // the clears of the early phase
+			const VkAccessFlags2 cullAccess = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+			const RenderGraph::Access drawReads[] = {
+				{resources.draws, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT},
+				{resources.drawCounts, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT}};
+
+			// early pass -------------------------------------------
+
+			if(!_asyncComputeEnabled)
+			{
+				_renderGraph.addPass("early culling", {
+					{resources.draws, cullStages, cullAccess},
+					{resources.drawCounts, cullStages, cullAccess},
+					{resources.visibility, cullStages, cullAccess}},
+					[this](VkCommandBuffer commandBuffer, uint32_t) { recordCulling(commandBuffer, CullPhase::Early); });
+			}
+
+			_renderGraph.addPass("early render pass", {
+				drawReads[0], drawReads[1],
+				attachment(resources.color, false, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+				attachment(resources.depth, true, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)},
+				[this](VkCommandBuffer commandBuffer, uint32_t imageIndex)
+				{
+					beginRendering(commandBuffer, true, false, imageIndex);
+					VkCommandBuffer earlyDraws = recordIndirectDraws(_frameCommands[_currentFrame].workers[0], imageIndex, CullPhase::Early);
+					vkCmdExecuteCommands(commandBuffer, 1, &earlyDraws);
+					endRendering(commandBuffer);
+				});
+
+			// depth pyramid -------------------------------------------
+
+			_renderGraph.addPass("depth pyramid", {
+				{resources.depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL},
+				{resources.depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL}},
+				[this](VkCommandBuffer commandBuffer, uint32_t) { recordDepthPyramid(commandBuffer); });
+
+			// late pass -------------------------------------------
+
+			_renderGraph.addPass("late culling", {
+				{resources.depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL},
+				{resources.draws, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT},
+				{resources.drawCounts, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT},
+				{resources.visibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT}},
+				[this](VkCommandBuffer commandBuffer, uint32_t) { recordCulling(commandBuffer, CullPhase::Late); });
+
+			_renderGraph.addPass("late render pass", {
+				drawReads[0], drawReads[1],
+				attachment(resources.color, false, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, lastLayout),
+				attachment(resources.depth, true, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)},
+				[this](VkCommandBuffer commandBuffer, uint32_t imageIndex)
+				{
+					beginRendering(commandBuffer, false, true, imageIndex);
+					VkCommandBuffer lateDraws = recordIndirectDraws(_frameCommands[_currentFrame].workers[0], imageIndex, CullPhase::Late);
+					vkCmdExecuteCommands(commandBuffer, 1, &lateDraws);
+					endRendering(commandBuffer);
+				});
+		}
 
-		UniformBufferObject ubo{};
-		ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.proj = glm::perspective(glm::radians(45.0f), _swapChainExtent.width / (float)_swapChainExtent.height, 0.1f, 10.0f);
+		_renderGraph.compile();
+		_renderGraph.print();
+		_depthImage = _renderGraph.getImage(resources.depth);
+		_depthImageView = _renderGraph.getImageView(resources.depth);
+	}
 
-		void* data;
-		vkMapMemory(_device, _uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(_device, _uniformBuffersMemory[currentImage]);
+	void destroyRenderGraph()
+	{
+		_renderGraph.destroy();
+		_depthImage = VK_NULL_HANDLE;
+		_depthImageView = VK_NULL_HANDLE;
 	}
 
-	void createDescriptorPool()
+	// Max depth pyramid for the occlusion test of cull.comp, rebuilt every frame from the depth of the early draws (see recordDepthPyramid).
+	// Level 0 is the power of two at or above half the depth buffer, so every level is an exact halving of the previous one.
+	// Depends on the depth buffer, so it is recreated with it, together with the descriptor sets that reference both.
+	void createDepthPyramid()
 	{
+		if(_objectDataPath != ObjectDataPath::GpuDriven)
+		{
+			return;
+		}
+
+		_depthPyramid.width = std::bit_ceil((_swapChainExtent.width + 1) / 2);
+		_depthPyramid.height = std::bit_ceil((_swapChainExtent.height + 1) / 2);
+		_depthPyramid.levels = std::bit_width(std::max(_depthPyramid.width, _depthPyramid.height));
+
+		// bound (never sampled) by the early cull phase, which may run on the async compute queue
+		createImage("depth pyramid", _depthPyramid.width, _depthPyramid.height, _depthPyramid.levels, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depthPyramid.image, _depthPyramid.memory, 0, true);
+		_depthPyramid.view = createImageView(_depthPyramid.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, _depthPyramid.levels);
+
+		_depthPyramid.mipViews.resize(_depthPyramid.levels);
+		for(uint32_t level = 0; level < _depthPyramid.levels; ++level)
+		{
+			VkImageViewCreateInfo viewInfo{};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = _depthPyramid.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = VK_FORMAT_R32_SFLOAT;
+			viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+
+			if(vkCreateImageView(_device, &viewInfo, nullptr, &_depthPyramid.mipViews[level]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create depth pyramid mip view");
+			}
+		}
+
+		// descriptor pool -------------------------------------------
+
+		// one set per level for the reduction, plus the one of cull.comp that samples the whole pyramid
 		VkDescriptorPoolSize poolSizes[2] = {};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(_swapChainImages.size());
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(_swapChainImages.size());
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[0].descriptorCount = _depthPyramid.levels + 1;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[1].descriptorCount = _depthPyramid.levels;
 
 		VkDescriptorPoolCreateInfo poolCreateInfo{};
 		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolCreateInfo.poolSizeCount = 2;
+		poolCreateInfo.poolSizeCount = static_cast<uint32_t>(std::size(poolSizes));
 		poolCreateInfo.pPoolSizes = poolSizes;
-		poolCreateInfo.maxSets = static_cast<uint32_t>(_swapChainImages.size());
+		poolCreateInfo.maxSets = _depthPyramid.levels + 1;
 
-		if(vkCreateDescriptorPool(_device, &poolCreateInfo, nullptr, &_descriptorPool) != VK_SUCCESS)
+		if(vkCreateDescriptorPool(_device, &poolCreateInfo, nullptr, &_depthPyramid.descriptorPool) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to create descriptor pool");
+			throw std::runtime_error("failed to create depth pyramid descriptor pool");
 		}
-	}
 
-	void createDescriptorSets()
-	{
-		std::vector<VkDescriptorSetLayout> layouts(_swapChainImages.size(), _descriptorSetLayout);
-		
+		// descriptor sets -------------------------------------------
+
+		std::vector<VkDescriptorSetLayout> layouts(_depthPyramid.levels, _depthReduceDescriptorSetLayout);
+		layouts.push_back(_depthPyramidDescriptorSetLayout);
+
 		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{};
 		descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocateInfo.descriptorPool = _descriptorPool;
-		descriptorSetAllocateInfo.descriptorSetCount = static_cast<uint32_t>(_swapChainImages.size());
+		descriptorSetAllocateInfo.descriptorPool = _depthPyramid.descriptorPool;
+		descriptorSetAllocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
 		descriptorSetAllocateInfo.pSetLayouts = layouts.data();
 
-		_descriptorSets.resize(layouts.size(), VK_NULL_HANDLE);
-		if(vkAllocateDescriptorSets(_device, &descriptorSetAllocateInfo, _descriptorSets.data()) != VK_SUCCESS)
+		std::vector<VkDescriptorSet> descriptorSets(layouts.size(), VK_NULL_HANDLE);
+		if(vkAllocateDescriptorSets(_device, &descriptorSetAllocateInfo, descriptorSets.data()) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to allocate descriptor sets");
+			throw std::runtime_error("failed to allocate depth pyramid descriptor sets");
 		}
+		_depthPyramid.cullSet = descriptorSets.back();
+		descriptorSets.pop_back();
+		_depthPyramid.reduceSets = std::move(descriptorSets);
 
-		for(size_t i = 0; i < _swapChainImages.size(); ++i)
+		// level 0 reads the depth buffer, every other level the one below; the pyramid stays in VK_IMAGE_LAYOUT_GENERAL
+		for(uint32_t level = 0; level < _depthPyramid.levels; ++level)
 		{
-			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = _uniformBuffers[i];
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(UniformBufferObject);
+			VkDescriptorImageInfo sourceInfo{};
+			sourceInfo.sampler = _depthPyramidSampler;
+			sourceInfo.imageView = level == 0 ? _depthImageView : _depthPyramid.mipViews[level - 1];
+			sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
 
-			VkDescriptorImageInfo imageInfo{};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = _textureImageView;
-			imageInfo.sampler = _textureSampler;
+			VkDescriptorImageInfo destinationInfo{};
+			destinationInfo.imageView = _depthPyramid.mipViews[level];
+			destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-			// The pBufferInfo field is used for descriptors that refer to buffer data, pImageInfo is used for descriptors that refer to image data, and pTexelBufferView is used for descriptors that refer to buffer views.
 			VkWriteDescriptorSet descriptorWrites[2] = {};
 			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[0].dstSet = _descriptorSets[i];
-			descriptorWrites[0].dstBinding = 0; // must match layout(binding) used in the shader
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[0].dstArrayElement = 0; // if the descriptor is an array, start index in array
-			descriptorWrites[0].descriptorCount = 1; // if the descriptor is an array, number of elements to update in array
-			descriptorWrites[0].pBufferInfo = &bufferInfo; // descriptorCount structures
+			descriptorWrites[0].dstSet = _depthPyramid.reduceSets[level];
+			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstArrayElement = 0;
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[0].descriptorCount = 1;
+			descriptorWrites[0].pImageInfo = &sourceInfo;
 
 			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[1].dstSet = _descriptorSets[i];
+			descriptorWrites[1].dstSet = _depthPyramid.reduceSets[level];
 			descriptorWrites[1].dstBinding = 1;
 			descriptorWrites[1].dstArrayElement = 0;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pImageInfo = &imageInfo;
+			descriptorWrites[1].pImageInfo = &destinationInfo;
 
 			vkUpdateDescriptorSets(_device, static_cast<uint32_t>(std::size(descriptorWrites)), descriptorWrites, 0, nullptr);
 		}
+
+		VkDescriptorImageInfo pyramidInfo{};
+		pyramidInfo.sampler = _depthPyramidSampler;
+		pyramidInfo.imageView = _depthPyramid.view;
+		pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet pyramidWrite{};
+		pyramidWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		pyramidWrite.dstSet = _depthPyramid.cullSet;
+		pyramidWrite.dstBinding = 0;
+		pyramidWrite.dstArrayElement = 0;
+		pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pyramidWrite.descriptorCount = 1;
+		pyramidWrite.pImageInfo = &pyramidInfo;
+
+		vkUpdateDescriptorSets(_device, 1, &pyramidWrite, 0, nullptr);
 	}
 
-	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+	void destroyDepthPyramid(DepthPyramid& pyramid)
 	{
-		// TODO: It is possible that the VK_FORMAT_R8G8B8A8_SRGB format is not supported by the graphics hardware.
-		// You should have a list of acceptable alternatives and go with the best one that is supported.
-		// However, support for this particular format is so widespread that we'll skip this step.
-		// Using different formats would also require annoying conversions. 
-		VkImageCreateInfo imageCreateInfo{};
-		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageCreateInfo.extent.width = width;
-		imageCreateInfo.extent.height = height;
-		imageCreateInfo.extent.depth = 1;
-		imageCreateInfo.mipLevels = mipLevels;
-		imageCreateInfo.arrayLayers = 1;
-		imageCreateInfo.format = format;
-		imageCreateInfo.tiling = tiling;
-		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageCreateInfo.usage = usage;
-		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imageCreateInfo.flags = 0; // Optional
-
-		if(vkCreateImage(_device, &imageCreateInfo, nullptr, &image) != VK_SUCCESS)
+		if(pyramid.image == VK_NULL_HANDLE)
 		{
-			throw std::runtime_error("failed to create image");
+			return;
 		}
 
-		VkMemoryRequirements memRequirements;
-		vkGetImageMemoryRequirements(_device, image, &memRequirements);
-
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		if(vkAllocateMemory(_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
+		vkDestroyDescriptorPool(_device, pyramid.descriptorPool, nullptr); // frees the sets too
+		for(auto view : pyramid.mipViews)
+		{
+			vkDestroyImageView(_device, view, nullptr);
 		}
-
-		vkBindImageMemory(_device, image, imageMemory, 0);
+		pyramid.mipViews.clear();
+		vkDestroyImageView(_device, pyramid.view, nullptr);
+		destroyImage(pyramid.image, pyramid.memory);
 	}
 
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+	// Loads the mesh cache if it is up to date, otherwise converts the OBJ and writes the cache for the next run.
+	// _vertexData and _indexData then point either into the mapped cache file or into _encodedVertices and _indices, until releaseModelData.
+	void loadModel()
 	{
-		VkCommandBuffer commandBuffer = beginSingleShotCommands();
-
-		VkImageMemoryBarrier barrier{};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.image = image;
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = mipLevels;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-
-		VkPipelineStageFlags sourceStage;
-		VkPipelineStageFlags destinationStage;
-		
-		if(oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		auto start = std::chrono::high_resolution_clock::now();
 
-			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-			destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		}
-		else if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		if(openMeshCache())
 		{
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			printf("mesh cache: loaded %s\n", MESH_CACHE_PATH.c_str());
 		}
 		else
 		{
-			throw std::invalid_argument("unsupported layout transition");
+			importObj();
+			buildLods();
+			optimizeMesh();
+			encodeVertices();
+			encodeIndices();
+			if(writeMeshCache() && openMeshCache())
+			{
+				// use the mapping as well, so both runs upload from the same place
+				releaseImportData();
+			}
+			else
+			{
+				_vertexData = _encodedVertices;
+				_indexData = _encodedIndices;
+			}
 		}
 
-		vkCmdPipelineBarrier(
-			commandBuffer,
-			sourceStage,
-			destinationStage,
-			0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier
-		);
-
-		endSingleShotCommands(commandBuffer);
+		auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("model: %llu vertices (%u + %u bytes), %zu indices (%u bytes) in %.2f ms\n", static_cast<unsigned long long>(_vertexCount),
+			_vertexFormat.getStride(0), _vertexFormat.splitPositions ? _vertexFormat.getStride(1) : 0,
+			_indexData.size() / getIndexSize(_indexType), getIndexSize(_indexType), elapsed);
+		putc('\n', stdout);
 	}
 
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+	// Packs _vertices into the streams described by _vertexFormat.
+	void encodeVertices()
 	{
-		VkCommandBuffer commandBuffer = beginSingleShotCommands();
+		_vertexCount = _vertices.size();
+		_positionScale = glm::vec3(1.0f);
+		_positionBias = glm::vec3(0.0f);
 
-		VkBufferImageCopy region{};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-		region.imageOffset = {0, 0, 0};
-		region.imageExtent = {width, height, 1};
+		if(_vertexFormat.position == PositionFormat::Snorm16 && !_vertices.empty())
+		{
+			glm::vec3 boundsMin = _vertices[0].pos;
+			glm::vec3 boundsMax = _vertices[0].pos;
+			for(const auto& vertex : _vertices)
+			{
+				boundsMin = glm::min(boundsMin, vertex.pos);
+				boundsMax = glm::max(boundsMax, vertex.pos);
+			}
 
-		vkCmdCopyBufferToImage(
-			commandBuffer,
-			buffer,
-			image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&region
-		);
+			// per axis, so the precision follows the extent of the mesh; a flat axis keeps a non-zero scale
+			_positionBias = 0.5f * (boundsMin + boundsMax);
+			_positionScale = glm::max(0.5f * (boundsMax - boundsMin), glm::vec3(1e-6f));
+		}
 
-		endSingleShotCommands(commandBuffer);
-	}
+		if(_vertexFormat.texCoord == TexCoordFormat::Unorm16)
+		{
+			for(const auto& vertex : _vertices)
+			{
+				if(vertex.texCoord.x < 0.0f || vertex.texCoord.x > 1.0f || vertex.texCoord.y < 0.0f || vertex.texCoord.y > 1.0f)
+				{
+					puts("model: texture coordinates outside [0, 1] are clamped by the unorm16 format");
+					break;
+				}
+			}
+		}
 
-	void generateMipmaps(VkImage image, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
-	{
-		VkCommandBuffer commandBuffer = beginSingleShotCommands();
+		const VkDeviceSize positionStride = _vertexFormat.getStride(0);
+		const VkDeviceSize attributeStride = _vertexFormat.splitPositions ? _vertexFormat.getStride(1) : 0;
+		_attributeStreamOffset = _vertexFormat.splitPositions ? alignSection(_vertexCount * positionStride) : 0;
+		_encodedVertices.assign(_attributeStreamOffset + _vertexCount * attributeStride + (_vertexFormat.splitPositions ? 0 : _vertexCount * positionStride), 0);
 
-		VkImageMemoryBarrier barrier{};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.image = image;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-		barrier.subresourceRange.levelCount = 1;
+		for(size_t i = 0; i < _vertices.size(); ++i)
+		{
+			_vertexFormat.encode(_vertices[i], _positionScale, _positionBias,
+				_encodedVertices.data() + i * positionStride, _encodedVertices.data() + _attributeStreamOffset + i * attributeStride);
+		}
+	}
 
-		int32_t mipWidth = texWidth;
-		int32_t mipHeight = texHeight;
+	// Reorders the imported triangles and vertices as selected by _meshOptimization, which only changes performance, not the image.
+	void optimizeMesh()
+	{
+		const MeshOptimizer::CacheStatistics before = MeshOptimizer::analyzeVertexCache(_indices, _vertices.size());
 
-		for(uint32_t i = 1; i < mipLevels; i++)
+		if(_meshOptimization != MeshOptimization::None)
 		{
-			barrier.subresourceRange.baseMipLevel = i - 1;
-			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			auto start = std::chrono::high_resolution_clock::now();
 
-			vkCmdPipelineBarrier(commandBuffer,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-				0, nullptr,
-				0, nullptr,
-				1, &barrier);
+			// every draw is optimized on its own, they all index _vertices directly (vertexOffset 0) after the import
+			for(const DrawCommand& draw : _drawCommands)
+			{
+				std::span<uint32_t> indices(_indices.data() + draw.firstIndex, draw.indexCount);
 
-			VkImageBlit blit{};
-			blit.srcOffsets[0] = {0, 0, 0};
-			blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.srcSubresource.mipLevel = i - 1;
-			blit.srcSubresource.baseArrayLayer = 0;
-			blit.srcSubresource.layerCount = 1;
-			blit.dstOffsets[0] = {0, 0, 0};
-			blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
-			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.dstSubresource.mipLevel = i;
-			blit.dstSubresource.baseArrayLayer = 0;
-			blit.dstSubresource.layerCount = 1;
+				MeshOptimizer::optimizeVertexCache(indices, _vertices.size());
+				if(_meshOptimization == MeshOptimization::VertexCacheAndOverdraw)
+				{
+					MeshOptimizer::optimizeOverdraw(indices, _vertices, OVERDRAW_THRESHOLD);
+				}
+			}
+			MeshOptimizer::optimizeVertexFetch(_indices, _vertices);
 
-			// Beware if you are using a dedicated transfer queue (as suggested in Vertex buffers): 
-			// vkCmdBlitImage must be submitted to a queue with graphics capability.
-			vkCmdBlitImage(commandBuffer,
-				image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1, &blit,
-				VK_FILTER_LINEAR);
+			auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+			printf("mesh optimizer: %.2f ms\n", elapsed);
+		}
 
-			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		const MeshOptimizer::CacheStatistics after = MeshOptimizer::analyzeVertexCache(_indices, _vertices.size());
+		printf("mesh optimizer: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (FIFO of %u)\n", before.acmr, after.acmr, before.atvr, after.atvr, MeshOptimizer::CACHE_SIZE);
+	}
 
-			vkCmdPipelineBarrier(commandBuffer,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-				0, nullptr,
-				0, nullptr,
-				1, &barrier);
+	static uint32_t getIndexSize(VkIndexType indexType)
+	{
+		return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
 
-			if(mipWidth > 1) mipWidth /= 2;
-			if(mipHeight > 1) mipHeight /= 2;
+	// 16-bit indices whenever every vertex can be addressed by them, which halves the index buffer and its fetch bandwidth.
+	void encodeIndices()
+	{
+		_indexType = _vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32; // primitive restart is off, so 0xFFFF is a valid index
+		_encodedIndices.resize(_indices.size() * getIndexSize(_indexType));
+
+		if(_indexType == VK_INDEX_TYPE_UINT16)
+		{
+			uint16_t* indices = reinterpret_cast<uint16_t*>(_encodedIndices.data());
+			for(size_t i = 0; i < _indices.size(); ++i)
+			{
+				indices[i] = static_cast<uint16_t>(_indices[i]);
+			}
+		}
+		else
+		{
+			memcpy(_encodedIndices.data(), _indices.data(), _encodedIndices.size());
 		}
+	}
 
-		barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	void releaseImportData()
+	{
+		_vertices.clear();
+		_vertices.shrink_to_fit();
+		_encodedVertices.clear();
+		_encodedVertices.shrink_to_fit();
+		_indices.clear();
+		_indices.shrink_to_fit();
+		_encodedIndices.clear();
+		_encodedIndices.shrink_to_fit();
+	}
 
-		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier);
+	// The vertex and index data are copied into the staging ring when the buffers are created, after that they are not needed anymore.
+	void releaseModelData()
+	{
+		_vertexData = {};
+		_indexData = {};
+		releaseImportData();
+		_meshFile.close();
+	}
 
-		endSingleShotCommands(commandBuffer);
+	static bool getSourceStamp(const std::string& path, uint64_t& size, int64_t& time)
+	{
+		std::error_code error;
+		size = std::filesystem::file_size(path, error);
+		if(error)
+		{
+			return false;
+		}
+		time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+		return !error;
 	}
 
-	void createTextureImage()
+	static uint64_t alignSection(uint64_t offset)
 	{
-		int texWidth = 0, texHeight = 0, texChannels = 0;
-		stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		ScopeExit se{[&] {stbi_image_free(pixels); }};
+		return (offset + MESH_SECTION_ALIGNMENT - 1) & ~(MESH_SECTION_ALIGNMENT - 1);
+	}
 
-		_textureMipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
-		
-		if(!pixels)
+	bool openMeshCache()
+	{
+		if(!_meshFile.open(MESH_CACHE_PATH))
 		{
-			stbi_image_free(pixels);
-			throw std::runtime_error("failed to load texture image from file");
+			return false;
 		}
 
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
+		auto reject = [this](const char* reason)
+		{
+			printf("mesh cache: %s, rebuilding\n", reason);
+			_meshFile.close();
+			return false;
+		};
 
-		VkBuffer stagingBuffer = VK_NULL_HANDLE;
-		VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+		if(_meshFile.size() < sizeof(MeshFileHeader))
+		{
+			return reject("truncated header");
+		}
 
-		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		MeshFileHeader header;
+		memcpy(&header, _meshFile.data(), sizeof(header));
 
-		void* data = nullptr;
-		vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(_device, stagingBufferMemory);
+		if(header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+		{
+			return reject("different file version");
+		}
 
-		// TODO: All of the helper functions that submit commands so far have been set up to execute synchronously by waiting for the queue to become idle.
-		// For practical applications it is recommended to combine these operations in a single command buffer and execute them asynchronously for higher throughput, especially the transitions and copy in the createTextureImage function. 
+		if(header.vertexFormat != _vertexFormat)
+		{
+			return reject("different vertex format");
+		}
 
-		createImage(texWidth, texHeight, _textureMipLevels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _textureImage, _textureImageMemory);
+		if(header.meshOptimization != _meshOptimization)
+		{
+			return reject("different mesh optimization");
+		}
 
-		transitionImageLayout(_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, _textureMipLevels);
+		if(header.indexType != VK_INDEX_TYPE_UINT16 && header.indexType != VK_INDEX_TYPE_UINT32)
+		{
+			return reject("unknown index type");
+		}
 
-		copyBufferToImage(stagingBuffer, _textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+		// without the OBJ around the cache is all we have, so it is used as is
+		uint64_t sourceSize = 0;
+		int64_t sourceTime = 0;
+		if(getSourceStamp(MODEL_PATH, sourceSize, sourceTime) && (sourceSize != header.sourceSize || sourceTime != header.sourceTime))
+		{
+			return reject("model changed");
+		}
 
-		// transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
-		generateMipmaps(_textureImage, texWidth, texHeight, _textureMipLevels);
+		const uint64_t fileSize = _meshFile.size();
+		auto sectionFits = [fileSize](uint64_t offset, uint64_t count, uint64_t stride)
+		{
+			return offset % MESH_SECTION_ALIGNMENT == 0 && offset <= fileSize && count <= (fileSize - offset) / stride;
+		};
+		const uint64_t expectedVertexSize = _vertexFormat.splitPositions ?
+			header.attributeStreamOffset + header.vertexCount * _vertexFormat.getStride(1) : header.vertexCount * _vertexFormat.getStride(0);
+		if(header.vertexSize != expectedVertexSize || header.attributeStreamOffset > header.vertexSize ||
+			!sectionFits(header.vertexOffset, header.vertexSize, 1) ||
+			!sectionFits(header.indexOffset, header.indexCount, getIndexSize(header.indexType)) ||
+			!sectionFits(header.drawOffset, header.drawCount, sizeof(DrawCommand)) ||
+			!sectionFits(header.meshOffset, header.meshCount, sizeof(Mesh)))
+		{
+			return reject("truncated sections");
+		}
 
-		// TODO: it looks like the code would be simpler if we just resized the image manually upon loading, and then load each mip level the same way we did for the original image
+		// every model has its meshes, a cache without any has nothing to draw
+		if(header.meshCount == 0)
+		{
+			return reject("no meshes");
+		}
 
-		vkDestroyBuffer(_device, stagingBuffer, nullptr);
-		vkFreeMemory(_device, stagingBufferMemory, nullptr);
+		// sections are aligned in the file and the mapping is page aligned, so they can be used in place
+		_vertexData = {_meshFile.data() + header.vertexOffset, header.vertexSize};
+		_vertexCount = header.vertexCount;
+		_attributeStreamOffset = header.attributeStreamOffset;
+		_positionScale = glm::vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+		_positionBias = glm::vec3(header.positionBias[0], header.positionBias[1], header.positionBias[2]);
+		_indexData = {_meshFile.data() + header.indexOffset, header.indexCount * getIndexSize(header.indexType)};
+		_indexType = header.indexType;
+
+		const DrawCommand* draws = reinterpret_cast<const DrawCommand*>(_meshFile.data() + header.drawOffset);
+		_drawCommands.assign(draws, draws + header.drawCount);
+
+		const Mesh* meshes = reinterpret_cast<const Mesh*>(_meshFile.data() + header.meshOffset);
+		_meshes.assign(meshes, meshes + header.meshCount);
+		for(const Mesh& mesh : _meshes)
+		{
+			if(mesh.lodCount == 0 || mesh.firstLod + mesh.lodCount > _drawCommands.size())
+			{
+				_meshes.clear();
+				return reject("invalid LOD ranges");
+			}
+		}
+		return true;
 	}
 
-	void destroyTextureImage()
+	// Written to a temporary file first, so an interrupted conversion never leaves a corrupt cache behind.
+	bool writeMeshCache()
 	{
-		vkDestroyImage(_device, _textureImage, nullptr);
-		vkFreeMemory(_device, _textureImageMemory, nullptr);
-	}
+		MeshFileHeader header;
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		getSourceStamp(MODEL_PATH, header.sourceSize, header.sourceTime);
+		header.vertexFormat = _vertexFormat;
+		memcpy(header.positionScale, &_positionScale, sizeof(header.positionScale));
+		memcpy(header.positionBias, &_positionBias, sizeof(header.positionBias));
+		header.drawCount = static_cast<uint32_t>(_drawCommands.size());
+		header.vertexCount = _vertexCount;
+		header.vertexSize = _encodedVertices.size();
+		header.attributeStreamOffset = _attributeStreamOffset;
+		header.indexCount = _indices.size();
+		header.indexType = _indexType;
+		header.meshOptimization = _meshOptimization;
+		header.vertexOffset = alignSection(sizeof(header));
+		header.indexOffset = alignSection(header.vertexOffset + header.vertexSize);
+		header.drawOffset = alignSection(header.indexOffset + _encodedIndices.size());
+		header.meshCount = static_cast<uint32_t>(_meshes.size());
+		header.meshOffset = alignSection(header.drawOffset + _drawCommands.size() * sizeof(DrawCommand));
+
+		const std::string tempPath = MESH_CACHE_PATH + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if(!file.is_open())
+			{
+				puts("mesh cache: failed to create cache file");
+				return false;
+			}
 
-	void createTextureImageView()
-	{
-		_textureImageView = createImageView(_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, _textureMipLevels);
+			auto writeSection = [&file](uint64_t offset, const void* data, size_t size)
+			{
+				const uint64_t padding = offset - static_cast<uint64_t>(file.tellp());
+				const char zeros[MESH_SECTION_ALIGNMENT] = {};
+				file.write(zeros, padding);
+				file.write(static_cast<const char*>(data), size);
+			};
+
+			writeSection(0, &header, sizeof(header));
+			writeSection(header.vertexOffset, _encodedVertices.data(), _encodedVertices.size());
+			writeSection(header.indexOffset, _encodedIndices.data(), _encodedIndices.size());
+			writeSection(header.drawOffset, _drawCommands.data(), _drawCommands.size() * sizeof(DrawCommand));
+			writeSection(header.meshOffset, _meshes.data(), _meshes.size() * sizeof(Mesh));
+
+			if(!file)
+			{
+				puts("mesh cache: failed to write cache file");
+				return false;
+			}
+		}
+
+		std::remove(MESH_CACHE_PATH.c_str());
+		if(std::rename(tempPath.c_str(), MESH_CACHE_PATH.c_str()) != 0)
+		{
+			puts("mesh cache: failed to replace cache file");
+			return false;
+		}
+
+		printf("mesh cache: written %s\n", MESH_CACHE_PATH.c_str());
+		return true;
 	}
 
-	void createTextureSampler()
+	void importObj()
 	{
-		// TODO: avoid asking this again (already did this when choosing best device)
-		VkPhysicalDeviceProperties properties{};
-		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string warn, err;
 
-		VkSamplerCreateInfo samplerCreateInfo{};
-		samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-		samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-		samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerCreateInfo.anisotropyEnable = VK_TRUE;
-		samplerCreateInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-		samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-		samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-		samplerCreateInfo.compareEnable = VK_FALSE;
-		samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-		samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerCreateInfo.mipLodBias = 0.0f;
-		samplerCreateInfo.minLod = 0.0f;
-		samplerCreateInfo.maxLod = static_cast<float>(_textureMipLevels);
+		if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
+		{
+			throw std::runtime_error(warn + err);
+		}
 
-		if(vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_textureSampler) != VK_SUCCESS)
+		// every shape goes into the same vertex and index buffers
+		std::vector<tinyobj::index_t> concatenated;
+		std::span<const tinyobj::index_t> corners;
+		if(shapes.size() == 1)
 		{
-			throw std::runtime_error("failed to create texture sampler");
+			corners = shapes[0].mesh.indices;
+		}
+		else
+		{
+			for(const auto& shape : shapes)
+			{
+				concatenated.insert(concatenated.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+			}
+			corners = concatenated;
 		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		deduplicateVertices(attrib, corners);
+		auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		printf("model: deduplicated %zu corners into %zu vertices in %.2f ms\n", corners.size(), _vertices.size(), elapsed);
+
+		Mesh mesh;
+		mesh.firstLod = static_cast<uint32_t>(_drawCommands.size());
+		_meshes.push_back(mesh);
+
+		DrawCommand draw;
+		draw.indexCount = static_cast<uint32_t>(_indices.size());
+		_drawCommands.push_back(draw);
 	}
 
-	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+	// Appends LOD 1 and coarser to every mesh, each level clustering LOD 0 on a grid half as fine as the previous one.
+	// Stops early once a level no longer removes enough triangles to be worth a draw of its own.
+	void buildLods()
 	{
-		for(VkFormat format : candidates)
+		for(Mesh& mesh : _meshes)
 		{
-			VkFormatProperties props;
-			vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &props);
+			const DrawCommand full = _drawCommands[mesh.firstLod];
+			// copied, the levels are appended to _indices
+			const std::vector<uint32_t> indices(_indices.begin() + full.firstIndex, _indices.begin() + full.firstIndex + full.indexCount);
+			if(indices.empty())
+			{
+				continue;
+			}
 
-			if(tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
+			// the LOD draws are appended after the draws of this mesh, so the mesh must be the last one imported
+			if(mesh.firstLod + mesh.lodCount != _drawCommands.size())
 			{
-				return format;
+				throw std::runtime_error("LODs must be built right after their mesh is imported");
 			}
-			else if(tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+
+			glm::vec3 boundsMin = _vertices[indices[0]].pos;
+			glm::vec3 boundsMax = boundsMin;
+			for(uint32_t index : indices)
 			{
-				return format;
+				boundsMin = glm::min(boundsMin, _vertices[index].pos);
+				boundsMax = glm::max(boundsMax, _vertices[index].pos);
 			}
-		}
 
-		throw std::runtime_error("failed to find supported format");
-	}
+			mesh.boundsCenter = 0.5f * (boundsMin + boundsMax);
+			mesh.boundsRadius = 0.0f;
+			for(uint32_t index : indices)
+			{
+				mesh.boundsRadius = std::max(mesh.boundsRadius, glm::distance(mesh.boundsCenter, _vertices[index].pos));
+			}
 
-	VkFormat findDepthFormat()
-	{
-		return findSupportedFormat(
-			{VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-		);
-	}
+			const float diagonal = glm::length(boundsMax - boundsMin);
+			uint32_t previousCount = full.indexCount;
 
-	bool hasStencilComponent(VkFormat format)
-	{
-		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+			printf("LOD 0: %u triangles\n", full.indexCount / 3);
+
+			for(uint32_t level = 1; level < MAX_LODS; ++level)
+			{
+				const float cellSize = diagonal / static_cast<float>(LOD_BASE_GRID >> (level - 1));
+
+				std::vector<uint32_t> simplified;
+				const float error = MeshOptimizer::simplifyClustered(indices, _vertices, cellSize, simplified);
+
+				if(simplified.empty() || simplified.size() > previousCount * LOD_MIN_REDUCTION)
+				{
+					break;
+				}
+
+				DrawCommand draw;
+				draw.firstIndex = static_cast<uint32_t>(_indices.size());
+				draw.indexCount = static_cast<uint32_t>(simplified.size());
+				draw.lodError = error;
+				_indices.insert(_indices.end(), simplified.begin(), simplified.end());
+				_drawCommands.push_back(draw);
+				++mesh.lodCount;
+
+				printf("LOD %u: %u triangles, error %.4f\n", level, draw.indexCount / 3, error);
+				previousCount = draw.indexCount;
+			}
+		}
 	}
 
-	void createDepthBuffer()
+	// Picks, per object, the coarsest LOD whose error projects to at most LOD_ERROR_PIXELS on screen.
+	// The error is projected at the point of the bounding sphere nearest to the camera, so it never underestimates.
+	uint32_t selectLod(const Mesh& mesh, const glm::mat4& modelView, float pixelsPerUnitAtUnitDepth) const
 	{
-		// TODO: although the tutorial uses only one depth buffer, several sources on the internet claim this is wrong and the code does not guarantee that two frames cannot overlap (draw simultaneously), leading to race conditions on the same depth buffer
-		// the best performance solution would be to create one depth buffer per frame in flight
-		// refs:
-		// https://www.reddit.com/r/vulkan/comments/aavxl4/why_is_a_single_depth_buffer_sufficient_for/
-		// https://stackoverflow.com/questions/62371266/why-is-a-single-depth-buffer-sufficient-for-this-vulkan-swapchain-render-loop
-		// https://www.reddit.com/r/vulkan/comments/aavxl4/why_is_a_single_depth_buffer_sufficient_for/ecvgupj/
-		// Note that some comments on the tutorial webpage says it is still ok:
-		//   As per the spec, implicit ordering does not guarantee that commands submitted before finish before commands submitted after start. For that, a synchronization command must be used. I think the best way to look at implicit ordering is that commands submitted before must start before commands submitted after start (but not finish).
-		//   In the most general case, where the graphicsand present queue end up being different, this example ends up relying on a bit of undefined behaviour, because there are no guarantees that two frames will not overlap(note that the external subpass dependency is not enough because it is for the COLOR_OUTPUT stage while depth writing happens in the FRAGMENT_TESTS stages).
-		//   However, if the graphics and present queue do end up being the same, then the renderFinished semaphore guarantees proper execution ordering.This is because the vkQueuePresentKHR command waits on that semaphoreand it must begin before later commands in the queue begin(due to implicit ordering) and that only happens after rendering from the previous frame finished.
-		VkFormat depthFormat = findDepthFormat();
-		createImage(_swapChainExtent.width, _swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depthImage, _depthImageMemory);
-		_depthImageView = createImageView(_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+		const glm::vec4 center = modelView * glm::vec4(mesh.boundsCenter, 1.0f);
+		const float depth = std::max(-center.z - mesh.boundsRadius, 1e-3f);
+		const float maxError = LOD_ERROR_PIXELS * depth / pixelsPerUnitAtUnitDepth;
 
-		// We don't need to explicitly transition the layout of the image to a depth attachment because we'll take care of this in the render pass.
+		uint32_t lod = mesh.firstLod;
+		for(uint32_t i = 1; i < mesh.lodCount; ++i)
+		{
+			if(_drawCommands[mesh.firstLod + i].lodError > maxError)
+			{
+				break;
+			}
+			lod = mesh.firstLod + i;
+		}
+		return lod;
 	}
 
-	void destroyDepthBuffer()
+	static Vertex makeVertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index)
 	{
-		vkDestroyImageView(_device, _depthImageView, nullptr);
-		vkDestroyImage(_device, _depthImage, nullptr);
-		vkFreeMemory(_device, _depthImageMemory, nullptr);
+		Vertex vertex{};
+
+		vertex.pos = {
+			attrib.vertices[3 * index.vertex_index + 0],
+			attrib.vertices[3 * index.vertex_index + 1],
+			attrib.vertices[3 * index.vertex_index + 2]
+		};
+
+		// The OBJ format assumes a coordinate system where a vertical coordinate of 0 means the bottom of the image.
+		// However we've uploaded our image into Vulkan in a top to bottom orientation where 0 means the top of the image.
+		// Solve this by flipping the vertical component of the texture coordinates.
+		vertex.texCoord = {
+			attrib.texcoords[2 * index.texcoord_index + 0],
+			1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+		};
+
+		vertex.color = {1.0f, 1.0f, 1.0f};
+
+		return vertex;
 	}
 
-	void loadModel()
+	// The corners contain a lot of duplicated vertex data, because many vertices are included in multiple triangles.
+	// We keep only the unique vertices and use the index buffer to reuse them whenever they come up.
+	// The result is the same as a serial pass (vertices numbered in order of first use), built in three parallel steps:
+	// 1. corners are split in contiguous chunks, and each chunk sorts its corners into partitions by hash
+	// 2. each partition deduplicates its corners with its own VertexTable, equal vertices always land in the same partition
+	// 3. a prefix sum over the chunks numbers the unique vertices, then every corner looks up the number of its first occurrence
+	void deduplicateVertices(const tinyobj::attrib_t& attrib, std::span<const tinyobj::index_t> corners)
 	{
-		tinyobj::attrib_t attrib;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string warn, err;
+		const uint32_t cornerCount = static_cast<uint32_t>(corners.size());
+		const uint32_t chunkCount = std::max(1u, std::min(_threadPool.getWorkerCount(), cornerCount / MIN_CORNERS_PER_JOB));
+		const uint32_t partitionCount = std::bit_ceil(chunkCount * 4); // more partitions than workers evens out the load
 
-		if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
+		auto chunkBegin = [&](uint32_t chunk) { return static_cast<uint32_t>(uint64_t(cornerCount) * chunk / chunkCount); };
+		auto partitionOf = [&](uint64_t hash) { return static_cast<uint32_t>(hash >> 40) & (partitionCount - 1); }; // bits the tables do not use for probing
+
+		// 1. partition the corners of each chunk, in order -------------------------------------------
+
+		std::vector<std::vector<std::vector<uint32_t>>> buckets(chunkCount, std::vector<std::vector<uint32_t>>(partitionCount));
+
+		_threadPool.run(chunkCount, [&](uint32_t chunk, uint32_t)
 		{
-			throw std::runtime_error(warn + err);
-		}
+			for(uint32_t corner = chunkBegin(chunk); corner < chunkBegin(chunk + 1); ++corner)
+			{
+				buckets[chunk][partitionOf(hashVertex(makeVertex(attrib, corners[corner])))].push_back(corner);
+			}
+		});
+
+		// 2. deduplicate each partition: firstCorner[c] is the first corner with the same vertex as c -------------------------------------------
+
+		std::vector<uint32_t> firstCorner(cornerCount);
+
+		_threadPool.run(partitionCount, [&](uint32_t partition, uint32_t)
+		{
+			VertexTable table;
+			for(uint32_t chunk = 0; chunk < chunkCount; ++chunk) // chunks in order, so the first insertion is the first occurrence
+			{
+				for(uint32_t corner : buckets[chunk][partition])
+				{
+					const Vertex vertex = makeVertex(attrib, corners[corner]);
+					firstCorner[corner] = table.findOrInsert(vertex, hashVertex(vertex), corner);
+				}
+			}
+		});
+
+		buckets.clear();
 
-		// The vertices vector contains a lot of duplicated vertex data, because many vertices are included in multiple triangles.
-		// We should keep only the unique vertices and use the index buffer to reuse them whenever they come up.
-		std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+		// 3. number unique vertices in order of first use -------------------------------------------
 
-		for(const auto& shape : shapes)
+		std::vector<uint32_t> chunkFirstVertex(chunkCount + 1, 0);
+
+		_threadPool.run(chunkCount, [&](uint32_t chunk, uint32_t)
 		{
-			for(const auto& index : shape.mesh.indices)
+			uint32_t uniqueCount = 0;
+			for(uint32_t corner = chunkBegin(chunk); corner < chunkBegin(chunk + 1); ++corner)
 			{
-				Vertex vertex{};
+				uniqueCount += firstCorner[corner] == corner;
+			}
+			chunkFirstVertex[chunk + 1] = uniqueCount;
+		});
 
-				vertex.pos = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]
-				};
+		for(uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			chunkFirstVertex[chunk + 1] += chunkFirstVertex[chunk];
+		}
 
-				// The OBJ format assumes a coordinate system where a vertical coordinate of 0 means the bottom of the image.
-				// However we've uploaded our image into Vulkan in a top to bottom orientation where 0 means the top of the image.
-				// Solve this by flipping the vertical component of the texture coordinates.
-				vertex.texCoord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-				};
+		_vertices.resize(chunkFirstVertex[chunkCount]);
+		_indices.resize(cornerCount);
 
-				vertex.color = {1.0f, 1.0f, 1.0f};
+		// unique corners first, so that the second pass only reads indices that are final
+		_threadPool.run(chunkCount, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t vertexIndex = chunkFirstVertex[chunk];
+			for(uint32_t corner = chunkBegin(chunk); corner < chunkBegin(chunk + 1); ++corner)
+			{
+				if(firstCorner[corner] == corner)
+				{
+					_vertices[vertexIndex] = makeVertex(attrib, corners[corner]);
+					_indices[corner] = vertexIndex++;
+				}
+			}
+		});
 
-				if(!uniqueVertices.contains(vertex))
+		_threadPool.run(chunkCount, [&](uint32_t chunk, uint32_t)
+		{
+			for(uint32_t corner = chunkBegin(chunk); corner < chunkBegin(chunk + 1); ++corner)
+			{
+				if(firstCorner[corner] != corner)
 				{
-					uniqueVertices[vertex] = static_cast<uint32_t>(_vertices.size());
-					_vertices.push_back(vertex);
+					_indices[corner] = _indices[firstCorner[corner]];
 				}
+			}
+		});
+	}
+
+	// Fixed corner view, except in benchmarks: one orbit around the grid every BENCHMARK_ORBIT_SECONDS while moving between
+	// half and one and a half times distance, so that LOD selection and culling see both close and far views.
+	glm::vec3 getCameraPosition(float time, float distance) const
+	{
+		if(!_settings.benchmark)
+		{
+			return glm::vec3(distance, distance, distance);
+		}
+
+		const float angle = glm::radians(360.0f) * time / BENCHMARK_ORBIT_SECONDS;
+		const float radius = distance * (1.0f + 0.5f * std::sin(2.0f * angle)) * std::sqrt(2.0f);
+		return glm::vec3(radius * std::cos(angle), radius * std::sin(angle), distance);
+	}
+
+	// A sceneGridSize x sceneGridSize grid of copies of the model, the default size of 1 is the original single object.
+	// The copies are children of a grid node and each spins around its own z axis.
+	void createScene()
+	{
+		const uint32_t gridSize = _settings.sceneGridSize;
+		if(uint64_t(gridSize) * gridSize > MAX_OBJECTS)
+		{
+			throw std::runtime_error("scene has more objects than MAX_OBJECTS");
+		}
+		if(_materials.size() > (1u << 12) || _drawCommands.size() > (1u << 16))
+		{
+			throw std::runtime_error("too many materials or LODs for the draw sort key, see makeDrawKey");
+		}
+
+		const float spacing = 1.5f;
+		const float center = 0.5f * spacing * static_cast<float>(gridSize - 1);
 
-				_indices.push_back(uniqueVertices[vertex]);
+		_sceneTransforms.clear();
+		const uint32_t grid = _sceneTransforms.addNode(TransformHierarchy::NO_PARENT, glm::vec3(0.0f));
+
+		for(uint32_t y = 0; y < gridSize; ++y)
+		{
+			for(uint32_t x = 0; x < gridSize; ++x)
+			{
+				SceneObject object;
+				object.node = _sceneTransforms.addNode(grid, glm::vec3(x * spacing - center, y * spacing - center, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, glm::radians(90.0f)));
+				object.mesh = 0;
+				object.drawCommand = _meshes[object.mesh].firstLod;
+				object.material = (x + y) % _materials.size(); // cycle through the materials along the diagonals
+				_objects.push_back(object);
 			}
 		}
+
+		// the per-frame object buffers hold the whole scene, in slices that keep every offset a multiple of 256 bytes
+		_objectCapacity = std::max<uint32_t>(static_cast<uint32_t>(_objects.size() + OBJECT_CAPACITY_GRANULARITY - 1) / OBJECT_CAPACITY_GRANULARITY, 1) * OBJECT_CAPACITY_GRANULARITY;
 	}
 
 private:
-	double _fpsLastTime = 0.0;
-	uint32_t _fpsFrameCount = 0;
+	Profiler _profiler;
+	bool _pipelineStatisticsEnabled = false; // pipelineStatisticsQuery and inheritedQueries, see createLogicalDevice
+	double _titleUpdateTime = 0.0;
 
 #ifdef _DEBUG
 	std::vector<const char*> _requiredInstanceExtensions = {
@@ -2306,6 +9977,17 @@ private:
 	    VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
 
+	// enabled only when the chosen device supports them
+	std::vector<const char*> _optionalDeviceExtensions = {
+	    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+	    VK_KHR_PRESENT_ID_EXTENSION_NAME, // both for frame pacing and latency measurements, see waitForFramePacing
+	    VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+	    VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, // batched barriers of the render graph, emulated by the validation layer we enable if the driver lacks it
+	    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME // core in Vulkan 1.3, but the instance targets 1.2, see createLogicalDevice
+	};
+
+	std::vector<const char*> _enabledDeviceExtensions; // required + supported optional
+
 #ifdef _DEBUG
 	static constexpr bool _enableValidationLayers = true;
 #else
@@ -2315,81 +9997,234 @@ private:
 	VkDebugUtilsMessengerEXT _debugMessenger = VK_NULL_HANDLE;
 
 	const std::string MODEL_PATH = "models/viking_room.obj";
+	const std::string MESH_CACHE_PATH = "models/viking_room.mesh"; // built from MODEL_PATH on first run
 	const std::string TEXTURE_PATH = "textures/viking_room.png";
+	// TEXTURE_PATH compressed offline with its mip chain baked in (e.g. with the KTX-Software or Compressonator tools), in order of preference, missing files are skipped
+	const std::vector<std::string> TEXTURE_KTX2_PATHS = {"textures/viking_room_bc7.ktx2", "textures/viking_room_astc.ktx2"};
+	const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+	const std::string PROFILER_TRACE_PATH = "profiler_trace.json"; // Chrome trace of the last frames, written on exit
+
+	AppSettings _settings;
+	std::vector<TaskGraph::Timing> _loadStages; // see initVulkan
+	double _loadTime = 0.0; // milliseconds from createInstance to the first frame
 
-	static constexpr uint32_t WIDTH = 800;
-	static constexpr uint32_t HEIGHT = 600;
 	GLFWwindow* _window = nullptr;
 	VkSurfaceKHR _surface = VK_NULL_HANDLE;
 
 	bool _windowResized = false;
 
+	// frame pacing and latency -------------------------------------------
+
+	struct LatencySample
+	{
+		uint64_t frameNumber = 0;
+		uint32_t frameIndex = 0; // its fence, when measuring without present wait
+		double inputTime = 0.0; // profiler clock
+	};
+
+	static constexpr uint64_t PRESENT_WAIT_TIMEOUT = 100'000'000; // nanoseconds, a frame that is not presented by then is not waited for
+	uint32_t _framesInFlight = 2; // see AppSettings::framesInFlight
+	VkPresentModeKHR _presentMode = VK_PRESENT_MODE_MAILBOX_KHR; // requested, see chooseSwapPresentMode
+	VkPresentModeKHR _swapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR; // in use
+	bool _presentWaitEnabled = false; // VK_KHR_present_id and VK_KHR_present_wait
+	PFN_vkWaitForPresentKHR _vkWaitForPresentKHR = nullptr;
+	bool _synchronization2Enabled = false; // VK_KHR_synchronization2, only used by _renderGraph
+	PFN_vkCmdPipelineBarrier2KHR _vkCmdPipelineBarrier2 = nullptr;
+	bool _dynamicRenderingEnabled = false; // VK_KHR_dynamic_rendering: _renderPass, _loadRenderPass and _framebuffers stay empty
+	PFN_vkCmdBeginRenderingKHR _vkCmdBeginRendering = nullptr;
+	PFN_vkCmdEndRenderingKHR _vkCmdEndRendering = nullptr;
+	uint64_t _lastPresentId = 0; // queued on the current swapchain
+	std::deque<LatencySample> _latencySamples;
+
 	static const uint32_t MINIMUM_VULKAN_VERSION = VK_API_VERSION_1_2;
 
+	// the classic PCIe BAR window, mapping VRAM through it is only worth it for small per-frame data unless resizable BAR enlarges it
+	static constexpr VkDeviceSize SMALL_BAR_HEAP_SIZE = 256ull * 1024 * 1024;
+
 	VkInstance _instance = VK_NULL_HANDLE;
 	
 	VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties _physicalDeviceProperties{};
+	std::vector<VkExtensionProperties> _physicalDeviceExtensions;
+	std::vector<VkPhysicalDevice> _deviceGroup; // in the order of its group, which gives the device indices, more than one only with --device-group, see chooseDeviceGroup
 	QueueFamilies _queueFamilies;
 	SwapChainInfo _swapChainInfo;
 
 	VkDevice _device = VK_NULL_HANDLE;
+	MemoryAllocator _allocator;
 	VkQueue _graphicsQueue = VK_NULL_HANDLE;
 	VkQueue _presentQueue = VK_NULL_HANDLE;
+	VkQueue _transferQueue = VK_NULL_HANDLE; // same as _graphicsQueue without a dedicated transfer family
+	VkQueue _computeQueue = VK_NULL_HANDLE; // only used with _asyncComputeEnabled
+	bool _asyncComputeEnabled = false;
+	VkSemaphore _computeTimeline = VK_NULL_HANDLE; // signaled by every async compute submit, waited on by the graphics submit of the same frame
+	uint64_t _computeTimelineValue = 0; // last value submitted
+	UploadEngine _uploadEngine;
+	static constexpr VkDeviceSize STAGING_RING_SIZE = 64ull * 1024 * 1024;
+	static constexpr VkDeviceSize STAGING_ALIGNMENT = 16; // covers texel size and the 4 byte offset rule of vkCmdCopyBufferToImage
+	VkBuffer _stagingRingBuffer = VK_NULL_HANDLE;
+	Allocation _stagingRingMemory;
 	
 	VkSwapchainKHR _swapChain = VK_NULL_HANDLE;
 	std::vector<VkImage> _swapChainImages; // depends on device
+	std::vector<Allocation> _offscreenImageMemory; // headless only, the swapchain owns its images
 	VkFormat _swapChainImageFormat;
 	VkExtent2D _swapChainExtent;
 	std::vector<VkImageView> _swapChainImageViews; // one per swapchain image
 	
 	VkRenderPass _renderPass = VK_NULL_HANDLE;
+	VkRenderPass _loadRenderPass = VK_NULL_HANDLE; // second pass of the GPU driven path, see createRenderPass
 
 	std::vector<VkFramebuffer> _framebuffers; // one per swapchain image
 
 	VkDescriptorSetLayout _descriptorSetLayout = VK_NULL_HANDLE;
+	static constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096; // size of the bindless texture array, lowered to the update after bind limits of the device
+	VkDescriptorSetLayout _bindlessDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool _bindlessDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet _bindlessDescriptorSet = VK_NULL_HANDLE;
+	std::vector<uint32_t> _freeTextureSlots;
+	uint32_t _overBudgetHeaps = 0; // bit per heap, see checkMemoryBudget
 	VkPipelineLayout _graphicsPipelineLayout = VK_NULL_HANDLE;
-	VkPipeline _graphicsPipeline = VK_NULL_HANDLE;
+	VkPipeline _graphicsPipeline = VK_NULL_HANDLE; // owned by _pipelines, pipeline of material 0 and the fallback of every other material
+
+	static constexpr uint32_t MAX_PIPELINE_COMPILE_THREADS = 2;
+	static constexpr uint32_t MAX_STARTUP_THREADS = 3; // besides the main thread, more than the independent stages of initVulkan would not help
+	PipelineCompiler _pipelineCompiler;
+	std::vector<Material> _materials;
+	std::vector<VkPipeline> _materialPipelines; // resolved once per frame, read by the recording threads
+
+	static constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43505456; // "VTPC"
+	VkPipelineCache _pipelineCache = VK_NULL_HANDLE;
+	std::unordered_map<PipelineKey, std::shared_future<VkPipeline>> _pipelines;
 
-	VkCommandPool _commandPool = VK_NULL_HANDLE;
-	std::vector<VkCommandBuffer> _commandBuffers; // one per swapchain image // TODO: only because we are pre-recording. if the command buffers were filled each frame, we could reduce to one per frame in flight, instead of one per swapchain image
+	static constexpr uint32_t MAX_RECORDING_THREADS = 8;
+	static constexpr uint32_t MIN_DRAWS_PER_JOB = 64; // below that, a secondary command buffer costs more than it saves
+	ThreadPool _threadPool;
+	std::vector<FrameCommands> _frameCommands; // one per frame in flight
 
-	static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 	std::vector<VkSemaphore> _imageAvailableSemaphores; // one per frame in flight
 	std::vector<VkSemaphore> _renderFinishedSemaphores; // one per frame in flight
 	std::vector<VkFence> _framesInFlightFences; // one per frame in flight
 	uint32_t _currentFrame = 0;
-
-	std::vector<Vertex> _vertices;
+	uint64_t _frameNumber = 0; // total frames submitted, used to know when deferred deletions are safe
+
+	std::deque<std::pair<uint64_t, std::function<void()>>> _deferredDeletions; // frame number when retired, deletion
+
+	static constexpr uint32_t MESH_CACHE_MAGIC = 0x48534D56; // "VMSH"
+	static constexpr uint32_t MESH_CACHE_VERSION = 4; // bump whenever the file layout changes, the vertex format is checked separately
+	static constexpr uint64_t MESH_SECTION_ALIGNMENT = 64;
+	static constexpr uint32_t MIN_CORNERS_PER_JOB = 64 * 1024; // below that, splitting the deduplication costs more than it saves
+	MappedFile _meshFile;
+	VertexFormat _vertexFormat;
+	std::vector<Vertex> _vertices; // only filled while converting the OBJ
+	std::vector<uint8_t> _encodedVertices; // _vertices in _vertexFormat
 	std::vector<uint32_t> _indices;
+	std::span<const uint8_t> _vertexData; // what gets uploaded: the mapped cache file, or _encodedVertices if the cache could not be written
+	std::vector<uint8_t> _encodedIndices; // _indices in _indexType
+	std::span<const uint8_t> _indexData;
+	VkIndexType _indexType = VK_INDEX_TYPE_UINT32;
+	MeshOptimization _meshOptimization = MeshOptimization::VertexCacheAndOverdraw; // set to None to A/B against the OBJ order
+	static constexpr float OVERDRAW_THRESHOLD = 1.05f; // ACMR a cluster may lose against the cache optimized order
+	uint64_t _vertexCount = 0;
+	VkDeviceSize _attributeStreamOffset = 0; // where stream 1 starts in the vertex buffer
+	glm::vec3 _positionScale{1.0f}; // dequantization of PositionFormat::Snorm16, applied through the model matrix
+	glm::vec3 _positionBias{0.0f};
+	std::vector<DrawCommand> _drawCommands;
+	std::vector<Mesh> _meshes;
+	static constexpr uint32_t MAX_LODS = 5; // including LOD 0
+	static constexpr uint32_t LOD_BASE_GRID = 64; // cells along the bounds diagonal for LOD 1, halved for every further level
+	static constexpr float LOD_MIN_REDUCTION = 0.8f; // a level must keep fewer than this fraction of the triangles of the previous one
+	static constexpr float LOD_ERROR_PIXELS = 1.0f; // screen-space error allowed when selecting a LOD
+
+	static constexpr double BENCHMARK_TIMESTEP = 1.0 / 60.0; // seconds of animation per frame in benchmarks
+	static constexpr float BENCHMARK_ORBIT_SECONDS = 20.0f;
+	static constexpr uint32_t MAX_OBJECTS = 1 << 17; // objects in the scene
+	static constexpr uint32_t OBJECT_CAPACITY_GRANULARITY = 64; // _objectCapacity is a multiple of it
+	static constexpr uint32_t MIN_OBJECTS_PER_JOB = 1024; // below that, splitting the per-object work of a frame costs more than it saves
+	static constexpr uint32_t SCENE_JOBS_PER_WORKER = 4; // some slack for work stealing, the cost of an object depends on whether it is culled
+	ObjectDataPath _objectDataPath = ObjectDataPath::GpuDriven; // falls back to Instanced if the device lacks the features, see createLogicalDevice
+	TransformHierarchy _sceneTransforms;
+	std::vector<SceneObject> _objects;
+	uint32_t _objectCapacity = 0; // per frame capacity of the object uniform and storage buffers, and per material capacity of the indirect draws
+	std::vector<std::vector<DrawItem>> _drawListChunks; // one per job of updateObjects
+	std::vector<DrawItem> _drawList; // CPU driven paths: the objects in the frustum, sorted, rebuilt every frame
+	std::vector<DrawBatch> _drawBatches;
 	VkBuffer _vertexBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory _vertexBufferMemory = VK_NULL_HANDLE;
+	Allocation _vertexBufferMemory;
+	VkBuffer _constantVertexBuffer = VK_NULL_HANDLE;
+	Allocation _constantVertexBufferMemory;
 	VkBuffer _indexBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory _indexBufferMemory = VK_NULL_HANDLE;
-
-	std::vector<VkBuffer> _uniformBuffers; // one per swapchain image // TODO: only because we are pre-recording. if the command buffers were filled each frame, we could reduce to one per frame in flight, instead of one per swapchain image
-	std::vector<VkDeviceMemory> _uniformBuffersMemory; // one per swapchain image // TODO: only because we are pre-recording. if the command buffers were filled each frame, we could reduce to one per frame in flight, instead of one per swapchain image
+	Allocation _indexBufferMemory;
+
+	std::vector<VkBuffer> _uniformBuffers; // one per frame in flight
+	std::vector<Allocation> _uniformBuffersMemory; // one per frame in flight
+	VkBuffer _objectUniformBuffer = VK_NULL_HANDLE; // _objectCapacity slices per frame in flight, bound with dynamic offsets
+	Allocation _objectUniformBufferMemory;
+	VkDeviceSize _objectUniformStride = 0;
+	VkBuffer _objectStorageBuffer = VK_NULL_HANDLE; // GpuObject, _objectCapacity per frame in flight
+	Allocation _objectStorageBufferMemory;
+
+	static constexpr uint32_t CULL_GROUP_SIZE = 64; // must match local_size_x in cull.comp
+	VkDescriptorSetLayout _cullDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout _cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline _cullPipeline = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> _cullDescriptorSets; // one per frame in flight
+	CullPushConstants _cullConstants; // written by updateUniformBuffer, pushed by recordCulling
+	VkBuffer _visibilityBuffer = VK_NULL_HANDLE; // one uint per object, see cull.comp
+	Allocation _visibilityBufferMemory;
+	bool _visibilityCleared = false; // cleared by the first frame, nothing is visible until then
+	static constexpr uint32_t DEPTH_REDUCE_GROUP_SIZE = 8; // must match local_size_x and local_size_y in depth_reduce.comp
+	VkDescriptorSetLayout _depthReduceDescriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout _depthReducePipelineLayout = VK_NULL_HANDLE;
+	VkPipeline _depthReducePipeline = VK_NULL_HANDLE;
+	VkDescriptorSetLayout _depthPyramidDescriptorSetLayout = VK_NULL_HANDLE;
+	VkSampler _depthPyramidSampler = VK_NULL_HANDLE;
+	DepthPyramid _depthPyramid;
+	VkBuffer _indirectDrawBuffer = VK_NULL_HANDLE;
+	Allocation _indirectDrawBufferMemory;
+	VkBuffer _drawCountBuffer = VK_NULL_HANDLE;
+	Allocation _drawCountBufferMemory;
+	VkDeviceSize _drawCountStride = 0; // per frame, aligned to minStorageBufferOffsetAlignment
 	
 	VkDescriptorPool _descriptorPool = VK_NULL_HANDLE;
 	std::vector<VkDescriptorSet> _descriptorSets;
 
+	MappedFile _textureFile; // KTX2 source, only open between loadTexture and createTextureImage
+	Ktx2Header _textureHeader;
+	std::vector<Ktx2Level> _textureLevels; // empty when TEXTURE_PATH is decoded instead
+	DecodedImage _decodedTexture; // PNG fallback, from loadTexture to createTextureImage
+
+	VkFormat _textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
 	uint32_t _textureMipLevels = 1;
 	VkImage _textureImage;
-	VkDeviceMemory _textureImageMemory;
+	Allocation _textureImageMemory;
 	VkImageView _textureImageView;
 	VkSampler _textureSampler;
+	uint32_t _textureSlot = 0; // in the bindless texture array
+
+	// the passes of a frame, see createRenderGraph
+	RenderGraph _renderGraph;
+	GraphResources _graphResources;
 
-	VkImage _depthImage;
-	VkDeviceMemory _depthImageMemory;
-	VkImageView _depthImageView;
+	VkImage _depthImage = VK_NULL_HANDLE; // transient image of _renderGraph
+	VkImageView _depthImageView = VK_NULL_HANDLE;
+	VkFormat _depthFormat = VK_FORMAT_UNDEFINED;
 };
 
-int main()
+int main(int argc, char** argv)
 {
+	AppSettings settings;
+	if(!parseCommandLine(argc, argv, settings))
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
 	HelloTriangleApplication app;
 
 	try
 	{
-		app.run();
+		app.run(settings);
 	}
 	catch(const std::exception& e)
 	{
@@ -1,8 +1,8 @@
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe hardcoded.vert -o hardcoded.vert.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe simple.vert -o simple.vert.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe ubo.vert -o ubo.vert.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe ubo_texture.vert -o ubo_texture.vert.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe ubo_texture_3d.vert -o ubo_texture_3d.vert.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe simple.frag -o simple.frag.spv
-C:/VulkanSDK/1.2.170.0/Bin/glslc.exe simple_texture.frag -o simple_texture.frag.spv
-pause
\ No newline at end of file
+@echo off
+rem Same as the CustomBuild step of the project. Stale binaries are deleted first, so a shader that fails to compile is missing instead of silently out of date.
+set GLSLC=C:/VulkanSDK/1.2.170.0/Bin/glslc.exe
+for %%s in (uber.vert uber.frag cull.comp depth_reduce.comp) do (
+	if exist %%s.spv del %%s.spv
+	%GLSLC% %%s -o %%s.spv || echo failed to compile %%s
+)
+pause
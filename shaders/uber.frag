@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Specialization constants, set at pipeline creation (see ShaderVariant in main.cpp).
+// Ids are shared with uber.vert, each stage only declares the ones it reads.
+
+// false: the texture is not sampled and the interpolated color times the base color is output as is
+layout(constant_id = 2) const bool USE_TEXTURE = true;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+// every texture in one partially bound array, see createBindlessTextures in main.cpp
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// after the model matrix of uber.vert, see MaterialPushConstants in main.cpp
+layout(push_constant) uniform PushConstants {
+    layout(offset = 64) vec4 baseColor;
+    uint textureIndex;
+} pushConstants;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 color = fragColor * pushConstants.baseColor.rgb;
+    if(USE_TEXTURE) {
+        color *= texture(textures[pushConstants.textureIndex], fragTexCoord).rgb;
+    }
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,55 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Specialization constants, set at pipeline creation (see ShaderVariant in main.cpp).
+// The driver folds them like literals, so every branch on them below is gone in the compiled variant.
+
+// where the per-object model matrix comes from
+// 0: push constants, 1: dynamic uniform buffer (one slice per object, selected with the dynamic offset)
+// 2: storage buffer filled for the GPU driven path, indexed by gl_InstanceIndex (the firstInstance written by cull.comp)
+// 3: the same storage buffer sorted into batches on the CPU, indexed by gl_InstanceIndex (firstInstance of the batch plus the instance)
+layout(constant_id = 0) const int OBJECT_DATA_PATH = 0;
+
+// false: the vertex color is ignored and the object is shaded white
+layout(constant_id = 1) const bool USE_VERTEX_COLOR = true;
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 view;
+    mat4 proj;
+} frame;
+
+layout(set = 0, binding = 2) uniform ObjectUniforms {
+    mat4 model;
+} object;
+
+// must match GpuObject in main.cpp and cull.comp, only the model matrix is read here
+struct GpuObject {
+    mat4 model;
+    vec4 bounds;
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint material;
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer Objects {
+    GpuObject objects[];
+};
+
+layout(push_constant) uniform PushConstants {
+    mat4 model;
+} pushConstants;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+void main() {
+    mat4 model = OBJECT_DATA_PATH == 0 ? pushConstants.model : OBJECT_DATA_PATH == 1 ? object.model : objects[gl_InstanceIndex].model;
+    gl_Position = frame.proj * frame.view * model * vec4(inPosition, 1.0);
+    fragColor = USE_VERTEX_COLOR ? inColor : vec3(1.0);
+    fragTexCoord = inTexCoord;
+}